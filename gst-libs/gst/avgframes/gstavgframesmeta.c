@@ -0,0 +1,115 @@
+/* GStreamer
+ * Copyright (C) <2015> Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <gstavgframesmeta.h>
+#include <string.h>
+#include <stdlib.h>
+
+GType
+gst_avg_frames_meta_api_get_type (void)
+{
+  static volatile GType type;
+  static const gchar *tags[] = { NULL };
+
+  if (g_once_init_enter (&type)) {
+    GType _type = gst_meta_api_type_register ("AvgFramesMetaAPI", tags);
+    g_once_init_leave (&type, _type);
+  }
+  return type;
+}
+
+static gboolean
+gst_avg_frames_meta_init (GstMeta *meta, gpointer params, GstBuffer *buffer)
+{
+  GstAvgFramesMeta *m = (GstAvgFramesMeta *) meta;
+
+  m->variance = NULL;
+  m->data_size = 0;
+  m->frames = 0;
+
+  return TRUE;
+}
+
+static gboolean
+gst_avg_frames_meta_transform (GstBuffer * transbuf, GstMeta * meta,
+    GstBuffer * buffer, GQuark type, gpointer data)
+{
+  GstAvgFramesMeta *m = (GstAvgFramesMeta *) meta;
+  GstAvgFramesMeta *copy;
+
+  /* the variance belongs to the frame, so it goes along with copies of it */
+  copy = gst_buffer_add_gst_avg_frames_meta (transbuf, m->data_size,
+      m->frames);
+  if (!copy)
+    return FALSE;
+  memcpy (copy->variance, m->variance, m->data_size * sizeof (gfloat));
+
+  return TRUE;
+}
+
+static void
+gst_avg_frames_meta_free (GstMeta *meta, GstBuffer *buffer)
+{
+  GstAvgFramesMeta *m = (GstAvgFramesMeta *) meta;
+
+  free (m->variance);
+  m->variance = NULL;
+  m->data_size = 0;
+  m->frames = 0;
+}
+
+const GstMetaInfo *
+gst_avg_frames_meta_get_info (void)
+{
+  static const GstMetaInfo *meta_info = NULL;
+
+  if (g_once_init_enter (&meta_info)) {
+    const GstMetaInfo *mi = gst_meta_register (GST_AVG_FRAMES_META_API_TYPE,
+        GST_AVG_FRAMES_META_IMPL_NAME,
+        sizeof (GstAvgFramesMeta),
+        gst_avg_frames_meta_init,
+        gst_avg_frames_meta_free,
+        gst_avg_frames_meta_transform);
+    g_once_init_leave (&meta_info, mi);
+  }
+  return meta_info;
+}
+
+GstAvgFramesMeta *
+gst_buffer_add_gst_avg_frames_meta (GstBuffer * buffer, guint data_size,
+    gint frames)
+{
+  GstAvgFramesMeta *meta;
+
+  g_return_val_if_fail (GST_IS_BUFFER (buffer), NULL);
+  g_return_val_if_fail (data_size > 0, NULL);
+
+  meta = (GstAvgFramesMeta *) gst_buffer_add_meta (buffer,
+      GST_AVG_FRAMES_META_INFO, NULL);
+
+  meta->variance = malloc (data_size * sizeof (gfloat));
+  if (!meta->variance) {
+    gst_buffer_remove_meta (buffer, (GstMeta *) meta);
+    return NULL;
+  }
+  meta->data_size = data_size;
+  meta->frames = frames;
+
+  return meta;
+}
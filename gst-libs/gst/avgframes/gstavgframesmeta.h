@@ -0,0 +1,83 @@
+/*
+ * GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+
+#ifndef __GST_AVG_FRAMES_META_H__
+#define __GST_AVG_FRAMES_META_H__
+
+#include <gst/gst.h>
+
+#define GST_AVG_FRAMES_META_IMPL_NAME "AvgFramesMeta"
+
+typedef struct _GstAvgFramesMeta GstAvgFramesMeta;
+
+/* The per pixel temporal variance of the frames that were averaged into the
+ * buffer. variance holds data_size samples: the rows of every plane one
+ * after the other, without the stride padding of the frame. */
+struct _GstAvgFramesMeta {
+    GstMeta        meta;
+    gfloat        *variance;
+    guint          data_size;
+    gint           frames;
+};
+
+
+GType gst_avg_frames_meta_api_get_type (void);
+#define GST_AVG_FRAMES_META_API_TYPE (gst_avg_frames_meta_api_get_type())
+
+#define gst_buffer_get_gst_avg_frames_meta(b) \
+	((GstAvgFramesMeta*)gst_buffer_get_meta((b),GST_AVG_FRAMES_META_API_TYPE))
+
+
+
+const GstMetaInfo *gst_avg_frames_meta_get_info (void);
+#define GST_AVG_FRAMES_META_INFO (gst_avg_frames_meta_get_info())
+
+/* adds a meta with room for data_size samples, for the caller to fill in */
+GstAvgFramesMeta * gst_buffer_add_gst_avg_frames_meta (GstBuffer      *buffer,
+                                                       guint           data_size,
+                                                       gint            frames);
+
+
+#endif /* __GST_AVG_FRAMES_META_H__ */
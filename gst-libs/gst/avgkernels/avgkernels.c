@@ -0,0 +1,571 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+/* Accumulate and normalize kernels shared by avgframes and avgrow.
+ *
+ * The scalar versions are the reference implementation, the vector versions
+ * must produce exactly the same results. The x86 kernels are built with
+ * target attributes so that no special compiler flags are needed, and the
+ * best one is picked at runtime. NEON is used whenever the compiler targets
+ * it (always the case on aarch64). */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <byteswap.h>
+#include "avgkernels.h"
+#include "avgkernelssimd.h"
+
+/* Division by a constant using a multiply and a shift (Granlund-Montgomery).
+ * The numerators are sums of divisor samples of sample_bits bits each, so
+ * they are below 2^num_bits with num_bits = sample_bits + l and
+ * l = ceil(log2(divisor)). With shift = num_bits + l and
+ * mul = ceil(2^shift / divisor) the result is exact for all of them.
+ * num_bits must not be above 31 so mul fits in 32 bits. */
+void
+avg_kernels_reciprocal (guint32 divisor, guint sample_bits, guint32 * mul,
+    guint * shift)
+{
+  guint l = 0;
+
+  g_return_if_fail (divisor > 0);
+
+  while (((guint64) 1 << l) < divisor)
+    l++;
+
+  g_return_if_fail (sample_bits + l <= 31);
+
+  *shift = sample_bits + 2 * l;
+  *mul = (guint32) ((((guint64) 1 << *shift) + divisor - 1) / divisor);
+}
+
+#define DIV(n, mul, shift) ((guint32) (((guint64) (n) * (mul)) >> (shift)))
+
+/* scalar reference */
+
+static void
+accum_u8_scalar (guint32 * sum, const guint8 * src, gsize n)
+{
+  gsize i;
+
+  for (i = 0; i < n; i++)
+    sum[i] += src[i];
+}
+
+static void
+accum_u16_scalar (guint32 * sum, const guint16 * src, gsize n)
+{
+  gsize i;
+
+  for (i = 0; i < n; i++)
+    sum[i] += src[i];
+}
+
+static void
+accum_u16_swap_scalar (guint32 * sum, const guint16 * src, gsize n)
+{
+  gsize i;
+
+  for (i = 0; i < n; i++)
+    sum[i] += __bswap_16 (src[i]);
+}
+
+static void
+norm_u8_scalar (guint8 * dst, guint32 * sum, gsize n, guint32 mul,
+    guint shift, gboolean clear)
+{
+  gsize i;
+
+  for (i = 0; i < n; i++) {
+    dst[i] = (guint8) DIV (sum[i], mul, shift);
+    if (clear)
+      sum[i] = 0;
+  }
+}
+
+static void
+norm_u16_scalar (guint16 * dst, guint32 * sum, gsize n, guint32 mul,
+    guint shift, gboolean clear)
+{
+  gsize i;
+
+  for (i = 0; i < n; i++) {
+    dst[i] = (guint16) DIV (sum[i], mul, shift);
+    if (clear)
+      sum[i] = 0;
+  }
+}
+
+static void
+norm_u16_swap_scalar (guint16 * dst, guint32 * sum, gsize n, guint32 mul,
+    guint shift, gboolean clear)
+{
+  gsize i;
+  guint16 val;
+
+  for (i = 0; i < n; i++) {
+    val = (guint16) DIV (sum[i], mul, shift);
+    dst[i] = __bswap_16 (val);
+    if (clear)
+      sum[i] = 0;
+  }
+}
+
+static const AvgKernels kernels_scalar = {
+  AVG_KERNELS_CPU_SCALAR, "scalar",
+  accum_u8_scalar, accum_u16_scalar, accum_u16_swap_scalar,
+  norm_u8_scalar, norm_u16_scalar, norm_u16_swap_scalar
+};
+
+#ifdef HAVE_X86_KERNELS
+
+/* SSE2 */
+
+static inline SSE2 __m128i
+div_epu32_sse2 (__m128i n, __m128i mul, __m128i shift)
+{
+  __m128i even = _mm_srl_epi64 (_mm_mul_epu32 (n, mul), shift);
+  __m128i odd = _mm_srl_epi64 (_mm_mul_epu32 (_mm_srli_epi64 (n, 32), mul),
+      shift);
+
+  /* every quotient fits in 32 bits, so the high halves are zero */
+  return _mm_or_si128 (even, _mm_slli_epi64 (odd, 32));
+}
+
+static inline SSE2 void
+accum_epu16_sse2 (guint32 * sum, __m128i v)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  __m128i *s = (__m128i *) sum;
+
+  _mm_storeu_si128 (s, _mm_add_epi32 (_mm_loadu_si128 (s),
+          _mm_unpacklo_epi16 (v, zero)));
+  _mm_storeu_si128 (s + 1, _mm_add_epi32 (_mm_loadu_si128 (s + 1),
+          _mm_unpackhi_epi16 (v, zero)));
+}
+
+static SSE2 void
+accum_u8_sse2 (guint32 * sum, const guint8 * src, gsize n)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  gsize i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i));
+
+    accum_epu16_sse2 (sum + i, _mm_unpacklo_epi8 (v, zero));
+    accum_epu16_sse2 (sum + i + 8, _mm_unpackhi_epi8 (v, zero));
+  }
+  accum_u8_scalar (sum + i, src + i, n - i);
+}
+
+static SSE2 void
+accum_u16_sse2 (guint32 * sum, const guint16 * src, gsize n)
+{
+  gsize i;
+
+  for (i = 0; i + 8 <= n; i += 8)
+    accum_epu16_sse2 (sum + i, _mm_loadu_si128 ((const __m128i *) (src + i)));
+  accum_u16_scalar (sum + i, src + i, n - i);
+}
+
+static SSE2 void
+accum_u16_swap_sse2 (guint32 * sum, const guint16 * src, gsize n)
+{
+  gsize i;
+
+  for (i = 0; i + 8 <= n; i += 8)
+    accum_epu16_sse2 (sum + i,
+        bswap_epi16_sse2 (_mm_loadu_si128 ((const __m128i *) (src + i))));
+  accum_u16_swap_scalar (sum + i, src + i, n - i);
+}
+
+static inline SSE2 __m128i
+norm_load_sse2 (guint32 * sum, __m128i mul, __m128i shift, gboolean clear)
+{
+  __m128i *s = (__m128i *) sum;
+  __m128i v = _mm_loadu_si128 (s);
+
+  if (clear)
+    _mm_storeu_si128 (s, _mm_setzero_si128 ());
+  return div_epu32_sse2 (v, mul, shift);
+}
+
+static SSE2 void
+norm_u8_sse2 (guint8 * dst, guint32 * sum, gsize n, guint32 mul,
+    guint shift, gboolean clear)
+{
+  const __m128i vmul = _mm_set1_epi32 (mul);
+  const __m128i vshift = _mm_cvtsi32_si128 (shift);
+  gsize i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    __m128i q0 = norm_load_sse2 (sum + i, vmul, vshift, clear);
+    __m128i q1 = norm_load_sse2 (sum + i + 4, vmul, vshift, clear);
+    __m128i q2 = norm_load_sse2 (sum + i + 8, vmul, vshift, clear);
+    __m128i q3 = norm_load_sse2 (sum + i + 12, vmul, vshift, clear);
+
+    _mm_storeu_si128 ((__m128i *) (dst + i),
+        _mm_packus_epi16 (_mm_packs_epi32 (q0, q1), _mm_packs_epi32 (q2,
+                q3)));
+  }
+  norm_u8_scalar (dst + i, sum + i, n - i, mul, shift, clear);
+}
+
+static SSE2 void
+norm_u16_sse2 (guint16 * dst, guint32 * sum, gsize n, guint32 mul,
+    guint shift, gboolean clear)
+{
+  const __m128i vmul = _mm_set1_epi32 (mul);
+  const __m128i vshift = _mm_cvtsi32_si128 (shift);
+  gsize i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    __m128i q0 = norm_load_sse2 (sum + i, vmul, vshift, clear);
+    __m128i q1 = norm_load_sse2 (sum + i + 4, vmul, vshift, clear);
+
+    _mm_storeu_si128 ((__m128i *) (dst + i), pack_epu32_epu16_sse2 (q0, q1));
+  }
+  norm_u16_scalar (dst + i, sum + i, n - i, mul, shift, clear);
+}
+
+static SSE2 void
+norm_u16_swap_sse2 (guint16 * dst, guint32 * sum, gsize n, guint32 mul,
+    guint shift, gboolean clear)
+{
+  const __m128i vmul = _mm_set1_epi32 (mul);
+  const __m128i vshift = _mm_cvtsi32_si128 (shift);
+  gsize i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    __m128i q0 = norm_load_sse2 (sum + i, vmul, vshift, clear);
+    __m128i q1 = norm_load_sse2 (sum + i + 4, vmul, vshift, clear);
+
+    _mm_storeu_si128 ((__m128i *) (dst + i),
+        bswap_epi16_sse2 (pack_epu32_epu16_sse2 (q0, q1)));
+  }
+  norm_u16_swap_scalar (dst + i, sum + i, n - i, mul, shift, clear);
+}
+
+static const AvgKernels kernels_sse2 = {
+  AVG_KERNELS_CPU_SSE2, "sse2",
+  accum_u8_sse2, accum_u16_sse2, accum_u16_swap_sse2,
+  norm_u8_sse2, norm_u16_sse2, norm_u16_swap_sse2
+};
+
+/* AVX2 */
+
+static inline AVX2 void
+accum_epu32_avx2 (guint32 * sum, __m256i v)
+{
+  __m256i *s = (__m256i *) sum;
+
+  _mm256_storeu_si256 (s, _mm256_add_epi32 (_mm256_loadu_si256 (s), v));
+}
+
+static AVX2 void
+accum_u8_avx2 (guint32 * sum, const guint8 * src, gsize n)
+{
+  gsize i;
+
+  for (i = 0; i + 32 <= n; i += 32) {
+    __m128i lo = _mm_loadu_si128 ((const __m128i *) (src + i));
+    __m128i hi = _mm_loadu_si128 ((const __m128i *) (src + i + 16));
+
+    accum_epu32_avx2 (sum + i, _mm256_cvtepu8_epi32 (lo));
+    accum_epu32_avx2 (sum + i + 8,
+        _mm256_cvtepu8_epi32 (_mm_srli_si128 (lo, 8)));
+    accum_epu32_avx2 (sum + i + 16, _mm256_cvtepu8_epi32 (hi));
+    accum_epu32_avx2 (sum + i + 24,
+        _mm256_cvtepu8_epi32 (_mm_srli_si128 (hi, 8)));
+  }
+  accum_u8_scalar (sum + i, src + i, n - i);
+}
+
+static AVX2 void
+accum_u16_avx2 (guint32 * sum, const guint16 * src, gsize n)
+{
+  gsize i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    __m128i lo = _mm_loadu_si128 ((const __m128i *) (src + i));
+    __m128i hi = _mm_loadu_si128 ((const __m128i *) (src + i + 8));
+
+    accum_epu32_avx2 (sum + i, _mm256_cvtepu16_epi32 (lo));
+    accum_epu32_avx2 (sum + i + 8, _mm256_cvtepu16_epi32 (hi));
+  }
+  accum_u16_scalar (sum + i, src + i, n - i);
+}
+
+static AVX2 void
+accum_u16_swap_avx2 (guint32 * sum, const guint16 * src, gsize n)
+{
+  gsize i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    __m128i lo = _mm_loadu_si128 ((const __m128i *) (src + i));
+    __m128i hi = _mm_loadu_si128 ((const __m128i *) (src + i + 8));
+
+    accum_epu32_avx2 (sum + i, _mm256_cvtepu16_epi32 (bswap_epi16_ssse3 (lo)));
+    accum_epu32_avx2 (sum + i + 8,
+        _mm256_cvtepu16_epi32 (bswap_epi16_ssse3 (hi)));
+  }
+  accum_u16_swap_scalar (sum + i, src + i, n - i);
+}
+
+static inline AVX2 __m256i
+norm_load_avx2 (guint32 * sum, __m256i mul, __m128i shift, gboolean clear)
+{
+  __m256i *s = (__m256i *) sum;
+  __m256i v = _mm256_loadu_si256 (s);
+  __m256i even, odd;
+
+  if (clear)
+    _mm256_storeu_si256 (s, _mm256_setzero_si256 ());
+
+  even = _mm256_srl_epi64 (_mm256_mul_epu32 (v, mul), shift);
+  odd = _mm256_srl_epi64 (_mm256_mul_epu32 (_mm256_srli_epi64 (v, 32), mul),
+      shift);
+  return _mm256_or_si256 (even, _mm256_slli_epi64 (odd, 32));
+}
+
+static AVX2 void
+norm_u8_avx2 (guint8 * dst, guint32 * sum, gsize n, guint32 mul,
+    guint shift, gboolean clear)
+{
+  const __m256i vmul = _mm256_set1_epi32 (mul);
+  const __m128i vshift = _mm_cvtsi32_si128 (shift);
+  const __m256i order = _mm256_setr_epi32 (0, 4, 1, 5, 2, 6, 3, 7);
+  gsize i;
+
+  for (i = 0; i + 32 <= n; i += 32) {
+    __m256i q0 = norm_load_avx2 (sum + i, vmul, vshift, clear);
+    __m256i q1 = norm_load_avx2 (sum + i + 8, vmul, vshift, clear);
+    __m256i q2 = norm_load_avx2 (sum + i + 16, vmul, vshift, clear);
+    __m256i q3 = norm_load_avx2 (sum + i + 24, vmul, vshift, clear);
+    __m256i b = _mm256_packus_epi16 (_mm256_packus_epi32 (q0, q1),
+        _mm256_packus_epi32 (q2, q3));
+
+    _mm256_storeu_si256 ((__m256i *) (dst + i),
+        _mm256_permutevar8x32_epi32 (b, order));
+  }
+  norm_u8_scalar (dst + i, sum + i, n - i, mul, shift, clear);
+}
+
+static AVX2 void
+norm_u16_avx2 (guint16 * dst, guint32 * sum, gsize n, guint32 mul,
+    guint shift, gboolean clear)
+{
+  const __m256i vmul = _mm256_set1_epi32 (mul);
+  const __m128i vshift = _mm_cvtsi32_si128 (shift);
+  gsize i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    __m256i q0 = norm_load_avx2 (sum + i, vmul, vshift, clear);
+    __m256i q1 = norm_load_avx2 (sum + i + 8, vmul, vshift, clear);
+
+    _mm256_storeu_si256 ((__m256i *) (dst + i),
+        pack_epu32_epu16_avx2 (q0, q1));
+  }
+  norm_u16_scalar (dst + i, sum + i, n - i, mul, shift, clear);
+}
+
+static AVX2 void
+norm_u16_swap_avx2 (guint16 * dst, guint32 * sum, gsize n, guint32 mul,
+    guint shift, gboolean clear)
+{
+  const __m256i vmul = _mm256_set1_epi32 (mul);
+  const __m128i vshift = _mm_cvtsi32_si128 (shift);
+  gsize i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    __m256i q0 = norm_load_avx2 (sum + i, vmul, vshift, clear);
+    __m256i q1 = norm_load_avx2 (sum + i + 8, vmul, vshift, clear);
+
+    _mm256_storeu_si256 ((__m256i *) (dst + i),
+        bswap_epi16_avx2 (pack_epu32_epu16_avx2 (q0, q1)));
+  }
+  norm_u16_swap_scalar (dst + i, sum + i, n - i, mul, shift, clear);
+}
+
+static const AvgKernels kernels_avx2 = {
+  AVG_KERNELS_CPU_AVX2, "avx2",
+  accum_u8_avx2, accum_u16_avx2, accum_u16_swap_avx2,
+  norm_u8_avx2, norm_u16_avx2, norm_u16_swap_avx2
+};
+
+#endif /* HAVE_X86_KERNELS */
+
+#ifdef HAVE_NEON_KERNELS
+
+static inline void
+accum_u16x8_neon (guint32 * sum, uint16x8_t v)
+{
+  vst1q_u32 (sum, vaddw_u16 (vld1q_u32 (sum), vget_low_u16 (v)));
+  vst1q_u32 (sum + 4, vaddw_u16 (vld1q_u32 (sum + 4), vget_high_u16 (v)));
+}
+
+static void
+accum_u8_neon (guint32 * sum, const guint8 * src, gsize n)
+{
+  gsize i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    uint8x16_t v = vld1q_u8 (src + i);
+
+    accum_u16x8_neon (sum + i, vmovl_u8 (vget_low_u8 (v)));
+    accum_u16x8_neon (sum + i + 8, vmovl_u8 (vget_high_u8 (v)));
+  }
+  accum_u8_scalar (sum + i, src + i, n - i);
+}
+
+static void
+accum_u16_neon (guint32 * sum, const guint16 * src, gsize n)
+{
+  gsize i;
+
+  for (i = 0; i + 8 <= n; i += 8)
+    accum_u16x8_neon (sum + i, vld1q_u16 (src + i));
+  accum_u16_scalar (sum + i, src + i, n - i);
+}
+
+static void
+accum_u16_swap_neon (guint32 * sum, const guint16 * src, gsize n)
+{
+  gsize i;
+
+  for (i = 0; i + 8 <= n; i += 8)
+    accum_u16x8_neon (sum + i,
+        vreinterpretq_u16_u8 (vrev16q_u8 (vld1q_u8 ((const guint8 *) (src +
+                        i)))));
+  accum_u16_swap_scalar (sum + i, src + i, n - i);
+}
+
+static inline uint16x4_t
+norm_load_neon (guint32 * sum, uint32x2_t mul, int64x2_t shift,
+    gboolean clear)
+{
+  uint32x4_t v = vld1q_u32 (sum);
+  uint64x2_t lo, hi;
+
+  if (clear)
+    vst1q_u32 (sum, vdupq_n_u32 (0));
+
+  lo = vshlq_u64 (vmull_u32 (vget_low_u32 (v), mul), shift);
+  hi = vshlq_u64 (vmull_u32 (vget_high_u32 (v), mul), shift);
+  /* the quotients fit in 16 bits */
+  return vmovn_u32 (vcombine_u32 (vmovn_u64 (lo), vmovn_u64 (hi)));
+}
+
+static void
+norm_u8_neon (guint8 * dst, guint32 * sum, gsize n, guint32 mul,
+    guint shift, gboolean clear)
+{
+  const uint32x2_t vmul = vdup_n_u32 (mul);
+  const int64x2_t vshift = vdupq_n_s64 (-(gint64) shift);
+  gsize i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    uint16x4_t q0 = norm_load_neon (sum + i, vmul, vshift, clear);
+    uint16x4_t q1 = norm_load_neon (sum + i + 4, vmul, vshift, clear);
+
+    vst1_u8 (dst + i, vmovn_u16 (vcombine_u16 (q0, q1)));
+  }
+  norm_u8_scalar (dst + i, sum + i, n - i, mul, shift, clear);
+}
+
+static void
+norm_u16_neon (guint16 * dst, guint32 * sum, gsize n, guint32 mul,
+    guint shift, gboolean clear)
+{
+  const uint32x2_t vmul = vdup_n_u32 (mul);
+  const int64x2_t vshift = vdupq_n_s64 (-(gint64) shift);
+  gsize i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    uint16x4_t q0 = norm_load_neon (sum + i, vmul, vshift, clear);
+    uint16x4_t q1 = norm_load_neon (sum + i + 4, vmul, vshift, clear);
+
+    vst1q_u16 (dst + i, vcombine_u16 (q0, q1));
+  }
+  norm_u16_scalar (dst + i, sum + i, n - i, mul, shift, clear);
+}
+
+static void
+norm_u16_swap_neon (guint16 * dst, guint32 * sum, gsize n, guint32 mul,
+    guint shift, gboolean clear)
+{
+  const uint32x2_t vmul = vdup_n_u32 (mul);
+  const int64x2_t vshift = vdupq_n_s64 (-(gint64) shift);
+  gsize i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    uint16x4_t q0 = norm_load_neon (sum + i, vmul, vshift, clear);
+    uint16x4_t q1 = norm_load_neon (sum + i + 4, vmul, vshift, clear);
+    uint8x16_t b = vreinterpretq_u8_u16 (vcombine_u16 (q0, q1));
+
+    vst1q_u8 ((guint8 *) (dst + i), vrev16q_u8 (b));
+  }
+  norm_u16_swap_scalar (dst + i, sum + i, n - i, mul, shift, clear);
+}
+
+static const AvgKernels kernels_neon = {
+  AVG_KERNELS_CPU_NEON, "neon",
+  accum_u8_neon, accum_u16_neon, accum_u16_swap_neon,
+  norm_u8_neon, norm_u16_neon, norm_u16_swap_neon
+};
+
+#endif /* HAVE_NEON_KERNELS */
+
+/* returns NULL if the kernels for cpu are not usable on this machine */
+const AvgKernels *
+avg_kernels_get (AvgKernelsCpu cpu)
+{
+  switch (cpu) {
+    case AVG_KERNELS_CPU_SCALAR:
+      return &kernels_scalar;
+#ifdef HAVE_X86_KERNELS
+    case AVG_KERNELS_CPU_SSE2:
+      __builtin_cpu_init ();
+      return __builtin_cpu_supports ("sse2") ? &kernels_sse2 : NULL;
+    case AVG_KERNELS_CPU_AVX2:
+      __builtin_cpu_init ();
+      return __builtin_cpu_supports ("avx2") ? &kernels_avx2 : NULL;
+#endif
+#ifdef HAVE_NEON_KERNELS
+    case AVG_KERNELS_CPU_NEON:
+      return &kernels_neon;
+#endif
+    default:
+      return NULL;
+  }
+}
+
+const AvgKernels *
+avg_kernels_get_best (void)
+{
+  const AvgKernels *kernels = NULL;
+  gint cpu;
+
+  for (cpu = AVG_KERNELS_CPU_LAST - 1; cpu >= 0 && !kernels; cpu--)
+    kernels = avg_kernels_get (cpu);
+
+  return kernels;
+}
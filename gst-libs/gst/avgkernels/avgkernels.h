@@ -0,0 +1,67 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __AVG_KERNELS_H__
+#define __AVG_KERNELS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  AVG_KERNELS_CPU_SCALAR,
+  AVG_KERNELS_CPU_SSE2,
+  AVG_KERNELS_CPU_AVX2,
+  AVG_KERNELS_CPU_NEON,
+  AVG_KERNELS_CPU_LAST
+} AvgKernelsCpu;
+
+/* The accumulate kernels add a row of n samples in src to sum. The _swap
+ * variants byteswap every sample before adding it.
+ *
+ * The normalize kernels write sum[i] / divisor to dst, where the division is
+ * done as (sum[i] * mul) >> shift with the values from avg_kernels_reciprocal.
+ * If clear is set sum is zeroed as it is read. */
+typedef struct
+{
+  AvgKernelsCpu cpu;
+  const gchar *name;
+
+  void (*accum_u8) (guint32 * sum, const guint8 * src, gsize n);
+  void (*accum_u16) (guint32 * sum, const guint16 * src, gsize n);
+  void (*accum_u16_swap) (guint32 * sum, const guint16 * src, gsize n);
+
+  void (*norm_u8) (guint8 * dst, guint32 * sum, gsize n, guint32 mul,
+      guint shift, gboolean clear);
+  void (*norm_u16) (guint16 * dst, guint32 * sum, gsize n, guint32 mul,
+      guint shift, gboolean clear);
+  void (*norm_u16_swap) (guint16 * dst, guint32 * sum, gsize n, guint32 mul,
+      guint shift, gboolean clear);
+} AvgKernels;
+
+void avg_kernels_reciprocal (guint32 divisor, guint sample_bits,
+    guint32 * mul, guint * shift);
+
+const AvgKernels *avg_kernels_get (AvgKernelsCpu cpu);
+const AvgKernels *avg_kernels_get_best (void);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,88 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+/* Vector helpers shared by the kernel modules, only for use in the
+ * kernel sources. */
+
+#ifndef __AVG_KERNELS_SIMD_H__
+#define __AVG_KERNELS_SIMD_H__
+
+#include <glib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HAVE_NEON_KERNELS 1
+#include <arm_neon.h>
+#endif
+
+#ifdef HAVE_X86_KERNELS
+
+#define SSE2 __attribute__ ((target ("sse2")))
+#define AVX2 __attribute__ ((target ("avx2")))
+
+static inline SSE2 __m128i
+bswap_epi16_sse2 (__m128i v)
+{
+  return _mm_or_si128 (_mm_slli_epi16 (v, 8), _mm_srli_epi16 (v, 8));
+}
+
+/* quotients are at most 65535, bias them so the signed pack is exact */
+static inline SSE2 __m128i
+pack_epu32_epu16_sse2 (__m128i a, __m128i b)
+{
+  const __m128i bias32 = _mm_set1_epi32 (0x8000);
+  const __m128i bias16 = _mm_set1_epi16 ((gint16) 0x8000);
+
+  return _mm_xor_si128 (_mm_packs_epi32 (_mm_sub_epi32 (a, bias32),
+          _mm_sub_epi32 (b, bias32)), bias16);
+}
+
+static inline AVX2 __m128i
+bswap_epi16_ssse3 (__m128i v)
+{
+  const __m128i mask = _mm_setr_epi8 (1, 0, 3, 2, 5, 4, 7, 6,
+      9, 8, 11, 10, 13, 12, 15, 14);
+
+  return _mm_shuffle_epi8 (v, mask);
+}
+
+static inline AVX2 __m256i
+bswap_epi16_avx2 (__m256i v)
+{
+  const __m256i mask = _mm256_setr_epi8 (1, 0, 3, 2, 5, 4, 7, 6,
+      9, 8, 11, 10, 13, 12, 15, 14, 1, 0, 3, 2, 5, 4, 7, 6,
+      9, 8, 11, 10, 13, 12, 15, 14);
+
+  return _mm256_shuffle_epi8 (v, mask);
+}
+
+/* the packs work per 128 bit lane, put the 64 bit blocks back in order */
+static inline AVX2 __m256i
+pack_epu32_epu16_avx2 (__m256i a, __m256i b)
+{
+  return _mm256_permute4x64_epi64 (_mm256_packus_epi32 (a, b), 0xd8);
+}
+
+#endif /* HAVE_X86_KERNELS */
+
+#endif
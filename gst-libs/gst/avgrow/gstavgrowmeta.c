@@ -0,0 +1,137 @@
+/* GStreamer
+ * Copyright (C) <2015> Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <gstavgrowmeta.h>
+#include <string.h>
+#include <stdlib.h>
+
+GType
+gst_avgrow_meta_api_get_type (void)
+{
+  static volatile GType type;
+  static const gchar *tags[] = { NULL };
+
+  if (g_once_init_enter (&type)) {
+    GType _type = gst_meta_api_type_register ("AvgrowMetaAPI", tags);
+    g_once_init_leave (&type, _type);
+  }
+  return type;
+}
+
+static gboolean
+gst_avgrow_meta_init (GstMeta *meta, gpointer params, GstBuffer *buffer)
+{
+  GstAvgrowMeta *m = (GstAvgrowMeta *) meta;
+
+  m->mean = NULL;
+  m->stddev = NULL;
+  m->min = NULL;
+  m->max = NULL;
+  m->data_size = 0;
+  m->rows = 0;
+
+  return TRUE;
+}
+
+static gboolean
+gst_avgrow_meta_transform (GstBuffer * transbuf, GstMeta * meta,
+    GstBuffer * buffer, GQuark type, gpointer data)
+{
+  GstAvgrowMeta *m = (GstAvgrowMeta *) meta;
+  GstAvgrowMeta *copy;
+
+  /* the profile belongs to the frame, so it goes along with copies of it */
+  copy = gst_buffer_add_gst_avgrow_meta (transbuf, m->data_size, m->rows,
+      m->min != NULL, m->stddev != NULL);
+  if (!copy)
+    return FALSE;
+  memcpy (copy->mean, m->mean, m->data_size * sizeof (gfloat));
+  if (m->stddev)
+    memcpy (copy->stddev, m->stddev, m->data_size * sizeof (gfloat));
+  if (m->min) {
+    memcpy (copy->min, m->min, m->data_size * sizeof (guint16));
+    memcpy (copy->max, m->max, m->data_size * sizeof (guint16));
+  }
+
+  return TRUE;
+}
+
+static void
+gst_avgrow_meta_free (GstMeta *meta, GstBuffer *buffer)
+{
+  GstAvgrowMeta *m = (GstAvgrowMeta *) meta;
+
+  /* all the arrays are in the block of the mean */
+  free (m->mean);
+  m->mean = NULL;
+  m->stddev = NULL;
+  m->min = NULL;
+  m->max = NULL;
+  m->data_size = 0;
+  m->rows = 0;
+}
+
+const GstMetaInfo *
+gst_avgrow_meta_get_info (void)
+{
+  static const GstMetaInfo *meta_info = NULL;
+
+  if (g_once_init_enter (&meta_info)) {
+    const GstMetaInfo *mi = gst_meta_register (GST_AVGROW_META_API_TYPE,
+        GST_AVGROW_META_IMPL_NAME,
+        sizeof (GstAvgrowMeta),
+        gst_avgrow_meta_init,
+        gst_avgrow_meta_free,
+        gst_avgrow_meta_transform);
+    g_once_init_leave (&meta_info, mi);
+  }
+  return meta_info;
+}
+
+GstAvgrowMeta *
+gst_buffer_add_gst_avgrow_meta (GstBuffer * buffer, guint data_size,
+    gint rows, gboolean extrema, gboolean stddev)
+{
+  GstAvgrowMeta *meta;
+  gsize floats = stddev ? 2 : 1;
+  gsize shorts = extrema ? 2 : 0;
+
+  g_return_val_if_fail (GST_IS_BUFFER (buffer), NULL);
+  g_return_val_if_fail (data_size > 0, NULL);
+
+  meta = (GstAvgrowMeta *) gst_buffer_add_meta (buffer,
+      GST_AVGROW_META_INFO, NULL);
+
+  meta->mean = malloc (data_size * (floats * sizeof (gfloat) +
+          shorts * sizeof (guint16)));
+  if (!meta->mean) {
+    gst_buffer_remove_meta (buffer, (GstMeta *) meta);
+    return NULL;
+  }
+  if (stddev)
+    meta->stddev = meta->mean + data_size;
+  if (extrema) {
+    meta->min = (guint16 *) (meta->mean + floats * data_size);
+    meta->max = meta->min + data_size;
+  }
+  meta->data_size = data_size;
+  meta->rows = rows;
+
+  return meta;
+}
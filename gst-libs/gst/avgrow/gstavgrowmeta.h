@@ -0,0 +1,93 @@
+/*
+ * GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+
+#ifndef __GST_AVGROW_META_H__
+#define __GST_AVGROW_META_H__
+
+#include <gst/gst.h>
+
+#define GST_AVGROW_META_IMPL_NAME "AvgrowMeta"
+
+typedef struct _GstAvgrowMeta GstAvgrowMeta;
+
+/* The column profile of the buffer: the mean of the samples of every column
+ * of the region of interest that avgrow reads, or of every nocols columns
+ * when they are binned. The arrays hold data_size samples with the
+ * components of a column one after the other. rows is the number of rows
+ * behind every sample. min, max and stddev are NULL unless they were asked
+ * for. */
+struct _GstAvgrowMeta {
+    GstMeta        meta;
+    gfloat        *mean;
+    gfloat        *stddev;
+    guint16       *min;
+    guint16       *max;
+    guint          data_size;
+    gint           rows;
+};
+
+
+GType gst_avgrow_meta_api_get_type (void);
+#define GST_AVGROW_META_API_TYPE (gst_avgrow_meta_api_get_type())
+
+#define gst_buffer_get_gst_avgrow_meta(b) \
+	((GstAvgrowMeta*)gst_buffer_get_meta((b),GST_AVGROW_META_API_TYPE))
+
+
+
+const GstMetaInfo *gst_avgrow_meta_get_info (void);
+#define GST_AVGROW_META_INFO (gst_avgrow_meta_get_info())
+
+/* adds a meta with room for data_size samples of the mean, and of the
+ * extrema and the standard deviation if they are wanted, for the caller to
+ * fill in */
+GstAvgrowMeta * gst_buffer_add_gst_avgrow_meta (GstBuffer      *buffer,
+                                                guint           data_size,
+                                                gint            rows,
+                                                gboolean        extrema,
+                                                gboolean        stddev);
+
+
+#endif /* __GST_AVGROW_META_H__ */
@@ -21,6 +21,179 @@
 #include <string.h>
 #include <stdlib.h>
 
+/* The payload of a meta: a header followed by the rolling_median and error
+ * arrays. Blocks from a pool go back to its free list when the last meta
+ * sharing them is freed, others are freed. */
+typedef struct _GstFpncMagicBlock GstFpncMagicBlock;
+
+struct _GstFpncMagicBlock {
+  volatile gint refcount;
+  GstFpncMagicPool *pool;
+  GstFpncMagicBlock *next;
+  guint data_size;
+  GstFpncMagicType median_type;
+  GstFpncMagicType error_type;
+};
+
+#define BLOCK_HEADER_SIZE GST_ROUND_UP_8 (sizeof (GstFpncMagicBlock))
+#define BLOCK_MEDIANS(b) ((guint8 *) (b) + BLOCK_HEADER_SIZE)
+#define BLOCK_ERRORS(b) (BLOCK_MEDIANS (b) + GST_ROUND_UP_8 ((b)->data_size * \
+      gst_fpnc_magic_type_get_size ((b)->median_type)))
+
+struct _GstFpncMagicPool {
+  volatile gint refcount;
+  guint data_size;
+  GstFpncMagicType median_type;
+  GstFpncMagicType error_type;
+  GMutex lock;
+  GstFpncMagicBlock *free_blocks;
+};
+
+guint
+gst_fpnc_magic_type_get_size (GstFpncMagicType type)
+{
+  switch (type) {
+    case GST_FPNC_MAGIC_UINT8:
+      return sizeof (guint8);
+    case GST_FPNC_MAGIC_UINT16:
+    case GST_FPNC_MAGIC_INT16:
+      return sizeof (guint16);
+    default:
+      return sizeof (gint32);
+  }
+}
+
+static GstFpncMagicBlock *
+gst_fpnc_magic_block_new (guint data_size, GstFpncMagicType median_type,
+    GstFpncMagicType error_type)
+{
+  GstFpncMagicBlock *block;
+  gsize medians, errors;
+
+  medians = GST_ROUND_UP_8 (data_size *
+      gst_fpnc_magic_type_get_size (median_type));
+  errors = data_size * gst_fpnc_magic_type_get_size (error_type);
+
+  block = malloc (BLOCK_HEADER_SIZE + medians + errors);
+  if (!block)
+    return NULL;
+  block->refcount = 1;
+  block->pool = NULL;
+  block->next = NULL;
+  block->data_size = data_size;
+  block->median_type = median_type;
+  block->error_type = error_type;
+
+  return block;
+}
+
+static void
+gst_fpnc_magic_block_unref (GstFpncMagicBlock * block)
+{
+  GstFpncMagicPool *pool = block->pool;
+
+  if (!g_atomic_int_dec_and_test (&block->refcount))
+    return;
+
+  if (!pool) {
+    free (block);
+    return;
+  }
+
+  g_mutex_lock (&pool->lock);
+  block->next = pool->free_blocks;
+  pool->free_blocks = block;
+  g_mutex_unlock (&pool->lock);
+  gst_fpnc_magic_pool_unref (pool);
+}
+
+GstFpncMagicPool *
+gst_fpnc_magic_pool_new (guint data_size, GstFpncMagicType median_type,
+    GstFpncMagicType error_type)
+{
+  GstFpncMagicPool *pool;
+
+  g_return_val_if_fail (data_size > 0, NULL);
+
+  pool = malloc (sizeof (GstFpncMagicPool));
+  if (!pool)
+    return NULL;
+  pool->refcount = 1;
+  pool->data_size = data_size;
+  pool->median_type = median_type;
+  pool->error_type = error_type;
+  g_mutex_init (&pool->lock);
+  pool->free_blocks = NULL;
+
+  return pool;
+}
+
+GstFpncMagicPool *
+gst_fpnc_magic_pool_ref (GstFpncMagicPool * pool)
+{
+  g_atomic_int_inc (&pool->refcount);
+  return pool;
+}
+
+void
+gst_fpnc_magic_pool_unref (GstFpncMagicPool * pool)
+{
+  GstFpncMagicBlock *block;
+
+  if (!g_atomic_int_dec_and_test (&pool->refcount))
+    return;
+
+  while (pool->free_blocks) {
+    block = pool->free_blocks;
+    pool->free_blocks = block->next;
+    free (block);
+  }
+  g_mutex_clear (&pool->lock);
+  free (pool);
+}
+
+guint
+gst_fpnc_magic_pool_get_data_size (GstFpncMagicPool * pool)
+{
+  return pool->data_size;
+}
+
+static GstFpncMagicBlock *
+gst_fpnc_magic_pool_acquire (GstFpncMagicPool * pool)
+{
+  GstFpncMagicBlock *block;
+
+  g_mutex_lock (&pool->lock);
+  block = pool->free_blocks;
+  if (block)
+    pool->free_blocks = block->next;
+  g_mutex_unlock (&pool->lock);
+
+  if (!block) {
+    block = gst_fpnc_magic_block_new (pool->data_size, pool->median_type,
+        pool->error_type);
+    if (!block)
+      return NULL;
+  }
+  block->refcount = 1;
+  block->next = NULL;
+  block->pool = gst_fpnc_magic_pool_ref (pool);
+
+  return block;
+}
+
+static void
+gst_fpnc_magic_meta_set_block (GstFpncMagicMeta * meta,
+    GstFpncMagicBlock * block)
+{
+  meta->block = block;
+  meta->data_size = block->data_size;
+  meta->median_type = block->median_type;
+  meta->error_type = block->error_type;
+  meta->rolling_median.ptr = BLOCK_MEDIANS (block);
+  meta->error.ptr = BLOCK_ERRORS (block);
+}
+
 GType
 gst_fpnc_magic_meta_api_get_type (void)
 {
@@ -40,10 +213,13 @@ gst_fpnc_magic_meta_init (GstMeta *meta, gpointer params, GstBuffer *buffer)
   GstFpncMagicMeta *m = (GstFpncMagicMeta *) meta;
   //GST_WARNING("fpncm init");
 
-  m->rolling_median = NULL;
-  m->error = NULL;
+  m->rolling_median.ptr = NULL;
+  m->error.ptr = NULL;
+  m->median_type = GST_FPNC_MAGIC_INT32;
+  m->error_type = GST_FPNC_MAGIC_INT32;
   m->data_size = 0;
   m->avg = 0;
+  m->block = NULL;
 
   return TRUE;
 }
@@ -53,12 +229,19 @@ gst_fpnc_magic_meta_transform (GstBuffer * transbuf, GstMeta * meta,
     GstBuffer * buffer, GQuark type, gpointer data)
 {
   GstFpncMagicMeta *m = (GstFpncMagicMeta *) meta;
+  GstFpncMagicMeta *copy;
+  GstFpncMagicBlock *block = m->block;
 
   /*This is called when data is copied into a new buffer so to maintain the metadata
-    it needs to be set on the new buffer */
-  //GST_WARNING("fpncm trans");
-  gst_buffer_add_gst_fpnc_magic_meta (transbuf, m->rolling_median, 
-    m->error, m->data_size, m->avg);
+    it needs to be set on the new buffer. The copy shares the block. */
+  if (!block)
+    return TRUE;
+
+  copy = (GstFpncMagicMeta *) gst_buffer_add_meta (transbuf,
+      GST_FPNC_MAGIC_META_INFO, NULL);
+  g_atomic_int_inc (&block->refcount);
+  gst_fpnc_magic_meta_set_block (copy, block);
+  copy->avg = m->avg;
 
   return TRUE;
 }
@@ -67,13 +250,12 @@ void
 gst_fpnc_magic_meta_free (GstMeta *meta, GstBuffer *buffer)
 {
   GstFpncMagicMeta *m = (GstFpncMagicMeta *) meta;
-  //GST_WARNING("fpncm free meta %p", m);
-  if (m->rolling_median)
-    free (m->rolling_median);
-  m->rolling_median = NULL;
-  if (m->error)
-    free (m->error);
-  m->error = NULL;
+
+  if (m->block)
+    gst_fpnc_magic_block_unref (m->block);
+  m->block = NULL;
+  m->rolling_median.ptr = NULL;
+  m->error.ptr = NULL;
   m->data_size = 0;
   m->avg = 0;
 }
@@ -100,25 +282,42 @@ gst_buffer_add_gst_fpnc_magic_meta (GstBuffer * buffer, gpointer rolling_median,
   gpointer error, guint data_size, gint avg)
 {
   GstFpncMagicMeta *meta;
+  GstFpncMagicBlock *block;
 
   g_return_val_if_fail (GST_IS_BUFFER (buffer), NULL);
   g_return_val_if_fail (rolling_median, NULL);
   g_return_val_if_fail (error, NULL);
 
+  block = gst_fpnc_magic_block_new (data_size, GST_FPNC_MAGIC_INT32,
+      GST_FPNC_MAGIC_INT32);
+  if (!block)
+    return NULL;
+  memcpy(BLOCK_MEDIANS (block), rolling_median, data_size * sizeof(gint));
+  memcpy(BLOCK_ERRORS (block), error, data_size * sizeof(gint));
+
   meta = (GstFpncMagicMeta *) gst_buffer_add_meta (buffer, GST_FPNC_MAGIC_META_INFO, NULL);
+  gst_fpnc_magic_meta_set_block (meta, block);
+  meta->avg = avg;
 
-  
-  meta->data_size = data_size;
-  meta->rolling_median = malloc(data_size * sizeof(gint));
-  g_return_val_if_fail (meta->rolling_median, NULL);
-  memcpy(meta->rolling_median, rolling_median, data_size * sizeof(gint));
-  meta->error = malloc(data_size * sizeof(gint));
-  if (!meta->error){
-    free(meta->rolling_median);
+  return meta;
+}
+
+GstFpncMagicMeta *
+gst_buffer_add_gst_fpnc_magic_meta_from_pool (GstBuffer * buffer,
+    GstFpncMagicPool * pool)
+{
+  GstFpncMagicMeta *meta;
+  GstFpncMagicBlock *block;
+
+  g_return_val_if_fail (GST_IS_BUFFER (buffer), NULL);
+  g_return_val_if_fail (pool, NULL);
+
+  block = gst_fpnc_magic_pool_acquire (pool);
+  if (!block)
     return NULL;
-  }
-  memcpy(meta->error, error, data_size * sizeof(gint));
-  meta->avg = avg;
-  //GST_WARNING("meta addr %p", meta);
+
+  meta = (GstFpncMagicMeta *) gst_buffer_add_meta (buffer, GST_FPNC_MAGIC_META_INFO, NULL);
+  gst_fpnc_magic_meta_set_block (meta, block);
+
   return meta;
 }
@@ -51,23 +51,68 @@
 #define GST_FPNC_MAGIC_META_IMPL_NAME "FpncMagicMeta"
 
 typedef struct _GstFpncMagicMeta GstFpncMagicMeta;
+typedef struct _GstFpncMagicPool GstFpncMagicPool;
 
-/*union arrayptr {
+/* the type of the values in an array of the meta */
+typedef enum {
+    GST_FPNC_MAGIC_UINT8,
+    GST_FPNC_MAGIC_UINT16,
+    GST_FPNC_MAGIC_INT16,
+    GST_FPNC_MAGIC_INT32
+} GstFpncMagicType;
+
+typedef union {
     guint8  *ui8;
-    gint8   *i8;
     guint16 *ui16;
     gint16  *i16;
+    gint32  *i32;
     gpointer ptr;
-};*/
+} GstFpncMagicArray;
 
+/* The arrays are as small as the sample format allows: fpncmagic stores
+ * GRAY8 medians as UINT8 with INT16 errors and GRAY16 medians as UINT16 with
+ * INT32 errors, since a 16 bit error does not fit in 16 bits. Read them with
+ * gst_fpnc_magic_meta_get_median() and gst_fpnc_magic_meta_get_error() or by
+ * switching on the type.
+ *
+ * rolling_median and error point into a refcounted block that is shared by
+ * all copies of the buffer, so they must not be written to once the meta is
+ * on a buffer that may have been copied. */
 struct _GstFpncMagicMeta {
-    GstMeta        meta;
-    gint          *rolling_median;
-    gint          *error;
-    guint          data_size;
-    gint           avg;
+    GstMeta             meta;
+    GstFpncMagicArray   rolling_median;
+    GstFpncMagicArray   error;
+    GstFpncMagicType    median_type;
+    GstFpncMagicType    error_type;
+    guint               data_size;
+    gint                avg;
+
+    /*< private >*/
+    gpointer            block;
 };
 
+guint gst_fpnc_magic_type_get_size (GstFpncMagicType type);
+
+static inline gint
+gst_fpnc_magic_array_get (GstFpncMagicType type, GstFpncMagicArray array,
+    guint i)
+{
+  switch (type) {
+    case GST_FPNC_MAGIC_UINT8:
+      return array.ui8[i];
+    case GST_FPNC_MAGIC_UINT16:
+      return array.ui16[i];
+    case GST_FPNC_MAGIC_INT16:
+      return array.i16[i];
+    default:
+      return array.i32[i];
+  }
+}
+
+#define gst_fpnc_magic_meta_get_median(m,i) \
+	gst_fpnc_magic_array_get ((m)->median_type, (m)->rolling_median, (i))
+#define gst_fpnc_magic_meta_get_error(m,i) \
+	gst_fpnc_magic_array_get ((m)->error_type, (m)->error, (i))
 
 GType gst_fpnc_magic_meta_api_get_type (void);
 #define GST_FPNC_MAGIC_META_API_TYPE (gst_fpnc_magic_meta_api_get_type())
@@ -80,12 +125,30 @@ GType gst_fpnc_magic_meta_api_get_type (void);
 const GstMetaInfo *gst_fpnc_magic_meta_get_info (void);
 #define GST_FPNC_MAGIC_META_INFO (gst_fpnc_magic_meta_get_info())
 
+/* copies data_size gint medians and errors into an INT32 meta */
 GstFpncMagicMeta * gst_buffer_add_gst_fpnc_magic_meta (GstBuffer      *buffer,
                                                        gpointer        rolling_median,
                                                        gpointer        error,
                                                        guint           data_size,
                                                        gint            avg);
 
+/* A pool of blocks for metas of data_size columns of the given types.
+ * Blocks go back to the pool when the last buffer sharing them is freed, so
+ * a producer that adds its metas from a pool stops allocating once enough
+ * blocks are in flight. Blocks keep the pool alive until they are
+ * returned. */
+GstFpncMagicPool * gst_fpnc_magic_pool_new (guint              data_size,
+                                            GstFpncMagicType   median_type,
+                                            GstFpncMagicType   error_type);
+GstFpncMagicPool * gst_fpnc_magic_pool_ref (GstFpncMagicPool *pool);
+void gst_fpnc_magic_pool_unref (GstFpncMagicPool *pool);
+guint gst_fpnc_magic_pool_get_data_size (GstFpncMagicPool *pool);
+
+/* adds a meta with a block from pool, the caller fills in the arrays and
+ * avg */
+GstFpncMagicMeta * gst_buffer_add_gst_fpnc_magic_meta_from_pool (GstBuffer        *buffer,
+                                                                 GstFpncMagicPool *pool);
+
 
 
 #endif /* __GST_FPNC_MAGIC_META_H__ */
\ No newline at end of file
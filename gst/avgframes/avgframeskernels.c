@@ -0,0 +1,1594 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+/* Sliding window, filter, order statistic and variance kernels for
+ * avgframes. The accumulate and normalize kernels are shared with avgrow in
+ * gst-libs/gst/avgkernels.
+ *
+ * The scalar versions are the reference implementation, the vector versions
+ * must produce exactly the same results. The x86 kernels are built with
+ * target attributes so that no special compiler flags are needed, and the
+ * best one is picked at runtime. NEON is used whenever the compiler targets
+ * it (always the case on aarch64). */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <byteswap.h>
+#include <math.h>
+#include <string.h>
+#include <gst/avgkernels/avgkernelssimd.h>
+#include "avgframeskernels.h"
+
+/* Batcher's odd-even merge sort for any n, comparators running into inputs
+ * above n are left out. Returns the number of comparators and writes them
+ * to pairs if it is not NULL. */
+static gint
+batcher_network (gint n, guint8 * pairs)
+{
+  gint p, k, j, i, n_pairs = 0;
+
+  for (p = 1; p < n; p += p) {
+    for (k = p; k > 0; k /= 2) {
+      for (j = k % p; j + k < n; j += k + k) {
+        for (i = 0; i < k && i + j + k < n; i++) {
+          if ((i + j) / (p + p) != (i + j + k) / (p + p))
+            continue;
+          if (pairs) {
+            pairs[2 * n_pairs] = i + j;
+            pairs[2 * n_pairs + 1] = i + j + k;
+          }
+          n_pairs++;
+        }
+      }
+    }
+  }
+  return n_pairs;
+}
+
+/* A sorting network that only has to deliver the median: going backwards
+ * from the output, a comparator is only kept if one of its outputs is used
+ * later on. For larger windows this drops close to half of them. */
+AvgFramesNetwork *
+avg_frames_network_new_median (gint n_inputs)
+{
+  AvgFramesNetwork *net;
+  gboolean used[AVG_FRAMES_MAX_NETWORK] = { FALSE, };
+  gboolean *keep;
+  gint n_pairs, c, n;
+
+  g_return_val_if_fail (n_inputs > 0 && n_inputs <= AVG_FRAMES_MAX_NETWORK,
+      NULL);
+
+  n_pairs = batcher_network (n_inputs, NULL);
+
+  net = g_new0 (AvgFramesNetwork, 1);
+  net->n_inputs = n_inputs;
+  /* the lower median for even windows */
+  net->out = (n_inputs - 1) / 2;
+  net->pairs = g_new (guint8, 2 * MAX (n_pairs, 1));
+  batcher_network (n_inputs, net->pairs);
+
+  keep = g_new (gboolean, MAX (n_pairs, 1));
+  used[net->out] = TRUE;
+  for (c = n_pairs - 1; c >= 0; c--) {
+    guint8 a = net->pairs[2 * c], b = net->pairs[2 * c + 1];
+
+    keep[c] = used[a] || used[b];
+    if (keep[c])
+      used[a] = used[b] = TRUE;
+  }
+
+  for (c = 0, n = 0; c < n_pairs; c++) {
+    if (!keep[c])
+      continue;
+    net->pairs[2 * n] = net->pairs[2 * c];
+    net->pairs[2 * n + 1] = net->pairs[2 * c + 1];
+    n++;
+  }
+  net->n_pairs = n;
+  g_free (keep);
+
+  return net;
+}
+
+void
+avg_frames_network_free (AvgFramesNetwork * net)
+{
+  if (!net)
+    return;
+  g_free (net->pairs);
+  g_free (net);
+}
+
+/* runs net on the values in v, with vmin and vmax working on type */
+#define NETWORK_RUN(type, v, net, vmin, vmax) \
+  G_STMT_START { \
+    const guint8 *p_ = (net)->pairs; \
+    gint c_; \
+    for (c_ = 0; c_ < (net)->n_pairs; c_++, p_ += 2) { \
+      type lo_ = vmin (v[p_[0]], v[p_[1]]); \
+      v[p_[1]] = vmax (v[p_[0]], v[p_[1]]); \
+      v[p_[0]] = lo_; \
+    } \
+  } G_STMT_END
+
+/* the clip kernels work on blocks of this many samples so that the per
+ * sample statistics stay in the cache */
+#define CLIP_BLOCK 64
+
+#define EMA_FRAC_8 AVG_FRAMES_EMA_FRAC_BITS (8)
+#define EMA_FRAC_16 AVG_FRAMES_EMA_FRAC_BITS (16)
+
+/* the state never leaves [0, in_max << F], so it can be handled as signed.
+ * Right shifts of negative values are arithmetic with every supported
+ * compiler. */
+#define EMA_STEP(acc, in, k, frac) \
+  ((acc) = (guint32) ((gint32) (acc) + \
+      (((gint32) ((guint32) (in) << (frac)) - (gint32) (acc)) >> (k))))
+#define EMA_OUT(acc, frac) (((acc) + (1u << ((frac) - 1))) >> (frac))
+
+/* scalar reference */
+
+static void
+slide_u8_scalar (guint32 * sum, guint8 * old, const guint8 * src, gsize n)
+{
+  gsize i;
+
+  for (i = 0; i < n; i++) {
+    sum[i] += src[i] - old[i];
+    old[i] = src[i];
+  }
+}
+
+static void
+slide_u16_scalar (guint32 * sum, guint16 * old, const guint16 * src, gsize n)
+{
+  gsize i;
+
+  for (i = 0; i < n; i++) {
+    sum[i] += src[i] - old[i];
+    old[i] = src[i];
+  }
+}
+
+static void
+slide_u16_swap_scalar (guint32 * sum, guint16 * old, const guint16 * src,
+    gsize n)
+{
+  gsize i;
+
+  for (i = 0; i < n; i++) {
+    sum[i] += __bswap_16 (src[i]) - __bswap_16 (old[i]);
+    old[i] = src[i];
+  }
+}
+
+static void
+ema_u8_scalar (guint32 * acc, guint8 * dst, const guint8 * src, gsize n,
+    guint k)
+{
+  gsize i;
+
+  for (i = 0; i < n; i++) {
+    EMA_STEP (acc[i], src[i], k, EMA_FRAC_8);
+    dst[i] = (guint8) EMA_OUT (acc[i], EMA_FRAC_8);
+  }
+}
+
+static void
+ema_u16_scalar (guint32 * acc, guint16 * dst, const guint16 * src, gsize n,
+    guint k)
+{
+  gsize i;
+
+  for (i = 0; i < n; i++) {
+    EMA_STEP (acc[i], src[i], k, EMA_FRAC_16);
+    dst[i] = (guint16) EMA_OUT (acc[i], EMA_FRAC_16);
+  }
+}
+
+static void
+ema_u16_swap_scalar (guint32 * acc, guint16 * dst, const guint16 * src,
+    gsize n, guint k)
+{
+  gsize i;
+  guint16 val;
+
+  for (i = 0; i < n; i++) {
+    EMA_STEP (acc[i], __bswap_16 (src[i]), k, EMA_FRAC_16);
+    val = (guint16) EMA_OUT (acc[i], EMA_FRAC_16);
+    dst[i] = __bswap_16 (val);
+  }
+}
+
+static void
+median_u8_range (guint8 * dst, const guint8 * const *src, gsize start,
+    gsize end, const AvgFramesNetwork * net)
+{
+  guint8 v[AVG_FRAMES_MAX_NETWORK];
+  gsize i;
+  gint k;
+
+  for (i = start; i < end; i++) {
+    for (k = 0; k < net->n_inputs; k++)
+      v[k] = src[k][i];
+    NETWORK_RUN (guint8, v, net, MIN, MAX);
+    dst[i] = v[net->out];
+  }
+}
+
+static void
+median_u16_range (guint16 * dst, const guint16 * const *src, gsize start,
+    gsize end, const AvgFramesNetwork * net)
+{
+  guint16 v[AVG_FRAMES_MAX_NETWORK];
+  gsize i;
+  gint k;
+
+  for (i = start; i < end; i++) {
+    for (k = 0; k < net->n_inputs; k++)
+      v[k] = src[k][i];
+    NETWORK_RUN (guint16, v, net, MIN, MAX);
+    dst[i] = v[net->out];
+  }
+}
+
+static void
+median_u8_scalar (guint8 * dst, const guint8 * const *src, gsize n,
+    const AvgFramesNetwork * net)
+{
+  median_u8_range (dst, src, 0, n, net);
+}
+
+static void
+median_u16_scalar (guint16 * dst, const guint16 * const *src, gsize n,
+    const AvgFramesNetwork * net)
+{
+  median_u16_range (dst, src, 0, n, net);
+}
+
+/* A sample s of the n at a pixel is kept when it is within kappa standard
+ * deviations of their mean, (s - S / n)^2 <= kappa^2 (Q / n - (S / n)^2)
+ * with S and Q the sums of the samples and of their squares. Times n^2 this
+ * is |n s - S| <= sqrt (kappa^2 (n Q - S^2)), so the test of every sample
+ * is done on exact integers and the vector kernels give the same results as
+ * the scalar ones. The radius on the right is worked out once per pixel by
+ * clip_radius_u8 () or clip_radius_u16 (), which all versions share.
+ *
+ * A kernel goes over blocks of CLIP_BLOCK pixels: a sums pass adds up S and
+ * Q, a keep pass adds up the kept samples and counts them. Where none are
+ * kept the mean of all of them is taken. With at most
+ * AVG_FRAMES_MAX_NETWORK samples, 8 bit samples have |n s - S|, the kept
+ * sums and the counts in 16 bits and 16 bit samples in 32 bits. */
+
+typedef void (*ClipSumsU8) (guint16 * sum, guint32 * sumsq,
+    const guint8 * const *src, gint n_src, gsize i0, gint m);
+typedef void (*ClipKeepU8) (guint16 * kept, guint16 * count,
+    const guint16 * sum, const guint16 * radius, const guint8 * const *src,
+    gint n_src, gsize i0, gint m);
+typedef void (*ClipSumsU16) (guint32 * sum, guint64 * sumsq,
+    const guint16 * const *src, gint n_src, gsize i0, gint m);
+typedef void (*ClipKeepU16) (guint32 * kept, guint32 * count,
+    const guint32 * sum, const guint32 * radius, const guint16 * const *src,
+    gint n_src, gsize i0, gint m);
+
+/* the radii are clamped to what the signed vector compares can take, which
+ * is more than any |n s - S| */
+static inline void
+clip_radius_u8 (guint16 * radius, const guint16 * sum, const guint32 * sumsq,
+    gint n_src, gint m, gdouble kappa)
+{
+  gdouble k2 = kappa * kappa, r;
+  gint i;
+
+  for (i = 0; i < m; i++) {
+    r = sqrt (k2 * (gdouble) ((guint64) n_src * sumsq[i] -
+            (guint64) sum[i] * sum[i]));
+    radius[i] = r < G_MAXINT16 ? (guint16) r : G_MAXINT16;
+  }
+}
+
+static inline void
+clip_radius_u16 (guint32 * radius, const guint32 * sum, const guint64 * sumsq,
+    gint n_src, gint m, gdouble kappa)
+{
+  gdouble k2 = kappa * kappa, r;
+  gint i;
+
+  for (i = 0; i < m; i++) {
+    r = sqrt (k2 * (gdouble) (n_src * sumsq[i] - (guint64) sum[i] * sum[i]));
+    radius[i] = r < G_MAXINT32 ? (guint32) r : G_MAXINT32;
+  }
+}
+
+/* writes the means to dst, or with 8 fractional bits to dst16 if it is not
+ * NULL */
+static inline void
+clip_u8_run (guint8 * dst, guint16 * dst16, const guint8 * const *src,
+    gint n_src, gsize n, gdouble kappa, ClipSumsU8 sums, ClipKeepU8 keep)
+{
+  guint16 sum[CLIP_BLOCK], radius[CLIP_BLOCK], kept[CLIP_BLOCK],
+      count[CLIP_BLOCK];
+  guint32 sumsq[CLIP_BLOCK], k, c;
+  gsize i0;
+  gint i, m;
+
+  for (i0 = 0; i0 < n; i0 += m) {
+    m = (gint) MIN (CLIP_BLOCK, n - i0);
+    sums (sum, sumsq, src, n_src, i0, m);
+    clip_radius_u8 (radius, sum, sumsq, n_src, m, kappa);
+    keep (kept, count, sum, radius, src, n_src, i0, m);
+    for (i = 0; i < m; i++) {
+      k = count[i] ? kept[i] : sum[i];
+      c = count[i] ? count[i] : (guint32) n_src;
+      if (dst16)
+        dst16[i0 + i] = (k << 8) / c;
+      else
+        dst[i0 + i] = k / c;
+    }
+  }
+}
+
+static inline void
+clip_u16_run (guint16 * dst, const guint16 * const *src, gint n_src, gsize n,
+    gdouble kappa, ClipSumsU16 sums, ClipKeepU16 keep)
+{
+  guint32 sum[CLIP_BLOCK], radius[CLIP_BLOCK], kept[CLIP_BLOCK],
+      count[CLIP_BLOCK];
+  guint64 sumsq[CLIP_BLOCK];
+  gsize i0;
+  gint i, m;
+
+  for (i0 = 0; i0 < n; i0 += m) {
+    m = (gint) MIN (CLIP_BLOCK, n - i0);
+    sums (sum, sumsq, src, n_src, i0, m);
+    clip_radius_u16 (radius, sum, sumsq, n_src, m, kappa);
+    keep (kept, count, sum, radius, src, n_src, i0, m);
+    for (i = 0; i < m; i++)
+      dst[i0 + i] = count[i] ? kept[i] / count[i] : sum[i] / n_src;
+  }
+}
+
+static void
+clip_sums_u8_scalar (guint16 * sum, guint32 * sumsq,
+    const guint8 * const *src, gint n_src, gsize i0, gint m)
+{
+  gint i, k;
+
+  memset (sum, 0, m * sizeof (guint16));
+  memset (sumsq, 0, m * sizeof (guint32));
+  for (k = 0; k < n_src; k++) {
+    const guint8 *s = src[k] + i0;
+
+    for (i = 0; i < m; i++) {
+      sum[i] += s[i];
+      sumsq[i] += s[i] * s[i];
+    }
+  }
+}
+
+static void
+clip_keep_u8_scalar (guint16 * kept, guint16 * count, const guint16 * sum,
+    const guint16 * radius, const guint8 * const *src, gint n_src, gsize i0,
+    gint m)
+{
+  gint i, k;
+
+  memset (kept, 0, m * sizeof (guint16));
+  memset (count, 0, m * sizeof (guint16));
+  for (k = 0; k < n_src; k++) {
+    const guint8 *s = src[k] + i0;
+
+    for (i = 0; i < m; i++) {
+      if (ABS (n_src * s[i] - sum[i]) <= radius[i]) {
+        kept[i] += s[i];
+        count[i]++;
+      }
+    }
+  }
+}
+
+static void
+clip_sums_u16_scalar (guint32 * sum, guint64 * sumsq,
+    const guint16 * const *src, gint n_src, gsize i0, gint m)
+{
+  gint i, k;
+
+  memset (sum, 0, m * sizeof (guint32));
+  memset (sumsq, 0, m * sizeof (guint64));
+  for (k = 0; k < n_src; k++) {
+    const guint16 *s = src[k] + i0;
+
+    for (i = 0; i < m; i++) {
+      sum[i] += s[i];
+      sumsq[i] += (guint32) s[i] * s[i];
+    }
+  }
+}
+
+static void
+clip_keep_u16_scalar (guint32 * kept, guint32 * count, const guint32 * sum,
+    const guint32 * radius, const guint16 * const *src, gint n_src,
+    gsize i0, gint m)
+{
+  gint i, k;
+
+  memset (kept, 0, m * sizeof (guint32));
+  memset (count, 0, m * sizeof (guint32));
+  for (k = 0; k < n_src; k++) {
+    const guint16 *s = src[k] + i0;
+
+    for (i = 0; i < m; i++) {
+      if (ABS (n_src * s[i] - (gint32) sum[i]) <= (gint32) radius[i]) {
+        kept[i] += s[i];
+        count[i]++;
+      }
+    }
+  }
+}
+
+static void
+clip_u8_scalar (guint8 * dst, const guint8 * const *src, gint n_src,
+    gsize n, gdouble kappa)
+{
+  clip_u8_run (dst, NULL, src, n_src, n, kappa, clip_sums_u8_scalar,
+      clip_keep_u8_scalar);
+}
+
+static void
+clip_u8_wide_scalar (guint16 * dst, const guint8 * const *src, gint n_src,
+    gsize n, gdouble kappa)
+{
+  clip_u8_run (NULL, dst, src, n_src, n, kappa, clip_sums_u8_scalar,
+      clip_keep_u8_scalar);
+}
+
+static void
+clip_u16_scalar (guint16 * dst, const guint16 * const *src, gint n_src,
+    gsize n, gdouble kappa)
+{
+  clip_u16_run (dst, src, n_src, n, kappa, clip_sums_u16_scalar,
+      clip_keep_u16_scalar);
+}
+
+/* The squares need 64 bit sums, which leaves little for hand written
+ * versions to gain over what the compiler makes of these. */
+static void
+accum_sq_u8_scalar (guint32 * sum, guint64 * sumsq, const guint8 * src,
+    gsize n)
+{
+  gsize i;
+
+  for (i = 0; i < n; i++) {
+    sum[i] += src[i];
+    sumsq[i] += (guint32) src[i] * src[i];
+  }
+}
+
+static void
+accum_sq_u16_scalar (guint32 * sum, guint64 * sumsq, const guint16 * src,
+    gsize n)
+{
+  gsize i;
+
+  for (i = 0; i < n; i++) {
+    sum[i] += src[i];
+    sumsq[i] += (guint32) src[i] * src[i];
+  }
+}
+
+static void
+accum_sq_u16_swap_scalar (guint32 * sum, guint64 * sumsq,
+    const guint16 * src, gsize n)
+{
+  gsize i;
+  guint16 val;
+
+  for (i = 0; i < n; i++) {
+    val = __bswap_16 (src[i]);
+    sum[i] += val;
+    sumsq[i] += (guint32) val * val;
+  }
+}
+
+/* count * sumsq - sum^2 is exact in 64 bits for every window whose sums fit
+ * in 31 bits, so the only rounding is in the final division */
+static void
+variance_scalar (gfloat * dst, guint64 * sumsq, const guint32 * sum,
+    gsize n, guint32 count, gboolean clear)
+{
+  gdouble div = (gdouble) count * count;
+  gsize i;
+
+  for (i = 0; i < n; i++) {
+    dst[i] = (gfloat) ((gdouble) (count * sumsq[i] -
+            (guint64) sum[i] * sum[i]) / div);
+    if (clear)
+      sumsq[i] = 0;
+  }
+}
+
+static const AvgFramesKernels kernels_scalar = {
+  AVG_KERNELS_CPU_SCALAR, "scalar",
+  slide_u8_scalar, slide_u16_scalar, slide_u16_swap_scalar,
+  ema_u8_scalar, ema_u16_scalar, ema_u16_swap_scalar,
+  median_u8_scalar, median_u16_scalar,
+  clip_u8_scalar, clip_u16_scalar, clip_u8_wide_scalar,
+  accum_sq_u8_scalar, accum_sq_u16_scalar, accum_sq_u16_swap_scalar,
+  variance_scalar
+};
+
+#ifdef HAVE_X86_KERNELS
+
+/* SSE2 */
+
+static inline SSE2 void
+slide_epu16_sse2 (guint32 * sum, __m128i add, __m128i sub)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  __m128i *s = (__m128i *) sum;
+  __m128i lo = _mm_sub_epi32 (_mm_unpacklo_epi16 (add, zero),
+      _mm_unpacklo_epi16 (sub, zero));
+  __m128i hi = _mm_sub_epi32 (_mm_unpackhi_epi16 (add, zero),
+      _mm_unpackhi_epi16 (sub, zero));
+
+  _mm_storeu_si128 (s, _mm_add_epi32 (_mm_loadu_si128 (s), lo));
+  _mm_storeu_si128 (s + 1, _mm_add_epi32 (_mm_loadu_si128 (s + 1), hi));
+}
+
+static SSE2 void
+slide_u8_sse2 (guint32 * sum, guint8 * old, const guint8 * src, gsize n)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  gsize i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    __m128i add = _mm_loadu_si128 ((const __m128i *) (src + i));
+    __m128i sub = _mm_loadu_si128 ((const __m128i *) (old + i));
+
+    _mm_storeu_si128 ((__m128i *) (old + i), add);
+    slide_epu16_sse2 (sum + i, _mm_unpacklo_epi8 (add, zero),
+        _mm_unpacklo_epi8 (sub, zero));
+    slide_epu16_sse2 (sum + i + 8, _mm_unpackhi_epi8 (add, zero),
+        _mm_unpackhi_epi8 (sub, zero));
+  }
+  slide_u8_scalar (sum + i, old + i, src + i, n - i);
+}
+
+static SSE2 void
+slide_u16_sse2 (guint32 * sum, guint16 * old, const guint16 * src, gsize n)
+{
+  gsize i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    __m128i add = _mm_loadu_si128 ((const __m128i *) (src + i));
+    __m128i sub = _mm_loadu_si128 ((const __m128i *) (old + i));
+
+    _mm_storeu_si128 ((__m128i *) (old + i), add);
+    slide_epu16_sse2 (sum + i, add, sub);
+  }
+  slide_u16_scalar (sum + i, old + i, src + i, n - i);
+}
+
+static SSE2 void
+slide_u16_swap_sse2 (guint32 * sum, guint16 * old, const guint16 * src,
+    gsize n)
+{
+  gsize i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    __m128i add = _mm_loadu_si128 ((const __m128i *) (src + i));
+    __m128i sub = _mm_loadu_si128 ((const __m128i *) (old + i));
+
+    _mm_storeu_si128 ((__m128i *) (old + i), add);
+    slide_epu16_sse2 (sum + i, bswap_epi16_sse2 (add), bswap_epi16_sse2 (sub));
+  }
+  slide_u16_swap_scalar (sum + i, old + i, src + i, n - i);
+}
+
+/* one filter step on 4 samples, returns the rounded outputs */
+static inline SSE2 __m128i
+ema_epi32_sse2 (guint32 * acc, __m128i in, __m128i k, const gint frac)
+{
+  __m128i *a = (__m128i *) acc;
+  __m128i state = _mm_loadu_si128 (a);
+  __m128i diff = _mm_sub_epi32 (_mm_slli_epi32 (in, frac), state);
+
+  state = _mm_add_epi32 (state, _mm_sra_epi32 (diff, k));
+  _mm_storeu_si128 (a, state);
+  return _mm_srli_epi32 (_mm_add_epi32 (state,
+          _mm_set1_epi32 (1 << (frac - 1))), frac);
+}
+
+static inline SSE2 __m128i
+ema_epu16_sse2 (guint32 * acc, __m128i in, __m128i k, const gint frac)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  __m128i lo = ema_epi32_sse2 (acc, _mm_unpacklo_epi16 (in, zero), k, frac);
+  __m128i hi = ema_epi32_sse2 (acc + 4, _mm_unpackhi_epi16 (in, zero), k,
+      frac);
+
+  return pack_epu32_epu16_sse2 (lo, hi);
+}
+
+static SSE2 void
+ema_u8_sse2 (guint32 * acc, guint8 * dst, const guint8 * src, gsize n,
+    guint k)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i vk = _mm_cvtsi32_si128 (k);
+  gsize i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i));
+    __m128i lo = ema_epu16_sse2 (acc + i, _mm_unpacklo_epi8 (v, zero), vk,
+        EMA_FRAC_8);
+    __m128i hi = ema_epu16_sse2 (acc + i + 8, _mm_unpackhi_epi8 (v, zero), vk,
+        EMA_FRAC_8);
+
+    _mm_storeu_si128 ((__m128i *) (dst + i), _mm_packus_epi16 (lo, hi));
+  }
+  ema_u8_scalar (acc + i, dst + i, src + i, n - i, k);
+}
+
+static SSE2 void
+ema_u16_sse2 (guint32 * acc, guint16 * dst, const guint16 * src, gsize n,
+    guint k)
+{
+  const __m128i vk = _mm_cvtsi32_si128 (k);
+  gsize i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i));
+
+    _mm_storeu_si128 ((__m128i *) (dst + i), ema_epu16_sse2 (acc + i, v, vk,
+            EMA_FRAC_16));
+  }
+  ema_u16_scalar (acc + i, dst + i, src + i, n - i, k);
+}
+
+static SSE2 void
+ema_u16_swap_sse2 (guint32 * acc, guint16 * dst, const guint16 * src,
+    gsize n, guint k)
+{
+  const __m128i vk = _mm_cvtsi32_si128 (k);
+  gsize i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i));
+
+    _mm_storeu_si128 ((__m128i *) (dst + i),
+        bswap_epi16_sse2 (ema_epu16_sse2 (acc + i, bswap_epi16_sse2 (v), vk,
+                EMA_FRAC_16)));
+  }
+  ema_u16_swap_scalar (acc + i, dst + i, src + i, n - i, k);
+}
+
+static SSE2 void
+median_u8_sse2 (guint8 * dst, const guint8 * const *src, gsize n,
+    const AvgFramesNetwork * net)
+{
+  __m128i v[AVG_FRAMES_MAX_NETWORK];
+  gsize i;
+  gint k;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    for (k = 0; k < net->n_inputs; k++)
+      v[k] = _mm_loadu_si128 ((const __m128i *) (src[k] + i));
+    NETWORK_RUN (__m128i, v, net, _mm_min_epu8, _mm_max_epu8);
+    _mm_storeu_si128 ((__m128i *) (dst + i), v[net->out]);
+  }
+  median_u8_range (dst, src, i, n, net);
+}
+
+/* there is no unsigned 16 bit min/max before SSE4.1, flip the sign bits and
+ * sort with the signed ones */
+static SSE2 void
+median_u16_sse2 (guint16 * dst, const guint16 * const *src, gsize n,
+    const AvgFramesNetwork * net)
+{
+  const __m128i bias = _mm_set1_epi16 ((gint16) 0x8000);
+  __m128i v[AVG_FRAMES_MAX_NETWORK];
+  gsize i;
+  gint k;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    for (k = 0; k < net->n_inputs; k++)
+      v[k] = _mm_xor_si128 (_mm_loadu_si128 ((const __m128i *) (src[k] + i)),
+          bias);
+    NETWORK_RUN (__m128i, v, net, _mm_min_epi16, _mm_max_epi16);
+    _mm_storeu_si128 ((__m128i *) (dst + i), _mm_xor_si128 (v[net->out],
+            bias));
+  }
+  median_u16_range (dst, src, i, n, net);
+}
+
+/* n s is at most 32640 for 8 bit samples, so |n s - S| is the or of the
+ * two saturated differences */
+static SSE2 void
+clip_sums_u8_sse2 (guint16 * sum, guint32 * sumsq,
+    const guint8 * const *src, gint n_src, gsize i0, gint m)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  gint i, k;
+
+  for (i = 0; i + 8 <= m; i += 8) {
+    __m128i s = zero, q0 = zero, q1 = zero;
+
+    for (k = 0; k < n_src; k++) {
+      __m128i v = _mm_unpacklo_epi8 (_mm_loadl_epi64 ((const __m128i *)
+              (src[k] + i0 + i)), zero);
+      __m128i sq = _mm_mullo_epi16 (v, v);
+
+      s = _mm_add_epi16 (s, v);
+      q0 = _mm_add_epi32 (q0, _mm_unpacklo_epi16 (sq, zero));
+      q1 = _mm_add_epi32 (q1, _mm_unpackhi_epi16 (sq, zero));
+    }
+    _mm_storeu_si128 ((__m128i *) (sum + i), s);
+    _mm_storeu_si128 ((__m128i *) (sumsq + i), q0);
+    _mm_storeu_si128 ((__m128i *) (sumsq + i + 4), q1);
+  }
+  clip_sums_u8_scalar (sum + i, sumsq + i, src, n_src, i0 + i, m - i);
+}
+
+static SSE2 void
+clip_keep_u8_sse2 (guint16 * kept, guint16 * count, const guint16 * sum,
+    const guint16 * radius, const guint8 * const *src, gint n_src, gsize i0,
+    gint m)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i one = _mm_set1_epi16 (1);
+  const __m128i n = _mm_set1_epi16 (n_src);
+  gint i, k;
+
+  for (i = 0; i + 8 <= m; i += 8) {
+    __m128i s = _mm_loadu_si128 ((const __m128i *) (sum + i));
+    __m128i r = _mm_loadu_si128 ((const __m128i *) (radius + i));
+    __m128i kp = zero, c = zero;
+
+    for (k = 0; k < n_src; k++) {
+      __m128i v = _mm_unpacklo_epi8 (_mm_loadl_epi64 ((const __m128i *)
+              (src[k] + i0 + i)), zero);
+      __m128i ns = _mm_mullo_epi16 (v, n);
+      __m128i d = _mm_or_si128 (_mm_subs_epu16 (ns, s),
+          _mm_subs_epu16 (s, ns));
+      __m128i out = _mm_cmpgt_epi16 (d, r);
+
+      kp = _mm_add_epi16 (kp, _mm_andnot_si128 (out, v));
+      c = _mm_add_epi16 (c, _mm_andnot_si128 (out, one));
+    }
+    _mm_storeu_si128 ((__m128i *) (kept + i), kp);
+    _mm_storeu_si128 ((__m128i *) (count + i), c);
+  }
+  clip_keep_u8_scalar (kept + i, count + i, sum + i, radius + i, src, n_src,
+      i0 + i, m - i);
+}
+
+/* the 64 bit squares of the even and the odd 32 bit lanes are summed apart
+ * and put back in order when they are stored */
+static SSE2 void
+clip_sums_u16_sse2 (guint32 * sum, guint64 * sumsq,
+    const guint16 * const *src, gint n_src, gsize i0, gint m)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  gint i, k;
+
+  for (i = 0; i + 8 <= m; i += 8) {
+    __m128i s0 = zero, s1 = zero;
+    __m128i e0 = zero, o0 = zero, e1 = zero, o1 = zero;
+
+    for (k = 0; k < n_src; k++) {
+      __m128i v = _mm_loadu_si128 ((const __m128i *) (src[k] + i0 + i));
+      __m128i v0 = _mm_unpacklo_epi16 (v, zero);
+      __m128i v1 = _mm_unpackhi_epi16 (v, zero);
+      __m128i w0 = _mm_srli_epi64 (v0, 32);
+      __m128i w1 = _mm_srli_epi64 (v1, 32);
+
+      s0 = _mm_add_epi32 (s0, v0);
+      s1 = _mm_add_epi32 (s1, v1);
+      e0 = _mm_add_epi64 (e0, _mm_mul_epu32 (v0, v0));
+      o0 = _mm_add_epi64 (o0, _mm_mul_epu32 (w0, w0));
+      e1 = _mm_add_epi64 (e1, _mm_mul_epu32 (v1, v1));
+      o1 = _mm_add_epi64 (o1, _mm_mul_epu32 (w1, w1));
+    }
+    _mm_storeu_si128 ((__m128i *) (sum + i), s0);
+    _mm_storeu_si128 ((__m128i *) (sum + i + 4), s1);
+    _mm_storeu_si128 ((__m128i *) (sumsq + i), _mm_unpacklo_epi64 (e0, o0));
+    _mm_storeu_si128 ((__m128i *) (sumsq + i + 2),
+        _mm_unpackhi_epi64 (e0, o0));
+    _mm_storeu_si128 ((__m128i *) (sumsq + i + 4),
+        _mm_unpacklo_epi64 (e1, o1));
+    _mm_storeu_si128 ((__m128i *) (sumsq + i + 6),
+        _mm_unpackhi_epi64 (e1, o1));
+  }
+  clip_sums_u16_scalar (sum + i, sumsq + i, src, n_src, i0 + i, m - i);
+}
+
+static inline SSE2 __m128i
+abs_epi32_sse2 (__m128i v)
+{
+  __m128i sign = _mm_srai_epi32 (v, 31);
+
+  return _mm_sub_epi32 (_mm_xor_si128 (v, sign), sign);
+}
+
+static SSE2 void
+clip_keep_u16_sse2 (guint32 * kept, guint32 * count, const guint32 * sum,
+    const guint32 * radius, const guint16 * const *src, gint n_src,
+    gsize i0, gint m)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i one = _mm_set1_epi32 (1);
+  const __m128i n = _mm_set1_epi16 (n_src);
+  gint i, k;
+
+  for (i = 0; i + 8 <= m; i += 8) {
+    __m128i s0 = _mm_loadu_si128 ((const __m128i *) (sum + i));
+    __m128i s1 = _mm_loadu_si128 ((const __m128i *) (sum + i + 4));
+    __m128i r0 = _mm_loadu_si128 ((const __m128i *) (radius + i));
+    __m128i r1 = _mm_loadu_si128 ((const __m128i *) (radius + i + 4));
+    __m128i kp0 = zero, kp1 = zero, c0 = zero, c1 = zero;
+
+    for (k = 0; k < n_src; k++) {
+      __m128i v = _mm_loadu_si128 ((const __m128i *) (src[k] + i0 + i));
+      __m128i lo = _mm_mullo_epi16 (v, n);
+      __m128i hi = _mm_mulhi_epu16 (v, n);
+      __m128i out0 = _mm_cmpgt_epi32 (abs_epi32_sse2 (_mm_sub_epi32
+              (_mm_unpacklo_epi16 (lo, hi), s0)), r0);
+      __m128i out1 = _mm_cmpgt_epi32 (abs_epi32_sse2 (_mm_sub_epi32
+              (_mm_unpackhi_epi16 (lo, hi), s1)), r1);
+
+      kp0 = _mm_add_epi32 (kp0, _mm_andnot_si128 (out0,
+              _mm_unpacklo_epi16 (v, zero)));
+      kp1 = _mm_add_epi32 (kp1, _mm_andnot_si128 (out1,
+              _mm_unpackhi_epi16 (v, zero)));
+      c0 = _mm_add_epi32 (c0, _mm_andnot_si128 (out0, one));
+      c1 = _mm_add_epi32 (c1, _mm_andnot_si128 (out1, one));
+    }
+    _mm_storeu_si128 ((__m128i *) (kept + i), kp0);
+    _mm_storeu_si128 ((__m128i *) (kept + i + 4), kp1);
+    _mm_storeu_si128 ((__m128i *) (count + i), c0);
+    _mm_storeu_si128 ((__m128i *) (count + i + 4), c1);
+  }
+  clip_keep_u16_scalar (kept + i, count + i, sum + i, radius + i, src, n_src,
+      i0 + i, m - i);
+}
+
+static SSE2 void
+clip_u8_sse2 (guint8 * dst, const guint8 * const *src, gint n_src,
+    gsize n, gdouble kappa)
+{
+  clip_u8_run (dst, NULL, src, n_src, n, kappa, clip_sums_u8_sse2,
+      clip_keep_u8_sse2);
+}
+
+static SSE2 void
+clip_u8_wide_sse2 (guint16 * dst, const guint8 * const *src, gint n_src,
+    gsize n, gdouble kappa)
+{
+  clip_u8_run (NULL, dst, src, n_src, n, kappa, clip_sums_u8_sse2,
+      clip_keep_u8_sse2);
+}
+
+static SSE2 void
+clip_u16_sse2 (guint16 * dst, const guint16 * const *src, gint n_src,
+    gsize n, gdouble kappa)
+{
+  clip_u16_run (dst, src, n_src, n, kappa, clip_sums_u16_sse2,
+      clip_keep_u16_sse2);
+}
+
+static const AvgFramesKernels kernels_sse2 = {
+  AVG_KERNELS_CPU_SSE2, "sse2",
+  slide_u8_sse2, slide_u16_sse2, slide_u16_swap_sse2,
+  ema_u8_sse2, ema_u16_sse2, ema_u16_swap_sse2,
+  median_u8_sse2, median_u16_sse2,
+  clip_u8_sse2, clip_u16_sse2, clip_u8_wide_sse2,
+  accum_sq_u8_scalar, accum_sq_u16_scalar, accum_sq_u16_swap_scalar,
+  variance_scalar
+};
+
+/* AVX2 */
+
+static inline AVX2 void
+slide_epu32_avx2 (guint32 * sum, __m256i add, __m256i sub)
+{
+  __m256i *s = (__m256i *) sum;
+
+  _mm256_storeu_si256 (s, _mm256_add_epi32 (_mm256_loadu_si256 (s),
+          _mm256_sub_epi32 (add, sub)));
+}
+
+static AVX2 void
+slide_u8_avx2 (guint32 * sum, guint8 * old, const guint8 * src, gsize n)
+{
+  gsize i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    __m128i add = _mm_loadu_si128 ((const __m128i *) (src + i));
+    __m128i sub = _mm_loadu_si128 ((const __m128i *) (old + i));
+
+    _mm_storeu_si128 ((__m128i *) (old + i), add);
+    slide_epu32_avx2 (sum + i, _mm256_cvtepu8_epi32 (add),
+        _mm256_cvtepu8_epi32 (sub));
+    slide_epu32_avx2 (sum + i + 8,
+        _mm256_cvtepu8_epi32 (_mm_srli_si128 (add, 8)),
+        _mm256_cvtepu8_epi32 (_mm_srli_si128 (sub, 8)));
+  }
+  slide_u8_scalar (sum + i, old + i, src + i, n - i);
+}
+
+static AVX2 void
+slide_u16_avx2 (guint32 * sum, guint16 * old, const guint16 * src, gsize n)
+{
+  gsize i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    __m128i add = _mm_loadu_si128 ((const __m128i *) (src + i));
+    __m128i sub = _mm_loadu_si128 ((const __m128i *) (old + i));
+
+    _mm_storeu_si128 ((__m128i *) (old + i), add);
+    slide_epu32_avx2 (sum + i, _mm256_cvtepu16_epi32 (add),
+        _mm256_cvtepu16_epi32 (sub));
+  }
+  slide_u16_scalar (sum + i, old + i, src + i, n - i);
+}
+
+static AVX2 void
+slide_u16_swap_avx2 (guint32 * sum, guint16 * old, const guint16 * src,
+    gsize n)
+{
+  gsize i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    __m128i add = _mm_loadu_si128 ((const __m128i *) (src + i));
+    __m128i sub = _mm_loadu_si128 ((const __m128i *) (old + i));
+
+    _mm_storeu_si128 ((__m128i *) (old + i), add);
+    slide_epu32_avx2 (sum + i,
+        _mm256_cvtepu16_epi32 (bswap_epi16_ssse3 (add)),
+        _mm256_cvtepu16_epi32 (bswap_epi16_ssse3 (sub)));
+  }
+  slide_u16_swap_scalar (sum + i, old + i, src + i, n - i);
+}
+
+static inline AVX2 __m256i
+ema_epi32_avx2 (guint32 * acc, __m256i in, __m128i k, const gint frac)
+{
+  __m256i *a = (__m256i *) acc;
+  __m256i state = _mm256_loadu_si256 (a);
+  __m256i diff = _mm256_sub_epi32 (_mm256_slli_epi32 (in, frac), state);
+
+  state = _mm256_add_epi32 (state, _mm256_sra_epi32 (diff, k));
+  _mm256_storeu_si256 (a, state);
+  return _mm256_srli_epi32 (_mm256_add_epi32 (state,
+          _mm256_set1_epi32 (1 << (frac - 1))), frac);
+}
+
+static AVX2 void
+ema_u8_avx2 (guint32 * acc, guint8 * dst, const guint8 * src, gsize n,
+    guint k)
+{
+  const __m128i vk = _mm_cvtsi32_si128 (k);
+  const __m256i order = _mm256_setr_epi32 (0, 4, 1, 5, 2, 6, 3, 7);
+  gsize i;
+
+  for (i = 0; i + 32 <= n; i += 32) {
+    __m128i lo = _mm_loadu_si128 ((const __m128i *) (src + i));
+    __m128i hi = _mm_loadu_si128 ((const __m128i *) (src + i + 16));
+    __m256i q0 = ema_epi32_avx2 (acc + i, _mm256_cvtepu8_epi32 (lo), vk,
+        EMA_FRAC_8);
+    __m256i q1 = ema_epi32_avx2 (acc + i + 8,
+        _mm256_cvtepu8_epi32 (_mm_srli_si128 (lo, 8)), vk, EMA_FRAC_8);
+    __m256i q2 = ema_epi32_avx2 (acc + i + 16, _mm256_cvtepu8_epi32 (hi), vk,
+        EMA_FRAC_8);
+    __m256i q3 = ema_epi32_avx2 (acc + i + 24,
+        _mm256_cvtepu8_epi32 (_mm_srli_si128 (hi, 8)), vk, EMA_FRAC_8);
+    __m256i b = _mm256_packus_epi16 (_mm256_packus_epi32 (q0, q1),
+        _mm256_packus_epi32 (q2, q3));
+
+    _mm256_storeu_si256 ((__m256i *) (dst + i),
+        _mm256_permutevar8x32_epi32 (b, order));
+  }
+  ema_u8_scalar (acc + i, dst + i, src + i, n - i, k);
+}
+
+static AVX2 void
+ema_u16_avx2 (guint32 * acc, guint16 * dst, const guint16 * src, gsize n,
+    guint k)
+{
+  const __m128i vk = _mm_cvtsi32_si128 (k);
+  gsize i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    __m128i lo = _mm_loadu_si128 ((const __m128i *) (src + i));
+    __m128i hi = _mm_loadu_si128 ((const __m128i *) (src + i + 8));
+    __m256i q0 = ema_epi32_avx2 (acc + i, _mm256_cvtepu16_epi32 (lo), vk,
+        EMA_FRAC_16);
+    __m256i q1 = ema_epi32_avx2 (acc + i + 8, _mm256_cvtepu16_epi32 (hi), vk,
+        EMA_FRAC_16);
+
+    _mm256_storeu_si256 ((__m256i *) (dst + i),
+        pack_epu32_epu16_avx2 (q0, q1));
+  }
+  ema_u16_scalar (acc + i, dst + i, src + i, n - i, k);
+}
+
+static AVX2 void
+ema_u16_swap_avx2 (guint32 * acc, guint16 * dst, const guint16 * src,
+    gsize n, guint k)
+{
+  const __m128i vk = _mm_cvtsi32_si128 (k);
+  gsize i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    __m128i lo = _mm_loadu_si128 ((const __m128i *) (src + i));
+    __m128i hi = _mm_loadu_si128 ((const __m128i *) (src + i + 8));
+    __m256i q0 = ema_epi32_avx2 (acc + i,
+        _mm256_cvtepu16_epi32 (bswap_epi16_ssse3 (lo)), vk, EMA_FRAC_16);
+    __m256i q1 = ema_epi32_avx2 (acc + i + 8,
+        _mm256_cvtepu16_epi32 (bswap_epi16_ssse3 (hi)), vk, EMA_FRAC_16);
+
+    _mm256_storeu_si256 ((__m256i *) (dst + i),
+        bswap_epi16_avx2 (pack_epu32_epu16_avx2 (q0, q1)));
+  }
+  ema_u16_swap_scalar (acc + i, dst + i, src + i, n - i, k);
+}
+
+static AVX2 void
+median_u8_avx2 (guint8 * dst, const guint8 * const *src, gsize n,
+    const AvgFramesNetwork * net)
+{
+  __m256i v[AVG_FRAMES_MAX_NETWORK];
+  gsize i;
+  gint k;
+
+  for (i = 0; i + 32 <= n; i += 32) {
+    for (k = 0; k < net->n_inputs; k++)
+      v[k] = _mm256_loadu_si256 ((const __m256i *) (src[k] + i));
+    NETWORK_RUN (__m256i, v, net, _mm256_min_epu8, _mm256_max_epu8);
+    _mm256_storeu_si256 ((__m256i *) (dst + i), v[net->out]);
+  }
+  median_u8_range (dst, src, i, n, net);
+}
+
+static AVX2 void
+median_u16_avx2 (guint16 * dst, const guint16 * const *src, gsize n,
+    const AvgFramesNetwork * net)
+{
+  __m256i v[AVG_FRAMES_MAX_NETWORK];
+  gsize i;
+  gint k;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    for (k = 0; k < net->n_inputs; k++)
+      v[k] = _mm256_loadu_si256 ((const __m256i *) (src[k] + i));
+    NETWORK_RUN (__m256i, v, net, _mm256_min_epu16, _mm256_max_epu16);
+    _mm256_storeu_si256 ((__m256i *) (dst + i), v[net->out]);
+  }
+  median_u16_range (dst, src, i, n, net);
+}
+
+static AVX2 void
+clip_sums_u8_avx2 (guint16 * sum, guint32 * sumsq,
+    const guint8 * const *src, gint n_src, gsize i0, gint m)
+{
+  const __m256i zero = _mm256_setzero_si256 ();
+  gint i, k;
+
+  for (i = 0; i + 16 <= m; i += 16) {
+    __m256i s = zero, q0 = zero, q1 = zero;
+
+    for (k = 0; k < n_src; k++) {
+      __m256i v = _mm256_cvtepu8_epi16 (_mm_loadu_si128 ((const __m128i *)
+              (src[k] + i0 + i)));
+      __m256i sq = _mm256_mullo_epi16 (v, v);
+
+      s = _mm256_add_epi16 (s, v);
+      q0 = _mm256_add_epi32 (q0,
+          _mm256_cvtepu16_epi32 (_mm256_castsi256_si128 (sq)));
+      q1 = _mm256_add_epi32 (q1,
+          _mm256_cvtepu16_epi32 (_mm256_extracti128_si256 (sq, 1)));
+    }
+    _mm256_storeu_si256 ((__m256i *) (sum + i), s);
+    _mm256_storeu_si256 ((__m256i *) (sumsq + i), q0);
+    _mm256_storeu_si256 ((__m256i *) (sumsq + i + 8), q1);
+  }
+  clip_sums_u8_sse2 (sum + i, sumsq + i, src, n_src, i0 + i, m - i);
+}
+
+static AVX2 void
+clip_keep_u8_avx2 (guint16 * kept, guint16 * count, const guint16 * sum,
+    const guint16 * radius, const guint8 * const *src, gint n_src, gsize i0,
+    gint m)
+{
+  const __m256i zero = _mm256_setzero_si256 ();
+  const __m256i one = _mm256_set1_epi16 (1);
+  const __m256i n = _mm256_set1_epi16 (n_src);
+  gint i, k;
+
+  for (i = 0; i + 16 <= m; i += 16) {
+    __m256i s = _mm256_loadu_si256 ((const __m256i *) (sum + i));
+    __m256i r = _mm256_loadu_si256 ((const __m256i *) (radius + i));
+    __m256i kp = zero, c = zero;
+
+    for (k = 0; k < n_src; k++) {
+      __m256i v = _mm256_cvtepu8_epi16 (_mm_loadu_si128 ((const __m128i *)
+              (src[k] + i0 + i)));
+      __m256i d = _mm256_abs_epi16 (_mm256_sub_epi16 (_mm256_mullo_epi16 (v,
+                  n), s));
+      __m256i out = _mm256_cmpgt_epi16 (d, r);
+
+      kp = _mm256_add_epi16 (kp, _mm256_andnot_si256 (out, v));
+      c = _mm256_add_epi16 (c, _mm256_andnot_si256 (out, one));
+    }
+    _mm256_storeu_si256 ((__m256i *) (kept + i), kp);
+    _mm256_storeu_si256 ((__m256i *) (count + i), c);
+  }
+  clip_keep_u8_sse2 (kept + i, count + i, sum + i, radius + i, src, n_src,
+      i0 + i, m - i);
+}
+
+/* the lanes of the 64 bit sums come out as 0 1 4 5 and 2 3 6 7 */
+static AVX2 void
+clip_sums_u16_avx2 (guint32 * sum, guint64 * sumsq,
+    const guint16 * const *src, gint n_src, gsize i0, gint m)
+{
+  const __m256i zero = _mm256_setzero_si256 ();
+  gint i, k;
+
+  for (i = 0; i + 8 <= m; i += 8) {
+    __m256i s = zero, e = zero, o = zero, lo, hi;
+
+    for (k = 0; k < n_src; k++) {
+      __m256i v = _mm256_cvtepu16_epi32 (_mm_loadu_si128 ((const __m128i *)
+              (src[k] + i0 + i)));
+      __m256i w = _mm256_srli_epi64 (v, 32);
+
+      s = _mm256_add_epi32 (s, v);
+      e = _mm256_add_epi64 (e, _mm256_mul_epu32 (v, v));
+      o = _mm256_add_epi64 (o, _mm256_mul_epu32 (w, w));
+    }
+    lo = _mm256_unpacklo_epi64 (e, o);
+    hi = _mm256_unpackhi_epi64 (e, o);
+    _mm256_storeu_si256 ((__m256i *) (sum + i), s);
+    _mm256_storeu_si256 ((__m256i *) (sumsq + i),
+        _mm256_permute2x128_si256 (lo, hi, 0x20));
+    _mm256_storeu_si256 ((__m256i *) (sumsq + i + 4),
+        _mm256_permute2x128_si256 (lo, hi, 0x31));
+  }
+  clip_sums_u16_scalar (sum + i, sumsq + i, src, n_src, i0 + i, m - i);
+}
+
+static AVX2 void
+clip_keep_u16_avx2 (guint32 * kept, guint32 * count, const guint32 * sum,
+    const guint32 * radius, const guint16 * const *src, gint n_src,
+    gsize i0, gint m)
+{
+  const __m256i zero = _mm256_setzero_si256 ();
+  const __m256i one = _mm256_set1_epi32 (1);
+  const __m256i n = _mm256_set1_epi32 (n_src);
+  gint i, k;
+
+  for (i = 0; i + 8 <= m; i += 8) {
+    __m256i s = _mm256_loadu_si256 ((const __m256i *) (sum + i));
+    __m256i r = _mm256_loadu_si256 ((const __m256i *) (radius + i));
+    __m256i kp = zero, c = zero;
+
+    for (k = 0; k < n_src; k++) {
+      __m256i v = _mm256_cvtepu16_epi32 (_mm_loadu_si128 ((const __m128i *)
+              (src[k] + i0 + i)));
+      __m256i d = _mm256_abs_epi32 (_mm256_sub_epi32 (_mm256_mullo_epi32 (v,
+                  n), s));
+      __m256i out = _mm256_cmpgt_epi32 (d, r);
+
+      kp = _mm256_add_epi32 (kp, _mm256_andnot_si256 (out, v));
+      c = _mm256_add_epi32 (c, _mm256_andnot_si256 (out, one));
+    }
+    _mm256_storeu_si256 ((__m256i *) (kept + i), kp);
+    _mm256_storeu_si256 ((__m256i *) (count + i), c);
+  }
+  clip_keep_u16_scalar (kept + i, count + i, sum + i, radius + i, src, n_src,
+      i0 + i, m - i);
+}
+
+static AVX2 void
+clip_u8_avx2 (guint8 * dst, const guint8 * const *src, gint n_src,
+    gsize n, gdouble kappa)
+{
+  clip_u8_run (dst, NULL, src, n_src, n, kappa, clip_sums_u8_avx2,
+      clip_keep_u8_avx2);
+}
+
+static AVX2 void
+clip_u8_wide_avx2 (guint16 * dst, const guint8 * const *src, gint n_src,
+    gsize n, gdouble kappa)
+{
+  clip_u8_run (NULL, dst, src, n_src, n, kappa, clip_sums_u8_avx2,
+      clip_keep_u8_avx2);
+}
+
+static AVX2 void
+clip_u16_avx2 (guint16 * dst, const guint16 * const *src, gint n_src,
+    gsize n, gdouble kappa)
+{
+  clip_u16_run (dst, src, n_src, n, kappa, clip_sums_u16_avx2,
+      clip_keep_u16_avx2);
+}
+
+static const AvgFramesKernels kernels_avx2 = {
+  AVG_KERNELS_CPU_AVX2, "avx2",
+  slide_u8_avx2, slide_u16_avx2, slide_u16_swap_avx2,
+  ema_u8_avx2, ema_u16_avx2, ema_u16_swap_avx2,
+  median_u8_avx2, median_u16_avx2,
+  clip_u8_avx2, clip_u16_avx2, clip_u8_wide_avx2,
+  accum_sq_u8_scalar, accum_sq_u16_scalar, accum_sq_u16_swap_scalar,
+  variance_scalar
+};
+
+#endif /* HAVE_X86_KERNELS */
+
+#ifdef HAVE_NEON_KERNELS
+
+static inline void
+slide_u16x8_neon (guint32 * sum, uint16x8_t add, uint16x8_t sub)
+{
+  uint32x4_t lo = vaddw_u16 (vld1q_u32 (sum), vget_low_u16 (add));
+  uint32x4_t hi = vaddw_u16 (vld1q_u32 (sum + 4), vget_high_u16 (add));
+
+  vst1q_u32 (sum, vsubw_u16 (lo, vget_low_u16 (sub)));
+  vst1q_u32 (sum + 4, vsubw_u16 (hi, vget_high_u16 (sub)));
+}
+
+static void
+slide_u8_neon (guint32 * sum, guint8 * old, const guint8 * src, gsize n)
+{
+  gsize i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    uint8x16_t add = vld1q_u8 (src + i);
+    uint8x16_t sub = vld1q_u8 (old + i);
+
+    vst1q_u8 (old + i, add);
+    slide_u16x8_neon (sum + i, vmovl_u8 (vget_low_u8 (add)),
+        vmovl_u8 (vget_low_u8 (sub)));
+    slide_u16x8_neon (sum + i + 8, vmovl_u8 (vget_high_u8 (add)),
+        vmovl_u8 (vget_high_u8 (sub)));
+  }
+  slide_u8_scalar (sum + i, old + i, src + i, n - i);
+}
+
+static void
+slide_u16_neon (guint32 * sum, guint16 * old, const guint16 * src, gsize n)
+{
+  gsize i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    uint16x8_t add = vld1q_u16 (src + i);
+    uint16x8_t sub = vld1q_u16 (old + i);
+
+    vst1q_u16 (old + i, add);
+    slide_u16x8_neon (sum + i, add, sub);
+  }
+  slide_u16_scalar (sum + i, old + i, src + i, n - i);
+}
+
+static void
+slide_u16_swap_neon (guint32 * sum, guint16 * old, const guint16 * src,
+    gsize n)
+{
+  gsize i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    uint16x8_t add = vld1q_u16 (src + i);
+    uint16x8_t sub = vld1q_u16 (old + i);
+
+    vst1q_u16 (old + i, add);
+    slide_u16x8_neon (sum + i,
+        vreinterpretq_u16_u8 (vrev16q_u8 (vreinterpretq_u8_u16 (add))),
+        vreinterpretq_u16_u8 (vrev16q_u8 (vreinterpretq_u8_u16 (sub))));
+  }
+  slide_u16_swap_scalar (sum + i, old + i, src + i, n - i);
+}
+
+/* frac has to be a constant for the immediate shifts */
+#define EMA_U32X4_NEON(acc, in, k, frac) \
+  G_STMT_START { \
+    int32x4_t state = vreinterpretq_s32_u32 (vld1q_u32 (acc)); \
+    int32x4_t diff = vsubq_s32 (vreinterpretq_s32_u32 (vshlq_n_u32 (in, \
+                frac)), state); \
+    state = vaddq_s32 (state, vshlq_s32 (diff, k)); \
+    vst1q_u32 (acc, vreinterpretq_u32_s32 (state)); \
+    in = vrshrq_n_u32 (vreinterpretq_u32_s32 (state), frac); \
+  } G_STMT_END
+
+static inline uint16x8_t
+ema_u16x8_neon (guint32 * acc, uint16x8_t in, int32x4_t k, const gint frac)
+{
+  uint32x4_t lo = vmovl_u16 (vget_low_u16 (in));
+  uint32x4_t hi = vmovl_u16 (vget_high_u16 (in));
+
+  if (frac == EMA_FRAC_8) {
+    EMA_U32X4_NEON (acc, lo, k, EMA_FRAC_8);
+    EMA_U32X4_NEON (acc + 4, hi, k, EMA_FRAC_8);
+  } else {
+    EMA_U32X4_NEON (acc, lo, k, EMA_FRAC_16);
+    EMA_U32X4_NEON (acc + 4, hi, k, EMA_FRAC_16);
+  }
+  /* the outputs fit in 16 bits */
+  return vcombine_u16 (vmovn_u32 (lo), vmovn_u32 (hi));
+}
+
+static void
+ema_u8_neon (guint32 * acc, guint8 * dst, const guint8 * src, gsize n,
+    guint k)
+{
+  /* a negative left shift is an arithmetic right shift */
+  const int32x4_t vk = vdupq_n_s32 (-(gint) k);
+  gsize i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    uint8x16_t v = vld1q_u8 (src + i);
+    uint16x8_t lo = ema_u16x8_neon (acc + i, vmovl_u8 (vget_low_u8 (v)), vk,
+        EMA_FRAC_8);
+    uint16x8_t hi = ema_u16x8_neon (acc + i + 8, vmovl_u8 (vget_high_u8 (v)),
+        vk, EMA_FRAC_8);
+
+    vst1q_u8 (dst + i, vcombine_u8 (vmovn_u16 (lo), vmovn_u16 (hi)));
+  }
+  ema_u8_scalar (acc + i, dst + i, src + i, n - i, k);
+}
+
+static void
+ema_u16_neon (guint32 * acc, guint16 * dst, const guint16 * src, gsize n,
+    guint k)
+{
+  const int32x4_t vk = vdupq_n_s32 (-(gint) k);
+  gsize i;
+
+  for (i = 0; i + 8 <= n; i += 8)
+    vst1q_u16 (dst + i, ema_u16x8_neon (acc + i, vld1q_u16 (src + i), vk,
+            EMA_FRAC_16));
+  ema_u16_scalar (acc + i, dst + i, src + i, n - i, k);
+}
+
+static void
+ema_u16_swap_neon (guint32 * acc, guint16 * dst, const guint16 * src,
+    gsize n, guint k)
+{
+  const int32x4_t vk = vdupq_n_s32 (-(gint) k);
+  gsize i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    uint16x8_t in = vreinterpretq_u16_u8 (vrev16q_u8 (vld1q_u8 ((const guint8
+                    *) (src + i))));
+    uint16x8_t out = ema_u16x8_neon (acc + i, in, vk, EMA_FRAC_16);
+
+    vst1q_u8 ((guint8 *) (dst + i), vrev16q_u8 (vreinterpretq_u8_u16 (out)));
+  }
+  ema_u16_swap_scalar (acc + i, dst + i, src + i, n - i, k);
+}
+
+static void
+median_u8_neon (guint8 * dst, const guint8 * const *src, gsize n,
+    const AvgFramesNetwork * net)
+{
+  uint8x16_t v[AVG_FRAMES_MAX_NETWORK];
+  gsize i;
+  gint k;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    for (k = 0; k < net->n_inputs; k++)
+      v[k] = vld1q_u8 (src[k] + i);
+    NETWORK_RUN (uint8x16_t, v, net, vminq_u8, vmaxq_u8);
+    vst1q_u8 (dst + i, v[net->out]);
+  }
+  median_u8_range (dst, src, i, n, net);
+}
+
+static void
+median_u16_neon (guint16 * dst, const guint16 * const *src, gsize n,
+    const AvgFramesNetwork * net)
+{
+  uint16x8_t v[AVG_FRAMES_MAX_NETWORK];
+  gsize i;
+  gint k;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    for (k = 0; k < net->n_inputs; k++)
+      v[k] = vld1q_u16 (src[k] + i);
+    NETWORK_RUN (uint16x8_t, v, net, vminq_u16, vmaxq_u16);
+    vst1q_u16 (dst + i, v[net->out]);
+  }
+  median_u16_range (dst, src, i, n, net);
+}
+
+static void
+clip_sums_u8_neon (guint16 * sum, guint32 * sumsq,
+    const guint8 * const *src, gint n_src, gsize i0, gint m)
+{
+  gint i, k;
+
+  for (i = 0; i + 8 <= m; i += 8) {
+    uint16x8_t s = vdupq_n_u16 (0);
+    uint32x4_t q0 = vdupq_n_u32 (0), q1 = vdupq_n_u32 (0);
+
+    for (k = 0; k < n_src; k++) {
+      uint8x8_t v = vld1_u8 (src[k] + i0 + i);
+      uint16x8_t sq = vmull_u8 (v, v);
+
+      s = vaddw_u8 (s, v);
+      q0 = vaddw_u16 (q0, vget_low_u16 (sq));
+      q1 = vaddw_u16 (q1, vget_high_u16 (sq));
+    }
+    vst1q_u16 (sum + i, s);
+    vst1q_u32 (sumsq + i, q0);
+    vst1q_u32 (sumsq + i + 4, q1);
+  }
+  clip_sums_u8_scalar (sum + i, sumsq + i, src, n_src, i0 + i, m - i);
+}
+
+static void
+clip_keep_u8_neon (guint16 * kept, guint16 * count, const guint16 * sum,
+    const guint16 * radius, const guint8 * const *src, gint n_src, gsize i0,
+    gint m)
+{
+  gint i, k;
+
+  for (i = 0; i + 8 <= m; i += 8) {
+    uint16x8_t s = vld1q_u16 (sum + i);
+    uint16x8_t r = vld1q_u16 (radius + i);
+    uint16x8_t kp = vdupq_n_u16 (0), c = vdupq_n_u16 (0);
+
+    for (k = 0; k < n_src; k++) {
+      uint16x8_t v = vmovl_u8 (vld1_u8 (src[k] + i0 + i));
+      uint16x8_t in = vcleq_u16 (vabdq_u16 (vmulq_n_u16 (v, n_src), s), r);
+
+      kp = vaddq_u16 (kp, vandq_u16 (in, v));
+      /* the mask is all ones, minus one */
+      c = vsubq_u16 (c, in);
+    }
+    vst1q_u16 (kept + i, kp);
+    vst1q_u16 (count + i, c);
+  }
+  clip_keep_u8_scalar (kept + i, count + i, sum + i, radius + i, src, n_src,
+      i0 + i, m - i);
+}
+
+static void
+clip_sums_u16_neon (guint32 * sum, guint64 * sumsq,
+    const guint16 * const *src, gint n_src, gsize i0, gint m)
+{
+  gint i, k;
+
+  for (i = 0; i + 4 <= m; i += 4) {
+    uint32x4_t s = vdupq_n_u32 (0);
+    uint64x2_t q0 = vdupq_n_u64 (0), q1 = vdupq_n_u64 (0);
+
+    for (k = 0; k < n_src; k++) {
+      uint16x4_t v = vld1_u16 (src[k] + i0 + i);
+      uint32x4_t sq = vmull_u16 (v, v);
+
+      s = vaddw_u16 (s, v);
+      q0 = vaddw_u32 (q0, vget_low_u32 (sq));
+      q1 = vaddw_u32 (q1, vget_high_u32 (sq));
+    }
+    vst1q_u32 (sum + i, s);
+    vst1q_u64 ((uint64_t *) sumsq + i, q0);
+    vst1q_u64 ((uint64_t *) sumsq + i + 2, q1);
+  }
+  clip_sums_u16_scalar (sum + i, sumsq + i, src, n_src, i0 + i, m - i);
+}
+
+static void
+clip_keep_u16_neon (guint32 * kept, guint32 * count, const guint32 * sum,
+    const guint32 * radius, const guint16 * const *src, gint n_src,
+    gsize i0, gint m)
+{
+  gint i, k;
+
+  for (i = 0; i + 4 <= m; i += 4) {
+    uint32x4_t s = vld1q_u32 (sum + i);
+    uint32x4_t r = vld1q_u32 (radius + i);
+    uint32x4_t kp = vdupq_n_u32 (0), c = vdupq_n_u32 (0);
+
+    for (k = 0; k < n_src; k++) {
+      uint16x4_t v = vld1_u16 (src[k] + i0 + i);
+      uint32x4_t in = vcleq_u32 (vabdq_u32 (vmull_n_u16 (v, n_src), s), r);
+
+      kp = vaddq_u32 (kp, vandq_u32 (in, vmovl_u16 (v)));
+      c = vsubq_u32 (c, in);
+    }
+    vst1q_u32 (kept + i, kp);
+    vst1q_u32 (count + i, c);
+  }
+  clip_keep_u16_scalar (kept + i, count + i, sum + i, radius + i, src, n_src,
+      i0 + i, m - i);
+}
+
+static void
+clip_u8_neon (guint8 * dst, const guint8 * const *src, gint n_src,
+    gsize n, gdouble kappa)
+{
+  clip_u8_run (dst, NULL, src, n_src, n, kappa, clip_sums_u8_neon,
+      clip_keep_u8_neon);
+}
+
+static void
+clip_u8_wide_neon (guint16 * dst, const guint8 * const *src, gint n_src,
+    gsize n, gdouble kappa)
+{
+  clip_u8_run (NULL, dst, src, n_src, n, kappa, clip_sums_u8_neon,
+      clip_keep_u8_neon);
+}
+
+static void
+clip_u16_neon (guint16 * dst, const guint16 * const *src, gint n_src,
+    gsize n, gdouble kappa)
+{
+  clip_u16_run (dst, src, n_src, n, kappa, clip_sums_u16_neon,
+      clip_keep_u16_neon);
+}
+
+static const AvgFramesKernels kernels_neon = {
+  AVG_KERNELS_CPU_NEON, "neon",
+  slide_u8_neon, slide_u16_neon, slide_u16_swap_neon,
+  ema_u8_neon, ema_u16_neon, ema_u16_swap_neon,
+  median_u8_neon, median_u16_neon,
+  clip_u8_neon, clip_u16_neon, clip_u8_wide_neon,
+  accum_sq_u8_scalar, accum_sq_u16_scalar, accum_sq_u16_swap_scalar,
+  variance_scalar
+};
+
+#endif /* HAVE_NEON_KERNELS */
+
+/* returns NULL if the kernels for cpu are not usable on this machine */
+const AvgFramesKernels *
+avg_frames_kernels_get (AvgKernelsCpu cpu)
+{
+  /* the shared kernels know what the cpu supports */
+  if (!avg_kernels_get (cpu))
+    return NULL;
+
+  switch (cpu) {
+    case AVG_KERNELS_CPU_SCALAR:
+      return &kernels_scalar;
+#ifdef HAVE_X86_KERNELS
+    case AVG_KERNELS_CPU_SSE2:
+      return &kernels_sse2;
+    case AVG_KERNELS_CPU_AVX2:
+      return &kernels_avx2;
+#endif
+#ifdef HAVE_NEON_KERNELS
+    case AVG_KERNELS_CPU_NEON:
+      return &kernels_neon;
+#endif
+    default:
+      return NULL;
+  }
+}
+
+/* the kernels for the same cpu as avg_kernels_get_best () */
+const AvgFramesKernels *
+avg_frames_kernels_get_best (void)
+{
+  return avg_frames_kernels_get (avg_kernels_get_best ()->cpu);
+}
@@ -0,0 +1,116 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __AVG_FRAMES_KERNELS_H__
+#define __AVG_FRAMES_KERNELS_H__
+
+#include <glib.h>
+#include <gst/avgkernels/avgkernels.h>
+
+G_BEGIN_DECLS
+
+/* The largest window the median kernels can sort */
+#define AVG_FRAMES_MAX_NETWORK 128
+
+/* A sorting network on n_inputs values, pruned down to the comparators that
+ * the value ending up at index out depends on. Comparator i puts the minimum
+ * of inputs pairs[2 * i] and pairs[2 * i + 1] at the first one. */
+typedef struct
+{
+  gint n_inputs;
+  gint out;
+  gint n_pairs;
+  guint8 *pairs;
+} AvgFramesNetwork;
+
+/* The accumulate and normalize kernels are the shared AvgKernels.
+ *
+ * The slide kernels add src to sum, subtract the sample that it replaces in
+ * old and then store src in old, all in one pass. A zeroed old is a window
+ * slot that has not been filled yet.
+ *
+ * The ema kernels run the recursive filter acc += ((in << F) - acc) >> k on
+ * the samples of src and write the rounded filter output to dst. acc
+ * holds the filter state with F = AVG_FRAMES_EMA_FRAC_BITS (sample_bits)
+ * fractional bits. With k = 0 the state is set to the input, which is how the
+ * filter is started.
+ *
+ * The median kernels write the value selected by net from the samples at the
+ * same position of the net->n_inputs rows in src to dst. The clip kernels
+ * write the mean of the samples of the n_src rows in src that are within
+ * kappa standard deviations of their mean, or the plain mean if there are
+ * none. Both work on native endian samples. clip_u8_wide writes the same
+ * mean of 8 bit samples with 8 fractional bits, as a 16 bit sample.
+ *
+ * The accum_sq kernels add src to sum like the accumulate kernels and the
+ * squares of the samples to sumsq in the same pass. The variance kernel
+ * writes the population variance of the count samples behind every sum and
+ * sumsq to dst, if clear is set sumsq is zeroed as it is read. */
+typedef struct
+{
+  AvgKernelsCpu cpu;
+  const gchar *name;
+
+  void (*slide_u8) (guint32 * sum, guint8 * old, const guint8 * src, gsize n);
+  void (*slide_u16) (guint32 * sum, guint16 * old, const guint16 * src,
+      gsize n);
+  void (*slide_u16_swap) (guint32 * sum, guint16 * old, const guint16 * src,
+      gsize n);
+
+  void (*ema_u8) (guint32 * acc, guint8 * dst, const guint8 * src, gsize n,
+      guint k);
+  void (*ema_u16) (guint32 * acc, guint16 * dst, const guint16 * src, gsize n,
+      guint k);
+  void (*ema_u16_swap) (guint32 * acc, guint16 * dst, const guint16 * src,
+      gsize n, guint k);
+
+  void (*median_u8) (guint8 * dst, const guint8 * const *src, gsize n,
+      const AvgFramesNetwork * net);
+  void (*median_u16) (guint16 * dst, const guint16 * const *src, gsize n,
+      const AvgFramesNetwork * net);
+
+  void (*clip_u8) (guint8 * dst, const guint8 * const *src, gint n_src,
+      gsize n, gdouble kappa);
+  void (*clip_u16) (guint16 * dst, const guint16 * const *src, gint n_src,
+      gsize n, gdouble kappa);
+  void (*clip_u8_wide) (guint16 * dst, const guint8 * const *src,
+      gint n_src, gsize n, gdouble kappa);
+
+  void (*accum_sq_u8) (guint32 * sum, guint64 * sumsq, const guint8 * src,
+      gsize n);
+  void (*accum_sq_u16) (guint32 * sum, guint64 * sumsq, const guint16 * src,
+      gsize n);
+  void (*accum_sq_u16_swap) (guint32 * sum, guint64 * sumsq,
+      const guint16 * src, gsize n);
+  void (*variance) (gfloat * dst, guint64 * sumsq, const guint32 * sum,
+      gsize n, guint32 count, gboolean clear);
+} AvgFramesKernels;
+
+/* keeps in << F and the differences to it within a gint32 */
+#define AVG_FRAMES_EMA_FRAC_BITS(sample_bits) (31 - (sample_bits))
+
+AvgFramesNetwork *avg_frames_network_new_median (gint n_inputs);
+void avg_frames_network_free (AvgFramesNetwork * net);
+
+const AvgFramesKernels *avg_frames_kernels_get (AvgKernelsCpu cpu);
+const AvgFramesKernels *avg_frames_kernels_get_best (void);
+
+G_END_DECLS
+
+#endif
@@ -27,20 +27,58 @@
  * gst-launch -v fakesrc ! avgframes ! fakesink
  * ]|
  * takes frames and averages them
+ * |[
+ * gst-launch -v v4l2src ! avgframes mode=sliding frameno=10 ! videoconvert ! xvimagesink
+ * ]|
+ * outputs the average of the last 10 frames for every input frame
+ * |[
+ * gst-launch -v v4l2src ! avgframes mode=ema alpha-shift=3 ! videoconvert ! xvimagesink
+ * ]|
+ * filters every frame with an exponential moving average where the newest
+ * frame has a weight of 1/8
+ * |[
+ * gst-launch -v v4l2src ! avgframes mode=median frameno=9 ! videoconvert ! xvimagesink
+ * ]|
+ * outputs the per pixel median of every 9 frames, which leaves out flashes
+ * and other single frame outliers
+ * |[
+ * gst-launch -v v4l2src ! avgframes frameno=16 variance=true ! fakesink
+ * ]|
+ * attaches the per pixel temporal variance of every 16 frames to their
+ * average as a GstAvgFramesMeta
+ * |[
+ * gst-launch -v v4l2src ! video/x-raw,format=GRAY8 ! avgframes frameno=16 ! video/x-raw,format=GRAY16_LE ! fakesink
+ * ]|
+ * outputs the average of every 16 8 bit frames with 8 fractional bits. GRAY8
+ * input can always go out as GRAY16_LE or GRAY16_BE, the same format is
+ * preferred. The 16 bit output of the block and sliding modes is the sum
+ * divided by the frame count with 8 fractional bits, truncated. In ema mode
+ * it is the filter state rounded to 8 fractional bits, in sigma-clip mode the
+ * mean of the kept samples with 8 fractional bits, truncated. The median is
+ * an 8 bit sample and is only shifted up by 8 bits.
  * </refsect2>
+ *
+ * The output of the block, median and sigma-clip modes is stamped with the
+ * start of its first frame and lasts until the end of its last one, so
+ * avgframes adds frameno - 1 frames of latency in those modes. The sliding
+ * and ema modes keep the time of every frame and add none. avgframes does
+ * its own QoS: no output buffer is allocated for a frame that is too late.
+ * In sliding and ema mode it still goes into the window or the filter
+ * state, in the other modes the window it would complete is dropped.
  */
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 
-#include <byteswap.h>
 #include <stdlib.h>
 #include <string.h>
 #include <gst/gst.h>
 #include <gst/video/video.h>
 #include <gst/video/gstvideofilter.h>
+#include <gst/avgframes/gstavgframesmeta.h>
 #include "gstavgframes.h"
+#include "avgframeskernels.h"
 
 GST_DEBUG_CATEGORY_STATIC (gst_avg_frames_debug_category);
 #define GST_CAT_DEFAULT gst_avg_frames_debug_category
@@ -56,34 +94,89 @@ static void gst_avg_frames_finalize (GObject * object);
 
 static gboolean gst_avg_frames_start (GstBaseTransform * trans);
 static gboolean gst_avg_frames_stop (GstBaseTransform * trans);
+static GstCaps *gst_avg_frames_transform_caps (GstBaseTransform * trans,
+    GstPadDirection direction, GstCaps * caps, GstCaps * filter);
 static gboolean gst_avg_frames_set_info (GstVideoFilter * filter, GstCaps * incaps,
     GstVideoInfo * in_info, GstCaps * outcaps, GstVideoInfo * out_info);
-static GstFlowReturn gst_avg_frames_transform_frame_ip (GstVideoFilter * filter,
-    GstVideoFrame * frame);
+static GstFlowReturn gst_avg_frames_generate_output (GstBaseTransform * trans,
+    GstBuffer ** outbuf);
+static GstFlowReturn gst_avg_frames_transform_frame (GstVideoFilter * filter,
+    GstVideoFrame * inframe, GstVideoFrame * outframe);
+static gboolean gst_avg_frames_query (GstBaseTransform * trans,
+    GstPadDirection direction, GstQuery * query);
 static gboolean gst_avg_frames_sink_event (GstBaseTransform * trans,
     GstEvent * event);
 static gboolean gst_avg_frames_src_event (GstBaseTransform * trans,
     GstEvent * event);
+static void gst_avg_frames_band_func (gpointer data, gpointer user_data);
 
 #define DEFAULT_FRAME_NO 10
 #define MIN_FRAME_NO 1
-#define MAX_FRAME_NO 100
+/* the most 16 bit samples that the sums and avg_kernels_reciprocal take */
+#define MAX_FRAME_NO 32768
+#define DEFAULT_MODE GST_AVG_FRAMES_MODE_BLOCK
+#define DEFAULT_ALPHA_SHIFT 3
+#define MAX_ALPHA_SHIFT 15
+#define DEFAULT_KAPPA 2.0
+#define MAX_KAPPA 10.0
+#define DEFAULT_VARIANCE FALSE
+#define DEFAULT_N_THREADS 0
+#define MAX_N_THREADS 64
+
+/* rows of the sums are padded to this many samples, which keeps every row
+ * of the sums and of the sliding window on its own cache lines */
+#define ROW_ALIGN 64
+/* smaller frames are not worth waking up the workers for */
+#define MIN_BAND_SIZE (ROW_ALIGN * 256)
 
 enum
 {
   PROP_0,
-  PROP_NO_OF_FRAMES
+  PROP_NO_OF_FRAMES,
+  PROP_MODE,
+  PROP_ALPHA_SHIFT,
+  PROP_KAPPA,
+  PROP_VARIANCE,
+  PROP_N_THREADS
 };
 
 /* pad templates */
 
 #define VIDEO_SRC_CAPS \
-    GST_VIDEO_CAPS_MAKE("{ RGBA, GRAY8, GRAY16_BE, GRAY16_LE }")
+    GST_VIDEO_CAPS_MAKE("{ RGBA, GRAY8, GRAY16_BE, GRAY16_LE, I420, NV12, Y444 }")
 
 #define VIDEO_SINK_CAPS \
-    GST_VIDEO_CAPS_MAKE("{ RGBA, GRAY8, GRAY16_BE, GRAY16_LE }")
+    GST_VIDEO_CAPS_MAKE("{ RGBA, GRAY8, GRAY16_BE, GRAY16_LE, I420, NV12, Y444 }")
 
 
+#define GST_TYPE_AVG_FRAMES_MODE (gst_avg_frames_mode_get_type ())
+static GType
+gst_avg_frames_mode_get_type (void)
+{
+  static GType avg_frames_mode_type = 0;
+  static const GEnumValue mode_types[] = {
+    {GST_AVG_FRAMES_MODE_BLOCK,
+        "Output one average for every frameno frames", "block"},
+    {GST_AVG_FRAMES_MODE_SLIDING,
+        "Output the average of the last frameno frames for every frame",
+        "sliding"},
+    {GST_AVG_FRAMES_MODE_EMA,
+        "Filter every frame with an exponential moving average", "ema"},
+    {GST_AVG_FRAMES_MODE_MEDIAN,
+        "Output the per pixel median of every frameno frames", "median"},
+    {GST_AVG_FRAMES_MODE_SIGMA_CLIP,
+        "Output the per pixel mean of every frameno frames, leaving out the "
+        "samples more than kappa standard deviations from it", "sigma-clip"},
+    {0, NULL, NULL}
+  };
+
+  if (!avg_frames_mode_type) {
+    avg_frames_mode_type =
+        g_enum_register_static ("GstAvgFramesMode", mode_types);
+  }
+  return avg_frames_mode_type;
+}
+
 /* class initialization */
 
 G_DEFINE_TYPE_WITH_CODE (GstAvgFrames, gst_avg_frames, GST_TYPE_VIDEO_FILTER,
@@ -115,22 +208,76 @@ gst_avg_frames_class_init (GstAvgFramesClass * klass)
 
   g_object_class_install_property (gobject_class, PROP_NO_OF_FRAMES,
       g_param_spec_int ("frameno", "Frames",
-          "Number of frames to average together", MIN_FRAME_NO, MAX_FRAME_NO,
+          "Number of frames to average together (the median and sigma-clip "
+          "modes take at most " G_STRINGIFY (AVG_FRAMES_MAX_NETWORK) ")",
+          MIN_FRAME_NO, MAX_FRAME_NO,
           DEFAULT_FRAME_NO, G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
 
+  g_object_class_install_property (gobject_class, PROP_MODE,
+      g_param_spec_enum ("mode", "Mode",
+          "How frames are grouped for averaging", GST_TYPE_AVG_FRAMES_MODE,
+          DEFAULT_MODE, G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_ALPHA_SHIFT,
+      g_param_spec_uint ("alpha-shift", "Alpha shift",
+          "In ema mode a new frame is weighted with 1/2^alpha-shift",
+          0, MAX_ALPHA_SHIFT, DEFAULT_ALPHA_SHIFT,
+          G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_KAPPA,
+      g_param_spec_double ("kappa", "Kappa",
+          "In sigma-clip mode samples further than kappa standard deviations "
+          "from the mean are left out", 0.0, MAX_KAPPA, DEFAULT_KAPPA,
+          G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_VARIANCE,
+      g_param_spec_boolean ("variance", "Variance",
+          "In block mode attach the per pixel variance of the averaged frames "
+          "to the output as a GstAvgFramesMeta", DEFAULT_VARIANCE,
+          G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_N_THREADS,
+      g_param_spec_uint ("n-threads", "Threads",
+          "Number of threads that process a frame (0 = one per CPU), "
+          "takes effect on the next start",
+          0, MAX_N_THREADS, DEFAULT_N_THREADS,
+          G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
+
   gobject_class->finalize = gst_avg_frames_finalize;
   base_transform_class->start = GST_DEBUG_FUNCPTR (gst_avg_frames_start);
   base_transform_class->stop = GST_DEBUG_FUNCPTR (gst_avg_frames_stop);
+  base_transform_class->transform_caps =
+      GST_DEBUG_FUNCPTR (gst_avg_frames_transform_caps);
   video_filter_class->set_info = GST_DEBUG_FUNCPTR (gst_avg_frames_set_info);
-  video_filter_class->transform_frame_ip = GST_DEBUG_FUNCPTR (gst_avg_frames_transform_frame_ip);
+  video_filter_class->transform_frame = GST_DEBUG_FUNCPTR (gst_avg_frames_transform_frame);
+  base_transform_class->generate_output = GST_DEBUG_FUNCPTR (gst_avg_frames_generate_output);
   base_transform_class->sink_event = GST_DEBUG_FUNCPTR (gst_avg_frames_sink_event);
   base_transform_class->src_event = GST_DEBUG_FUNCPTR (gst_avg_frames_src_event);
+  base_transform_class->query = GST_DEBUG_FUNCPTR (gst_avg_frames_query);
 }
 
 static void
 gst_avg_frames_init (GstAvgFrames *avgframes)
 {
   avgframes->frame_no = DEFAULT_FRAME_NO;
+  avgframes->mode = DEFAULT_MODE;
+  avgframes->cur_mode = DEFAULT_MODE;
+  avgframes->alpha_shift = DEFAULT_ALPHA_SHIFT;
+  avgframes->kappa = DEFAULT_KAPPA;
+  avgframes->variance = DEFAULT_VARIANCE;
+  avgframes->n_threads = DEFAULT_N_THREADS;
+  g_mutex_init (&avgframes->lock);
+  g_cond_init (&avgframes->cond);
+  avgframes->kernels = avg_kernels_get_best ();
+  avgframes->frame_kernels = avg_frames_kernels_get_best ();
+  avgframes->window_start = GST_CLOCK_TIME_NONE;
+  avgframes->earliest_time = GST_CLOCK_TIME_NONE;
+
+  /* the base class would drop late input frames, which are all needed for
+   * the averages */
+  gst_base_transform_set_qos_enabled (GST_BASE_TRANSFORM (avgframes), FALSE);
+
+  GST_DEBUG_OBJECT (avgframes, "using %s kernels", avgframes->kernels->name);
 }
 
 void
@@ -144,6 +291,25 @@ gst_avg_frames_set_property (GObject * object, guint property_id,
   switch (property_id) {
     case PROP_NO_OF_FRAMES:
       avgframes->frame_no = g_value_get_int (value);
+      gst_element_post_message (GST_ELEMENT (avgframes),
+          gst_message_new_latency (GST_OBJECT (avgframes)));
+      break;
+    case PROP_MODE:
+      avgframes->mode = g_value_get_enum (value);
+      gst_element_post_message (GST_ELEMENT (avgframes),
+          gst_message_new_latency (GST_OBJECT (avgframes)));
+      break;
+    case PROP_ALPHA_SHIFT:
+      avgframes->alpha_shift = g_value_get_uint (value);
+      break;
+    case PROP_KAPPA:
+      avgframes->kappa = g_value_get_double (value);
+      break;
+    case PROP_VARIANCE:
+      avgframes->variance = g_value_get_boolean (value);
+      break;
+    case PROP_N_THREADS:
+      avgframes->n_threads = g_value_get_uint (value);
       break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -163,6 +329,21 @@ gst_avg_frames_get_property (GObject * object, guint property_id,
     case PROP_NO_OF_FRAMES:
       g_value_set_int(value, avgframes->frame_no);
       break;
+    case PROP_MODE:
+      g_value_set_enum(value, avgframes->mode);
+      break;
+    case PROP_ALPHA_SHIFT:
+      g_value_set_uint(value, avgframes->alpha_shift);
+      break;
+    case PROP_KAPPA:
+      g_value_set_double(value, avgframes->kappa);
+      break;
+    case PROP_VARIANCE:
+      g_value_set_boolean(value, avgframes->variance);
+      break;
+    case PROP_N_THREADS:
+      g_value_set_uint(value, avgframes->n_threads);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -176,6 +357,38 @@ void release(FrameSums *framesums)
 		framesums->data = 0;
 		framesums->size = 0;
 	}
+	if (framesums->sumsq) {
+		free (framesums->sumsq);
+		framesums->sumsq = NULL;
+	}
+}
+
+static void
+release_ring (FrameRing *ring)
+{
+  if (ring->data) {
+    free (ring->data);
+    ring->data = NULL;
+  }
+  ring->frame_size = 0;
+  ring->len = 0;
+  ring->head = 0;
+}
+
+static gboolean
+alloc_ring (FrameRing *ring, gint len, gsize frame_size)
+{
+  release_ring (ring);
+
+  if (posix_memalign ((void **) &ring->data, 64, len * frame_size) != 0) {
+    ring->data = NULL;
+    return FALSE;
+  }
+  memset (ring->data, 0, len * frame_size);
+
+  ring->frame_size = frame_size;
+  ring->len = len;
+  return TRUE;
 }
 
 void
@@ -186,6 +399,10 @@ gst_avg_frames_finalize (GObject * object)
   GST_DEBUG_OBJECT (avgframes, "finalize");
 
   release(&avgframes->framesums);
+  release_ring(&avgframes->ring);
+  avg_frames_network_free (avgframes->network);
+  g_mutex_clear (&avgframes->lock);
+  g_cond_clear (&avgframes->cond);
 
   G_OBJECT_CLASS (gst_avg_frames_parent_class)->finalize (object);
 }
@@ -194,7 +411,36 @@ static gboolean
 gst_avg_frames_start (GstBaseTransform * trans)
 {
   GstAvgFrames *avgframes = GST_AVG_FRAMES (trans);
+  GError *error = NULL;
+  guint n_threads = avgframes->n_threads;
+
   avgframes->frame_counter = 0;
+  avgframes->window_start = GST_CLOCK_TIME_NONE;
+
+  GST_OBJECT_LOCK (avgframes);
+  avgframes->earliest_time = GST_CLOCK_TIME_NONE;
+  avgframes->processed = 0;
+  avgframes->dropped = 0;
+  GST_OBJECT_UNLOCK (avgframes);
+
+  if (n_threads == 0)
+    n_threads = MIN (g_get_num_processors (), MAX_N_THREADS);
+
+  /* the streaming thread takes one band itself */
+  if (n_threads > 1) {
+    avgframes->pool = g_thread_pool_new (gst_avg_frames_band_func, avgframes,
+        n_threads - 1, TRUE, &error);
+    if (!avgframes->pool) {
+      GST_WARNING_OBJECT (avgframes, "Unable to start %u threads: %s",
+          n_threads - 1, error->message);
+      g_error_free (error);
+      n_threads = 1;
+    }
+  }
+  avgframes->pool_threads = n_threads;
+  avgframes->bands = g_new0 (AvgFramesBand, n_threads);
+
+  GST_DEBUG_OBJECT (avgframes, "processing frames with %u threads", n_threads);
 
   return TRUE;
 }
@@ -206,10 +452,115 @@ gst_avg_frames_stop (GstBaseTransform * trans)
 
   GST_DEBUG_OBJECT (avgframes, "stop");
   release(&avgframes->framesums);
+  release_ring(&avgframes->ring);
+  avg_frames_network_free (avgframes->network);
+  avgframes->network = NULL;
+
+  if (avgframes->pool) {
+    g_thread_pool_free (avgframes->pool, FALSE, TRUE);
+    avgframes->pool = NULL;
+  }
+  g_free (avgframes->bands);
+  avgframes->bands = NULL;
 
   return TRUE;
 }
 
+/* lays out the rows of every plane of info in the sums */
+static gboolean
+gst_avg_frames_layout (FrameSums *framesums, GstVideoInfo *info)
+{
+  gint bytes = info->finfo->bits / 8;
+  gint p, c;
+
+  framesums->size = 0;
+  framesums->samples = 0;
+  framesums->rows = 0;
+  framesums->n_planes = GST_VIDEO_INFO_N_PLANES (info);
+
+  for (p = 0; p < framesums->n_planes; p++) {
+    FramePlane *plane = &framesums->planes[p];
+
+    /* any component of the plane tells its size, the ones that share a
+     * plane are interleaved */
+    for (c = 0; c < GST_VIDEO_INFO_N_COMPONENTS (info); c++) {
+      if (GST_VIDEO_INFO_COMP_PLANE (info, c) == p)
+        break;
+    }
+    if (c == GST_VIDEO_INFO_N_COMPONENTS (info)) {
+      GST_ERROR("No component in plane %d", p);
+      return FALSE;
+    }
+
+    plane->rows = GST_VIDEO_INFO_COMP_HEIGHT (info, c);
+    plane->first_row = framesums->rows;
+    plane->row_samples = GST_VIDEO_INFO_COMP_WIDTH (info, c) *
+        GST_VIDEO_INFO_COMP_PSTRIDE (info, c) / bytes;
+    plane->sum_stride =
+        (plane->row_samples + ROW_ALIGN - 1) / ROW_ALIGN * ROW_ALIGN;
+    plane->sum_offset = framesums->size;
+    plane->packed_offset = framesums->samples;
+
+    framesums->rows += plane->rows;
+    framesums->size += plane->rows * plane->sum_stride;
+    framesums->samples += plane->rows * plane->row_samples;
+  }
+
+  return TRUE;
+}
+
+/* the formats that 8 bit frames can be averaged to */
+static const gchar *wide_formats[] = { "GRAY16_LE", "GRAY16_BE" };
+
+/* Every format goes out as itself. On top of that GRAY8 input can go out
+ * with the extra bits of the average as GRAY16, which comes after the same
+ * format so that it is only picked when downstream asks for it. */
+static GstCaps *
+gst_avg_frames_transform_caps (GstBaseTransform * trans,
+    GstPadDirection direction, GstCaps * caps, GstCaps * filter)
+{
+  GstCaps *ret, *tmp;
+  GstStructure *s, *narrow, *wide;
+  gint i, f;
+
+  GST_DEBUG_OBJECT (trans,
+      "Transforming caps %" GST_PTR_FORMAT " in direction %s", caps,
+      (direction == GST_PAD_SINK) ? "sink" : "src");
+
+  ret = gst_caps_copy (caps);
+
+  for (i = 0; i < gst_caps_get_size (caps); i++) {
+    s = gst_caps_get_structure (caps, i);
+
+    for (f = 0; f < G_N_ELEMENTS (wide_formats); f++) {
+      narrow = gst_structure_copy (s);
+      gst_structure_set (narrow, "format", G_TYPE_STRING, "GRAY8", NULL);
+      wide = gst_structure_copy (s);
+      gst_structure_set (wide, "format", G_TYPE_STRING, wide_formats[f], NULL);
+
+      if (direction == GST_PAD_SINK && gst_structure_can_intersect (s, narrow))
+        gst_caps_append_structure (ret, gst_structure_copy (wide));
+      else if (direction == GST_PAD_SRC &&
+          gst_structure_can_intersect (s, wide))
+        gst_caps_append_structure (ret, gst_structure_copy (narrow));
+
+      gst_structure_free (narrow);
+      gst_structure_free (wide);
+    }
+  }
+  ret = gst_caps_simplify (ret);
+
+  if (filter) {
+    tmp = gst_caps_intersect_full (filter, ret, GST_CAPS_INTERSECT_FIRST);
+    gst_caps_unref (ret);
+    ret = tmp;
+  }
+
+  GST_DEBUG_OBJECT (trans, "transformed to %" GST_PTR_FORMAT, ret);
+
+  return ret;
+}
+
 static gboolean
 gst_avg_frames_set_info (GstVideoFilter * filter, GstCaps * incaps,
     GstVideoInfo * in_info, GstCaps * outcaps, GstVideoInfo * out_info)
@@ -219,12 +570,28 @@ gst_avg_frames_set_info (GstVideoFilter * filter, GstCaps * incaps,
   GST_DEBUG ("caps %" GST_PTR_FORMAT
       "othercaps %" GST_PTR_FORMAT, incaps, outcaps);
 
-  release(&avgframes->framesums);
-
-  //gsize frameSize = in_info->width*in_info->height*in_info->finfo->n_components;
+  if (GST_VIDEO_INFO_FORMAT (in_info) != GST_VIDEO_INFO_FORMAT (out_info) &&
+      GST_VIDEO_INFO_FORMAT (in_info) != GST_VIDEO_FORMAT_GRAY8) {
+    GST_ERROR("Only GRAY8 can be averaged to a different format");
+    return FALSE;
+  }
 
-  avgframes->framesums.size = in_info->size/(in_info->finfo->bits/8);
-  avgframes->framesums.data = (guint32 *) calloc(avgframes->framesums.size, sizeof(guint32));
+  release(&avgframes->framesums);
+  release_ring(&avgframes->ring);
+
+  if (!gst_avg_frames_layout (&avgframes->framesums, in_info))
+    return FALSE;
+
+  /* cache line aligned so the bands of the threads do not share lines */
+  if (posix_memalign ((void **) &avgframes->framesums.data, 64,
+          avgframes->framesums.size * sizeof(guint32)) != 0) {
+    avgframes->framesums.data = NULL;
+    avgframes->framesums.size = 0;
+    GST_ERROR("Unable to allocate memory for the sums");
+    return FALSE;
+  }
+  memset (avgframes->framesums.data, 0,
+      avgframes->framesums.size * sizeof(guint32));
 
   GST_DEBUG_OBJECT (avgframes, "set_info");
 
@@ -245,95 +612,736 @@ gst_avg_frames_clear_avg(GstBaseTransform *trans)
     sum[i] = 0;
   }
   avgframes->frame_counter = 0;
+
+  if (avgframes->framesums.sumsq)
+    memset (avgframes->framesums.sumsq, 0,
+        avgframes->framesums.size * sizeof (guint64));
+
+  if (avgframes->ring.data)
+    memset (avgframes->ring.data, 0, avgframes->ring.len * avgframes->ring.frame_size);
+  avgframes->ring.head = 0;
 }
 
-static GstFlowReturn
-gst_avg_frames_transform_frame_ip (GstVideoFilter * filter, GstVideoFrame * frame)
+static void
+swap_u16 (guint16 *dst, const guint16 *src, gsize n)
 {
-  GstAvgFrames *avgframes = GST_AVG_FRAMES (filter);
-  guint32 *sum = avgframes->framesums.data;
-  int i;
-  guint16 val;
+  gsize i;
 
-  union {
-    guint8  *d8;
-    guint16 *d16;
-    gpointer ptr;
-  } data;
+  for (i = 0; i < n; i++)
+    dst[i] = GUINT16_SWAP_LE_BE (src[i]);
+}
 
-  data.ptr = GST_VIDEO_FRAME_PLANE_DATA (frame, 0);
+/* copies a row of src to the window in native endian */
+static void
+gst_avg_frames_store_row (const AvgFramesWork *work, gpointer old,
+    gconstpointer src, gsize n)
+{
+  if (work->swap)
+    swap_u16 (old, src, n);
+  else
+    memcpy (old, src, n * (work->bits / 8));
+}
+
+/* combines the rows of the window with the median or clip kernels */
+static void
+gst_avg_frames_order_row (GstAvgFrames *avgframes, const AvgFramesWork *work,
+    gconstpointer *window, gpointer dst, gsize n)
+{
+  const AvgFramesKernels *k = avgframes->frame_kernels;
+
+  if (work->bits == 8 && work->clip && work->wide) {
+    k->clip_u8_wide (dst, (const guint8 * const *) window, work->n_window, n,
+        work->kappa);
+    if (work->out_swap)
+      swap_u16 (dst, dst, n);
+  } else if (work->bits == 8) {
+    if (work->median)
+      k->median_u8 (dst, (const guint8 * const *) window, n, work->net);
+    else
+      k->clip_u8 (dst, (const guint8 * const *) window, work->n_window, n,
+          work->kappa);
+  } else {
+    if (work->median)
+      k->median_u16 (dst, (const guint16 * const *) window, n, work->net);
+    else
+      k->clip_u16 (dst, (const guint16 * const *) window, work->n_window, n,
+          work->kappa);
+    if (work->swap)
+      swap_u16 (dst, dst, n);
+  }
+}
+
+/* writes the 8 bit ema state in acc to the 16 bit row dst, rounded to 8
+ * fractional bits */
+static void
+gst_avg_frames_ema_wide_row (const AvgFramesWork *work, const guint32 *acc,
+    gpointer dst, gsize n)
+{
+  const guint frac = AVG_FRAMES_EMA_FRAC_BITS (8);
+  guint16 *d16 = dst;
+  gsize i;
 
-  if(frame->info.finfo->bits == 8) {
+  for (i = 0; i < n; i++) {
+    guint16 val = (acc[i] + (1u << (frac - 9))) >> (frac - 8);
+
+    d16[i] = work->out_swap ? GUINT16_SWAP_LE_BE (val) : val;
+  }
+}
+
+/* runs the steps of work on one row of n samples */
+static void
+gst_avg_frames_do_row (GstAvgFrames *avgframes, const AvgFramesWork *work,
+    guint32 *sum, guint64 *sumsq, gfloat *var, gpointer old,
+    gconstpointer src, gpointer dst, gsize n)
+{
+  const AvgKernels *k = avgframes->kernels;
+  const AvgFramesKernels *fk = avgframes->frame_kernels;
+
+  if (work->store) {
+    gst_avg_frames_store_row (work, old, src, n);
+    return;
+  }
 
-    for (i=0; i<avgframes->framesums.size; i++) {
-      sum[i] += data.d8[i];
+  if (work->sq) {
+    if (work->bits == 8)
+      fk->accum_sq_u8 (sum, sumsq, src, n);
+    else if (work->swap)
+      fk->accum_sq_u16_swap (sum, sumsq, src, n);
+    else
+      fk->accum_sq_u16 (sum, sumsq, src, n);
+  }
+  /* before the sums are cleared by the normalize step */
+  if (var)
+    fk->variance (var, sumsq, sum, n, work->count, work->clear);
+
+  if (work->bits == 8) {
+    if (work->slide)
+      fk->slide_u8 (sum, old, src, n);
+    if (work->accum)
+      k->accum_u8 (sum, src, n);
+    if (work->ema)
+      fk->ema_u8 (sum, dst, src, n, work->alpha_shift);
+    if (work->ema && work->wide)
+      gst_avg_frames_ema_wide_row (work, sum, dst, n);
+  } else if (work->swap) {
+    if (work->slide)
+      fk->slide_u16_swap (sum, old, src, n);
+    if (work->accum)
+      k->accum_u16_swap (sum, src, n);
+    if (work->ema)
+      fk->ema_u16_swap (sum, dst, src, n, work->alpha_shift);
+  } else {
+    if (work->slide)
+      fk->slide_u16 (sum, old, src, n);
+    if (work->accum)
+      k->accum_u16 (sum, src, n);
+    if (work->ema)
+      fk->ema_u16 (sum, dst, src, n, work->alpha_shift);
+  }
+
+  /* the output format decides how the sums are normalized */
+  if (work->norm) {
+    if (work->bits == 8 && !work->wide)
+      k->norm_u8 (dst, sum, n, work->mul, work->shift, work->clear);
+    else if (work->out_swap)
+      k->norm_u16_swap (dst, sum, n, work->mul, work->shift, work->clear);
+    else
+      k->norm_u16 (dst, sum, n, work->mul, work->shift, work->clear);
+  }
+}
+
+/* spreads the n 8 bit medians at the start of dst over the whole 16 bit
+ * row, going backwards so that no sample is overwritten before it is read */
+static void
+gst_avg_frames_widen_row (const AvgFramesWork *work, gpointer dst, gsize n)
+{
+  const guint8 *d8 = dst;
+  guint16 *d16 = dst;
+  gsize i;
+
+  for (i = n; i > 0; i--) {
+    guint16 val = (guint16) d8[i - 1] << 8;
+
+    d16[i - 1] = work->out_swap ? GUINT16_SWAP_LE_BE (val) : val;
+  }
+}
+
+/* runs the steps of work on rows [start, start + n) of all planes, walking
+ * every plane by its own stride */
+static void
+gst_avg_frames_do_band (GstAvgFrames *avgframes, const AvgFramesWork *work,
+    gint start, gint n)
+{
+  FrameSums *framesums = &avgframes->framesums;
+  gint bytes = work->bits / 8;
+  gint p = 0;
+  gint row, r;
+
+  for (row = start; row < start + n; row++) {
+    const FramePlane *plane;
+    gsize offset;
+    gpointer dst = NULL;
+    gpointer old = NULL;
+    gfloat *var = NULL;
+
+    while (row >= framesums->planes[p].first_row + framesums->planes[p].rows)
+      p++;
+    plane = &framesums->planes[p];
+    r = row - plane->first_row;
+
+    offset = plane->sum_offset + r * plane->sum_stride;
+    if (work->dst[p])
+      dst = (guint8 *) work->dst[p] + r * work->dst_stride[p];
+    /* the window has the layout of the sums */
+    if (work->old)
+      old = (guint8 *) work->old + offset * bytes;
+    if (work->var)
+      var = work->var + plane->packed_offset + r * plane->row_samples;
+
+    gst_avg_frames_do_row (avgframes, work, framesums->data + offset,
+        framesums->sumsq ? framesums->sumsq + offset : NULL, var, old,
+        (const guint8 *) work->src[p] + r * work->src_stride[p], dst,
+        plane->row_samples);
+
+    /* the row of the new frame is in the window now */
+    if (work->median || work->clip) {
+      gconstpointer window[AVG_FRAMES_MAX_NETWORK];
+      gint f;
+
+      for (f = 0; f < work->n_window; f++)
+        window[f] = (const guint8 *) work->window + f * work->window_stride +
+            offset * bytes;
+      gst_avg_frames_order_row (avgframes, work, window, dst,
+          plane->row_samples);
     }
+
+    /* a median has no fractional bits, it is only shifted up */
+    if (work->wide && dst && work->median)
+      gst_avg_frames_widen_row (work, dst, plane->row_samples);
+  }
+}
+
+static void
+gst_avg_frames_band_func (gpointer data, gpointer user_data)
+{
+  GstAvgFrames *avgframes = GST_AVG_FRAMES (user_data);
+  AvgFramesBand *band = data;
+
+  gst_avg_frames_do_band (avgframes, avgframes->work, band->start, band->n);
+
+  g_mutex_lock (&avgframes->lock);
+  if (--avgframes->pending == 0)
+    g_cond_signal (&avgframes->cond);
+  g_mutex_unlock (&avgframes->lock);
+}
+
+/* runs work over the whole frame. Large frames are split into bands of rows
+ * that are processed by the pool and the streaming thread, every row of the
+ * sums is on its own cache lines so no two threads share one. Returns when
+ * all bands are done. */
+static void
+gst_avg_frames_run (GstAvgFrames *avgframes, const AvgFramesWork *work)
+{
+  gint rows = avgframes->framesums.rows;
+  gint band_rows;
+  guint n_bands = 1;
+  guint i;
+
+  if (avgframes->pool)
+    n_bands = MIN (avgframes->pool_threads,
+        (avgframes->framesums.size + MIN_BAND_SIZE - 1) / MIN_BAND_SIZE);
+  n_bands = MIN (n_bands, rows);
+
+  if (n_bands <= 1) {
+    gst_avg_frames_do_band (avgframes, work, 0, rows);
+    return;
+  }
+
+  band_rows = (rows + n_bands - 1) / n_bands;
+  n_bands = (rows + band_rows - 1) / band_rows;
+
+  avgframes->work = work;
+  g_mutex_lock (&avgframes->lock);
+  avgframes->pending = n_bands - 1;
+  g_mutex_unlock (&avgframes->lock);
+
+  for (i = 1; i < n_bands; i++) {
+    avgframes->bands[i].start = i * band_rows;
+    avgframes->bands[i].n = MIN (band_rows, rows - (gint) i * band_rows);
+    g_thread_pool_push (avgframes->pool, &avgframes->bands[i], NULL);
+  }
+  gst_avg_frames_do_band (avgframes, work, 0, band_rows);
+
+  g_mutex_lock (&avgframes->lock);
+  while (avgframes->pending > 0)
+    g_cond_wait (&avgframes->cond, &avgframes->lock);
+  g_mutex_unlock (&avgframes->lock);
+}
+
+/* sets up the normalize step to divide by count. Wide output is the sum
+ * shifted up by 8 bits divided by count, which is done by taking 8 off the
+ * shift of a 16 bit division */
+static void
+gst_avg_frames_divisor (AvgFramesWork *work, guint32 count)
+{
+  avg_kernels_reciprocal (count, work->wide ? 16 : work->bits, &work->mul,
+      &work->shift);
+  if (work->wide)
+    work->shift -= 8;
+}
+
+/* frames that make up one output of mode, the modes that output every
+ * frame only count the frame itself */
+static gint
+gst_avg_frames_window_len (GstAvgFrames *avgframes, GstAvgFramesMode mode)
+{
+  switch (mode) {
+    case GST_AVG_FRAMES_MODE_SLIDING:
+    case GST_AVG_FRAMES_MODE_EMA:
+      return 1;
+    case GST_AVG_FRAMES_MODE_MEDIAN:
+    case GST_AVG_FRAMES_MODE_SIGMA_CLIP:
+      return MIN (avgframes->frame_no, AVG_FRAMES_MAX_NETWORK);
+    default:
+      return avgframes->frame_no;
+  }
+}
+
+/* the duration of a frame at the negotiated framerate, if there is one */
+static GstClockTime
+gst_avg_frames_frame_duration (GstAvgFrames *avgframes)
+{
+  GstVideoInfo *info = &GST_VIDEO_FILTER (avgframes)->in_info;
+
+  if (GST_VIDEO_INFO_FPS_N (info) <= 0)
+    return GST_CLOCK_TIME_NONE;
+
+  return gst_util_uint64_scale_int (GST_SECOND, GST_VIDEO_INFO_FPS_D (info),
+      GST_VIDEO_INFO_FPS_N (info));
+}
+
+/* stamps the output with the time from the start of the first frame of the
+ * block to the end of the last one, which is work */
+static void
+gst_avg_frames_stamp_window (GstAvgFrames *avgframes, AvgFramesWork *work)
+{
+  GstClockTime end = work->pts;
+  GstClockTime duration = work->duration;
+
+  if (!work->outbuf || !GST_CLOCK_TIME_IS_VALID (avgframes->window_start) ||
+      !GST_CLOCK_TIME_IS_VALID (work->pts))
+    return;
+
+  if (!GST_CLOCK_TIME_IS_VALID (duration))
+    duration = gst_avg_frames_frame_duration (avgframes);
+  if (GST_CLOCK_TIME_IS_VALID (duration))
+    end += duration;
+
+  GST_BUFFER_PTS (work->outbuf) = avgframes->window_start;
+  GST_BUFFER_DTS (work->outbuf) = GST_CLOCK_TIME_NONE;
+  if (end > avgframes->window_start)
+    GST_BUFFER_DURATION (work->outbuf) = end - avgframes->window_start;
+  else
+    GST_BUFFER_DURATION (work->outbuf) = GST_CLOCK_TIME_NONE;
+}
+
+/* adds the frame to the window of the last frame_no frames, dropping the
+ * oldest one, and writes the average of the window to the output. Without
+ * an output the window is only updated */
+static GstFlowReturn
+gst_avg_frames_slide (GstAvgFrames *avgframes, AvgFramesWork *work)
+{
+  FrameRing *ring = &avgframes->ring;
+  gsize size = avgframes->framesums.size;
+
+  /* the window length changed, start over with an empty window */
+  if (ring->len != avgframes->frame_no) {
+    if (!alloc_ring (ring, avgframes->frame_no, size * (work->bits / 8))) {
+      GST_ERROR("Unable to allocate memory for %d frames", avgframes->frame_no);
+      return GST_FLOW_ERROR;
+    }
+    gst_avg_frames_clear_avg (GST_BASE_TRANSFORM (avgframes));
+  }
+
+  if (avgframes->frame_counter < ring->len)
     avgframes->frame_counter++;
 
-    if (avgframes->frame_counter < avgframes->frame_no) {
-      return GST_BASE_TRANSFORM_FLOW_DROPPED;
-    } else {
+  work->old = ring->data + ring->head * ring->frame_size;
+  work->slide = TRUE;
+  work->norm = work->dst[0] != NULL;
+  gst_avg_frames_divisor (work, avgframes->frame_counter);
+  gst_avg_frames_run (avgframes, work);
+  ring->head = (ring->head + 1) % ring->len;
 
-      for (i=0; i<avgframes->framesums.size; i++) {
-        data.d8[i] = (guint8) (sum[i]/avgframes->frame_no);
-        sum[i] = 0;
-      }
-      avgframes->frame_counter = 0;
+  if (!work->norm)
+    return GST_BASE_TRANSFORM_FLOW_DROPPED;
+  return GST_FLOW_OK;
+}
+
+/* runs the frame through the recursive filter, the sums hold the filter
+ * state in fixed point */
+static GstFlowReturn
+gst_avg_frames_ema (GstAvgFrames *avgframes, AvgFramesWork *work)
+{
+  work->ema = TRUE;
+  /* the first frame after a reset becomes the state as it is */
+  work->alpha_shift = avgframes->frame_counter ? avgframes->alpha_shift : 0;
+  gst_avg_frames_run (avgframes, work);
+  avgframes->frame_counter = 1;
+
+  return GST_FLOW_OK;
+}
 
-      return GST_FLOW_OK;
+/* a late frame still goes into the filter state, the kernels write its
+ * output to the ring, which ema mode does not use otherwise */
+static GstFlowReturn
+gst_avg_frames_ema_late (GstAvgFrames *avgframes, AvgFramesWork *work)
+{
+  FrameRing *ring = &avgframes->ring;
+  FrameSums *framesums = &avgframes->framesums;
+  gint bytes = work->bits / 8;
+  gint p;
+
+  if (ring->len != 1 || ring->frame_size != framesums->size * bytes) {
+    if (!alloc_ring (ring, 1, framesums->size * bytes)) {
+      GST_ERROR("Unable to allocate memory for a frame");
+      return GST_FLOW_ERROR;
     }
   }
-  else if (frame->info.finfo->bits == 16) {
-    if (frame->info.finfo->format == GST_VIDEO_FORMAT_GRAY16_LE){
 
-      for (i=0; i<avgframes->framesums.size; i++) {
-        sum[i] += data.d16[i];
-      }
-      avgframes->frame_counter++;
-
-      if (avgframes->frame_counter < avgframes->frame_no) {
-        return GST_BASE_TRANSFORM_FLOW_DROPPED;
-      } else {
-        for (i=0; i<avgframes->framesums.size; i++) {
-          data.d16[i] = (guint16) (sum[i]/avgframes->frame_no);
-          sum[i] = 0;
-        }
-        avgframes->frame_counter = 0;
+  for (p = 0; p < framesums->n_planes; p++) {
+    work->dst[p] = ring->data + framesums->planes[p].sum_offset * bytes;
+    work->dst_stride[p] = framesums->planes[p].sum_stride * bytes;
+  }
+  work->out_swap = work->swap;
+  gst_avg_frames_ema (avgframes, work);
 
-        return GST_FLOW_OK;
+  return GST_BASE_TRANSFORM_FLOW_DROPPED;
+}
+
+/* keeps the frame in the window, every frame_no frames the median or the
+ * clipped mean of the window is written to the output and the window starts
+ * over */
+static GstFlowReturn
+gst_avg_frames_order (GstAvgFrames *avgframes, AvgFramesWork *work)
+{
+  FrameRing *ring = &avgframes->ring;
+  gsize size = avgframes->framesums.size;
+  gint len = gst_avg_frames_window_len (avgframes, avgframes->cur_mode);
+
+  if (ring->len != len) {
+    if (!alloc_ring (ring, len, size * (work->bits / 8))) {
+      GST_ERROR("Unable to allocate memory for %d frames", len);
+      return GST_FLOW_ERROR;
+    }
+    gst_avg_frames_clear_avg (GST_BASE_TRANSFORM (avgframes));
+  }
+
+  if (avgframes->frame_counter == 0)
+    avgframes->window_start = work->pts;
+
+  work->old = ring->data + avgframes->frame_counter * ring->frame_size;
+  work->store = TRUE;
+  avgframes->frame_counter++;
+
+  if (avgframes->frame_counter >= ring->len) {
+    work->window = ring->data;
+    work->window_stride = ring->frame_size;
+    work->n_window = avgframes->frame_counter;
+    if (avgframes->cur_mode == GST_AVG_FRAMES_MODE_MEDIAN) {
+      if (!avgframes->network ||
+          avgframes->network->n_inputs != work->n_window) {
+        avg_frames_network_free (avgframes->network);
+        avgframes->network = avg_frames_network_new_median (work->n_window);
       }
+      work->net = avgframes->network;
+      work->median = TRUE;
+    } else {
+      work->kappa = avgframes->kappa;
+      work->clip = TRUE;
+    }
+  }
+  gst_avg_frames_run (avgframes, work);
+
+  if (!work->median && !work->clip)
+    return GST_BASE_TRANSFORM_FLOW_DROPPED;
+
+  gst_avg_frames_stamp_window (avgframes, work);
+  avgframes->frame_counter = 0;
+  return GST_FLOW_OK;
+}
+
+/* the squares are only summed while the variance is wanted. Turning it on
+ * starts the block over, so that the squares cover the same frames as the
+ * sums */
+static gboolean
+gst_avg_frames_update_variance (GstAvgFrames *avgframes)
+{
+  FrameSums *framesums = &avgframes->framesums;
+
+  if (!avgframes->variance && framesums->sumsq) {
+    free (framesums->sumsq);
+    framesums->sumsq = NULL;
+  } else if (avgframes->variance && !framesums->sumsq) {
+    if (posix_memalign ((void **) &framesums->sumsq, 64,
+            framesums->size * sizeof (guint64)) != 0) {
+      framesums->sumsq = NULL;
+      GST_ERROR("Unable to allocate memory for the squares");
+      return FALSE;
     }
-    else if (frame->info.finfo->format == GST_VIDEO_FORMAT_GRAY16_BE){
+    gst_avg_frames_clear_avg (GST_BASE_TRANSFORM (avgframes));
+  }
 
+  return TRUE;
+}
 
+/* adds the frame to the sums, every frame_no frames the average is written
+ * to the output and the sums start over. With the variance on the squares
+ * are summed in the same pass and their variance goes out as a meta on the
+ * output */
+static GstFlowReturn
+gst_avg_frames_block (GstAvgFrames *avgframes, AvgFramesWork *work)
+{
+  GstAvgFramesMeta *meta;
 
-      for (i=0; i<avgframes->framesums.size; i++) {
-        sum[i] += __bswap_16(data.d16[i]);
-      }
-      avgframes->frame_counter++;
-
-      if (avgframes->frame_counter < avgframes->frame_no) {
-        return GST_BASE_TRANSFORM_FLOW_DROPPED;
-      } else {
-        for (i=0; i<avgframes->framesums.size; i++) {
-          val = (guint16) (sum[i]/avgframes->frame_no);
-          data.d16[i] = __bswap_16(val);
-          sum[i] = 0;
-        }
-        avgframes->frame_counter = 0;
+  if (!gst_avg_frames_update_variance (avgframes))
+    return GST_FLOW_ERROR;
 
-        return GST_FLOW_OK;
+  if (avgframes->frame_counter == 0)
+    avgframes->window_start = work->pts;
+  avgframes->frame_counter++;
+
+  work->sq = avgframes->framesums.sumsq != NULL;
+  work->accum = !work->sq;
+  if (avgframes->frame_counter >= avgframes->frame_no) {
+    work->norm = TRUE;
+    work->clear = TRUE;
+    gst_avg_frames_divisor (work, avgframes->frame_counter);
+
+    if (work->sq && work->outbuf) {
+      meta = gst_buffer_add_gst_avg_frames_meta (work->outbuf,
+          avgframes->framesums.samples, avgframes->frame_counter);
+      if (!meta) {
+        GST_ERROR("Unable to add the variance to the output");
+        return GST_FLOW_ERROR;
       }
+      work->var = meta->variance;
+      work->count = avgframes->frame_counter;
     }
-    else {
+  }
+  gst_avg_frames_run (avgframes, work);
+
+  if (!work->norm)
+    return GST_BASE_TRANSFORM_FLOW_DROPPED;
+
+  gst_avg_frames_stamp_window (avgframes, work);
+  avgframes->frame_counter = 0;
+  return GST_FLOW_OK;
+}
+
+/* the sums of one mode mean nothing to another */
+static void
+gst_avg_frames_update_mode (GstAvgFrames *avgframes)
+{
+  if (avgframes->mode != avgframes->cur_mode) {
+    gst_avg_frames_clear_avg (GST_BASE_TRANSFORM (avgframes));
+    avgframes->cur_mode = avgframes->mode;
+  }
+}
+
+static gboolean
+gst_avg_frames_setup_work (GstAvgFrames *avgframes, GstVideoFrame *frame,
+    AvgFramesWork *work)
+{
+  GstVideoFormat format = GST_VIDEO_FRAME_FORMAT (frame);
+  gint p;
+
+  work->bits = frame->info.finfo->bits;
+  work->pts = GST_BUFFER_PTS (frame->buffer);
+  work->duration = GST_BUFFER_DURATION (frame->buffer);
+
+  if (work->bits == 16) {
+    if (format != GST_VIDEO_FORMAT_GRAY16_LE &&
+        format != GST_VIDEO_FORMAT_GRAY16_BE) {
       GST_ERROR("Unhandled format type");
-      return GST_FLOW_ERROR;
+      return FALSE;
     }
+    work->swap = (format == GST_VIDEO_FORMAT_GRAY16_BE) ==
+        (G_BYTE_ORDER == G_LITTLE_ENDIAN);
   }
-  else {
-    GST_ERROR("Unhandled data size of %d bits", frame->info.finfo->bits);
+  else if (work->bits != 8) {
+    GST_ERROR("Unhandled data size of %d bits", work->bits);
+    return FALSE;
+  }
+
+  if (GST_VIDEO_FRAME_N_PLANES (frame) != avgframes->framesums.n_planes) {
+    GST_ERROR("Frame does not match the negotiated format");
+    return FALSE;
+  }
+
+  for (p = 0; p < GST_VIDEO_FRAME_N_PLANES (frame); p++) {
+    work->src[p] = GST_VIDEO_FRAME_PLANE_DATA (frame, p);
+    work->src_stride[p] = GST_VIDEO_FRAME_PLANE_STRIDE (frame, p);
+  }
+
+  return TRUE;
+}
+
+/* whether the output of buf would be too late by the last QoS event, it is
+ * then counted as dropped and reported */
+static gboolean
+gst_avg_frames_is_late (GstAvgFrames *avgframes, GstBuffer *buf)
+{
+  GstBaseTransform *trans = GST_BASE_TRANSFORM (avgframes);
+  GstClockTime running_time, stream_time, earliest;
+  GstMessage *msg;
+  guint64 processed, dropped;
+  gboolean late;
+
+  if (trans->segment.format != GST_FORMAT_TIME)
+    return FALSE;
+
+  running_time = gst_segment_to_running_time (&trans->segment,
+      GST_FORMAT_TIME, GST_BUFFER_PTS (buf));
+
+  GST_OBJECT_LOCK (avgframes);
+  earliest = avgframes->earliest_time;
+  late = GST_CLOCK_TIME_IS_VALID (running_time) &&
+      GST_CLOCK_TIME_IS_VALID (earliest) && running_time <= earliest;
+  if (late)
+    avgframes->dropped++;
+  else
+    avgframes->processed++;
+  processed = avgframes->processed;
+  dropped = avgframes->dropped;
+  GST_OBJECT_UNLOCK (avgframes);
+
+  if (!late)
+    return FALSE;
+
+  GST_DEBUG_OBJECT (avgframes, "skipping the output of a late frame at %"
+      GST_TIME_FORMAT, GST_TIME_ARGS (running_time));
+
+  stream_time = gst_segment_to_stream_time (&trans->segment, GST_FORMAT_TIME,
+      GST_BUFFER_PTS (buf));
+  msg = gst_message_new_qos (GST_OBJECT (avgframes), TRUE, running_time,
+      stream_time, GST_BUFFER_PTS (buf), GST_BUFFER_DURATION (buf));
+  gst_message_set_qos_values (msg, (gint64) (earliest - running_time), 1.0,
+      1000000);
+  gst_message_set_qos_stats (msg, GST_FORMAT_BUFFERS, processed, dropped);
+  gst_element_post_message (GST_ELEMENT (avgframes), msg);
+
+  return TRUE;
+}
+
+static GstFlowReturn
+gst_avg_frames_generate_output (GstBaseTransform * trans, GstBuffer ** outbuf)
+{
+  GstAvgFrames *avgframes = GST_AVG_FRAMES (trans);
+  GstVideoFilter *filter = GST_VIDEO_FILTER (trans);
+  GstBuffer *inbuf = trans->queued_buf;
+  AvgFramesWork work = { 0, };
+  GstVideoFrame frame;
+  GstFlowReturn ret = GST_FLOW_ERROR;
+  gboolean late;
+
+  gst_avg_frames_update_mode (avgframes);
+
+  if (inbuf == NULL || !filter->negotiated)
+    return GST_BASE_TRANSFORM_CLASS (gst_avg_frames_parent_class)->
+        generate_output (trans, outbuf);
+
+  /* frames that are output, or that complete a window, get an output buffer
+   * from downstream through the parent class, unless they are too late */
+  if (avgframes->frame_counter + 1 >=
+      gst_avg_frames_window_len (avgframes, avgframes->cur_mode)) {
+    late = gst_avg_frames_is_late (avgframes, inbuf);
+    if (!late)
+      return GST_BASE_TRANSFORM_CLASS (gst_avg_frames_parent_class)->
+          generate_output (trans, outbuf);
+  } else {
+    late = FALSE;
+  }
+
+  /* the rest is only read, so shared input buffers do not get copied */
+  *outbuf = NULL;
+  trans->queued_buf = NULL;
+
+  if (!gst_video_frame_map (&frame, &filter->in_info, inbuf, GST_MAP_READ)) {
+    GST_ERROR("Unable to map the input buffer");
+    gst_buffer_unref (inbuf);
     return GST_FLOW_ERROR;
   }
+
+  if (gst_avg_frames_setup_work (avgframes, &frame, &work)) {
+    switch (avgframes->cur_mode) {
+      case GST_AVG_FRAMES_MODE_SLIDING:
+        /* the window needs every frame */
+        ret = gst_avg_frames_slide (avgframes, &work);
+        break;
+      case GST_AVG_FRAMES_MODE_EMA:
+        ret = gst_avg_frames_ema_late (avgframes, &work);
+        break;
+      default:
+        if (late) {
+          /* the window the frame completes is dropped and starts over */
+          if (avgframes->cur_mode == GST_AVG_FRAMES_MODE_BLOCK)
+            gst_avg_frames_clear_avg (trans);
+          else
+            avgframes->frame_counter = 0;
+          ret = GST_FLOW_OK;
+        } else if (avgframes->cur_mode == GST_AVG_FRAMES_MODE_BLOCK) {
+          ret = gst_avg_frames_block (avgframes, &work);
+        } else {
+          ret = gst_avg_frames_order (avgframes, &work);
+        }
+        break;
+    }
+  }
+
+  gst_video_frame_unmap (&frame);
+  gst_buffer_unref (inbuf);
+
+  if (ret == GST_BASE_TRANSFORM_FLOW_DROPPED)
+    ret = GST_FLOW_OK;
+  return ret;
+}
+
+static GstFlowReturn
+gst_avg_frames_transform_frame (GstVideoFilter * filter,
+    GstVideoFrame * inframe, GstVideoFrame * outframe)
+{
+  GstAvgFrames *avgframes = GST_AVG_FRAMES (filter);
+  AvgFramesWork work = { 0, };
+
+  gint p;
+
+  if (!gst_avg_frames_setup_work (avgframes, inframe, &work))
+    return GST_FLOW_ERROR;
+
+  for (p = 0; p < GST_VIDEO_FRAME_N_PLANES (outframe); p++) {
+    work.dst[p] = GST_VIDEO_FRAME_PLANE_DATA (outframe, p);
+    work.dst_stride[p] = GST_VIDEO_FRAME_PLANE_STRIDE (outframe, p);
+  }
+  work.outbuf = outframe->buffer;
+  work.wide = outframe->info.finfo->bits > work.bits;
+  if (work.wide)
+    work.out_swap = (GST_VIDEO_FRAME_FORMAT (outframe) ==
+        GST_VIDEO_FORMAT_GRAY16_BE) == (G_BYTE_ORDER == G_LITTLE_ENDIAN);
+  else
+    work.out_swap = work.swap;
+
+  switch (avgframes->cur_mode) {
+    case GST_AVG_FRAMES_MODE_SLIDING:
+      return gst_avg_frames_slide (avgframes, &work);
+    case GST_AVG_FRAMES_MODE_EMA:
+      return gst_avg_frames_ema (avgframes, &work);
+    case GST_AVG_FRAMES_MODE_MEDIAN:
+    case GST_AVG_FRAMES_MODE_SIGMA_CLIP:
+      return gst_avg_frames_order (avgframes, &work);
+    default:
+      return gst_avg_frames_block (avgframes, &work);
+  }
 }
 
 static gboolean
@@ -347,6 +1355,11 @@ gst_avg_frames_sink_event (GstBaseTransform * trans, GstEvent * event)
     case GST_EVENT_FLUSH_START:
       gst_avg_frames_clear_avg(trans);
       break;
+    case GST_EVENT_FLUSH_STOP:
+      GST_OBJECT_LOCK (trans);
+      GST_AVG_FRAMES (trans)->earliest_time = GST_CLOCK_TIME_NONE;
+      GST_OBJECT_UNLOCK (trans);
+      break;
     case GST_EVENT_CUSTOM_DOWNSTREAM_OOB:
       s = gst_event_get_structure (event);
       name = gst_structure_get_string(s, "name");
@@ -371,11 +1384,23 @@ gst_avg_frames_src_event (GstBaseTransform * trans, GstEvent * event)
   gboolean ret = TRUE;
   const GstStructure *s;
   const gchar *name;
+  GstClockTimeDiff diff;
+  GstClockTime timestamp;
   GST_DEBUG("Src event %s",  gst_event_type_get_name (GST_EVENT_TYPE(event)));
   switch (GST_EVENT_TYPE(event)) {
     case GST_EVENT_FLUSH_START:
       gst_avg_frames_clear_avg(trans);
       break;
+    case GST_EVENT_QOS:
+      /* the frames before this time would be late downstream */
+      gst_event_parse_qos (event, NULL, NULL, &diff, &timestamp);
+      GST_OBJECT_LOCK (trans);
+      if (diff > 0)
+        GST_AVG_FRAMES (trans)->earliest_time = timestamp + diff;
+      else
+        GST_AVG_FRAMES (trans)->earliest_time = GST_CLOCK_TIME_NONE;
+      GST_OBJECT_UNLOCK (trans);
+      break;
     case GST_EVENT_CUSTOM_UPSTREAM:
       s = gst_event_get_structure (event);
       name = gst_structure_get_string(s, "name");
@@ -394,6 +1419,44 @@ gst_avg_frames_src_event (GstBaseTransform * trans, GstEvent * event)
   return ret;
 }
 
+/* the output of a window goes out with the time of its first frame when its
+ * last frame comes in */
+static gboolean
+gst_avg_frames_query (GstBaseTransform * trans, GstPadDirection direction,
+    GstQuery * query)
+{
+  GstAvgFrames *avgframes = GST_AVG_FRAMES (trans);
+  GstClockTime min, max, duration, latency;
+  gboolean live;
+  gboolean ret;
+
+  ret = GST_BASE_TRANSFORM_CLASS (gst_avg_frames_parent_class)->query (trans,
+      direction, query);
+
+  if (!ret || direction != GST_PAD_SRC ||
+      GST_QUERY_TYPE (query) != GST_QUERY_LATENCY)
+    return ret;
+
+  duration = gst_avg_frames_frame_duration (avgframes);
+  if (!GST_CLOCK_TIME_IS_VALID (duration))
+    return ret;
+
+  latency = duration *
+      (gst_avg_frames_window_len (avgframes, avgframes->mode) - 1);
+
+  gst_query_parse_latency (query, &live, &min, &max);
+  min += latency;
+  if (GST_CLOCK_TIME_IS_VALID (max))
+    max += latency;
+  gst_query_set_latency (query, live, min, max);
+
+  GST_DEBUG_OBJECT (avgframes, "adding %" GST_TIME_FORMAT " of latency, now %"
+      GST_TIME_FORMAT " - %" GST_TIME_FORMAT, GST_TIME_ARGS (latency),
+      GST_TIME_ARGS (min), GST_TIME_ARGS (max));
+
+  return ret;
+}
+
 static gboolean
 plugin_init (GstPlugin * plugin)
 {
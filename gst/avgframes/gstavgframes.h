@@ -22,6 +22,7 @@
 
 #include <gst/video/video.h>
 #include <gst/video/gstvideofilter.h>
+#include "avgframeskernels.h"
 
 G_BEGIN_DECLS
 
@@ -34,18 +35,133 @@ G_BEGIN_DECLS
 typedef struct _GstAvgFrames GstAvgFrames;
 typedef struct _GstAvgFramesClass GstAvgFramesClass;
 
+typedef enum {
+  GST_AVG_FRAMES_MODE_BLOCK,
+  GST_AVG_FRAMES_MODE_SLIDING,
+  GST_AVG_FRAMES_MODE_EMA,
+  GST_AVG_FRAMES_MODE_MEDIAN,
+  GST_AVG_FRAMES_MODE_SIGMA_CLIP
+} GstAvgFramesMode;
+
+/* where the rows of one plane are in the sums. Every row starts on a cache
+ * line and only holds the samples of the row, not the stride padding */
+typedef struct FramePlane
+{
+	gint rows;
+	/* index of the first row of the plane among the rows of all planes */
+	gint first_row;
+	gsize row_samples;
+	gsize sum_stride;
+	gsize sum_offset;
+	/* where the rows of the plane start in the variance of the meta, which
+	 * has no padding */
+	gsize packed_offset;
+}FramePlane;
+
 typedef struct FrameSums
 {
 	guint32 *data;
+	/* the sums of the squares, only there while the variance is wanted */
+	guint64 *sumsq;
 	gsize size;
+	/* the samples of a frame without the padding */
+	gsize samples;
+	gint n_planes;
+	gint rows;
+	FramePlane planes[GST_VIDEO_MAX_PLANES];
 }FrameSums;
 
+/* the last frames of a sliding window, as they came in, in the layout of
+ * the sums. The median and sigma-clip modes keep native endian samples */
+typedef struct FrameRing
+{
+	guint8 *data;
+	gsize frame_size;
+	gint len;
+	gint head;
+}FrameRing;
+
+/* one pass over the frame: the steps that are set run in this order on
+ * every band of the frame */
+typedef struct AvgFramesWork
+{
+	gconstpointer src[GST_VIDEO_MAX_PLANES];
+	gint src_stride[GST_VIDEO_MAX_PLANES];
+	GstClockTime pts;
+	GstClockTime duration;
+	/* only set when the frame produces an output */
+	gpointer dst[GST_VIDEO_MAX_PLANES];
+	gint dst_stride[GST_VIDEO_MAX_PLANES];
+	/* the slot of the sliding window that src replaces */
+	gpointer old;
+	/* the frames that median or clip combine, frame_size apart */
+	gconstpointer window;
+	gsize window_stride;
+	gint n_window;
+	gint bits;
+	gboolean swap;
+	/* 8 bit input goes out as 16 bit, in 8.8 fixed point */
+	gboolean wide;
+	gboolean out_swap;
+	gboolean slide;
+	gboolean accum;
+	gboolean ema;
+	gboolean norm;
+	guint32 mul;
+	guint shift;
+	gboolean clear;
+	guint alpha_shift;
+	/* the accumulate step adds the squares too */
+	gboolean sq;
+	/* the variance of the window goes here, with count frames in it */
+	gfloat *var;
+	guint32 count;
+	GstBuffer *outbuf;
+	gboolean store;
+	gboolean median;
+	gboolean clip;
+	const AvgFramesNetwork *net;
+	gdouble kappa;
+}AvgFramesWork;
+
+/* a range of rows over all planes */
+typedef struct AvgFramesBand
+{
+	gint start;
+	gint n;
+}AvgFramesBand;
+
 struct _GstAvgFrames
 {
   GstVideoFilter base_avgframes;
   gint frame_no;
   gint frame_counter;
+  GstAvgFramesMode mode;
+  GstAvgFramesMode cur_mode;
+  guint alpha_shift;
+  gdouble kappa;
+  gboolean variance;
+  /* the time of the first frame of the current block */
+  GstClockTime window_start;
+  /* QoS, protected by the object lock */
+  GstClockTime earliest_time;
+  guint64 processed;
+  guint64 dropped;
   FrameSums framesums;
+  FrameRing ring;
+  AvgFramesNetwork *network;
+  const AvgKernels *kernels;
+  const AvgFramesKernels *frame_kernels;
+
+  guint n_threads;
+  /* the workers of the pool plus the streaming thread */
+  guint pool_threads;
+  GThreadPool *pool;
+  AvgFramesBand *bands;
+  const AvgFramesWork *work;
+  gint pending;
+  GMutex lock;
+  GCond cond;
 };
 
 struct _GstAvgFramesClass
@@ -0,0 +1,153 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+/* Column binning kernels for avgrow. The vertical sum and normalize kernels
+ * are shared with avgframes in gst-libs/gst/avgkernels.
+ *
+ * The scalar versions are the reference implementation, the vector versions
+ * must produce exactly the same results. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/avgkernels/avgkernelssimd.h>
+#include "avgrowkernels.h"
+
+/* scalar reference */
+
+static void
+pair_add_scalar (guint32 * dst, const guint32 * src, gsize n)
+{
+  gsize i;
+
+  for (i = 0; i < n; i++)
+    dst[i] = src[2 * i] + src[2 * i + 1];
+}
+
+static const AvgRowKernels kernels_scalar = {
+  AVG_KERNELS_CPU_SCALAR, "scalar",
+  pair_add_scalar
+};
+
+#ifdef HAVE_X86_KERNELS
+
+static SSE2 void
+pair_add_sse2 (guint32 * dst, const guint32 * src, gsize n)
+{
+  gsize i;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    __m128 a = _mm_castsi128_ps (_mm_loadu_si128 ((const __m128i *)
+            (src + 2 * i)));
+    __m128 b = _mm_castsi128_ps (_mm_loadu_si128 ((const __m128i *)
+            (src + 2 * i + 4)));
+    __m128i even = _mm_castps_si128 (_mm_shuffle_ps (a, b,
+            _MM_SHUFFLE (2, 0, 2, 0)));
+    __m128i odd = _mm_castps_si128 (_mm_shuffle_ps (a, b,
+            _MM_SHUFFLE (3, 1, 3, 1)));
+
+    _mm_storeu_si128 ((__m128i *) (dst + i), _mm_add_epi32 (even, odd));
+  }
+  pair_add_scalar (dst + i, src + 2 * i, n - i);
+}
+
+static const AvgRowKernels kernels_sse2 = {
+  AVG_KERNELS_CPU_SSE2, "sse2",
+  pair_add_sse2
+};
+
+static AVX2 void
+pair_add_avx2 (guint32 * dst, const guint32 * src, gsize n)
+{
+  gsize i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    __m256i a = _mm256_loadu_si256 ((const __m256i *) (src + 2 * i));
+    __m256i b = _mm256_loadu_si256 ((const __m256i *) (src + 2 * i + 8));
+
+    /* hadd works per 128 bit lane, put the 64 bit blocks back in order */
+    _mm256_storeu_si256 ((__m256i *) (dst + i),
+        _mm256_permute4x64_epi64 (_mm256_hadd_epi32 (a, b), 0xd8));
+  }
+  pair_add_scalar (dst + i, src + 2 * i, n - i);
+}
+
+static const AvgRowKernels kernels_avx2 = {
+  AVG_KERNELS_CPU_AVX2, "avx2",
+  pair_add_avx2
+};
+
+#endif /* HAVE_X86_KERNELS */
+
+#ifdef HAVE_NEON_KERNELS
+
+static void
+pair_add_neon (guint32 * dst, const guint32 * src, gsize n)
+{
+  gsize i;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    uint32x4x2_t v = vuzpq_u32 (vld1q_u32 (src + 2 * i),
+        vld1q_u32 (src + 2 * i + 4));
+
+    vst1q_u32 (dst + i, vaddq_u32 (v.val[0], v.val[1]));
+  }
+  pair_add_scalar (dst + i, src + 2 * i, n - i);
+}
+
+static const AvgRowKernels kernels_neon = {
+  AVG_KERNELS_CPU_NEON, "neon",
+  pair_add_neon
+};
+
+#endif /* HAVE_NEON_KERNELS */
+
+/* returns NULL if the kernels for cpu are not usable on this machine */
+const AvgRowKernels *
+avg_row_kernels_get (AvgKernelsCpu cpu)
+{
+  /* the shared kernels know what the cpu supports */
+  if (!avg_kernels_get (cpu))
+    return NULL;
+
+  switch (cpu) {
+    case AVG_KERNELS_CPU_SCALAR:
+      return &kernels_scalar;
+#ifdef HAVE_X86_KERNELS
+    case AVG_KERNELS_CPU_SSE2:
+      return &kernels_sse2;
+    case AVG_KERNELS_CPU_AVX2:
+      return &kernels_avx2;
+#endif
+#ifdef HAVE_NEON_KERNELS
+    case AVG_KERNELS_CPU_NEON:
+      return &kernels_neon;
+#endif
+    default:
+      return NULL;
+  }
+}
+
+/* the kernels for the same cpu as avg_kernels_get_best () */
+const AvgRowKernels *
+avg_row_kernels_get_best (void)
+{
+  return avg_row_kernels_get (avg_kernels_get_best ()->cpu);
+}
@@ -0,0 +1,45 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __AVG_ROW_KERNELS_H__
+#define __AVG_ROW_KERNELS_H__
+
+#include <glib.h>
+#include <gst/avgkernels/avgkernels.h>
+
+G_BEGIN_DECLS
+
+/* The vertical sum and normalize kernels are in AvgKernels.
+ *
+ * The pair_add kernel writes src[2 * i] + src[2 * i + 1] to dst[i] for n
+ * outputs, dst may be src for adding up neighbouring columns in place. */
+typedef struct
+{
+  AvgKernelsCpu cpu;
+  const gchar *name;
+
+  void (*pair_add) (guint32 * dst, const guint32 * src, gsize n);
+} AvgRowKernels;
+
+const AvgRowKernels *avg_row_kernels_get (AvgKernelsCpu cpu);
+const AvgRowKernels *avg_row_kernels_get_best (void);
+
+G_END_DECLS
+
+#endif
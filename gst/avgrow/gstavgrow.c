@@ -25,10 +25,15 @@
 #endif
 
 #include <byteswap.h>
+#include <stdlib.h>
+#include <string.h>
 #include <gst/gst.h>
 #include <gst/video/video.h>
 #include <gst/video/gstvideofilter.h>
+#include <gst/avgrow/gstavgrowmeta.h>
+#include <math.h>
 #include "gstavgrow.h"
+#include "avgrowkernels.h"
 
 GST_DEBUG_CATEGORY_STATIC (gst_avgrow_debug_category);
 #define GST_CAT_DEFAULT gst_avgrow_debug_category
@@ -40,27 +45,71 @@ static void gst_avgrow_set_property (GObject * object,
     guint property_id, const GValue * value, GParamSpec * pspec);
 static void gst_avgrow_get_property (GObject * object,
     guint property_id, GValue * value, GParamSpec * pspec);
+static void gst_avgrow_finalize (GObject * object);
 
+static gboolean gst_avgrow_start (GstBaseTransform * trans);
+static gboolean gst_avgrow_stop (GstBaseTransform * trans);
 static gboolean gst_avgrow_set_info (GstVideoFilter * filter, GstCaps * incaps,
     GstVideoInfo * in_info, GstCaps * outcaps, GstVideoInfo * out_info);
+static gboolean gst_avgrow_set_caps (GstBaseTransform * trans,
+    GstCaps * incaps, GstCaps * outcaps);
+static gboolean gst_avgrow_get_unit_size (GstBaseTransform * trans,
+    GstCaps * caps, gsize * size);
+static gboolean gst_avgrow_transform_size (GstBaseTransform * trans,
+    GstPadDirection direction, GstCaps * caps, gsize size,
+    GstCaps * othercaps, gsize * othersize);
+static gboolean gst_avgrow_decide_allocation (GstBaseTransform * trans,
+    GstQuery * query);
+static GstFlowReturn gst_avgrow_transform (GstBaseTransform * trans,
+    GstBuffer * inbuf, GstBuffer * outbuf);
+static GstFlowReturn gst_avgrow_transform_ip (GstBaseTransform * trans,
+    GstBuffer * buf);
 static GstFlowReturn gst_avgrow_transform_frame (GstVideoFilter * filter,
     GstVideoFrame * inframe, GstVideoFrame * outframe);
 static GstCaps *gst_avgrow_fixate_caps (GstBaseTransform * base,
     GstPadDirection direction, GstCaps * caps, GstCaps * otherCaps);
 static GstCaps *gst_avgrow_transform_caps (GstBaseTransform * base,
     GstPadDirection direction, GstCaps * caps, GstCaps * filter);
+static GstFlowReturn gst_avgrow_generate_output (GstBaseTransform * trans,
+    GstBuffer ** outbuf);
+static gboolean gst_avgrow_sink_event (GstBaseTransform * trans,
+    GstEvent * event);
+static gboolean gst_avgrow_src_event (GstBaseTransform * trans,
+    GstEvent * event);
 
 enum
 {
   PROP_0,
   PROP_NO_OF_ROWS,
-  PROP_TOTAL_AVG
+  PROP_NO_OF_COLS,
+  PROP_TOTAL_AVG,
+  PROP_NO_OF_FRAMES,
+  PROP_STATISTIC,
+  PROP_TRIM,
+  PROP_N_THREADS,
+  PROP_ROI_TOP,
+  PROP_ROI_HEIGHT,
+  PROP_ROI_LEFT,
+  PROP_ROI_WIDTH,
+  PROP_ROI_META,
+  PROP_LINE_SCAN,
+  PROP_PASSTHROUGH_META,
+  PROP_META_EXTREMA,
+  PROP_META_STDDEV
 };
 
 /* pad templates */
 
 #define VIDEO_SRC_CAPS \
-    GST_VIDEO_CAPS_MAKE("{ RGBA, GRAY8, GRAY16_BE, GRAY16_LE }")
+    GST_VIDEO_CAPS_MAKE("{ RGBA, GRAY8, GRAY16_BE, GRAY16_LE }") "; " \
+    GST_AVGROW_FLOAT_CAPS_NAME ", " \
+    "width = " GST_VIDEO_SIZE_RANGE ", " \
+    "height = " GST_VIDEO_SIZE_RANGE ", " \
+    "framerate = " GST_VIDEO_FPS_RANGE
+
+/* the input formats a float output can be made from */
+#define FLOAT_SINK_CAPS \
+    GST_VIDEO_CAPS_MAKE("{ GRAY8, GRAY16_BE, GRAY16_LE }")
 
 #define VIDEO_SINK_CAPS \
     GST_VIDEO_CAPS_MAKE("{ RGBA, GRAY8, GRAY16_BE, GRAY16_LE }")
@@ -69,8 +118,57 @@ enum
 #define MAX_ROWS G_MAXINT
 #define DEFAULT_ROWS 2
 
+#define MIN_COLS 1
+#define MAX_COLS G_MAXINT
+#define DEFAULT_COLS 1
+
 #define DEFAULT_PROP_TOTAL_AVG FALSE
 
+#define MIN_FRAMES 1
+#define MAX_FRAMES G_MAXINT
+#define DEFAULT_FRAMES 1
+
+#define DEFAULT_STATISTIC GST_AVGROW_STATISTIC_MEAN
+#define DEFAULT_TRIM 0.1
+#define MAX_TRIM 0.5
+
+#define DEFAULT_ROI 0
+#define DEFAULT_ROI_META FALSE
+
+#define DEFAULT_LINE_SCAN FALSE
+
+#define DEFAULT_PASSTHROUGH_META FALSE
+#define DEFAULT_META_EXTREMA FALSE
+#define DEFAULT_META_STDDEV FALSE
+
+#define DEFAULT_N_THREADS 0
+#define MAX_N_THREADS 64
+/* frames with fewer samples per thread are not worth splitting */
+#define MIN_BAND_SIZE (64 * 1024)
+
+#define GST_TYPE_AVGROW_STATISTIC (gst_avgrow_statistic_get_type ())
+static GType
+gst_avgrow_statistic_get_type (void)
+{
+  static GType avgrow_statistic_type = 0;
+  static const GEnumValue statistic_types[] = {
+    {GST_AVGROW_STATISTIC_MEAN,
+        "Average the samples of every column", "mean"},
+    {GST_AVGROW_STATISTIC_MEDIAN,
+        "Take the median of the samples of every column", "median"},
+    {GST_AVGROW_STATISTIC_TRIMMED_MEAN,
+        "Average the samples of every column leaving out the trim fraction "
+        "of the lowest and of the highest ones", "trimmed-mean"},
+    {0, NULL, NULL}
+  };
+
+  if (!avgrow_statistic_type) {
+    avgrow_statistic_type =
+        g_enum_register_static ("GstAvgrowStatistic", statistic_types);
+  }
+  return avgrow_statistic_type;
+}
+
 /* class initialization */
 
 G_DEFINE_TYPE_WITH_CODE (GstAvgrow, gst_avgrow, GST_TYPE_VIDEO_FILTER,
@@ -97,6 +195,7 @@ gst_avgrow_class_init (GstAvgrowClass * klass)
 
   gobject_class->set_property = gst_avgrow_set_property;
   gobject_class->get_property = gst_avgrow_get_property;
+  gobject_class->finalize = gst_avgrow_finalize;
 
 
   g_object_class_install_property (gobject_class, PROP_NO_OF_ROWS,
@@ -104,13 +203,107 @@ gst_avgrow_class_init (GstAvgrowClass * klass)
           "Number of rows to average together", MIN_ROWS, MAX_ROWS,
           DEFAULT_ROWS, G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
 
+  g_object_class_install_property (gobject_class, PROP_NO_OF_COLS,
+      g_param_spec_int ("nocols", "Columns",
+          "Number of neighbouring columns to average together", MIN_COLS,
+          MAX_COLS, DEFAULT_COLS, G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
+
   g_object_class_install_property (gobject_class, PROP_TOTAL_AVG,
       g_param_spec_boolean ("total-avg", "Total Average",
           "Calculates the total average of every column", DEFAULT_PROP_TOTAL_AVG,
           G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
 
+  g_object_class_install_property (gobject_class, PROP_NO_OF_FRAMES,
+      g_param_spec_int ("frameno", "Frames",
+          "In total average mode add up the columns of this many frames and "
+          "output one row for all of them", MIN_FRAMES, MAX_FRAMES,
+          DEFAULT_FRAMES, G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_STATISTIC,
+      g_param_spec_enum ("statistic", "Statistic",
+          "How the samples of a column are reduced to one, the robust ones "
+          "run on a single thread and need nocols=1", GST_TYPE_AVGROW_STATISTIC,
+          DEFAULT_STATISTIC, G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_TRIM,
+      g_param_spec_double ("trim", "Trim",
+          "Fraction of the samples of a column left out at either end by "
+          "the trimmed mean", 0.0, MAX_TRIM, DEFAULT_TRIM,
+          G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_N_THREADS,
+      g_param_spec_uint ("n-threads", "Threads",
+          "Number of threads that sum a frame in total average mode "
+          "(0 = one per CPU), takes effect on the next start",
+          0, MAX_N_THREADS, DEFAULT_N_THREADS,
+          G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_ROI_TOP,
+      g_param_spec_int ("roi-top", "ROI top",
+          "First row that is read", 0, G_MAXINT,
+          DEFAULT_ROI, G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_ROI_HEIGHT,
+      g_param_spec_int ("roi-height", "ROI height",
+          "Number of rows that are read (0 = up to the bottom)", 0, G_MAXINT,
+          DEFAULT_ROI, G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_ROI_LEFT,
+      g_param_spec_int ("roi-left", "ROI left",
+          "First column that is read", 0, G_MAXINT,
+          DEFAULT_ROI, G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_ROI_WIDTH,
+      g_param_spec_int ("roi-width", "ROI width",
+          "Number of columns that are read (0 = up to the right edge), "
+          "the output is as wide as the region", 0, G_MAXINT,
+          DEFAULT_ROI, G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_ROI_META,
+      g_param_spec_boolean ("roi-meta", "ROI meta",
+          "In total average and passthrough-meta mode only average the rows "
+          "of the GstVideoRegionOfInterestMeta of the input buffer that are "
+          "within the region of interest", DEFAULT_ROI_META,
+          G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_LINE_SCAN,
+      g_param_spec_boolean ("line-scan", "Line scan",
+          "Add up the lines of consecutive buffers and output a row every "
+          "norows lines, wherever the buffers start and end",
+          DEFAULT_LINE_SCAN, G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_PASSTHROUGH_META,
+      g_param_spec_boolean ("passthrough-meta", "Passthrough meta",
+          "Pass the frames on untouched and attach the mean of every column "
+          "of the region of interest as a GstAvgrowMeta",
+          DEFAULT_PASSTHROUGH_META,
+          G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_META_EXTREMA,
+      g_param_spec_boolean ("meta-extrema", "Meta extrema",
+          "In passthrough-meta mode also attach the minimum and maximum of "
+          "every column", DEFAULT_META_EXTREMA,
+          G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_META_STDDEV,
+      g_param_spec_boolean ("meta-stddev", "Meta standard deviation",
+          "In passthrough-meta mode also attach the standard deviation of "
+          "every column", DEFAULT_META_STDDEV,
+          G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
+
+  base_transform_class->start = GST_DEBUG_FUNCPTR (gst_avgrow_start);
+  base_transform_class->stop = GST_DEBUG_FUNCPTR (gst_avgrow_stop);
   base_transform_class->fixate_caps = GST_DEBUG_FUNCPTR (gst_avgrow_fixate_caps);
   base_transform_class->transform_caps = GST_DEBUG_FUNCPTR (gst_avgrow_transform_caps);
+  base_transform_class->generate_output = GST_DEBUG_FUNCPTR (gst_avgrow_generate_output);
+  base_transform_class->set_caps = GST_DEBUG_FUNCPTR (gst_avgrow_set_caps);
+  base_transform_class->get_unit_size = GST_DEBUG_FUNCPTR (gst_avgrow_get_unit_size);
+  base_transform_class->transform_size = GST_DEBUG_FUNCPTR (gst_avgrow_transform_size);
+  base_transform_class->decide_allocation = GST_DEBUG_FUNCPTR (gst_avgrow_decide_allocation);
+  base_transform_class->transform = GST_DEBUG_FUNCPTR (gst_avgrow_transform);
+  base_transform_class->transform_ip = GST_DEBUG_FUNCPTR (gst_avgrow_transform_ip);
+  base_transform_class->sink_event = GST_DEBUG_FUNCPTR (gst_avgrow_sink_event);
+  base_transform_class->src_event = GST_DEBUG_FUNCPTR (gst_avgrow_src_event);
   video_filter_class->set_info = GST_DEBUG_FUNCPTR (gst_avgrow_set_info);
   video_filter_class->transform_frame = GST_DEBUG_FUNCPTR (gst_avgrow_transform_frame);
 
@@ -120,6 +313,23 @@ static void
 gst_avgrow_init (GstAvgrow *avgrow)
 {
   avgrow->rows = DEFAULT_ROWS;
+  avgrow->cols = DEFAULT_COLS;
+  avgrow->frameno = DEFAULT_FRAMES;
+  avgrow->window_start = GST_CLOCK_TIME_NONE;
+  avgrow->statistic = DEFAULT_STATISTIC;
+  avgrow->trim = DEFAULT_TRIM;
+  avgrow->kernels = avg_kernels_get_best ();
+  avgrow->row_kernels = avg_row_kernels_get_best ();
+  avgrow->n_threads = DEFAULT_N_THREADS;
+  avgrow->line_scan = DEFAULT_LINE_SCAN;
+  avgrow->passthrough_meta = DEFAULT_PASSTHROUGH_META;
+  avgrow->meta_extrema = DEFAULT_META_EXTREMA;
+  avgrow->meta_stddev = DEFAULT_META_STDDEV;
+  avgrow->scan_start = GST_CLOCK_TIME_NONE;
+  g_mutex_init (&avgrow->lock);
+  g_cond_init (&avgrow->cond);
+
+  GST_DEBUG_OBJECT (avgrow, "using %s kernels", avgrow->kernels->name);
 }
 
 void
@@ -137,6 +347,48 @@ gst_avgrow_set_property (GObject * object, guint property_id,
     case PROP_NO_OF_ROWS:
       avgrow->rows = g_value_get_int (value);
       break;
+    case PROP_NO_OF_COLS:
+      avgrow->cols = g_value_get_int (value);
+      break;
+    case PROP_NO_OF_FRAMES:
+      avgrow->frameno = g_value_get_int (value);
+      break;
+    case PROP_STATISTIC:
+      avgrow->statistic = g_value_get_enum (value);
+      break;
+    case PROP_TRIM:
+      avgrow->trim = g_value_get_double (value);
+      break;
+    case PROP_N_THREADS:
+      avgrow->n_threads = g_value_get_uint (value);
+      break;
+    case PROP_ROI_TOP:
+      avgrow->roi_top = g_value_get_int (value);
+      break;
+    case PROP_ROI_HEIGHT:
+      avgrow->roi_height = g_value_get_int (value);
+      break;
+    case PROP_ROI_LEFT:
+      avgrow->roi_left = g_value_get_int (value);
+      break;
+    case PROP_ROI_WIDTH:
+      avgrow->roi_width = g_value_get_int (value);
+      break;
+    case PROP_ROI_META:
+      avgrow->roi_meta = g_value_get_boolean (value);
+      break;
+    case PROP_LINE_SCAN:
+      avgrow->line_scan = g_value_get_boolean (value);
+      break;
+    case PROP_PASSTHROUGH_META:
+      avgrow->passthrough_meta = g_value_get_boolean (value);
+      break;
+    case PROP_META_EXTREMA:
+      avgrow->meta_extrema = g_value_get_boolean (value);
+      break;
+    case PROP_META_STDDEV:
+      avgrow->meta_stddev = g_value_get_boolean (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -158,12 +410,173 @@ gst_avgrow_get_property (GObject * object, guint property_id,
     case PROP_NO_OF_ROWS:
       g_value_set_int(value, avgrow->rows);
       break;
+    case PROP_NO_OF_COLS:
+      g_value_set_int(value, avgrow->cols);
+      break;
+    case PROP_NO_OF_FRAMES:
+      g_value_set_int(value, avgrow->frameno);
+      break;
+    case PROP_STATISTIC:
+      g_value_set_enum(value, avgrow->statistic);
+      break;
+    case PROP_TRIM:
+      g_value_set_double(value, avgrow->trim);
+      break;
+    case PROP_N_THREADS:
+      g_value_set_uint(value, avgrow->n_threads);
+      break;
+    case PROP_ROI_TOP:
+      g_value_set_int(value, avgrow->roi_top);
+      break;
+    case PROP_ROI_HEIGHT:
+      g_value_set_int(value, avgrow->roi_height);
+      break;
+    case PROP_ROI_LEFT:
+      g_value_set_int(value, avgrow->roi_left);
+      break;
+    case PROP_ROI_WIDTH:
+      g_value_set_int(value, avgrow->roi_width);
+      break;
+    case PROP_ROI_META:
+      g_value_set_boolean(value, avgrow->roi_meta);
+      break;
+    case PROP_LINE_SCAN:
+      g_value_set_boolean(value, avgrow->line_scan);
+      break;
+    case PROP_PASSTHROUGH_META:
+      g_value_set_boolean(value, avgrow->passthrough_meta);
+      break;
+    case PROP_META_EXTREMA:
+      g_value_set_boolean(value, avgrow->meta_extrema);
+      break;
+    case PROP_META_STDDEV:
+      g_value_set_boolean(value, avgrow->meta_stddev);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
   }
 }
 
+static void
+gst_avgrow_free_sums (GstAvgrow * avgrow)
+{
+  free (avgrow->sums);
+  avgrow->sums = NULL;
+  free (avgrow->wide_sums);
+  avgrow->wide_sums = NULL;
+  avgrow->n_sums = 0;
+}
+
+static void
+gst_avgrow_free_hist (GstAvgrow * avgrow)
+{
+  g_free (avgrow->hist);
+  avgrow->hist = NULL;
+  g_free (avgrow->fine_hist);
+  avgrow->fine_hist = NULL;
+  g_free (avgrow->ranks);
+  avgrow->ranks = NULL;
+  avgrow->n_hist = 0;
+}
+
+void
+gst_avgrow_finalize (GObject * object)
+{
+  GstAvgrow *avgrow = GST_AVGROW (object);
+
+  GST_DEBUG_OBJECT (avgrow, "finalize");
+
+  gst_avgrow_free_sums (avgrow);
+  gst_avgrow_free_hist (avgrow);
+  g_mutex_clear (&avgrow->lock);
+  g_cond_clear (&avgrow->cond);
+
+  G_OBJECT_CLASS (gst_avgrow_parent_class)->finalize (object);
+}
+
+static void gst_avgrow_band_func (gpointer data, gpointer user_data);
+
+static gboolean
+gst_avgrow_start (GstBaseTransform * trans)
+{
+  GstAvgrow *avgrow = GST_AVGROW (trans);
+  GError *error = NULL;
+  guint n_threads = avgrow->n_threads;
+
+  if (n_threads == 0)
+    n_threads = MIN (g_get_num_processors (), MAX_N_THREADS);
+
+  /* the streaming thread takes one band itself */
+  if (n_threads > 1) {
+    avgrow->pool = g_thread_pool_new (gst_avgrow_band_func, avgrow,
+        n_threads - 1, TRUE, &error);
+    if (!avgrow->pool) {
+      GST_WARNING_OBJECT (avgrow, "Unable to start %u threads: %s",
+          n_threads - 1, error->message);
+      g_error_free (error);
+      n_threads = 1;
+    }
+  }
+  avgrow->pool_threads = n_threads;
+  avgrow->bands = g_new0 (GstAvgrowBand, n_threads);
+
+  GST_DEBUG_OBJECT (avgrow, "summing frames with %u threads", n_threads);
+
+  return TRUE;
+}
+
+static gboolean
+gst_avgrow_stop (GstBaseTransform * trans)
+{
+  GstAvgrow *avgrow = GST_AVGROW (trans);
+
+  GST_DEBUG_OBJECT (avgrow, "stop");
+
+  if (avgrow->pool) {
+    g_thread_pool_free (avgrow->pool, FALSE, TRUE);
+    avgrow->pool = NULL;
+  }
+  g_free (avgrow->bands);
+  avgrow->bands = NULL;
+  gst_avgrow_free_sums (avgrow);
+  gst_avgrow_free_hist (avgrow);
+  gst_buffer_replace (&avgrow->scan_buf, NULL);
+  avgrow->scan_lines = 0;
+  avgrow->scan_start = GST_CLOCK_TIME_NONE;
+  avgrow->frame_counter = 0;
+  avgrow->window_start = GST_CLOCK_TIME_NONE;
+  avgrow->clear_pending = FALSE;
+
+  return TRUE;
+}
+
+/* the part of a width x height frame that is read, FALSE if the region of
+ * interest is not within the frame */
+static gboolean
+gst_avgrow_roi (GstAvgrow * avgrow, gint width, gint height, gint * x,
+    gint * y, gint * w, gint * h)
+{
+  if (avgrow->roi_left >= width || avgrow->roi_top >= height)
+    return FALSE;
+
+  *x = avgrow->roi_left;
+  *y = avgrow->roi_top;
+  *w = avgrow->roi_width ? avgrow->roi_width : width - *x;
+  *h = avgrow->roi_height ? avgrow->roi_height : height - *y;
+
+  return *w <= width - *x && *h <= height - *y;
+}
+
+/* the input size can not be told from the output size if the region of
+ * interest leaves any rows or columns out */
+static gboolean
+gst_avgrow_has_roi (GstAvgrow * avgrow)
+{
+  return avgrow->roi_top || avgrow->roi_height || avgrow->roi_left ||
+      avgrow->roi_width;
+}
+
 static GstCaps *
 gst_avgrow_fixate_caps (GstBaseTransform * base,
     GstPadDirection direction, GstCaps * caps, GstCaps * othercaps)
@@ -171,10 +584,14 @@ gst_avgrow_fixate_caps (GstBaseTransform * base,
   GstAvgrow *avgrow = GST_AVGROW (base);
   GstStructure *ins, *outs;
   gint from_w, from_h, to_w, to_h;
+  gint roi_x, roi_y, roi_w, roi_h;
 
   GST_DEBUG_OBJECT (base, "trying to fixate othercaps %" GST_PTR_FORMAT
       " based on caps %" GST_PTR_FORMAT, othercaps, caps);
 
+  if (avgrow->passthrough_meta)
+    return gst_caps_fixate (othercaps);
+
   ins = gst_caps_get_structure (caps, 0);
   outs = gst_caps_get_structure (othercaps, 0);
 
@@ -184,31 +601,49 @@ gst_avgrow_fixate_caps (GstBaseTransform * base,
   gst_structure_get_int (outs, "width", &to_w);
   gst_structure_get_int (outs, "height", &to_h);
 
-  /* if rows is larger than from_h do not set the caps */
-  if (!(from_h/avgrow->rows) && (!avgrow->total_avg))
-    return othercaps;
-
   /*cases for source and sink negotiation*/
   if (direction == GST_PAD_SINK) {
+    /* only the region of interest is averaged */
+    if (!gst_avgrow_roi (avgrow, from_w, from_h, &roi_x, &roi_y, &roi_w,
+            &roi_h))
+      return othercaps;
+
+    /* if rows is larger than the region height do not set the caps */
+    if (!(roi_h/avgrow->rows) && !avgrow->total_avg && !avgrow->line_scan)
+      return othercaps;
+
     /*is the othercaps height is a range then we try to negotiate it correctly
       otherwise we cant really do anything*/
     if (gst_structure_has_field_typed(outs, "height", GST_TYPE_INT_RANGE)) {
-      if (avgrow->total_avg)
+      if (avgrow->total_avg || avgrow->line_scan)
         gst_structure_set(outs, "height", G_TYPE_INT, 1, NULL);
       else
-        gst_structure_set(outs, "height", G_TYPE_INT, from_h / avgrow->rows, NULL);
+        gst_structure_set(outs, "height", G_TYPE_INT, roi_h / avgrow->rows, NULL);
     }
+    /* if cols is larger than the region width do not set the caps */
+    if (!(roi_w/avgrow->cols))
+      return othercaps;
+    if (gst_structure_has_field_typed(outs, "width", GST_TYPE_INT_RANGE))
+      gst_structure_set(outs, "width", G_TYPE_INT, roi_w / avgrow->cols, NULL);
 
   }
-  else {
+  else if (!gst_avgrow_has_roi (avgrow)) {
+    if (!(from_h/avgrow->rows) && (!avgrow->total_avg))
+      return othercaps;
+
     if (gst_structure_has_field_typed(outs, "height", GST_TYPE_INT_RANGE)) {
-      if (!(avgrow->total_avg))
+      if (!avgrow->total_avg && !avgrow->line_scan)
         gst_structure_set(outs, "height", G_TYPE_INT, from_h * avgrow->rows, NULL);
     }
+    if (gst_structure_has_field_typed(outs, "width", GST_TYPE_INT_RANGE))
+      gst_structure_set(outs, "width", G_TYPE_INT, from_w * avgrow->cols, NULL);
   }
 
-  gst_structure_set_value (outs, "format",
-      gst_structure_get_value (ins, "format"));
+  /* the float rows have no format to keep */
+  if (gst_structure_has_field (ins, "format") &&
+      gst_structure_has_field (outs, "format"))
+    gst_structure_set_value (outs, "format",
+        gst_structure_get_value (ins, "format"));
 
   GST_DEBUG_OBJECT (base, "fixated othercaps to %" GST_PTR_FORMAT, othercaps);
   return othercaps;
@@ -218,19 +653,65 @@ static GstCaps *
 gst_avgrow_transform_caps (GstBaseTransform * base,
     GstPadDirection direction, GstCaps * caps, GstCaps * filter)
 {
+  GstAvgrow *avgrow = GST_AVGROW (base);
 
-  GstStructure *newstruct;
+  GstStructure *newstruct, *s;
   GstCaps *newcaps, *ret;
-
-  newcaps = gst_caps_copy (caps);
-  newstruct = gst_caps_get_structure (newcaps, 0);
+  guint i, n;
 
   GST_DEBUG_OBJECT (base,
       "Transforming caps %" GST_PTR_FORMAT " in direction %s", caps,
       (direction == GST_PAD_SINK) ? "sink" : "src");
 
-  gst_structure_set (newstruct, "height", GST_TYPE_INT_RANGE, 1, G_MAXINT,
-    NULL);
+  /* the frames go through as they are */
+  if (avgrow->passthrough_meta) {
+    if (!filter)
+      return gst_caps_ref (caps);
+    return gst_caps_intersect_full (filter, caps, GST_CAPS_INTERSECT_FIRST);
+  }
+
+  newcaps = gst_caps_new_empty ();
+  n = gst_caps_get_size (caps);
+  for (i = 0; i < n; i++) {
+    newstruct = gst_structure_copy (gst_caps_get_structure (caps, i));
+
+    /* float rows are made from gray frames */
+    if (direction == GST_PAD_SRC &&
+        gst_structure_has_name (newstruct, GST_AVGROW_FLOAT_CAPS_NAME)) {
+      s = gst_structure_new_from_string (FLOAT_SINK_CAPS);
+      if (gst_structure_has_field (newstruct, "width"))
+        gst_structure_set_value (s, "width",
+            gst_structure_get_value (newstruct, "width"));
+      if (gst_structure_has_field (newstruct, "framerate"))
+        gst_structure_set_value (s, "framerate",
+            gst_structure_get_value (newstruct, "framerate"));
+      gst_structure_free (newstruct);
+      newstruct = s;
+    }
+
+    gst_structure_set (newstruct, "height", GST_TYPE_INT_RANGE, 1, G_MAXINT,
+      NULL);
+
+    /* the output is as wide as the region of interest divided by cols */
+    if (avgrow->roi_left || avgrow->roi_width || avgrow->cols > 1)
+      gst_structure_set (newstruct, "width", GST_TYPE_INT_RANGE, 1, G_MAXINT,
+        NULL);
+
+    gst_caps_append_structure_full (newcaps, newstruct,
+        gst_caps_features_copy (gst_caps_get_features (caps, i)));
+  }
+
+  /* the same rows can also go out as floats, after the formats of the input */
+  if (direction == GST_PAD_SINK) {
+    n = gst_caps_get_size (newcaps);
+    for (i = 0; i < n; i++) {
+      s = gst_structure_copy (gst_caps_get_structure (newcaps, i));
+      gst_structure_set_name (s, GST_AVGROW_FLOAT_CAPS_NAME);
+      gst_structure_remove_fields (s, "format", "interlace-mode",
+          "colorimetry", "chroma-site", "pixel-aspect-ratio", NULL);
+      gst_caps_append_structure (newcaps, s);
+    }
+  }
 
   /* if a filter is present, it needs to be applied */
   if (!filter)
@@ -248,17 +729,73 @@ gst_avgrow_set_info (GstVideoFilter * filter, GstCaps * incaps,
     GstVideoInfo * in_info, GstCaps * outcaps, GstVideoInfo * out_info)
 {
   GstAvgrow *avgrow = GST_AVGROW (filter);
+  gint roi_x, roi_y, roi_w, roi_h;
+
+  if (!gst_avgrow_roi (avgrow, in_info->width, in_info->height, &roi_x,
+          &roi_y, &roi_w, &roi_h)) {
+    GST_ERROR("Region of interest %d,%d %dx%d is not within the %dx%d input",
+        avgrow->roi_left, avgrow->roi_top, avgrow->roi_width,
+        avgrow->roi_height, in_info->width, in_info->height);
+    return FALSE;
+  }
+
+  if (avgrow->frameno > 1 && (!avgrow->total_avg || avgrow->roi_meta ||
+          avgrow->statistic != GST_AVGROW_STATISTIC_MEAN)) {
+    GST_ERROR("frameno=%d needs total-avg, the mean statistic and no "
+        "roi-meta", avgrow->frameno);
+    return FALSE;
+  }
+
+  /* the buffers are only made writable for the meta, there is nothing to
+   * allocate */
+  gst_base_transform_set_in_place (GST_BASE_TRANSFORM (filter),
+      avgrow->passthrough_meta);
+  if (avgrow->passthrough_meta) {
+    if (roi_w % avgrow->cols || avgrow->line_scan ||
+        avgrow->statistic != GST_AVGROW_STATISTIC_MEAN) {
+      GST_ERROR("The column profile needs the mean statistic, no line scan "
+          "and a region of interest that is a multiple of nocols=%d wide",
+          avgrow->cols);
+      return FALSE;
+    }
+    return TRUE;
+  }
+
+  if (roi_w != out_info->width * avgrow->cols) {
+    GST_ERROR("Input width is not larger than output by a factor of %d, input:%d, output:%d",
+        avgrow->cols, roi_w, out_info->width);
+    return FALSE;
+  }
+
+  if (avgrow->statistic != GST_AVGROW_STATISTIC_MEAN && avgrow->cols != 1) {
+    GST_ERROR("The robust statistics can not be combined with nocols=%d",
+        avgrow->cols);
+    return FALSE;
+  }
+
+  if (avgrow->float_out && (!GST_VIDEO_INFO_IS_GRAY (in_info) ||
+          avgrow->statistic != GST_AVGROW_STATISTIC_MEAN)) {
+    GST_ERROR("Float output needs gray input and the mean statistic");
+    return FALSE;
+  }
+
+  if (avgrow->line_scan && (avgrow->total_avg ||
+          avgrow->statistic != GST_AVGROW_STATISTIC_MEAN)) {
+    GST_ERROR("Line scan mode can not be combined with total-avg or the "
+        "robust statistics");
+    return FALSE;
+  }
 
-  if (avgrow->total_avg) {
+  if (avgrow->total_avg || avgrow->line_scan) {
     if (out_info->height!=1) {
-      GST_ERROR("Unable to set output frame to height == 1 in total average mode");
+      GST_ERROR("Unable to set output frame to height == 1 in %s mode",
+          avgrow->line_scan ? "line scan" : "total average");
       return FALSE;
     }
   }
-  else if ((in_info->width != out_info->width) ||
-        (in_info->height != (out_info->height * avgrow->rows))) {
+  else if (roi_h != (out_info->height * avgrow->rows)) {
     GST_ERROR("Input height is not larger than output by a factor of %d, input:%d, output:%d",
-        avgrow->rows, in_info->height, out_info->height);
+        avgrow->rows, roi_h, out_info->height);
       return FALSE;
   }
 
@@ -270,133 +807,1235 @@ gst_avgrow_set_info (GstVideoFilter * filter, GstCaps * incaps,
   return TRUE;
 }
 
+/* GstVideoFilter can only negotiate video formats. For the float rows the
+ * output is described by a frame of the input format with the output size,
+ * which is all the work setup looks at */
+static gboolean
+gst_avgrow_set_caps (GstBaseTransform * trans, GstCaps * incaps,
+    GstCaps * outcaps)
+{
+  GstAvgrow *avgrow = GST_AVGROW (trans);
+  GstVideoFilter *filter = GST_VIDEO_FILTER (trans);
+  GstStructure *s = gst_caps_get_structure (outcaps, 0);
+  GstVideoInfo in_info, out_info;
+  gint width, height;
+
+  avgrow->float_out = gst_structure_has_name (s, GST_AVGROW_FLOAT_CAPS_NAME);
+  if (!avgrow->float_out)
+    return GST_BASE_TRANSFORM_CLASS (gst_avgrow_parent_class)->set_caps (
+        trans, incaps, outcaps);
+
+  if (!gst_video_info_from_caps (&in_info, incaps) ||
+      !gst_structure_get_int (s, "width", &width) ||
+      !gst_structure_get_int (s, "height", &height)) {
+    GST_ERROR("Invalid caps %" GST_PTR_FORMAT " and %" GST_PTR_FORMAT, incaps,
+        outcaps);
+    filter->negotiated = FALSE;
+    return FALSE;
+  }
+  gst_video_info_set_format (&out_info, GST_VIDEO_INFO_FORMAT (&in_info),
+      width, height);
+
+  filter->negotiated = gst_avgrow_set_info (filter, incaps, &in_info, outcaps,
+      &out_info);
+  if (filter->negotiated) {
+    filter->in_info = in_info;
+    filter->out_info = out_info;
+  }
+
+  return filter->negotiated;
+}
 
-static GstFlowReturn
-gst_avgrow_transform_frame (GstVideoFilter * filter, GstVideoFrame * inframe,
-    GstVideoFrame * outframe)
+static gboolean
+gst_avgrow_get_unit_size (GstBaseTransform * trans, GstCaps * caps,
+    gsize * size)
 {
-  GstAvgrow *avgrow = GST_AVGROW (filter);
+  GstStructure *s = gst_caps_get_structure (caps, 0);
+  gint width, height;
 
-  int i, j, z;
-  guint64 sum;
+  if (!gst_structure_has_name (s, GST_AVGROW_FLOAT_CAPS_NAME))
+    return GST_BASE_TRANSFORM_CLASS (gst_avgrow_parent_class)->get_unit_size (
+        trans, caps, size);
+
+  if (!gst_structure_get_int (s, "width", &width) ||
+      !gst_structure_get_int (s, "height", &height))
+    return FALSE;
+
+  *size = (gsize) width * height * sizeof (gfloat);
+
+  return TRUE;
+}
+
+/* GstVideoFilter takes the size from video caps, which the float rows do not
+ * have */
+static gboolean
+gst_avgrow_transform_size (GstBaseTransform * trans,
+    GstPadDirection direction, GstCaps * caps, gsize size,
+    GstCaps * othercaps, gsize * othersize)
+{
+  GstStructure *s = gst_caps_get_structure (othercaps, 0);
+
+  if (!gst_structure_has_name (s, GST_AVGROW_FLOAT_CAPS_NAME))
+    return GST_BASE_TRANSFORM_CLASS (gst_avgrow_parent_class)->transform_size (
+        trans, direction, caps, size, othercaps, othersize);
+
+  return gst_avgrow_get_unit_size (trans, othercaps, othersize);
+}
+
+/* the video buffer pool only takes video caps, the float rows come from a
+ * plain pool */
+static gboolean
+gst_avgrow_decide_allocation (GstBaseTransform * trans, GstQuery * query)
+{
+  GstCaps *caps;
+  GstBufferPool *pool;
+  GstStructure *config;
+  gsize size;
+  guint min = 0, max = 0;
+
+  gst_query_parse_allocation (query, &caps, NULL);
+  if (!caps || !gst_structure_has_name (gst_caps_get_structure (caps, 0),
+          GST_AVGROW_FLOAT_CAPS_NAME))
+    return GST_BASE_TRANSFORM_CLASS (gst_avgrow_parent_class)->
+        decide_allocation (trans, query);
+
+  if (!gst_avgrow_get_unit_size (trans, caps, &size))
+    return FALSE;
+
+  if (gst_query_get_n_allocation_pools (query) > 0)
+    gst_query_parse_nth_allocation_pool (query, 0, NULL, NULL, &min, &max);
+
+  pool = gst_buffer_pool_new ();
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_set_params (config, caps, size, min, max);
+  if (!gst_buffer_pool_set_config (pool, config)) {
+    GST_ERROR("Unable to configure the buffer pool for %" GST_PTR_FORMAT,
+        caps);
+    gst_object_unref (pool);
+    return FALSE;
+  }
+
+  if (gst_query_get_n_allocation_pools (query) > 0)
+    gst_query_set_nth_allocation_pool (query, 0, pool, size, min, max);
+  else
+    gst_query_add_allocation_pool (query, pool, size, min, max);
+  gst_object_unref (pool);
+
+  return TRUE;
+}
+
+/* The frame is streamed row by row into a row of per column sums, so every
+ * input sample is read once and in memory order. The sums are only divided
+ * and written out once a whole group of rows has been added.
+ */
+static void
+gst_avgrow_accum_u8 (guint64 * sums, gconstpointer row, gint n)
+{
+  const guint8 *src = row;
+  gint i;
+
+  for (i = 0; i < n; i++)
+    sums[i] += src[i];
+}
+
+static void
+gst_avgrow_accum_u16 (guint64 * sums, gconstpointer row, gint n)
+{
+  const guint16 *src = row;
+  gint i;
+
+  for (i = 0; i < n; i++)
+    sums[i] += src[i];
+}
+
+static void
+gst_avgrow_accum_u16_swap (guint64 * sums, gconstpointer row, gint n)
+{
+  const guint16 *src = row;
+  gint i;
+
+  for (i = 0; i < n; i++)
+    sums[i] += __bswap_16 (src[i]);
+}
+
+static void
+gst_avgrow_store_u8 (gpointer row, guint64 * sums, gint n, guint count)
+{
+  guint8 *dst = row;
+  gint i;
+
+  for (i = 0; i < n; i++) {
+    dst[i] = sums[i] / count;
+    sums[i] = 0;
+  }
+}
+
+static void
+gst_avgrow_store_u16 (gpointer row, guint64 * sums, gint n, guint count)
+{
+  guint16 *dst = row;
+  gint i;
+
+  for (i = 0; i < n; i++) {
+    dst[i] = sums[i] / count;
+    sums[i] = 0;
+  }
+}
+
+static void
+gst_avgrow_store_u16_swap (gpointer row, guint64 * sums, gint n, guint count)
+{
+  guint16 *dst = row;
   guint16 val;
-  gint outwidth = outframe->info.width;
-  guint n_comps = outframe->info.finfo->n_components;
-  gint in_step = GST_VIDEO_FRAME_PLANE_STRIDE(inframe,0)/(inframe->info.finfo->bits/8);
-  gint out_step = GST_VIDEO_FRAME_PLANE_STRIDE(outframe,0)/(outframe->info.finfo->bits/8);
-  union {
-    guint8  *d8;
-    guint16 *d16;
-    gpointer ptr;
-  } indata, outdata;
-
-
-  indata.ptr = GST_VIDEO_FRAME_PLANE_DATA (inframe, 0);
-  outdata.ptr = GST_VIDEO_FRAME_PLANE_DATA (outframe, 0);
-
-
-  if (outframe->info.finfo->bits == 8) {
-    if (avgrow->total_avg) {
-      for (i=0; i < outwidth*n_comps; i++) {
-        sum = 0;
-        for (z=0; z<inframe->info.height; z++) {
-          sum +=  indata.d8[i + z*in_step];
-        }
-        sum /= inframe->info.height;
-        outdata.d8[i] = sum;
-      }
+  gint i;
+
+  for (i = 0; i < n; i++) {
+    val = sums[i] / count;
+    dst[i] = __bswap_16 (val);
+    sums[i] = 0;
+  }
+}
+
+/* Sums of up to 2^(31 - bits) samples fit the 32 bit accumulators and can
+ * be divided by a reciprocal multiplication, which is what the vector
+ * kernels do. Larger blocks fall back to the 64 bit scalar path above. */
+static gboolean
+gst_avgrow_fits_kernels (guint divisor, guint bits)
+{
+  guint l = 0;
+
+  while (((guint64) 1 << l) < divisor)
+    l++;
+
+  return bits + l <= 31;
+}
+
+/* picks the sums for adding up divisor samples of work->bits and how to
+ * divide them again */
+static void
+gst_avgrow_set_divisor (GstAvgrowWork * work, guint divisor)
+{
+  work->divisor = divisor;
+  work->wide = !gst_avgrow_fits_kernels (divisor, work->bits);
+  if (work->wide) {
+    if (work->bits == 8) {
+      work->accum_wide = gst_avgrow_accum_u8;
+      work->store_wide = gst_avgrow_store_u8;
+    } else if (work->swap) {
+      work->accum_wide = gst_avgrow_accum_u16_swap;
+      work->store_wide = gst_avgrow_store_u16_swap;
     } else {
-      if (inframe->info.height == (outframe->info.height * avgrow->rows)) {
-
-        for (i=0; i < outwidth*n_comps; i++) {
-          for (j=0; j < outframe->info.height; j++) {
-            sum = 0;
-            for (z=0; z<avgrow->rows; z++)
-              sum +=  indata.d8[i + j*in_step*avgrow->rows + z*in_step];
-            sum /= avgrow->rows;
-            outdata.d8[i + (j*out_step)] = sum;
-          }
-        }
+      work->accum_wide = gst_avgrow_accum_u16;
+      work->store_wide = gst_avgrow_store_u16;
+    }
+  } else
+    avg_kernels_reciprocal (divisor, work->bits, &work->mul, &work->shift);
+}
 
-      } else {
-        GST_ERROR("Input height is not larger than output by a factor of %d, input:%d, output:%d",
-          avgrow->rows, inframe->info.height, outframe->info.height);
-        return GST_FLOW_ERROR;
-      }
+/* gives every band its own row of sums, each starting on a new cache line so
+ * the threads do not share any */
+static gboolean
+gst_avgrow_alloc_sums (GstAvgrow * avgrow, gint n)
+{
+  gsize row = GST_ROUND_UP_16 (n);
+  guint i;
+
+  gst_avgrow_free_sums (avgrow);
+
+  if (posix_memalign ((void **) &avgrow->sums, 64,
+          avgrow->pool_threads * row * sizeof (guint32)) != 0) {
+    avgrow->sums = NULL;
+    return FALSE;
+  }
+  if (posix_memalign ((void **) &avgrow->wide_sums, 64,
+          avgrow->pool_threads * row * sizeof (guint64)) != 0) {
+    avgrow->wide_sums = NULL;
+    gst_avgrow_free_sums (avgrow);
+    return FALSE;
+  }
+  memset (avgrow->sums, 0, avgrow->pool_threads * row * sizeof (guint32));
+  memset (avgrow->wide_sums, 0, avgrow->pool_threads * row * sizeof (guint64));
+
+  for (i = 0; i < avgrow->pool_threads; i++) {
+    avgrow->bands[i].sums = avgrow->sums + i * row;
+    avgrow->bands[i].wide_sums = avgrow->wide_sums + i * row;
+  }
+  avgrow->n_sums = n;
+
+  return TRUE;
+}
+
+static inline void
+gst_avgrow_accum_row (GstAvgrow * avgrow, GstAvgrowBand * band,
+    const guint8 * src)
+{
+  const GstAvgrowWork *work = &avgrow->work;
+  const AvgKernels *k = avgrow->kernels;
+
+  if (work->wide)
+    work->accum_wide (band->wide_sums, src, work->n);
+  else if (work->bits == 8)
+    k->accum_u8 (band->sums, src, work->n);
+  else if (work->swap)
+    k->accum_u16_swap (band->sums, (const guint16 *) src, work->n);
+  else
+    k->accum_u16 (band->sums, (const guint16 *) src, work->n);
+}
+
+/* adds up every cols neighbouring pixels of the sums in place, the sums of
+ * a pixel never move to the right so they can be read after the ones
+ * before them are written */
+static void
+gst_avgrow_bin_u32 (guint32 * sums, gint n_out, gint cols, gint comps)
+{
+  gint i, k, first;
+  guint32 sum;
+
+  for (i = 0; i < n_out; i++) {
+    first = (i / comps) * cols * comps + i % comps;
+    sum = 0;
+    for (k = 0; k < cols; k++)
+      sum += sums[first + k * comps];
+    sums[i] = sum;
+  }
+}
+
+static void
+gst_avgrow_bin_u64 (guint64 * sums, gint n_out, gint cols, gint comps)
+{
+  gint i, k, first;
+  guint64 sum;
+
+  for (i = 0; i < n_out; i++) {
+    first = (i / comps) * cols * comps + i % comps;
+    sum = 0;
+    for (k = 0; k < cols; k++)
+      sum += sums[first + k * comps];
+    sums[i] = sum;
+  }
+}
+
+/* bins the columns of a band's sums down to n_out sums. Single component
+ * rows binned by a power of two are folded with the pair_add kernel */
+static void
+gst_avgrow_bin (GstAvgrow * avgrow, GstAvgrowBand * band)
+{
+  const GstAvgrowWork *work = &avgrow->work;
+  gint n;
+
+  if (work->wide) {
+    gst_avgrow_bin_u64 (band->wide_sums, work->n_out, work->cols, work->comps);
+    memset (band->wide_sums + work->n_out, 0,
+        (work->n - work->n_out) * sizeof (guint64));
+    return;
+  }
+
+  if (work->comps == 1 && (work->cols & (work->cols - 1)) == 0) {
+    for (n = work->n / 2; n >= work->n_out; n /= 2)
+      avgrow->row_kernels->pair_add (band->sums, band->sums, n);
+  } else
+    gst_avgrow_bin_u32 (band->sums, work->n_out, work->cols, work->comps);
+  memset (band->sums + work->n_out, 0,
+      (work->n - work->n_out) * sizeof (guint32));
+}
+
+/* the exact means, without rounding them to the input format */
+static void
+gst_avgrow_store_float (GstAvgrow * avgrow, GstAvgrowBand * band,
+    gfloat * dst)
+{
+  const GstAvgrowWork *work = &avgrow->work;
+  gdouble divisor = work->divisor;
+  gint i;
+
+  if (work->wide) {
+    for (i = 0; i < work->n_out; i++) {
+      dst[i] = band->wide_sums[i] / divisor;
+      band->wide_sums[i] = 0;
+    }
+  } else {
+    for (i = 0; i < work->n_out; i++) {
+      dst[i] = band->sums[i] / divisor;
+      band->sums[i] = 0;
     }
   }
-  else if (outframe->info.finfo->bits == 16) {
-    if (inframe->info.finfo->format == GST_VIDEO_FORMAT_GRAY16_LE) {
-      if (avgrow->total_avg) {
-        for (i=0; i < outwidth*n_comps; i++) {
-          sum = 0;
-          for (z=0; z<inframe->info.height; z++)
-            sum +=  indata.d16[i + z*in_step];
-          sum /= inframe->info.height;
-          outdata.d16[i] = sum;
-        }
-      } else {
-        if (inframe->info.height == (outframe->info.height * avgrow->rows)) {
-
-          for (i=0; i < outwidth*n_comps; i++) {
-            for (j=0; j < outframe->info.height; j++) {
-              sum = 0;
-              for (z=0; z<avgrow->rows; z++)
-                sum +=  indata.d16[i + j*in_step*avgrow->rows + z*in_step];
-              sum /= avgrow->rows;
-              outdata.d16[i + (j*out_step)] = sum;
-            }
-          }
+}
 
-        } else {
-          GST_ERROR("Input height is not larger than output by a factor of %d, input:%d, output:%d",
-            avgrow->rows, inframe->info.height, outframe->info.height);
-          return GST_FLOW_ERROR;
-        }
-      }
-    } else if (inframe->info.finfo->format == GST_VIDEO_FORMAT_GRAY16_BE) {
-      if (avgrow->total_avg) {
-        for (i=0; i < outwidth*n_comps; i++) {
-          sum = 0;
-          for (z=0; z<inframe->info.height; z++)
-            sum +=  __bswap_16(indata.d16[i + z*in_step]);
-          sum /= inframe->info.height;
-          val = sum;
-          outdata.d16[i] = __bswap_16(val);
-        }
-      } else {
-        if (inframe->info.height == (outframe->info.height * avgrow->rows)) {
-
-          for (i=0; i < outwidth*n_comps; i++) {
-            for (j=0; j < outframe->info.height; j++) {
-              sum = 0;
-              for (z=0; z<avgrow->rows; z++)
-                sum +=  __bswap_16(indata.d16[i + j*in_step*avgrow->rows + z*in_step]);
-              sum /= avgrow->rows;
-              val = sum;
-              outdata.d16[i + (j*out_step)] = __bswap_16(val);
-            }
-          }
+static void
+gst_avgrow_store_row (GstAvgrow * avgrow, GstAvgrowBand * band, guint8 * dst)
+{
+  const GstAvgrowWork *work = &avgrow->work;
+  const AvgKernels *k = avgrow->kernels;
+
+  if (work->cols > 1)
+    gst_avgrow_bin (avgrow, band);
+
+  if (work->float_out)
+    gst_avgrow_store_float (avgrow, band, (gfloat *) dst);
+  else if (work->wide)
+    work->store_wide (dst, band->wide_sums, work->n_out, work->divisor);
+  else if (work->bits == 8)
+    k->norm_u8 (dst, band->sums, work->n_out, work->mul, work->shift, TRUE);
+  else if (work->swap)
+    k->norm_u16_swap ((guint16 *) dst, band->sums, work->n_out, work->mul,
+        work->shift, TRUE);
+  else
+    k->norm_u16 ((guint16 *) dst, band->sums, work->n_out, work->mul,
+        work->shift, TRUE);
+}
 
-        } else {
-          GST_ERROR("Input height is not larger than output by a factor of %d, input:%d, output:%d",
-            avgrow->rows, inframe->info.height, outframe->info.height);
-          return GST_FLOW_ERROR;
-        }
+static void
+gst_avgrow_accum_band (GstAvgrow * avgrow, GstAvgrowBand * band)
+{
+  const guint8 *src = avgrow->work.src + band->start * avgrow->work.in_stride;
+  gint z;
+
+  for (z = 0; z < band->n; z++) {
+    gst_avgrow_accum_row (avgrow, band, src);
+    src += avgrow->work.in_stride;
+  }
+}
+
+static void
+gst_avgrow_band_func (gpointer data, gpointer user_data)
+{
+  GstAvgrow *avgrow = GST_AVGROW (user_data);
+
+  gst_avgrow_accum_band (avgrow, data);
+
+  g_mutex_lock (&avgrow->lock);
+  if (--avgrow->pending == 0)
+    g_cond_signal (&avgrow->cond);
+  g_mutex_unlock (&avgrow->lock);
+}
+
+/* adds the partial sums of the other bands to the first one */
+static void
+gst_avgrow_merge_bands (GstAvgrow * avgrow, guint n_bands)
+{
+  GstAvgrowBand *first = &avgrow->bands[0];
+  gint n = avgrow->work.n;
+  guint b;
+  gint i;
+
+  for (b = 1; b < n_bands; b++) {
+    GstAvgrowBand *band = &avgrow->bands[b];
+
+    if (avgrow->work.wide) {
+      for (i = 0; i < n; i++) {
+        first->wide_sums[i] += band->wide_sums[i];
+        band->wide_sums[i] = 0;
+      }
+    } else {
+      for (i = 0; i < n; i++) {
+        first->sums[i] += band->sums[i];
+        band->sums[i] = 0;
       }
     }
-    else {
+  }
+}
+
+/* sums all rows of the frame into the first band. Large frames are split
+ * into bands of rows that are summed by the pool and the streaming thread
+ * into their own rows of partial sums, which are merged once all bands are
+ * done. */
+static void
+gst_avgrow_sum_frame (GstAvgrow * avgrow, gint rows)
+{
+  gint band_rows;
+  guint n_bands = 1;
+  guint i;
+
+  if (avgrow->pool)
+    n_bands = MIN (avgrow->pool_threads,
+        ((gsize) rows * avgrow->work.n + MIN_BAND_SIZE - 1) / MIN_BAND_SIZE);
+  n_bands = MIN (n_bands, rows);
+
+  if (n_bands <= 1) {
+    avgrow->bands[0].start = 0;
+    avgrow->bands[0].n = rows;
+    gst_avgrow_accum_band (avgrow, &avgrow->bands[0]);
+    return;
+  }
+
+  band_rows = (rows + n_bands - 1) / n_bands;
+  n_bands = (rows + band_rows - 1) / band_rows;
+
+  g_mutex_lock (&avgrow->lock);
+  avgrow->pending = n_bands - 1;
+  g_mutex_unlock (&avgrow->lock);
+
+  for (i = 0; i < n_bands; i++) {
+    avgrow->bands[i].start = i * band_rows;
+    avgrow->bands[i].n = MIN (band_rows, rows - (gint) i * band_rows);
+    if (i > 0)
+      g_thread_pool_push (avgrow->pool, &avgrow->bands[i], NULL);
+  }
+  gst_avgrow_accum_band (avgrow, &avgrow->bands[0]);
+
+  g_mutex_lock (&avgrow->lock);
+  while (avgrow->pending > 0)
+    g_cond_wait (&avgrow->cond, &avgrow->lock);
+  g_mutex_unlock (&avgrow->lock);
+
+  gst_avgrow_merge_bands (avgrow, n_bands);
+}
+
+/* Robust statistics. Every column gets a histogram of 256 bins, and the
+ * statistic is the mean of the samples with the ranks lo to hi - 1 of a
+ * column, which is the median for hi = lo + 1. 8 bit samples are counted
+ * directly. For 16 bit samples a first pass counts the high bytes, which
+ * tells in which buckets the ranks lo and hi - 1 are, and a second pass
+ * counts the low bytes of the samples in those two buckets and sums the
+ * samples of the buckets in between. Both stay linear in the number of
+ * samples and need no sorting. */
+
+static gboolean
+gst_avgrow_alloc_hist (GstAvgrow * avgrow, gint n, guint bits)
+{
+  gst_avgrow_free_hist (avgrow);
+
+  avgrow->hist = g_try_new0 (guint32, (gsize) n * 256);
+  if (bits == 16) {
+    avgrow->fine_hist = g_try_new0 (guint32, (gsize) n * 256);
+    avgrow->ranks = g_try_new0 (GstAvgrowRanks, n);
+  }
+  if (!avgrow->hist || (bits == 16 && (!avgrow->fine_hist || !avgrow->ranks))) {
+    gst_avgrow_free_hist (avgrow);
+    return FALSE;
+  }
+  avgrow->n_hist = n;
+
+  return TRUE;
+}
+
+static void
+gst_avgrow_rank_range (GstAvgrow * avgrow, guint count, guint * lo, guint * hi)
+{
+  *lo = (count - 1) / 2;
+  *hi = *lo + 1;
+
+  if (avgrow->statistic == GST_AVGROW_STATISTIC_TRIMMED_MEAN &&
+      count - 2 * (guint) (count * avgrow->trim) > 0) {
+    *lo = count * avgrow->trim;
+    *hi = count - *lo;
+  }
+}
+
+/* sums the samples with ranks lo to hi - 1 of a histogram of the values
+ * base to base + 255, whose first sample has the rank first. The histogram
+ * is cleared on the way */
+static guint64
+gst_avgrow_hist_sum (guint32 * hist, guint base, guint first, guint lo,
+    guint hi)
+{
+  guint64 sum = 0;
+  guint r = first, a, b;
+  gint v;
+
+  for (v = 0; v < 256; v++) {
+    if (!hist[v])
+      continue;
+    a = MAX (r, lo);
+    b = MIN (r + hist[v], hi);
+    if (b > a)
+      sum += (guint64) (base + v) * (b - a);
+    r += hist[v];
+    hist[v] = 0;
+  }
+
+  return sum;
+}
+
+/* finds the buckets of the ranks lo and hi - 1 in a high byte histogram and
+ * clears it */
+static void
+gst_avgrow_find_buckets (guint32 * hist, guint lo, guint hi,
+    GstAvgrowRanks * ranks)
+{
+  guint r = 0;
+  gint v;
+
+  for (v = 0; v < 256; v++) {
+    if (r <= lo && lo < r + hist[v]) {
+      ranks->lo_bucket = v;
+      ranks->lo_first = r;
+    }
+    if (r <= hi - 1 && hi - 1 < r + hist[v]) {
+      ranks->hi_bucket = v;
+      ranks->hi_first = r;
+    }
+    r += hist[v];
+    hist[v] = 0;
+  }
+  ranks->sum = 0;
+}
+
+/* writes the robust statistic of every column of the rows of src to dst */
+static void
+gst_avgrow_robust_group (GstAvgrow * avgrow, const guint8 * src, gint rows,
+    guint8 * dst)
+{
+  const GstAvgrowWork *work = &avgrow->work;
+  const guint8 *row;
+  const guint16 *row16;
+  guint32 *hist = avgrow->hist;
+  guint32 *fine = avgrow->fine_hist;
+  GstAvgrowRanks *ranks = avgrow->ranks;
+  guint lo, hi, v, b;
+  guint16 val;
+  gint i, z;
+
+  gst_avgrow_rank_range (avgrow, rows, &lo, &hi);
+
+  if (work->bits == 8) {
+    for (z = 0, row = src; z < rows; z++, row += work->in_stride)
+      for (i = 0; i < work->n; i++)
+        hist[i * 256 + row[i]]++;
+
+    for (i = 0; i < work->n; i++)
+      dst[i] = gst_avgrow_hist_sum (hist + i * 256, 0, 0, lo, hi) / (hi - lo);
+    return;
+  }
+
+  for (z = 0, row = src; z < rows; z++, row += work->in_stride) {
+    row16 = (const guint16 *) row;
+    for (i = 0; i < work->n; i++) {
+      v = work->swap ? __bswap_16 (row16[i]) : row16[i];
+      hist[i * 256 + (v >> 8)]++;
+    }
+  }
+
+  for (i = 0; i < work->n; i++)
+    gst_avgrow_find_buckets (hist + i * 256, lo, hi, &ranks[i]);
+
+  for (z = 0, row = src; z < rows; z++, row += work->in_stride) {
+    row16 = (const guint16 *) row;
+    for (i = 0; i < work->n; i++) {
+      v = work->swap ? __bswap_16 (row16[i]) : row16[i];
+      b = v >> 8;
+      if (b == ranks[i].lo_bucket)
+        hist[i * 256 + (v & 0xff)]++;
+      else if (b == ranks[i].hi_bucket)
+        fine[i * 256 + (v & 0xff)]++;
+      else if (b > ranks[i].lo_bucket && b < ranks[i].hi_bucket)
+        ranks[i].sum += v;
+    }
+  }
+
+  for (i = 0; i < work->n; i++) {
+    guint64 sum = ranks[i].sum;
+
+    sum += gst_avgrow_hist_sum (hist + i * 256, ranks[i].lo_bucket << 8,
+        ranks[i].lo_first, lo, hi);
+    if (ranks[i].hi_bucket != ranks[i].lo_bucket)
+      sum += gst_avgrow_hist_sum (fine + i * 256, ranks[i].hi_bucket << 8,
+          ranks[i].hi_first, lo, hi);
+    val = sum / (hi - lo);
+    ((guint16 *) dst)[i] = work->swap ? __bswap_16 (val) : val;
+  }
+}
+
+/* sets up avgrow->work for reading the region of interest of inframe into
+ * out_info sized rows, and returns the number of rows of the region */
+static gboolean
+gst_avgrow_setup_work (GstAvgrow * avgrow, GstVideoFrame * inframe,
+    GstVideoInfo * out_info, gint * rows)
+{
+  GstAvgrowWork *work = &avgrow->work;
+
+  gint roi_x, roi_y, roi_w, roi_h;
+  gboolean swap = FALSE;
+  guint bits = out_info->finfo->bits;
+  gint comps = out_info->finfo->n_components;
+  gint n;
+  const guint8 *indata = GST_VIDEO_FRAME_PLANE_DATA (inframe, 0);
+  GstVideoRegionOfInterestMeta *meta;
+
+  if (bits == 16) {
+    if (inframe->info.finfo->format == GST_VIDEO_FORMAT_GRAY16_BE)
+      swap = TRUE;
+    else if (inframe->info.finfo->format != GST_VIDEO_FORMAT_GRAY16_LE) {
       GST_ERROR("Unhandled format type");
-      return GST_FLOW_ERROR;
+      return FALSE;
+    }
+  }
+  else if (bits != 8) {
+    GST_ERROR("Unhandled data size of %d bits", bits);
+    return FALSE;
+  }
+
+  if (!gst_avgrow_roi (avgrow, inframe->info.width, inframe->info.height,
+          &roi_x, &roi_y, &roi_w, &roi_h) ||
+      roi_w != out_info->width * avgrow->cols) {
+    GST_ERROR("Region of interest does not match the negotiated frames");
+    return FALSE;
+  }
+  n = roi_w * comps;
+
+  /* the output size is fixed, so a region from the buffer can only narrow
+   * down the rows of a total average or a column profile */
+  if (avgrow->roi_meta && (avgrow->total_avg || avgrow->passthrough_meta)) {
+    meta = gst_buffer_get_video_region_of_interest_meta (inframe->buffer);
+    if (meta && (gint) meta->y < roi_y + roi_h &&
+        (gint) (meta->y + meta->h) > roi_y) {
+      roi_h = MIN ((gint) (meta->y + meta->h), roi_y + roi_h);
+      roi_y = MAX ((gint) meta->y, roi_y);
+      roi_h -= roi_y;
+    } else if (meta) {
+      GST_DEBUG_OBJECT (avgrow, "Region meta is outside of the region of "
+          "interest, ignoring it");
     }
   }
+
+  indata += roi_y * GST_VIDEO_FRAME_PLANE_STRIDE (inframe, 0) +
+      roi_x * GST_VIDEO_FRAME_COMP_PSTRIDE (inframe, 0);
+
+  /* total-avg and the column profile are simply a single group covering
+   * the whole region, in line scan mode the groups go across buffers */
+  if (avgrow->line_scan)
+    work->group = avgrow->rows;
+  else if (avgrow->total_avg || avgrow->passthrough_meta)
+    work->group = roi_h;
+  else if (roi_h == (out_info->height * avgrow->rows))
+    work->group = avgrow->rows;
   else {
-    GST_ERROR("Unhandled data size of %d bits", outframe->info.finfo->bits);
+    GST_ERROR("Input height is not larger than output by a factor of %d, input:%d, output:%d",
+      avgrow->rows, roi_h, out_info->height);
+    return FALSE;
+  }
+
+  if (avgrow->n_sums != n) {
+    if (!gst_avgrow_alloc_sums (avgrow, n)) {
+      GST_ERROR("Unable to allocate memory for the sums");
+      return FALSE;
+    }
+    /* the lines and frames added up so far are gone with the old sums */
+    avgrow->scan_lines = 0;
+    avgrow->frame_counter = 0;
+  }
+
+  work->src = indata;
+  work->in_stride = GST_VIDEO_FRAME_PLANE_STRIDE (inframe, 0);
+  work->n = n;
+  work->cols = avgrow->cols;
+  work->comps = comps;
+  work->n_out = out_info->width * comps;
+  work->bits = bits;
+  work->swap = swap;
+  work->float_out = avgrow->float_out || avgrow->passthrough_meta;
+  /* the windowed total average scales this by its frames */
+  gst_avgrow_set_divisor (work, work->group * work->cols);
+
+  if (avgrow->statistic != GST_AVGROW_STATISTIC_MEAN &&
+      (avgrow->n_hist != n || (bits == 16 && !avgrow->fine_hist)) &&
+      !gst_avgrow_alloc_hist (avgrow, n, bits)) {
+    GST_ERROR("Unable to allocate memory for the histograms");
+    return FALSE;
+  }
+
+  *rows = roi_h;
+  return TRUE;
+}
+
+/* forgets the lines or frames that have been added up for the next row.
+ * The sums are only touched by the streaming thread, which clears them the
+ * next time it looks at them */
+static void
+gst_avgrow_clear_sums (GstAvgrow * avgrow)
+{
+  g_mutex_lock (&avgrow->lock);
+  avgrow->clear_pending = TRUE;
+  g_mutex_unlock (&avgrow->lock);
+}
+
+/* clears the sums if a flush asked for it, called by the streaming thread
+ * with the lock held. Returns TRUE if the sums were cleared */
+static gboolean
+gst_avgrow_take_clear (GstAvgrow * avgrow)
+{
+  if (!avgrow->clear_pending)
+    return FALSE;
+
+  if (avgrow->sums && avgrow->bands) {
+    memset (avgrow->bands[0].sums, 0, avgrow->n_sums * sizeof (guint32));
+    memset (avgrow->bands[0].wide_sums, 0, avgrow->n_sums * sizeof (guint64));
+  }
+  avgrow->scan_lines = 0;
+  avgrow->scan_start = GST_CLOCK_TIME_NONE;
+  avgrow->frame_counter = 0;
+  avgrow->window_start = GST_CLOCK_TIME_NONE;
+  avgrow->clear_pending = FALSE;
+
+  return TRUE;
+}
+
+/* the time line of a frame starts at, interpolated over the buffer */
+static GstClockTime
+gst_avgrow_line_time (GstBuffer * buffer, gint line, gint height)
+{
+  if (!GST_BUFFER_PTS_IS_VALID (buffer))
+    return GST_CLOCK_TIME_NONE;
+  if (!GST_BUFFER_DURATION_IS_VALID (buffer))
+    return GST_BUFFER_PTS (buffer);
+
+  return GST_BUFFER_PTS (buffer) +
+      gst_util_uint64_scale_int (GST_BUFFER_DURATION (buffer), line, height);
+}
+
+/* In line scan mode the lines of the incoming buffers are added up until
+ * norows of them are in, wherever the buffer boundaries are, and every
+ * complete row goes out as a buffer of its own. A buffer can complete
+ * several rows, this is called until it does not return one anymore. */
+static GstFlowReturn
+gst_avgrow_generate_output (GstBaseTransform * trans, GstBuffer ** outbuf)
+{
+  GstAvgrow *avgrow = GST_AVGROW (trans);
+  GstVideoFilter *filter = GST_VIDEO_FILTER (trans);
+  GstVideoFrame inframe, outframe;
+  GstMapInfo map;
+  GstFlowReturn ret = GST_FLOW_OK;
+  const guint8 *indata;
+  guint8 *outdata;
+  gboolean flushed;
+  GstClockTime end;
+  gint rows = 0, first;
+
+  if (!avgrow->line_scan)
+    return GST_BASE_TRANSFORM_CLASS (gst_avgrow_parent_class)->
+        generate_output (trans, outbuf);
+
+  *outbuf = NULL;
+
+  if (trans->queued_buf) {
+    gst_buffer_replace (&avgrow->scan_buf, NULL);
+    avgrow->scan_buf = trans->queued_buf;
+    avgrow->scan_line = 0;
+    trans->queued_buf = NULL;
+  }
+  if (!avgrow->scan_buf)
+    return GST_FLOW_OK;
+
+  if (!filter->negotiated) {
+    gst_buffer_replace (&avgrow->scan_buf, NULL);
+    return GST_FLOW_NOT_NEGOTIATED;
+  }
+
+  if (!gst_video_frame_map (&inframe, &filter->in_info, avgrow->scan_buf,
+          GST_MAP_READ)) {
+    GST_ERROR("Unable to map the input buffer");
+    gst_buffer_replace (&avgrow->scan_buf, NULL);
     return GST_FLOW_ERROR;
   }
+
+  /* the lines are counted from the top of the region of interest */
+  first = avgrow->roi_top;
+
+  g_mutex_lock (&avgrow->lock);
+  if (!gst_avgrow_setup_work (avgrow, &inframe, &filter->out_info, &rows)) {
+    g_mutex_unlock (&avgrow->lock);
+    ret = GST_FLOW_ERROR;
+    goto done;
+  }
+  gst_avgrow_take_clear (avgrow);
+  indata = avgrow->work.src + avgrow->scan_line * avgrow->work.in_stride;
+  while (avgrow->scan_line < rows && avgrow->scan_lines < avgrow->work.group) {
+    if (avgrow->scan_lines == 0)
+      avgrow->scan_start = gst_avgrow_line_time (avgrow->scan_buf,
+          first + avgrow->scan_line, inframe.info.height);
+    gst_avgrow_accum_row (avgrow, &avgrow->bands[0], indata);
+    indata += avgrow->work.in_stride;
+    avgrow->scan_line++;
+    avgrow->scan_lines++;
+  }
+  g_mutex_unlock (&avgrow->lock);
+
+  if (avgrow->scan_lines < avgrow->work.group)
+    goto done;
+
+  ret = GST_BASE_TRANSFORM_GET_CLASS (trans)->prepare_output_buffer (trans,
+      avgrow->scan_buf, outbuf);
+  if (ret != GST_FLOW_OK || !*outbuf)
+    goto done;
+
+  if (avgrow->float_out ? !gst_buffer_map (*outbuf, &map, GST_MAP_WRITE) :
+      !gst_video_frame_map (&outframe, &filter->out_info, *outbuf,
+          GST_MAP_WRITE)) {
+    GST_ERROR("Unable to map the output buffer");
+    gst_buffer_replace (outbuf, NULL);
+    ret = GST_FLOW_ERROR;
+    goto done;
+  }
+  outdata = avgrow->float_out ? map.data :
+      GST_VIDEO_FRAME_PLANE_DATA (&outframe, 0);
+
+  g_mutex_lock (&avgrow->lock);
+  /* flushed while the buffer was being prepared */
+  flushed = gst_avgrow_take_clear (avgrow);
+  if (!flushed) {
+    gst_avgrow_store_row (avgrow, &avgrow->bands[0], outdata);
+    avgrow->scan_lines = 0;
+  }
+  g_mutex_unlock (&avgrow->lock);
+
+  if (avgrow->float_out)
+    gst_buffer_unmap (*outbuf, &map);
+  else
+    gst_video_frame_unmap (&outframe);
+  if (flushed) {
+    gst_buffer_replace (outbuf, NULL);
+    goto done;
+  }
+
+  /* the row covers the time from its first line to the end of its last */
+  end = gst_avgrow_line_time (avgrow->scan_buf, first + avgrow->scan_line,
+      inframe.info.height);
+  GST_BUFFER_PTS (*outbuf) = avgrow->scan_start;
+  GST_BUFFER_DTS (*outbuf) = GST_CLOCK_TIME_NONE;
+  if (GST_CLOCK_TIME_IS_VALID (avgrow->scan_start) &&
+      GST_CLOCK_TIME_IS_VALID (end) && end > avgrow->scan_start)
+    GST_BUFFER_DURATION (*outbuf) = end - avgrow->scan_start;
+  else
+    GST_BUFFER_DURATION (*outbuf) = GST_CLOCK_TIME_NONE;
+
+done:
+  gst_video_frame_unmap (&inframe);
+  if (ret != GST_FLOW_OK || avgrow->scan_line >= rows)
+    gst_buffer_replace (&avgrow->scan_buf, NULL);
+
+  return ret;
+}
+
+/* stamps the output with the time from the start of the first frame of the
+ * window to the end of the last one, which is inbuf */
+static void
+gst_avgrow_stamp_window (GstAvgrow * avgrow, GstBuffer * inbuf,
+    GstBuffer * outbuf)
+{
+  GstClockTime end = GST_BUFFER_PTS (inbuf);
+
+  if (!GST_CLOCK_TIME_IS_VALID (avgrow->window_start) ||
+      !GST_CLOCK_TIME_IS_VALID (end))
+    return;
+
+  if (GST_BUFFER_DURATION_IS_VALID (inbuf))
+    end += GST_BUFFER_DURATION (inbuf);
+
+  GST_BUFFER_PTS (outbuf) = avgrow->window_start;
+  GST_BUFFER_DTS (outbuf) = GST_CLOCK_TIME_NONE;
+  if (end > avgrow->window_start)
+    GST_BUFFER_DURATION (outbuf) = end - avgrow->window_start;
+  else
+    GST_BUFFER_DURATION (outbuf) = GST_CLOCK_TIME_NONE;
+}
+
+/* Adds the columns of the frame to the sums of the window, straight from
+ * the input, and only writes the row out once frameno frames are in. The
+ * frames before are dropped. A window keeps the frameno it started with,
+ * so the sums always go into the same accumulators and are divided by the
+ * frames that are in them; a new frameno takes effect with the next one. */
+static GstFlowReturn
+gst_avgrow_window (GstAvgrow * avgrow, GstVideoFrame * inframe, gint rows,
+    guint8 * outdata, GstBuffer * outbuf)
+{
+  GstAvgrowWork *work = &avgrow->work;
+  gint frames;
+
+  g_mutex_lock (&avgrow->lock);
+  gst_avgrow_take_clear (avgrow);
+  if (avgrow->frame_counter == 0) {
+    avgrow->window_start = GST_BUFFER_PTS (inframe->buffer);
+    avgrow->window_frames = avgrow->frameno;
+  }
+  frames = avgrow->window_frames;
+  g_mutex_unlock (&avgrow->lock);
+
+  gst_avgrow_set_divisor (work, work->group * work->cols * frames);
+
+  /* a single frame has nothing to carry over */
+  if (frames == 1) {
+    gst_avgrow_sum_frame (avgrow, rows);
+    gst_avgrow_store_row (avgrow, &avgrow->bands[0], outdata);
+    return GST_FLOW_OK;
+  }
+
+  gst_avgrow_sum_frame (avgrow, rows);
+
+  g_mutex_lock (&avgrow->lock);
+  /* flushed while the frame was being added, it starts over */
+  if (gst_avgrow_take_clear (avgrow) || ++avgrow->frame_counter < frames) {
+    g_mutex_unlock (&avgrow->lock);
+    return GST_BASE_TRANSFORM_FLOW_DROPPED;
+  }
+  avgrow->frame_counter = 0;
+  g_mutex_unlock (&avgrow->lock);
+
+  gst_avgrow_store_row (avgrow, &avgrow->bands[0], outdata);
+  gst_avgrow_stamp_window (avgrow, inframe->buffer, outbuf);
+
+  return GST_FLOW_OK;
+}
+
+/* averages inframe into the out_info sized rows at outdata */
+static GstFlowReturn
+gst_avgrow_process (GstAvgrow * avgrow, GstVideoFrame * inframe,
+    GstBuffer * outbuf, guint8 * outdata, gint out_stride,
+    GstVideoInfo * out_info)
+{
+  GstAvgrowWork *work = &avgrow->work;
+
+  gint j, z, rows;
+  const guint8 *indata;
+
+  if (!gst_avgrow_setup_work (avgrow, inframe, out_info, &rows))
+    return GST_FLOW_ERROR;
+  indata = work->src;
+
+  if (avgrow->statistic != GST_AVGROW_STATISTIC_MEAN) {
+    for (j = 0; j < (avgrow->total_avg ? 1 : out_info->height); j++) {
+      gst_avgrow_robust_group (avgrow, indata, work->group, outdata);
+      indata += work->group * work->in_stride;
+      outdata += out_stride;
+    }
+  } else if (avgrow->total_avg) {
+    return gst_avgrow_window (avgrow, inframe, rows, outdata, outbuf);
+  } else {
+    for (j = 0; j < out_info->height; j++) {
+      for (z = 0; z < work->group; z++) {
+        gst_avgrow_accum_row (avgrow, &avgrow->bands[0], indata);
+        indata += work->in_stride;
+      }
+      gst_avgrow_store_row (avgrow, &avgrow->bands[0], outdata);
+      outdata += out_stride;
+    }
+  }
+
   return GST_FLOW_OK;
 }
 
+static GstFlowReturn
+gst_avgrow_transform_frame (GstVideoFilter * filter, GstVideoFrame * inframe,
+    GstVideoFrame * outframe)
+{
+  return gst_avgrow_process (GST_AVGROW (filter), inframe, outframe->buffer,
+      GST_VIDEO_FRAME_PLANE_DATA (outframe, 0),
+      GST_VIDEO_FRAME_PLANE_STRIDE (outframe, 0), &outframe->info);
+}
+
+/* the float rows are not video frames, so they are written to the buffer
+ * as it is */
+static GstFlowReturn
+gst_avgrow_transform (GstBaseTransform * trans, GstBuffer * inbuf,
+    GstBuffer * outbuf)
+{
+  GstAvgrow *avgrow = GST_AVGROW (trans);
+  GstVideoFilter *filter = GST_VIDEO_FILTER (trans);
+  GstVideoFrame inframe;
+  GstMapInfo map;
+  GstFlowReturn ret;
+
+  if (!avgrow->float_out)
+    return GST_BASE_TRANSFORM_CLASS (gst_avgrow_parent_class)->transform (
+        trans, inbuf, outbuf);
+
+  if (!filter->negotiated)
+    return GST_FLOW_NOT_NEGOTIATED;
+
+  if (!gst_video_frame_map (&inframe, &filter->in_info, inbuf, GST_MAP_READ)) {
+    GST_ERROR("Unable to map the input buffer");
+    return GST_FLOW_ERROR;
+  }
+  if (!gst_buffer_map (outbuf, &map, GST_MAP_WRITE)) {
+    GST_ERROR("Unable to map the output buffer");
+    gst_video_frame_unmap (&inframe);
+    return GST_FLOW_ERROR;
+  }
+
+  ret = gst_avgrow_process (avgrow, &inframe, outbuf, map.data,
+      filter->out_info.width * sizeof (gfloat), &filter->out_info);
+
+  gst_buffer_unmap (outbuf, &map);
+  gst_video_frame_unmap (&inframe);
+
+  return ret;
+}
+
+/* the spread of the samples behind every mean of the profile, in a second
+ * pass over the region that is only made when it is asked for */
+static void
+gst_avgrow_profile_spread (GstAvgrow * avgrow, gint rows, GstAvgrowMeta * meta)
+{
+  const GstAvgrowWork *work = &avgrow->work;
+  const guint8 *src = work->src;
+  guint64 *sum = NULL, *sumsq = NULL;
+  gdouble mean, var;
+  gint i, j, o, c, b, k;
+  guint v;
+
+  if (meta->stddev) {
+    sum = g_new0 (guint64, work->n_out);
+    sumsq = g_new0 (guint64, work->n_out);
+  }
+  if (meta->min) {
+    for (o = 0; o < work->n_out; o++) {
+      meta->min[o] = G_MAXUINT16;
+      meta->max[o] = 0;
+    }
+  }
+
+  for (j = 0; j < rows; j++) {
+    /* sample i of the row goes to component k of binned column c */
+    i = 0;
+    for (c = 0; c < work->n_out; c += work->comps) {
+      for (b = 0; b < work->cols; b++) {
+        for (k = 0; k < work->comps; k++, i++) {
+          if (work->bits == 8)
+            v = src[i];
+          else if (work->swap)
+            v = GUINT16_SWAP_LE_BE (((const guint16 *) src)[i]);
+          else
+            v = ((const guint16 *) src)[i];
+
+          o = c + k;
+          if (meta->min) {
+            meta->min[o] = MIN (meta->min[o], v);
+            meta->max[o] = MAX (meta->max[o], v);
+          }
+          if (sumsq) {
+            sum[o] += v;
+            sumsq[o] += (guint64) v * v;
+          }
+        }
+      }
+    }
+    src += work->in_stride;
+  }
+
+  if (sumsq) {
+    for (o = 0; o < work->n_out; o++) {
+      mean = (gdouble) sum[o] / work->divisor;
+      var = (gdouble) sumsq[o] / work->divisor - mean * mean;
+      meta->stddev[o] = var > 0 ? sqrt (var) : 0;
+    }
+    g_free (sum);
+    g_free (sumsq);
+  }
+}
+
+/* In passthrough-meta mode the frame goes on as it is, with its column
+ * profile attached. The frame is only read, the buffer is only writable for
+ * the meta */
+static GstFlowReturn
+gst_avgrow_transform_ip (GstBaseTransform * trans, GstBuffer * buf)
+{
+  GstAvgrow *avgrow = GST_AVGROW (trans);
+  GstVideoFilter *filter = GST_VIDEO_FILTER (trans);
+  GstVideoFrame frame;
+  GstVideoInfo info;
+  GstAvgrowMeta *meta;
+  GstFlowReturn ret = GST_FLOW_OK;
+  gint roi_x, roi_y, roi_w, roi_h, rows;
+
+  if (!avgrow->passthrough_meta)
+    return GST_BASE_TRANSFORM_CLASS (gst_avgrow_parent_class)->transform_ip (
+        trans, buf);
+
+  if (!filter->negotiated)
+    return GST_FLOW_NOT_NEGOTIATED;
+
+  if (!gst_avgrow_roi (avgrow, filter->in_info.width, filter->in_info.height,
+          &roi_x, &roi_y, &roi_w, &roi_h)) {
+    GST_ERROR("Region of interest is not within the frame");
+    return GST_FLOW_ERROR;
+  }
+  /* the profile is worked out like a single output row of the input format */
+  gst_video_info_set_format (&info, GST_VIDEO_INFO_FORMAT (&filter->in_info),
+      roi_w / avgrow->cols, 1);
+
+  /* added before the frame is mapped, which takes a reference */
+  meta = gst_buffer_add_gst_avgrow_meta (buf,
+      info.width * GST_VIDEO_INFO_N_COMPONENTS (&info), roi_h,
+      avgrow->meta_extrema, avgrow->meta_stddev);
+  if (!meta) {
+    GST_ERROR("Unable to add the column profile to the buffer");
+    return GST_FLOW_ERROR;
+  }
+
+  if (!gst_video_frame_map (&frame, &filter->in_info, buf, GST_MAP_READ)) {
+    GST_ERROR("Unable to map the input buffer");
+    return GST_FLOW_ERROR;
+  }
+
+  if (!gst_avgrow_setup_work (avgrow, &frame, &info, &rows)) {
+    ret = GST_FLOW_ERROR;
+    goto done;
+  }
+  meta->rows = rows;
+
+  gst_avgrow_sum_frame (avgrow, rows);
+  gst_avgrow_store_row (avgrow, &avgrow->bands[0], (guint8 *) meta->mean);
+  if (meta->min || meta->stddev)
+    gst_avgrow_profile_spread (avgrow, rows, meta);
+
+done:
+  gst_video_frame_unmap (&frame);
+
+  return ret;
+}
+
+static gboolean
+gst_avgrow_sink_event (GstBaseTransform * trans, GstEvent * event)
+{
+  const GstStructure *s;
+  const gchar *name;
+
+  GST_DEBUG("Sink event %s",  gst_event_type_get_name (GST_EVENT_TYPE(event)));
+  switch (GST_EVENT_TYPE(event)) {
+    case GST_EVENT_FLUSH_START:
+      gst_avgrow_clear_sums (GST_AVGROW (trans));
+      break;
+    case GST_EVENT_CUSTOM_DOWNSTREAM_OOB:
+      s = gst_event_get_structure (event);
+      name = gst_structure_get_string(s, "name");
+      if (name != NULL && strncmp(name, "qtec-flush", 10)==0){
+        GST_DEBUG("FLUSH");
+        gst_avgrow_clear_sums (GST_AVGROW (trans));
+      }
+      break;
+    default:
+      break;
+  }
+
+  return GST_BASE_TRANSFORM_CLASS (gst_avgrow_parent_class)->sink_event (
+      trans, event);
+}
+
+static gboolean
+gst_avgrow_src_event (GstBaseTransform * trans, GstEvent * event)
+{
+  const GstStructure *s;
+  const gchar *name;
+
+  GST_DEBUG("Src event %s",  gst_event_type_get_name (GST_EVENT_TYPE(event)));
+  switch (GST_EVENT_TYPE(event)) {
+    case GST_EVENT_FLUSH_START:
+      gst_avgrow_clear_sums (GST_AVGROW (trans));
+      break;
+    case GST_EVENT_CUSTOM_UPSTREAM:
+      s = gst_event_get_structure (event);
+      name = gst_structure_get_string(s, "name");
+      if (name != NULL && strncmp(name, "qtec-flush", 10)==0){
+        GST_DEBUG("FLUSH");
+        gst_avgrow_clear_sums (GST_AVGROW (trans));
+      }
+      break;
+    default:
+      break;
+  }
+
+  return GST_BASE_TRANSFORM_CLASS (gst_avgrow_parent_class)->src_event (
+      trans, event);
+}
 
 static gboolean
 plugin_init (GstPlugin * plugin)
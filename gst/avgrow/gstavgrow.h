@@ -22,6 +22,7 @@
 
 #include <gst/video/video.h>
 #include <gst/video/gstvideofilter.h>
+#include "avgrowkernels.h"
 
 G_BEGIN_DECLS
 
@@ -31,16 +32,137 @@ G_BEGIN_DECLS
 #define GST_IS_AVGROW(obj)   (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_AVGROW))
 #define GST_IS_AVGROW_CLASS(obj)   (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_AVGROW))
 
+/* the rows of exact column means, native endian 32 bit floats of the
+ * negotiated width, height and framerate. Only gray input is supported */
+#define GST_AVGROW_FLOAT_CAPS_NAME "video/x-raw-gray-float"
+
 typedef struct _GstAvgrow GstAvgrow;
 typedef struct _GstAvgrowClass GstAvgrowClass;
 
+typedef enum {
+  GST_AVGROW_STATISTIC_MEAN,
+  GST_AVGROW_STATISTIC_MEDIAN,
+  GST_AVGROW_STATISTIC_TRIMMED_MEAN
+} GstAvgrowStatistic;
+
+typedef void (*GstAvgrowAccumFunc) (guint64 * sums, gconstpointer row, gint n);
+typedef void (*GstAvgrowStoreFunc) (gpointer row, guint64 * sums, gint n,
+    guint count);
+
+/* how the rows of the current frame are summed and normalized */
+typedef struct
+{
+  const guint8 *src;
+  gint in_stride;
+  gint n;
+  gint group;
+  /* columns that are binned together, the n samples of the sums become
+   * n_out samples of comps components */
+  gint cols;
+  gint comps;
+  gint n_out;
+  /* the number of samples behind every output sample, group * cols */
+  guint divisor;
+  guint bits;
+  gboolean swap;
+  /* the block is too large for 32 bit sums, use the 64 bit scalar path */
+  gboolean wide;
+  GstAvgrowAccumFunc accum_wide;
+  GstAvgrowStoreFunc store_wide;
+  guint32 mul;
+  guint shift;
+  /* the means go out as floats instead of samples of the input format */
+  gboolean float_out;
+} GstAvgrowWork;
+
+/* where the ranks of a robust statistic are in the high byte buckets of a
+ * column of 16 bit samples, and the sum of the samples in between */
+typedef struct
+{
+  guint lo_bucket;
+  guint hi_bucket;
+  guint lo_first;
+  guint hi_first;
+  guint64 sum;
+} GstAvgrowRanks;
+
+/* a range of input rows and the partial column sums they are added to */
+typedef struct
+{
+  gint start;
+  gint n;
+  guint32 *sums;
+  guint64 *wide_sums;
+} GstAvgrowBand;
+
 struct _GstAvgrow
 {
   GstVideoFilter base_avgrow;
 
   gint format_data_number;
   gint rows;
+  gint cols;
   gboolean total_avg;
+  GstAvgrowStatistic statistic;
+  gdouble trim;
+
+  /* region of interest, a zero size extends it to the edge of the frame */
+  gint roi_top;
+  gint roi_height;
+  gint roi_left;
+  gint roi_width;
+  gboolean roi_meta;
+
+  /* pass the frames on with their column profile as a GstAvgrowMeta */
+  gboolean passthrough_meta;
+  gboolean meta_extrema;
+  gboolean meta_stddev;
+
+  /* negotiated GST_AVGROW_FLOAT_CAPS_NAME output */
+  gboolean float_out;
+
+  const AvgKernels *kernels;
+  const AvgRowKernels *row_kernels;
+
+  /* per column sums of the row group being averaged, one row per band.
+   * wide_sums is used when the group is too tall for 32 bit sums */
+  guint32 *sums;
+  guint64 *wide_sums;
+  gint n_sums;
+
+  guint n_threads;
+  /* the workers of the pool plus the streaming thread */
+  guint pool_threads;
+  GThreadPool *pool;
+  GstAvgrowBand *bands;
+
+  /* per column histograms of the robust statistics */
+  guint32 *hist;
+  guint32 *fine_hist;
+  GstAvgrowRanks *ranks;
+  gint n_hist;
+
+  /* in total average mode the sums of frameno frames make one row. The
+   * window keeps the frameno it started with in window_frames */
+  gint frameno;
+  gint window_frames;
+  gint frame_counter;
+  GstClockTime window_start;
+
+  /* a flush asks the streaming thread to clear the sums */
+  gboolean clear_pending;
+
+  /* line scan mode, rows are added up across the incoming buffers */
+  gboolean line_scan;
+  GstBuffer *scan_buf;
+  gint scan_line;
+  gint scan_lines;
+  GstClockTime scan_start;
+
+  GstAvgrowWork work;
+  gint pending;
+  GMutex lock;
+  GCond cond;
 };
 
 struct _GstAvgrowClass
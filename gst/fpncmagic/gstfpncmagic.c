@@ -28,7 +28,6 @@
 #include "config.h"
 #endif
 
-#include <byteswap.h>
 #include <stdlib.h>
 #include <string.h>
 #include <gst/gst.h>
@@ -36,7 +35,7 @@
 #include <gst/video/gstvideofilter.h>
 #include <gst/fpncmagic/gstfpncmagicmeta.h>
 #include "gstfpncmagic.h"
-#include "quickselect.h"
+#include "medianfilter.h"
 
 GST_DEBUG_CATEGORY_STATIC (gst_fpncmagic_debug_category);
 #define GST_CAT_DEFAULT gst_fpncmagic_debug_category
@@ -64,7 +63,9 @@ static GstCaps *gst_fpncmagic_fixate_caps (GstBaseTransform * base,
 
 enum
 {
-  PROP_0
+  PROP_0,
+  PROP_WINDOW,
+  PROP_N_THREADS
 };
 
 /* pad templates */
@@ -77,7 +78,21 @@ enum
 #define VIDEO_SINK_CAPS \
     GST_VIDEO_CAPS_MAKE("{ GRAY8, GRAY16_LE, GRAY16_BE }")
 
-#define RANGE 50
+#define DEFAULT_WINDOW 50
+#define MAX_WINDOW 16384
+
+#define DEFAULT_N_THREADS 0
+#define MAX_N_THREADS 64
+/* rows with fewer columns per thread are not worth splitting */
+#define MIN_CHUNK_SIZE 2048
+
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+#define GRAY16_NATIVE GST_VIDEO_FORMAT_GRAY16_LE
+#define GRAY16_SWAPPED GST_VIDEO_FORMAT_GRAY16_BE
+#else
+#define GRAY16_NATIVE GST_VIDEO_FORMAT_GRAY16_BE
+#define GRAY16_SWAPPED GST_VIDEO_FORMAT_GRAY16_LE
+#endif
 
 /* class initialization */
 
@@ -109,6 +124,20 @@ gst_fpncmagic_class_init (GstFpncmagicClass * klass)
   gobject_class->get_property = gst_fpncmagic_get_property;
   gobject_class->dispose = gst_fpncmagic_dispose;
   gobject_class->finalize = gst_fpncmagic_finalize;
+
+  g_object_class_install_property (gobject_class, PROP_WINDOW,
+      g_param_spec_uint ("window", "Median window",
+          "Number of columns the rolling median is taken over, centered on "
+          "each column", 1, MAX_WINDOW, DEFAULT_WINDOW,
+          G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
+
+  g_object_class_install_property (gobject_class, PROP_N_THREADS,
+      g_param_spec_uint ("n-threads", "Threads",
+          "Number of threads that filter the columns of wide rows "
+          "(0 = one per CPU), takes effect on the next start",
+          0, MAX_N_THREADS, DEFAULT_N_THREADS,
+          G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE));
+
   base_transform_class->start = GST_DEBUG_FUNCPTR (gst_fpncmagic_start);
   base_transform_class->stop = GST_DEBUG_FUNCPTR (gst_fpncmagic_stop);
   base_transform_class->fixate_caps = GST_DEBUG_FUNCPTR (gst_fpncmagic_fixate_caps);
@@ -120,8 +149,14 @@ gst_fpncmagic_class_init (GstFpncmagicClass * klass)
 static void
 gst_fpncmagic_init (GstFpncmagic *fpncmagic)
 {
-  fpncmagic->rolling_medians = NULL;
-  fpncmagic->errors = NULL;
+  fpncmagic->meta_pool = NULL;
+  fpncmagic->native_row = NULL;
+  fpncmagic->window = DEFAULT_WINDOW;
+  fpncmagic->n_threads = DEFAULT_N_THREADS;
+  fpncmagic->pool = NULL;
+  fpncmagic->chunks = NULL;
+  g_mutex_init (&fpncmagic->lock);
+  g_cond_init (&fpncmagic->cond);
 }
 
 void
@@ -133,6 +168,14 @@ gst_fpncmagic_set_property (GObject * object, guint property_id,
   GST_DEBUG_OBJECT (fpncmagic, "set_property");
 
   switch (property_id) {
+    case PROP_WINDOW:
+      GST_OBJECT_LOCK (fpncmagic);
+      fpncmagic->window = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (fpncmagic);
+      break;
+    case PROP_N_THREADS:
+      fpncmagic->n_threads = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -148,6 +191,14 @@ gst_fpncmagic_get_property (GObject * object, guint property_id,
   GST_DEBUG_OBJECT (fpncmagic, "get_property");
 
   switch (property_id) {
+    case PROP_WINDOW:
+      GST_OBJECT_LOCK (fpncmagic);
+      g_value_set_uint (value, fpncmagic->window);
+      GST_OBJECT_UNLOCK (fpncmagic);
+      break;
+    case PROP_N_THREADS:
+      g_value_set_uint (value, fpncmagic->n_threads);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -174,17 +225,42 @@ gst_fpncmagic_finalize (GObject * object)
   GST_DEBUG_OBJECT (fpncmagic, "finalize");
 
   /* clean up object here */
+  g_mutex_clear (&fpncmagic->lock);
+  g_cond_clear (&fpncmagic->cond);
 
   G_OBJECT_CLASS (gst_fpncmagic_parent_class)->finalize (object);
 }
 
+static void gst_fpncmagic_chunk_func (gpointer data, gpointer user_data);
+
 static gboolean
 gst_fpncmagic_start (GstBaseTransform * trans)
 {
   GstFpncmagic *fpncmagic = GST_FPNCMAGIC (trans);
+  GError *error = NULL;
+  guint n_threads = fpncmagic->n_threads;
 
   GST_DEBUG_OBJECT (fpncmagic, "start");
 
+  if (n_threads == 0)
+    n_threads = MIN (g_get_num_processors (), MAX_N_THREADS);
+
+  /* the streaming thread takes one chunk itself */
+  if (n_threads > 1) {
+    fpncmagic->pool = g_thread_pool_new (gst_fpncmagic_chunk_func, fpncmagic,
+        n_threads - 1, TRUE, &error);
+    if (!fpncmagic->pool) {
+      GST_WARNING_OBJECT (fpncmagic, "Unable to start %u threads: %s",
+          n_threads - 1, error->message);
+      g_error_free (error);
+      n_threads = 1;
+    }
+  }
+  fpncmagic->pool_threads = n_threads;
+  fpncmagic->chunks = g_new0 (GstFpncmagicChunk, n_threads);
+
+  GST_DEBUG_OBJECT (fpncmagic, "filtering rows with %u threads", n_threads);
+
   return TRUE;
 }
 
@@ -239,15 +315,27 @@ static gboolean
 gst_fpncmagic_stop (GstBaseTransform * trans)
 {
   GstFpncmagic *fpncmagic = GST_FPNCMAGIC (trans);
+  guint i;
+
+  if (fpncmagic->meta_pool) {
+    gst_fpnc_magic_pool_unref (fpncmagic->meta_pool);
+    fpncmagic->meta_pool = NULL;
+  }
 
-  if (fpncmagic->rolling_medians) {
-    free (fpncmagic->rolling_medians);
-    fpncmagic->rolling_medians = NULL;
+  if (fpncmagic->native_row) {
+    free (fpncmagic->native_row);
+    fpncmagic->native_row = NULL;
   }
 
-  if (fpncmagic->errors) {
-    free (fpncmagic->errors);
-    fpncmagic->errors = NULL;
+  if (fpncmagic->pool) {
+    g_thread_pool_free (fpncmagic->pool, FALSE, TRUE);
+    fpncmagic->pool = NULL;
+  }
+  if (fpncmagic->chunks) {
+    for (i = 0; i < fpncmagic->pool_threads; i++)
+      median_filter_free (fpncmagic->chunks[i].median_filter);
+    g_free (fpncmagic->chunks);
+    fpncmagic->chunks = NULL;
   }
 
   return TRUE;
@@ -264,27 +352,34 @@ gst_fpncmagic_set_info (GstVideoFilter * filter, GstCaps * incaps,
     return FALSE;
   }
 
-  if (fpncmagic->rolling_medians) {
-    free (fpncmagic->rolling_medians);
-    fpncmagic->rolling_medians = NULL;
+  if (fpncmagic->meta_pool) {
+    gst_fpnc_magic_pool_unref (fpncmagic->meta_pool);
+    fpncmagic->meta_pool = NULL;
   }
 
-  if (fpncmagic->errors) {
-    free (fpncmagic->errors);
-    fpncmagic->errors = NULL;
+  if (fpncmagic->native_row) {
+    free (fpncmagic->native_row);
+    fpncmagic->native_row = NULL;
   }
 
-  fpncmagic->rolling_medians = malloc(in_info->width * sizeof(gint));
-  if (!fpncmagic->rolling_medians) {
-    GST_ERROR("Unable to allocate memory of size: %lu", in_info->width * sizeof(gint));
+  /* buffers still holding metas of the old size keep the old pool alive */
+  if (GST_VIDEO_INFO_FORMAT (in_info) == GST_VIDEO_FORMAT_GRAY8)
+    fpncmagic->meta_pool = gst_fpnc_magic_pool_new (in_info->width,
+        GST_FPNC_MAGIC_UINT8, GST_FPNC_MAGIC_INT16);
+  else
+    fpncmagic->meta_pool = gst_fpnc_magic_pool_new (in_info->width,
+        GST_FPNC_MAGIC_UINT16, GST_FPNC_MAGIC_INT32);
+  if (!fpncmagic->meta_pool) {
+    GST_ERROR("Unable to allocate a meta pool for width: %d", in_info->width);
     return FALSE;
   }
 
-  fpncmagic->errors = malloc(in_info->width * sizeof(gint));
-  if (!fpncmagic->errors) {
-    GST_ERROR("Unable to allocate memory of size: %lu", in_info->width * sizeof(gint));
-    free(fpncmagic->rolling_medians);
-    return FALSE;
+  if (GST_VIDEO_INFO_FORMAT (in_info) == GRAY16_SWAPPED) {
+    fpncmagic->native_row = malloc(in_info->width * sizeof(guint16));
+    if (!fpncmagic->native_row) {
+      GST_ERROR("Unable to allocate memory of size: %lu", in_info->width * sizeof(guint16));
+      return FALSE;
+    }
   }
 
   GST_DEBUG ("in caps %" GST_PTR_FORMAT " out caps %" GST_PTR_FORMAT, incaps,
@@ -293,107 +388,173 @@ gst_fpncmagic_set_info (GstVideoFilter * filter, GstCaps * incaps,
   return TRUE;
 }
 
+/* medians, errors and the sum of the samples of the columns of chunk */
 static void
-fpncmagic_8b (GstVideoFilter * filter, GstVideoFrame *frame)
+gst_fpncmagic_filter_chunk (GstFpncmagic * fpncmagic, GstFpncmagicChunk * chunk)
 {
-  gint i, min, max;
-  guint8 medarray[RANGE];
+  GstFpncmagicWork *work = &fpncmagic->work;
+  GstFpncMagicMeta *meta = work->meta;
+  gint i, end = chunk->start + chunk->n;
+  gint64 sum = 0;
 
-  guint8 *data = GST_VIDEO_FRAME_PLANE_DATA (frame, 0);
-  GstFpncmagic *fpncmagic = GST_FPNCMAGIC (filter);
-  gint *rms = (gint*)fpncmagic->rolling_medians;
-  gint *errs = (gint*)fpncmagic->errors;
-  gint avg = 0;
-
-  for (i=0; i<frame->info.width; i++) {
-    min = i - RANGE/2;
-    max = i + RANGE/2;
-    if (min < 0)
-      min = 0;
-    if (max >= frame->info.width)
-      max = frame->info.width - 1;
-    memcpy(medarray, data + min, max - min);
-    rms[i] = quick_select_uint8_t(medarray, max - min);
-    errs[i] = data[i] - rms[i];
-    avg += data[i];
+  if (work->bits == 8) {
+    const guint8 *data = work->data;
+
+    median_filter_uint8_t (chunk->median_filter, data, work->width,
+        chunk->start, end, meta->rolling_median.ui8);
+
+    for (i=chunk->start; i<end; i++) {
+      meta->error.i16[i] = data[i] - meta->rolling_median.ui8[i];
+      sum += data[i];
+    }
+  } else {
+    const guint16 *data = work->data;
+
+    median_filter_uint16_t (chunk->median_filter, data, work->width,
+        chunk->start, end, meta->rolling_median.ui16);
+
+    for (i=chunk->start; i<end; i++) {
+      meta->error.i32[i] = data[i] - meta->rolling_median.ui16[i];
+      sum += data[i];
+    }
   }
 
-  gst_buffer_add_gst_fpnc_magic_meta(frame->buffer, fpncmagic->rolling_medians,
-    fpncmagic->errors, frame->info.width, avg/frame->info.width);
+  chunk->sum = sum;
 }
 
 static void
-fpncmagic_16b_LE (GstVideoFilter * filter, GstVideoFrame * frame)
+gst_fpncmagic_chunk_func (gpointer data, gpointer user_data)
 {
-  gint i, min, max;
-  guint16 medarray[RANGE];
+  GstFpncmagic *fpncmagic = GST_FPNCMAGIC (user_data);
 
-  guint16 *data = GST_VIDEO_FRAME_PLANE_DATA (frame, 0);
-  GstFpncmagic *fpncmagic = GST_FPNCMAGIC (filter);
-  gint *rms = (gint*)fpncmagic->rolling_medians;
-  gint *errs = (gint*)fpncmagic->errors;
-  gint avg = 0;
-
-  for (i=0; i<frame->info.width; i++) {
-    min = i - RANGE/2;
-    max = i + RANGE/2;
-    if (min < 0)
-      min = 0;
-    if (max >= frame->info.width)
-      max = frame->info.width - 1;
-    memcpy(medarray, data + min, (max - min)*2);
-    rms[i] = quick_select_uint16_t(medarray, max - min);
-    errs[i] = data[i] - rms[i];
-    avg += data[i];
+  gst_fpncmagic_filter_chunk (fpncmagic, data);
+
+  g_mutex_lock (&fpncmagic->lock);
+  if (--fpncmagic->pending == 0)
+    g_cond_signal (&fpncmagic->cond);
+  g_mutex_unlock (&fpncmagic->lock);
+}
+
+/* Filters a row in native byte order into a new meta on the buffer. Wide
+ * rows are split into chunks of columns that are filtered by the pool and
+ * the streaming thread. Every chunk reads the window / 2 columns around it
+ * and has its own filter state, so the result does not depend on the
+ * split. The sums of the chunks are added up once all of them are done, in
+ * 64 bits since a wide row of 16 bit samples does not fit in an int. */
+static GstFlowReturn
+fpncmagic_row (GstFpncmagic * fpncmagic, GstVideoFrame * frame,
+    gconstpointer data)
+{
+  GstFpncmagicWork *work = &fpncmagic->work;
+  GstFpncMagicMeta *meta;
+  gint width = frame->info.width;
+  gint chunk_cols;
+  gint64 sum = 0;
+  guint n_chunks = 1;
+  guint i;
+
+  meta = gst_buffer_add_gst_fpnc_magic_meta_from_pool (frame->buffer,
+      fpncmagic->meta_pool);
+  if (!meta) {
+    GST_ERROR("Unable to add fpncmagic meta");
+    return GST_FLOW_ERROR;
+  }
+  work->meta = meta;
+  work->data = data;
+  work->width = width;
+  work->bits = frame->info.finfo->bits;
+
+  if (fpncmagic->pool)
+    n_chunks = MIN (fpncmagic->pool_threads,
+        (width + MIN_CHUNK_SIZE - 1) / MIN_CHUNK_SIZE);
+
+  if (n_chunks <= 1) {
+    fpncmagic->chunks[0].start = 0;
+    fpncmagic->chunks[0].n = width;
+    gst_fpncmagic_filter_chunk (fpncmagic, &fpncmagic->chunks[0]);
+    meta->avg = fpncmagic->chunks[0].sum/width;
+    return GST_FLOW_OK;
+  }
+
+  chunk_cols = (width + n_chunks - 1) / n_chunks;
+  n_chunks = (width + chunk_cols - 1) / chunk_cols;
+
+  g_mutex_lock (&fpncmagic->lock);
+  fpncmagic->pending = n_chunks - 1;
+  g_mutex_unlock (&fpncmagic->lock);
+
+  for (i = 0; i < n_chunks; i++) {
+    fpncmagic->chunks[i].start = i * chunk_cols;
+    fpncmagic->chunks[i].n = MIN (chunk_cols, width - (gint) i * chunk_cols);
+    if (i > 0)
+      g_thread_pool_push (fpncmagic->pool, &fpncmagic->chunks[i], NULL);
   }
+  gst_fpncmagic_filter_chunk (fpncmagic, &fpncmagic->chunks[0]);
+
+  g_mutex_lock (&fpncmagic->lock);
+  while (fpncmagic->pending > 0)
+    g_cond_wait (&fpncmagic->cond, &fpncmagic->lock);
+  g_mutex_unlock (&fpncmagic->lock);
 
-  gst_buffer_add_gst_fpnc_magic_meta(frame->buffer, fpncmagic->rolling_medians,
-    fpncmagic->errors, frame->info.width, avg/frame->info.width);
+  for (i = 0; i < n_chunks; i++)
+    sum += fpncmagic->chunks[i].sum;
+  meta->avg = sum/width;
+
+  return GST_FLOW_OK;
 }
 
+/* picks up a changed window, the filters only reallocate when it grows */
 static void
-fpncmagic_16b_BE (GstVideoFilter * filter, GstVideoFrame * frame)
+gst_fpncmagic_update_window (GstFpncmagic * fpncmagic, guint bits)
 {
-  gint i, j, min, max;
-  guint16 medarray[RANGE];
-  guint16 val;
-
-  guint16 *data = GST_VIDEO_FRAME_PLANE_DATA (frame, 0);
-  GstFpncmagic *fpncmagic = GST_FPNCMAGIC (filter);
-  gint *rms = (gint*)fpncmagic->rolling_medians;
-  gint *errs = (gint*)fpncmagic->errors;
-  gint avg = 0;
-
-  for (i=0; i<frame->info.width; i++) {
-    val = __bswap_16(data[i]);
-    min = i - RANGE/2;
-    max = i + RANGE/2;
-    if (min < 0)
-      min = 0;
-    if (max >= frame->info.width)
-      max = frame->info.width - 1;
-    /* need to copy and swap bytes for correct alignment */
-    for (j=0; j<(max - min); j++)
-      medarray[j] = __bswap_16(data[min + j]);
-    rms[i] = quick_select_uint16_t(medarray, max - min);
-    errs[i] = val - rms[i];
-    avg += val;
+  static const gchar *methods[] = { "sorting network", "histogram", "heap" };
+  GstFpncmagicChunk *chunk;
+  gint window;
+  guint i;
+
+  GST_OBJECT_LOCK (fpncmagic);
+  window = fpncmagic->window;
+  GST_OBJECT_UNLOCK (fpncmagic);
+
+  chunk = &fpncmagic->chunks[0];
+  if (chunk->median_filter &&
+      median_filter_get_range (chunk->median_filter) == window)
+    return;
+
+  for (i = 0; i < fpncmagic->pool_threads; i++) {
+    chunk = &fpncmagic->chunks[i];
+    if (!chunk->median_filter)
+      chunk->median_filter = median_filter_new (window);
+    else
+      median_filter_set_range (chunk->median_filter, window);
   }
 
-  gst_buffer_add_gst_fpnc_magic_meta(frame->buffer, fpncmagic->rolling_medians,
-    fpncmagic->errors, frame->info.width, avg/frame->info.width);
+  GST_DEBUG_OBJECT (fpncmagic, "median window %d using %s", window,
+      methods[median_filter_method (fpncmagic->chunks[0].median_filter, bits)]);
 }
 
 static GstFlowReturn
 gst_fpncmagic_transform_frame_ip (GstVideoFilter * filter, GstVideoFrame * frame)
 {
+  GstFpncmagic *fpncmagic = GST_FPNCMAGIC (filter);
+  guint16 *data, *native;
+  gint i;
+
+  gst_fpncmagic_update_window (fpncmagic, frame->info.finfo->bits);
+
   if (frame->info.finfo->bits == 8)
-    fpncmagic_8b (filter, frame);
+    return fpncmagic_row (fpncmagic, frame, GST_VIDEO_FRAME_PLANE_DATA (frame, 0));
   else if (frame->info.finfo->bits == 16){
-    if (frame->info.finfo->format == GST_VIDEO_FORMAT_GRAY16_BE)
-      fpncmagic_16b_BE (filter, frame);
-    else if (frame->info.finfo->format == GST_VIDEO_FORMAT_GRAY16_LE)
-      fpncmagic_16b_LE (filter, frame);
+    data = GST_VIDEO_FRAME_PLANE_DATA (frame, 0);
+    if (frame->info.finfo->format == GRAY16_NATIVE)
+      return fpncmagic_row (fpncmagic, frame, data);
+    else if (frame->info.finfo->format == GRAY16_SWAPPED) {
+      /* swap the row once instead of every window it is part of */
+      native = (guint16*)fpncmagic->native_row;
+      for (i=0; i<frame->info.width; i++)
+        native[i] = GUINT16_SWAP_LE_BE (data[i]);
+      return fpncmagic_row (fpncmagic, frame, native);
+    }
     else {
       GST_ERROR("Unhandled format type");
       return GST_FLOW_ERROR;
@@ -403,7 +564,6 @@ gst_fpncmagic_transform_frame_ip (GstVideoFilter * filter, GstVideoFrame * frame
     GST_ERROR("Unhandled data size of %d bits", frame->info.finfo->bits);
     return GST_FLOW_ERROR;
   }
-  return GST_FLOW_OK;
 }
 
 static gboolean
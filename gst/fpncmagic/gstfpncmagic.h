@@ -34,14 +34,48 @@ G_BEGIN_DECLS
 typedef struct _GstFpncmagic GstFpncmagic;
 typedef struct _GstFpncmagicClass GstFpncmagicClass;
 
+/* the row being filtered, in native byte order */
+typedef struct
+{
+  gconstpointer data;
+  gint width;
+  guint bits;
+  gpointer meta;
+} GstFpncmagicWork;
+
+/* a range of columns filtered by one thread, with its own median filter
+ * state and the sum of its samples */
+typedef struct
+{
+  gint start;
+  gint n;
+  gpointer median_filter;
+  gint64 sum;
+} GstFpncmagicChunk;
+
 
 
 struct _GstFpncmagic
 {
   GstVideoFilter base_fpncmagic;
 
-  gpointer rolling_medians;
-  gpointer errors;
+  /* GstFpncMagicPool the metas are filled in from */
+  gpointer meta_pool;
+
+  guint window;
+  /* 16 bit rows in foreign byte order are swapped into this once */
+  gpointer native_row;
+
+  guint n_threads;
+  /* the workers of the pool plus the streaming thread */
+  guint pool_threads;
+  GThreadPool *pool;
+  GstFpncmagicChunk *chunks;
+
+  GstFpncmagicWork work;
+  gint pending;
+  GMutex lock;
+  GCond cond;
 };
 
 struct _GstFpncmagicClass
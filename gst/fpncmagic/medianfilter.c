@@ -0,0 +1,360 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#include <string.h>
+#include "medianfilter.h"
+
+enum
+{
+  HEAP_LOW,                     /* max-heap, lower half of the window */
+  HEAP_HIGH                     /* min-heap, upper half of the window */
+};
+
+struct _MedianFilter
+{
+  gint range;
+  gint slots;
+
+  /* 8 bit state */
+  guint hist[256];
+
+  /* 16 bit state, indexed by column % range */
+  guint16 *values;
+  gint *where;                  /* >= 0 index in HEAP_LOW, else ~index in HEAP_HIGH */
+  gint *heap[2];
+  gint heap_len[2];
+};
+
+MedianFilter *
+median_filter_new (gint range)
+{
+  MedianFilter *mf;
+
+  g_return_val_if_fail (range > 0, NULL);
+
+  mf = g_new0 (MedianFilter, 1);
+  median_filter_set_range (mf, range);
+
+  return mf;
+}
+
+void
+median_filter_free (MedianFilter * mf)
+{
+  if (!mf)
+    return;
+
+  g_free (mf->values);
+  g_free (mf->where);
+  g_free (mf->heap[HEAP_LOW]);
+  g_free (mf->heap[HEAP_HIGH]);
+  g_free (mf);
+}
+
+void
+median_filter_set_range (MedianFilter * mf, gint range)
+{
+  g_return_if_fail (range > 0);
+
+  mf->range = range;
+
+  /* the window never holds more than range columns */
+  if (range <= mf->slots)
+    return;
+
+  mf->slots = range;
+  mf->values = g_renew (guint16, mf->values, range);
+  mf->where = g_renew (gint, mf->where, range);
+  mf->heap[HEAP_LOW] = g_renew (gint, mf->heap[HEAP_LOW], range);
+  mf->heap[HEAP_HIGH] = g_renew (gint, mf->heap[HEAP_HIGH], range);
+}
+
+gint
+median_filter_get_range (const MedianFilter * mf)
+{
+  return mf->range;
+}
+
+MedianFilterMethod
+median_filter_method (const MedianFilter * mf, guint bits)
+{
+  if (mf->range <= MEDIAN_FILTER_NETWORK_MAX)
+    return MEDIAN_FILTER_NETWORK;
+  if (bits == 8)
+    return MEDIAN_FILTER_HISTOGRAM;
+  return MEDIAN_FILTER_HEAP;
+}
+
+/* small windows: pad the window to MEDIAN_FILTER_NETWORK_MAX with the
+ * largest value and sort it with Batcher's odd-even merge network. The
+ * padding sorts to the end so the rank of the median is unchanged. */
+
+#define SORT2(a,b) { guint16 t = MIN (v[a], v[b]); v[b] = MAX (v[a], v[b]); v[a] = t; }
+
+static inline guint16
+network_median (guint16 * v, gint n)
+{
+  SORT2 (0, 1); SORT2 (2, 3); SORT2 (4, 5); SORT2 (6, 7);
+  SORT2 (0, 2); SORT2 (1, 3); SORT2 (4, 6); SORT2 (5, 7);
+  SORT2 (1, 2); SORT2 (5, 6);
+  SORT2 (0, 4); SORT2 (1, 5); SORT2 (2, 6); SORT2 (3, 7);
+  SORT2 (2, 4); SORT2 (3, 5);
+  SORT2 (1, 2); SORT2 (3, 4); SORT2 (5, 6);
+
+  return v[(n - 1) / 2];
+}
+
+#undef SORT2
+
+#define DEFINE_NETWORK_FILTER(type) \
+static void \
+network_filter_##type (const type * data, gint width, gint start, gint end, \
+    type * medians, gint before, gint after) \
+{ \
+  guint16 v[MEDIAN_FILTER_NETWORK_MAX]; \
+  gint i, j, lo, hi; \
+ \
+  for (i = start; i < end; i++) { \
+    lo = MAX (i - before, 0); \
+    hi = MIN (i + after, width - 1); \
+    if (hi <= lo) { \
+      medians[i] = data[i]; \
+      continue; \
+    } \
+    for (j = 0; j < hi - lo; j++) \
+      v[j] = data[lo + j]; \
+    for (; j < MEDIAN_FILTER_NETWORK_MAX; j++) \
+      v[j] = G_MAXUINT16; \
+    medians[i] = network_median (v, hi - lo); \
+  } \
+}
+
+DEFINE_NETWORK_FILTER (guint8);
+DEFINE_NETWORK_FILTER (guint16);
+
+/* 8 bit: histogram with a tracked median. below counts the samples smaller
+ * than med, the median of n samples is the one at rank (n - 1) / 2. */
+
+static void
+histogram_filter (MedianFilter * mf, const guint8 * data, gint width,
+    gint start, gint end, guint8 * medians, gint before, gint after)
+{
+  gint i, lo, hi, cur_lo, cur_hi;
+  guint *hist = mf->hist;
+  guint med = 0, below = 0, rank;
+
+  memset (hist, 0, sizeof (mf->hist));
+  cur_lo = cur_hi = MAX (start - before, 0);
+
+  for (i = start; i < end; i++) {
+    lo = MAX (i - before, 0);
+    hi = MIN (i + after, width - 1);
+
+    for (; cur_lo < MIN (lo, cur_hi); cur_lo++) {
+      hist[data[cur_lo]]--;
+      if (data[cur_lo] < med)
+        below--;
+    }
+    if (cur_lo == cur_hi)
+      cur_lo = cur_hi = lo;
+    for (; cur_hi < hi; cur_hi++) {
+      hist[data[cur_hi]]++;
+      if (data[cur_hi] < med)
+        below++;
+    }
+
+    if (cur_hi == cur_lo) {
+      medians[i] = data[i];
+      continue;
+    }
+
+    rank = (cur_hi - cur_lo - 1) / 2;
+    while (below > rank)
+      below -= hist[--med];
+    while (below + hist[med] <= rank)
+      below += hist[med++];
+
+    medians[i] = med;
+  }
+}
+
+void
+median_filter_uint8_t (MedianFilter * mf, const guint8 * data, gint width,
+    gint start, gint end, guint8 * medians)
+{
+  gint before = mf->range / 2;
+  gint after = mf->range - before;
+
+  if (median_filter_method (mf, 8) == MEDIAN_FILTER_NETWORK)
+    network_filter_guint8 (data, width, start, end, medians, before, after);
+  else
+    histogram_filter (mf, data, width, start, end, medians, before, after);
+}
+
+/* 16 bit: two heaps of window slots. Every value in HEAP_LOW is <= every
+ * value in HEAP_HIGH and HEAP_LOW holds (n + 1) / 2 slots, so its top is the
+ * median. */
+
+static inline gboolean
+heap_before (const MedianFilter * mf, gint h, gint a, gint b)
+{
+  if (h == HEAP_LOW)
+    return mf->values[a] > mf->values[b];
+  return mf->values[a] < mf->values[b];
+}
+
+static inline void
+heap_set (MedianFilter * mf, gint h, gint idx, gint slot)
+{
+  mf->heap[h][idx] = slot;
+  mf->where[slot] = (h == HEAP_LOW) ? idx : ~idx;
+}
+
+static void
+heap_sift_up (MedianFilter * mf, gint h, gint idx)
+{
+  gint *heap = mf->heap[h];
+  gint slot = heap[idx];
+  gint parent;
+
+  while (idx > 0) {
+    parent = (idx - 1) / 2;
+    if (!heap_before (mf, h, slot, heap[parent]))
+      break;
+    heap_set (mf, h, idx, heap[parent]);
+    idx = parent;
+  }
+  heap_set (mf, h, idx, slot);
+}
+
+static void
+heap_sift_down (MedianFilter * mf, gint h, gint idx)
+{
+  gint *heap = mf->heap[h];
+  gint len = mf->heap_len[h];
+  gint slot = heap[idx];
+  gint child;
+
+  for (;;) {
+    child = 2 * idx + 1;
+    if (child >= len)
+      break;
+    if (child + 1 < len && heap_before (mf, h, heap[child + 1], heap[child]))
+      child++;
+    if (!heap_before (mf, h, heap[child], slot))
+      break;
+    heap_set (mf, h, idx, heap[child]);
+    idx = child;
+  }
+  heap_set (mf, h, idx, slot);
+}
+
+static void
+heap_push (MedianFilter * mf, gint h, gint slot)
+{
+  gint idx = mf->heap_len[h]++;
+
+  heap_set (mf, h, idx, slot);
+  heap_sift_up (mf, h, idx);
+}
+
+static gint
+heap_take (MedianFilter * mf, gint h, gint idx)
+{
+  gint *heap = mf->heap[h];
+  gint slot = heap[idx];
+  gint last = --mf->heap_len[h];
+
+  if (idx != last) {
+    heap_set (mf, h, idx, heap[last]);
+    if (idx > 0 && heap_before (mf, h, heap[idx], heap[(idx - 1) / 2]))
+      heap_sift_up (mf, h, idx);
+    else
+      heap_sift_down (mf, h, idx);
+  }
+
+  return slot;
+}
+
+static void
+heap_balance (MedianFilter * mf, gint n)
+{
+  gint target = (n + 1) / 2;
+
+  while (mf->heap_len[HEAP_LOW] > target)
+    heap_push (mf, HEAP_HIGH, heap_take (mf, HEAP_LOW, 0));
+  while (mf->heap_len[HEAP_LOW] < target)
+    heap_push (mf, HEAP_LOW, heap_take (mf, HEAP_HIGH, 0));
+}
+
+static void
+heap_filter (MedianFilter * mf, const guint16 * data, gint width,
+    gint start, gint end, guint16 * medians, gint before, gint after)
+{
+  gint i, lo, hi, slot, w, cur_lo, cur_hi;
+
+  mf->heap_len[HEAP_LOW] = 0;
+  mf->heap_len[HEAP_HIGH] = 0;
+  cur_lo = cur_hi = MAX (start - before, 0);
+
+  for (i = start; i < end; i++) {
+    lo = MAX (i - before, 0);
+    hi = MIN (i + after, width - 1);
+
+    /* drop before adding so the window never needs more than range slots */
+    for (; cur_lo < MIN (lo, cur_hi); cur_lo++) {
+      w = mf->where[cur_lo % mf->range];
+      if (w >= 0)
+        heap_take (mf, HEAP_LOW, w);
+      else
+        heap_take (mf, HEAP_HIGH, ~w);
+      heap_balance (mf, cur_hi - cur_lo - 1);
+    }
+    if (cur_lo == cur_hi)
+      cur_lo = cur_hi = lo;
+    for (; cur_hi < hi; cur_hi++) {
+      slot = cur_hi % mf->range;
+      mf->values[slot] = data[cur_hi];
+      if (mf->heap_len[HEAP_LOW] == 0
+          || data[cur_hi] <= mf->values[mf->heap[HEAP_LOW][0]])
+        heap_push (mf, HEAP_LOW, slot);
+      else
+        heap_push (mf, HEAP_HIGH, slot);
+      heap_balance (mf, cur_hi - cur_lo + 1);
+    }
+
+    if (cur_hi == cur_lo)
+      medians[i] = data[i];
+    else
+      medians[i] = mf->values[mf->heap[HEAP_LOW][0]];
+  }
+}
+
+void
+median_filter_uint16_t (MedianFilter * mf, const guint16 * data, gint width,
+    gint start, gint end, guint16 * medians)
+{
+  gint before = mf->range / 2;
+  gint after = mf->range - before;
+
+  if (median_filter_method (mf, 16) == MEDIAN_FILTER_NETWORK)
+    network_filter_guint16 (data, width, start, end, medians, before, after);
+  else
+    heap_filter (mf, data, width, start, end, medians, before, after);
+}
@@ -0,0 +1,70 @@
+/* GStreamer
+ * Copyright (C) 2015 Dimitrios Katsaros <patcherwork@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifndef __FPNC_MEDIAN_FILTER_H__
+#define __FPNC_MEDIAN_FILTER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  MEDIAN_FILTER_NETWORK,
+  MEDIAN_FILTER_HISTOGRAM,
+  MEDIAN_FILTER_HEAP
+} MedianFilterMethod;
+
+/* windows up to this size are sorted with a fixed sorting network */
+#define MEDIAN_FILTER_NETWORK_MAX 8
+
+typedef struct _MedianFilter MedianFilter;
+
+/* A running median over a row of samples. Column i gets the median of the
+ * columns [i - range / 2, i - range / 2 + range), clipped to
+ * [0, width - 1). When the window holds an even number of samples the lower
+ * of the two middle values is used.
+ *
+ * The method depends on the range and the sample size, see
+ * median_filter_method(). Small windows are copied and run through a
+ * sorting network. Larger 8 bit windows are kept in a 256 bin histogram
+ * whose median is tracked as the window slides. Larger 16 bit windows are
+ * kept in a max-heap for the lower half and a min-heap for the upper half,
+ * so adding and dropping a column costs O(log range). The 16 bit samples
+ * must be in native order. */
+MedianFilter *median_filter_new (gint range);
+void median_filter_free (MedianFilter * mf);
+
+/* only reallocates when the range grows beyond any range used before */
+void median_filter_set_range (MedianFilter * mf, gint range);
+gint median_filter_get_range (const MedianFilter * mf);
+MedianFilterMethod median_filter_method (const MedianFilter * mf, guint bits);
+
+/* filters the columns [start, end) of a row of width samples. The window
+ * reaches outside of [start, end), so filters of neighbouring column ranges
+ * give the same medians as one filter over the whole row. medians is
+ * indexed by column like data. */
+void median_filter_uint8_t (MedianFilter * mf, const guint8 * data,
+    gint width, gint start, gint end, guint8 * medians);
+void median_filter_uint16_t (MedianFilter * mf, const guint16 * data,
+    gint width, gint start, gint end, guint16 * medians);
+
+G_END_DECLS
+
+#endif
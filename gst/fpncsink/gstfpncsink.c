@@ -388,21 +388,9 @@ gst_fpnc_sink_set_caps (GstBaseSink * sink, GstCaps * caps)
   if (fpncsink->rolling_medians)
     free(fpncsink->rolling_medians);
 
-  fpncsink->calc_errors = malloc(fpncsink->info.width * fpncsink->max_fpnc_no * sizeof(gint));
-
-  if (!fpncsink->calc_errors) {
-    GST_ERROR("Unable to allocate memory of size %lu", fpncsink->info.width * fpncsink->max_fpnc_no * sizeof(gint));
-    return FALSE;
-  }
-
-
-  fpncsink->rolling_medians = malloc(fpncsink->info.width * fpncsink->max_fpnc_no * sizeof(gint));
-
-  if (!fpncsink->rolling_medians) {
-    GST_ERROR("Unable to allocate memory of size %lu", fpncsink->info.width * fpncsink->max_fpnc_no * sizeof(gint));
-    free(fpncsink->calc_errors);
-    return FALSE;
-  }
+  /* allocated for the types of the first meta that is stored */
+  fpncsink->calc_errors = NULL;
+  fpncsink->rolling_medians = NULL;
 
   return TRUE;
 
@@ -453,6 +441,43 @@ error:
 #define EXPOSURE "Exposure Time, Absolute"
 #define FPNC     "Fixed Pattern Noise Correction"
 
+/* makes room for max_fpnc_no rows in the types of meta */
+static gboolean
+gst_fpnc_sink_alloc_rows (GstFpncSink * fpncsink, GstFpncMagicMeta * meta)
+{
+  gsize esize = gst_fpnc_magic_type_get_size (meta->error_type);
+  gsize msize = gst_fpnc_magic_type_get_size (meta->median_type);
+
+  if (fpncsink->calc_errors && fpncsink->error_type == meta->error_type &&
+      fpncsink->median_type == meta->median_type)
+    return TRUE;
+
+  if (fpncsink->calc_errors)
+    free(fpncsink->calc_errors);
+  if (fpncsink->rolling_medians)
+    free(fpncsink->rolling_medians);
+  fpncsink->rolling_medians = NULL;
+
+  fpncsink->calc_errors = malloc(fpncsink->info.width * fpncsink->max_fpnc_no * esize);
+  if (!fpncsink->calc_errors) {
+    GST_ERROR("Unable to allocate memory of size %lu", fpncsink->info.width * fpncsink->max_fpnc_no * esize);
+    return FALSE;
+  }
+
+  fpncsink->rolling_medians = malloc(fpncsink->info.width * fpncsink->max_fpnc_no * msize);
+  if (!fpncsink->rolling_medians) {
+    GST_ERROR("Unable to allocate memory of size %lu", fpncsink->info.width * fpncsink->max_fpnc_no * msize);
+    free(fpncsink->calc_errors);
+    fpncsink->calc_errors = NULL;
+    return FALSE;
+  }
+
+  fpncsink->error_type = meta->error_type;
+  fpncsink->median_type = meta->median_type;
+
+  return TRUE;
+}
+
 #define MINIMUM_DN 9766
 #define MAXIMUM_DN 51400
 
@@ -469,8 +494,9 @@ gst_fpnc_sink_show_frame (GstVideoSink * sink, GstBuffer * buf)
   GValue *val;
   const GValue *cval = NULL;
   GstMapFlags flags = GST_MAP_READ;
-  gint *fpnc_ptr, *fpnc_ptr2;
-  gint *fpnc_ptr3, *fpnc_ptr4;
+  GstFpncMagicArray fpnc_ptr, fpnc_ptr2;
+  GstFpncMagicArray fpnc_ptr3, fpnc_ptr4;
+  gsize erow, mrow;
 
   //Hack for T#643, discarding first buffer in case it is a prerolled buffer
   if (fpncsink->skip_first) {
@@ -598,19 +624,24 @@ gst_fpnc_sink_show_frame (GstVideoSink * sink, GstBuffer * buf)
         gfloat diff;
 
         /* calculate the response curve slopes. They are stored in the same memory as the first error */
-        fpnc_ptr = fpncsink->calc_errors;
-        fpnc_ptr3 = fpncsink->rolling_medians;
+        erow = fpncsink->info.width * gst_fpnc_magic_type_get_size (fpncsink->error_type);
+        mrow = fpncsink->info.width * gst_fpnc_magic_type_get_size (fpncsink->median_type);
+        fpnc_ptr.ptr = fpncsink->calc_errors;
+        fpnc_ptr3.ptr = fpncsink->rolling_medians;
         for (i=1; i<fpncsink->fpnc_no; i++){
-          fpnc_ptr2 = fpncsink->calc_errors + (i * fpncsink->info.width);
-          fpnc_ptr4 = fpncsink->rolling_medians + (i * fpncsink->info.width);
+          fpnc_ptr2.ptr = fpncsink->calc_errors + (i * erow);
+          fpnc_ptr4.ptr = fpncsink->rolling_medians + (i * mrow);
 
           for (j=0; j<fpncsink->info.width; j++) {
             /*calc the difference */
-            diff = (fpnc_ptr4[j] - fpnc_ptr3[j]);
+            diff = (gst_fpnc_magic_array_get (fpncsink->median_type, fpnc_ptr4, j) -
+                gst_fpnc_magic_array_get (fpncsink->median_type, fpnc_ptr3, j));
             if (diff == 0)
               diff = 1;
             /* divide by the intensity */
-            dmatrix[j+((i-1) * fpncsink->info.width)] = (fpnc_ptr2[j] - fpnc_ptr[j]) / diff;
+            dmatrix[j+((i-1) * fpncsink->info.width)] =
+                (gst_fpnc_magic_array_get (fpncsink->error_type, fpnc_ptr2, j) -
+                gst_fpnc_magic_array_get (fpncsink->error_type, fpnc_ptr, j)) / diff;
           }
 
           fpnc_ptr = fpnc_ptr2;
@@ -704,12 +735,22 @@ gst_fpnc_sink_show_frame (GstVideoSink * sink, GstBuffer * buf)
     /* if the exposure is within the dn limits */
     else {
       GST_DEBUG("DN is at %d", image_avg);
-      /* store the error and the rolling medians */
-      fpnc_ptr  = fpncsink->calc_errors + (fpncsink->fpnc_no * fpncsink->info.width);
-      fpnc_ptr2 = fpncsink->rolling_medians + (fpncsink->fpnc_no * fpncsink->info.width);
+      /* store the error and the rolling medians as they are in the meta */
+      if (fpncsink->fpnc_no == 0) {
+        if (!gst_fpnc_sink_alloc_rows (fpncsink, fpncmeta))
+          return GST_FLOW_ERROR;
+      } else if (fpncmeta->error_type != fpncsink->error_type ||
+          fpncmeta->median_type != fpncsink->median_type) {
+        GST_ERROR("FPNC magic metadata changed type during calibration");
+        return GST_FLOW_ERROR;
+      }
+      erow = fpncsink->info.width * gst_fpnc_magic_type_get_size (fpncsink->error_type);
+      mrow = fpncsink->info.width * gst_fpnc_magic_type_get_size (fpncsink->median_type);
 
-      memcpy(fpnc_ptr, fpncmeta->error, fpncsink->info.width * sizeof(gint));
-      memcpy(fpnc_ptr2, fpncmeta->rolling_median, fpncsink->info.width * sizeof(gint));
+      memcpy(fpncsink->calc_errors + (fpncsink->fpnc_no * erow),
+          fpncmeta->error.ptr, erow);
+      memcpy(fpncsink->rolling_medians + (fpncsink->fpnc_no * mrow),
+          fpncmeta->rolling_median.ptr, mrow);
       /* increment the calculated fpncs */
       fpncsink->fpnc_no++;
     }
@@ -22,6 +22,7 @@
 
 #include <gst/video/video.h>
 #include <gst/video/gstvideosink.h>
+#include <gst/fpncmagic/gstfpncmagicmeta.h>
 
 G_BEGIN_DECLS
 
@@ -39,8 +40,12 @@ struct _GstFpncSink
   GstVideoSink base_fpncsink;
   GstVideoInfo info;
 
-  gint   *calc_errors;
-  gint   *rolling_medians;
+  /* max_fpnc_no rows of width values each, stored in the types of the
+   * fpncmagic metas they were copied from */
+  guint8 *calc_errors;
+  guint8 *rolling_medians;
+  GstFpncMagicType error_type;
+  GstFpncMagicType median_type;
   gint   fpnc_no;
   gint   max_fpnc_no;
 
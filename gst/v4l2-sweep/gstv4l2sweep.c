@@ -540,8 +540,8 @@ double colDiffMagic(GstV4l2sweep *v4l2sweep, GstFpncMagicMeta* meta)
 
 	for (i=0; i<meta->data_size-1; i++) {
 		//calc neighbor difference
-		temp = abs(meta->error[i] - meta->error[i+1]);
-
+		temp = abs(gst_fpnc_magic_meta_get_error(meta, i) -
+				gst_fpnc_magic_meta_get_error(meta, i+1));
 		//calc RMS of neighbor difference
 		diff += temp*temp;
 	}
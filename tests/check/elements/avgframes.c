@@ -8,6 +8,8 @@
 #include <gst/check/gstcheck.h>
 #include <time.h>
 #include <stdlib.h>
+#include <gst/avgframes/gstavgframesmeta.h>
+#include "avgframeskernels.h"
 
 /* NOTE ABOUT AVGFRAMES:
  * Do not forget that frames that are getting averaged are being dropped
@@ -17,6 +19,9 @@
 
 /* helper data */
 
+/* the largest frameno */
+#define MAX_FRAMES 100
+
 /* random data for building buffers with */
 guint8 junk_data[] = { 0x00, 0xfe, 0x01, 0x03, 0x04, 0xfd, 0x00, 0xff };
 guint8 junk_data2[] = { 0x0a, 0x00, 0x03, 0x01, 0x04, 0xff, 0x00, 0xff };
@@ -410,6 +415,1189 @@ GST_START_TEST (test_avgframes_averaging)
 }
 GST_END_TEST;
 
+GST_START_TEST (test_avgframes_sliding)
+{
+  GstElement *filter;
+  GstCaps *caps;
+  GstBuffer *buffer, *outp_buffer;
+  GstPad *pad_peer;
+  GstPad *sink_pad = NULL;
+  GstPad *src_pad;
+  gchar element_name[] = "avgframes";
+  GList *test_buffers = NULL;
+
+  gst_check_drop_buffers();
+  filter = gst_check_setup_element (element_name);
+
+  /* every frame should generate the average of the last three */
+  g_object_set(filter, "frameno", 3, "mode", 1, NULL);
+
+  /*caps init */
+  caps = gst_caps_new_simple ("video/x-raw",
+        "width", G_TYPE_INT, sizeof(junk_data),
+        "height", G_TYPE_INT, 1,
+        "framerate", GST_TYPE_FRACTION, 1, 1,
+        "format", G_TYPE_STRING, "GRAY8",
+      NULL);
+  ck_assert_msg (GST_IS_CAPS (caps));
+
+  /* create a rudementary buffers that will be pushed */
+  buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, junk_data, sizeof(junk_data),
+        0, sizeof(junk_data), NULL, NULL);
+  test_buffers = g_list_append(test_buffers, buffer);
+  buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, junk_data2, sizeof(junk_data2),
+        0, sizeof(junk_data2), NULL, NULL);
+  test_buffers = g_list_append(test_buffers, buffer);
+  buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, junk_data3, sizeof(junk_data3),
+        0, sizeof(junk_data3), NULL, NULL);
+  test_buffers = g_list_append(test_buffers, buffer);
+
+  /* link our "source" to the averager */
+  src_pad = gst_pad_new ("src", GST_PAD_SRC);
+  ck_assert_msg (GST_IS_PAD (src_pad));
+  gst_pad_set_active (src_pad, TRUE);
+  gst_check_setup_events (src_pad, filter, caps, GST_FORMAT_BYTES);
+  pad_peer = gst_element_get_static_pad (filter, "sink");
+  ck_assert_msg (GST_IS_PAD (pad_peer));
+  ck_assert_msg (gst_pad_link (src_pad, pad_peer) == GST_PAD_LINK_OK,
+    "Could not link source and %s sink pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  /* link our "sink" to the averager */
+  sink_pad = gst_pad_new ("sink", GST_PAD_SINK);
+  ck_assert_msg (GST_IS_PAD (sink_pad));
+  gst_pad_set_chain_function (sink_pad, gst_check_chain_func);
+  gst_pad_set_active (sink_pad, TRUE);
+  pad_peer = gst_element_get_static_pad (filter, "src");
+  ck_assert_msg (gst_pad_link (pad_peer, sink_pad) == GST_PAD_LINK_OK,
+      "Could not link sink and %s source pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  /* every push has to produce a frame */
+  while (test_buffers != NULL) {
+    buffer = GST_BUFFER (test_buffers->data);
+    test_buffers = g_list_remove (test_buffers, buffer);
+    ck_assert_msg (gst_pad_push (src_pad, buffer) == GST_FLOW_OK,
+      "Failed to push buffer");
+  }
+  ck_assert_int_eq  (g_list_length (buffers), 3);
+
+  /* the window grows from one frame to three, the averages of the first
+   * two and of all three frames both happen to be junk_data3 */
+  outp_buffer = GST_BUFFER (buffers->data);
+  gst_check_buffer_data(outp_buffer, junk_data, sizeof(junk_data));
+  outp_buffer = GST_BUFFER (buffers->next->data);
+  gst_check_buffer_data(outp_buffer, junk_data3, sizeof(junk_data3));
+  outp_buffer = GST_BUFFER (buffers->next->next->data);
+  gst_check_buffer_data(outp_buffer, junk_data3, sizeof(junk_data3));
+
+  /* cleanup */
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_NULL) == GST_STATE_CHANGE_SUCCESS, "could not set to null");
+
+  gst_check_drop_buffers();
+  g_list_free (test_buffers);
+  g_object_unref (src_pad);
+  g_object_unref (sink_pad);
+  gst_caps_unref(caps);
+
+  gst_check_teardown_element(filter);
+
+}
+GST_END_TEST;
+
+GST_START_TEST (test_avgframes_ema)
+{
+  GstElement *filter;
+  GstCaps *caps;
+  GstBuffer *buffer, *outp_buffer;
+  GstPad *pad_peer;
+  GstPad *sink_pad = NULL;
+  GstPad *src_pad;
+  gchar element_name[] = "avgframes";
+  GstStructure *s;
+
+  gst_check_drop_buffers();
+  filter = gst_check_setup_element (element_name);
+
+  /* a new frame gets half of the weight */
+  g_object_set(filter, "mode", 2, "alpha-shift", 1, NULL);
+
+  /*caps init */
+  caps = gst_caps_new_simple ("video/x-raw",
+        "width", G_TYPE_INT, sizeof(junk_data),
+        "height", G_TYPE_INT, 1,
+        "framerate", GST_TYPE_FRACTION, 1, 1,
+        "format", G_TYPE_STRING, "GRAY8",
+      NULL);
+  ck_assert_msg (GST_IS_CAPS (caps));
+
+  /* link our "source" to the averager */
+  src_pad = gst_pad_new ("src", GST_PAD_SRC);
+  ck_assert_msg (GST_IS_PAD (src_pad));
+  gst_pad_set_active (src_pad, TRUE);
+  gst_check_setup_events (src_pad, filter, caps, GST_FORMAT_BYTES);
+  pad_peer = gst_element_get_static_pad (filter, "sink");
+  ck_assert_msg (GST_IS_PAD (pad_peer));
+  ck_assert_msg (gst_pad_link (src_pad, pad_peer) == GST_PAD_LINK_OK,
+    "Could not link source and %s sink pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  /* link our "sink" to the averager */
+  sink_pad = gst_pad_new ("sink", GST_PAD_SINK);
+  ck_assert_msg (GST_IS_PAD (sink_pad));
+  gst_pad_set_chain_function (sink_pad, gst_check_chain_func);
+  gst_pad_set_active (sink_pad, TRUE);
+  pad_peer = gst_element_get_static_pad (filter, "src");
+  ck_assert_msg (gst_pad_link (pad_peer, sink_pad) == GST_PAD_LINK_OK,
+      "Could not link sink and %s source pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  /* the first frame starts the filter, the second one is mixed in with
+   * half of the weight, which gives the average of both */
+  buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, junk_data, sizeof(junk_data),
+        0, sizeof(junk_data), NULL, NULL);
+  ck_assert_msg (gst_pad_push (src_pad, buffer) == GST_FLOW_OK,
+      "Failed to push buffer");
+  buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, junk_data2, sizeof(junk_data2),
+        0, sizeof(junk_data2), NULL, NULL);
+  ck_assert_msg (gst_pad_push (src_pad, buffer) == GST_FLOW_OK,
+      "Failed to push buffer");
+  ck_assert_int_eq  (g_list_length (buffers), 2);
+  outp_buffer = GST_BUFFER (buffers->data);
+  gst_check_buffer_data(outp_buffer, junk_data, sizeof(junk_data));
+  outp_buffer = GST_BUFFER (buffers->next->data);
+  gst_check_buffer_data(outp_buffer, junk_data3, sizeof(junk_data3));
+
+  /* after a flush the filter starts over */
+  s = gst_structure_new ("qtec-flush-struct",
+    "name", G_TYPE_STRING, "qtec-flush", NULL);
+  gst_pad_push_event (src_pad, gst_event_new_custom (GST_EVENT_CUSTOM_DOWNSTREAM_OOB, s));
+  buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, junk_data2, sizeof(junk_data2),
+        0, sizeof(junk_data2), NULL, NULL);
+  ck_assert_msg (gst_pad_push (src_pad, buffer) == GST_FLOW_OK,
+      "Failed to push buffer");
+  ck_assert_int_eq  (g_list_length (buffers), 3);
+  outp_buffer = GST_BUFFER (buffers->next->next->data);
+  gst_check_buffer_data(outp_buffer, junk_data2, sizeof(junk_data2));
+
+  /* cleanup */
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_NULL) == GST_STATE_CHANGE_SUCCESS, "could not set to null");
+
+  gst_check_drop_buffers();
+  g_object_unref (src_pad);
+  g_object_unref (sink_pad);
+  gst_caps_unref(caps);
+
+  gst_check_teardown_element(filter);
+
+}
+GST_END_TEST;
+
+GST_START_TEST (test_avgframes_threads)
+{
+  GstElement *filter;
+  GstCaps *caps;
+  GstBuffer *buffer, *outp_buffer;
+  GstPad *pad_peer;
+  GstPad *sink_pad = NULL;
+  GstPad *src_pad;
+  gchar element_name[] = "avgframes";
+  GstMapInfo map;
+  /* big enough to be split up, with a last band that is not full */
+  gint width = 1000, height = 77;
+  gsize i, n = width * height;
+  guint16 *frame;
+  gint f;
+
+  gst_check_drop_buffers();
+  filter = gst_check_setup_element (element_name);
+
+  g_object_set(filter, "frameno", 3, "n-threads", 4, NULL);
+
+  /*caps init */
+  caps = gst_caps_new_simple ("video/x-raw",
+        "width", G_TYPE_INT, width,
+        "height", G_TYPE_INT, height,
+        "framerate", GST_TYPE_FRACTION, 1, 1,
+        "format", G_TYPE_STRING, "GRAY16_LE",
+      NULL);
+  ck_assert_msg (GST_IS_CAPS (caps));
+
+  /* link our "source" to the averager */
+  src_pad = gst_pad_new ("src", GST_PAD_SRC);
+  ck_assert_msg (GST_IS_PAD (src_pad));
+  gst_pad_set_active (src_pad, TRUE);
+  gst_check_setup_events (src_pad, filter, caps, GST_FORMAT_BYTES);
+  pad_peer = gst_element_get_static_pad (filter, "sink");
+  ck_assert_msg (GST_IS_PAD (pad_peer));
+  ck_assert_msg (gst_pad_link (src_pad, pad_peer) == GST_PAD_LINK_OK,
+    "Could not link source and %s sink pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  /* link our "sink" to the averager */
+  sink_pad = gst_pad_new ("sink", GST_PAD_SINK);
+  ck_assert_msg (GST_IS_PAD (sink_pad));
+  gst_pad_set_chain_function (sink_pad, gst_check_chain_func);
+  gst_pad_set_active (sink_pad, TRUE);
+  pad_peer = gst_element_get_static_pad (filter, "src");
+  ck_assert_msg (gst_pad_link (pad_peer, sink_pad) == GST_PAD_LINK_OK,
+      "Could not link sink and %s source pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  /* the frames differ per pixel, so every band has its own values */
+  for (f = 0; f < 3; f++) {
+    frame = g_new (guint16, n);
+    for (i = 0; i < n; i++)
+      frame[i] = GUINT16_TO_LE ((i * 7 + f * 1000) & 0xffff);
+    buffer = gst_buffer_new_wrapped (frame, n * sizeof (guint16));
+    ck_assert_msg (gst_pad_push (src_pad, buffer) == GST_FLOW_OK,
+      "Failed to push buffer");
+  }
+  ck_assert_int_eq  (g_list_length (buffers), 1);
+
+  outp_buffer = GST_BUFFER (buffers->data);
+  ck_assert_msg (gst_buffer_map (outp_buffer, &map, GST_MAP_READ));
+  for (i = 0; i < n; i++) {
+    guint32 sum = 0;
+    for (f = 0; f < 3; f++)
+      sum += (i * 7 + f * 1000) & 0xffff;
+    ck_assert_int_eq (GUINT16_FROM_LE (((guint16 *) map.data)[i]), sum / 3);
+  }
+  gst_buffer_unmap (outp_buffer, &map);
+
+  /* cleanup */
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_NULL) == GST_STATE_CHANGE_SUCCESS, "could not set to null");
+
+  gst_check_drop_buffers();
+  g_object_unref (src_pad);
+  g_object_unref (sink_pad);
+  gst_caps_unref(caps);
+
+  gst_check_teardown_element(filter);
+
+}
+GST_END_TEST;
+
+GST_START_TEST (test_avgframes_planar)
+{
+  GstElement *filter;
+  GstCaps *caps;
+  GstBuffer *buffer, *outp_buffer;
+  GstPad *pad_peer;
+  GstPad *sink_pad = NULL;
+  GstPad *src_pad;
+  gchar element_name[] = "avgframes";
+  GstMapInfo map;
+  /* I420 6x2: Y rows of 6 in a stride of 8 at 0, U and V rows of 3 in a
+   * stride of 4 at 16 and 20 */
+  const gsize size = 24;
+  const gsize row_offset[] = { 0, 8, 16, 20 };
+  const gsize row_len[] = { 6, 6, 3, 3 };
+  guint8 *frame;
+  gsize i, r;
+  gint f;
+
+  gst_check_drop_buffers();
+  filter = gst_check_setup_element (element_name);
+
+  g_object_set(filter, "frameno", 3, NULL);
+
+  /*caps init */
+  caps = gst_caps_new_simple ("video/x-raw",
+        "width", G_TYPE_INT, 6,
+        "height", G_TYPE_INT, 2,
+        "framerate", GST_TYPE_FRACTION, 1, 1,
+        "format", G_TYPE_STRING, "I420",
+      NULL);
+  ck_assert_msg (GST_IS_CAPS (caps));
+
+  /* link our "source" to the averager */
+  src_pad = gst_pad_new ("src", GST_PAD_SRC);
+  ck_assert_msg (GST_IS_PAD (src_pad));
+  gst_pad_set_active (src_pad, TRUE);
+  gst_check_setup_events (src_pad, filter, caps, GST_FORMAT_BYTES);
+  pad_peer = gst_element_get_static_pad (filter, "sink");
+  ck_assert_msg (GST_IS_PAD (pad_peer));
+  ck_assert_msg (gst_pad_link (src_pad, pad_peer) == GST_PAD_LINK_OK,
+    "Could not link source and %s sink pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  /* link our "sink" to the averager */
+  sink_pad = gst_pad_new ("sink", GST_PAD_SINK);
+  ck_assert_msg (GST_IS_PAD (sink_pad));
+  gst_pad_set_chain_function (sink_pad, gst_check_chain_func);
+  gst_pad_set_active (sink_pad, TRUE);
+  pad_peer = gst_element_get_static_pad (filter, "src");
+  ck_assert_msg (gst_pad_link (pad_peer, sink_pad) == GST_PAD_LINK_OK,
+      "Could not link sink and %s source pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  for (f = 0; f < 3; f++) {
+    frame = g_malloc (size);
+    for (i = 0; i < size; i++)
+      frame[i] = (i * 5 + f * 60) & 0xff;
+    buffer = gst_buffer_new_wrapped (frame, size);
+    ck_assert_msg (gst_pad_push (src_pad, buffer) == GST_FLOW_OK,
+      "Failed to push buffer");
+  }
+  ck_assert_int_eq  (g_list_length (buffers), 1);
+
+  /* every plane is averaged, the padding is left alone */
+  outp_buffer = GST_BUFFER (buffers->data);
+  ck_assert_msg (gst_buffer_map (outp_buffer, &map, GST_MAP_READ));
+  ck_assert_int_eq (map.size, size);
+  for (r = 0; r < G_N_ELEMENTS (row_offset); r++) {
+    for (i = row_offset[r]; i < row_offset[r] + row_len[r]; i++) {
+      guint sum = 0;
+      for (f = 0; f < 3; f++)
+        sum += (i * 5 + f * 60) & 0xff;
+      ck_assert_int_eq (map.data[i], sum / 3);
+    }
+  }
+  gst_buffer_unmap (outp_buffer, &map);
+
+  /* cleanup */
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_NULL) == GST_STATE_CHANGE_SUCCESS, "could not set to null");
+
+  gst_check_drop_buffers();
+  g_object_unref (src_pad);
+  g_object_unref (sink_pad);
+  gst_caps_unref(caps);
+
+  gst_check_teardown_element(filter);
+
+}
+GST_END_TEST;
+
+GST_START_TEST (test_avgframes_median)
+{
+  GstElement *filter;
+  GstCaps *caps;
+  GstBuffer *buffer, *outp_buffer;
+  GstPad *pad_peer;
+  GstPad *sink_pad = NULL;
+  GstPad *src_pad;
+  gchar element_name[] = "avgframes";
+  GstMapInfo map;
+  guint8 *frame;
+  gint f, i;
+
+  gst_check_drop_buffers();
+  filter = gst_check_setup_element (element_name);
+
+  g_object_set(filter, "frameno", 3, "mode", 3, NULL);
+
+  /*caps init */
+  caps = gst_caps_new_simple ("video/x-raw",
+        "width", G_TYPE_INT, sizeof(junk_data),
+        "height", G_TYPE_INT, 1,
+        "framerate", GST_TYPE_FRACTION, 1, 1,
+        "format", G_TYPE_STRING, "GRAY8",
+      NULL);
+  ck_assert_msg (GST_IS_CAPS (caps));
+
+  /* link our "source" to the averager */
+  src_pad = gst_pad_new ("src", GST_PAD_SRC);
+  ck_assert_msg (GST_IS_PAD (src_pad));
+  gst_pad_set_active (src_pad, TRUE);
+  gst_check_setup_events (src_pad, filter, caps, GST_FORMAT_BYTES);
+  pad_peer = gst_element_get_static_pad (filter, "sink");
+  ck_assert_msg (GST_IS_PAD (pad_peer));
+  ck_assert_msg (gst_pad_link (src_pad, pad_peer) == GST_PAD_LINK_OK,
+    "Could not link source and %s sink pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  /* link our "sink" to the averager */
+  sink_pad = gst_pad_new ("sink", GST_PAD_SINK);
+  ck_assert_msg (GST_IS_PAD (sink_pad));
+  gst_pad_set_chain_function (sink_pad, gst_check_chain_func);
+  gst_pad_set_active (sink_pad, TRUE);
+  pad_peer = gst_element_get_static_pad (filter, "src");
+  ck_assert_msg (gst_pad_link (pad_peer, sink_pad) == GST_PAD_LINK_OK,
+      "Could not link sink and %s source pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  /* the per pixel median of the three junk frames is junk_data3 */
+  buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, junk_data, sizeof(junk_data),
+        0, sizeof(junk_data), NULL, NULL);
+  ck_assert_msg (gst_pad_push (src_pad, buffer) == GST_FLOW_OK,
+      "Failed to push buffer");
+  buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, junk_data2, sizeof(junk_data2),
+        0, sizeof(junk_data2), NULL, NULL);
+  ck_assert_msg (gst_pad_push (src_pad, buffer) == GST_FLOW_OK,
+      "Failed to push buffer");
+  ck_assert_int_eq  (g_list_length (buffers), 0);
+  buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, junk_data3, sizeof(junk_data3),
+        0, sizeof(junk_data3), NULL, NULL);
+  ck_assert_msg (gst_pad_push (src_pad, buffer) == GST_FLOW_OK,
+      "Failed to push buffer");
+  ck_assert_int_eq  (g_list_length (buffers), 1);
+  outp_buffer = GST_BUFFER (buffers->data);
+  gst_check_buffer_data(outp_buffer, junk_data3, sizeof(junk_data3));
+
+  /* four dark frames and a flash: the flash is clipped away, a plain mean
+   * would give 58 */
+  g_object_set(filter, "frameno", 5, "mode", 4, "kappa", 1.5, NULL);
+  for (f = 0; f < 5; f++) {
+    frame = g_malloc (sizeof(junk_data));
+    memset (frame, f == 2 ? 250 : 10, sizeof(junk_data));
+    buffer = gst_buffer_new_wrapped (frame, sizeof(junk_data));
+    ck_assert_msg (gst_pad_push (src_pad, buffer) == GST_FLOW_OK,
+      "Failed to push buffer");
+  }
+  ck_assert_int_eq  (g_list_length (buffers), 2);
+  outp_buffer = GST_BUFFER (buffers->next->data);
+  ck_assert_msg (gst_buffer_map (outp_buffer, &map, GST_MAP_READ));
+  for (i = 0; i < sizeof(junk_data); i++)
+    ck_assert_int_eq (map.data[i], 10);
+  gst_buffer_unmap (outp_buffer, &map);
+
+  /* cleanup */
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_NULL) == GST_STATE_CHANGE_SUCCESS, "could not set to null");
+
+  gst_check_drop_buffers();
+  g_object_unref (src_pad);
+  g_object_unref (sink_pad);
+  gst_caps_unref(caps);
+
+  gst_check_teardown_element(filter);
+
+}
+GST_END_TEST;
+
+GST_START_TEST (test_avgframes_variance)
+{
+  GstElement *filter;
+  GstCaps *caps;
+  GstBuffer *buffer, *outp_buffer;
+  GstPad *pad_peer;
+  GstPad *sink_pad = NULL;
+  GstPad *src_pad;
+  gchar element_name[] = "avgframes";
+  GstAvgFramesMeta *meta;
+  const guint8 *frames[] = { junk_data, junk_data2, junk_data3 };
+  gint f, i;
+
+  gst_check_drop_buffers();
+  filter = gst_check_setup_element (element_name);
+
+  g_object_set(filter, "frameno", 3, "variance", TRUE, NULL);
+
+  /*caps init */
+  caps = gst_caps_new_simple ("video/x-raw",
+        "width", G_TYPE_INT, sizeof(junk_data),
+        "height", G_TYPE_INT, 1,
+        "framerate", GST_TYPE_FRACTION, 1, 1,
+        "format", G_TYPE_STRING, "GRAY8",
+      NULL);
+  ck_assert_msg (GST_IS_CAPS (caps));
+
+  /* link our "source" to the averager */
+  src_pad = gst_pad_new ("src", GST_PAD_SRC);
+  ck_assert_msg (GST_IS_PAD (src_pad));
+  gst_pad_set_active (src_pad, TRUE);
+  gst_check_setup_events (src_pad, filter, caps, GST_FORMAT_BYTES);
+  pad_peer = gst_element_get_static_pad (filter, "sink");
+  ck_assert_msg (GST_IS_PAD (pad_peer));
+  ck_assert_msg (gst_pad_link (src_pad, pad_peer) == GST_PAD_LINK_OK,
+    "Could not link source and %s sink pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  /* link our "sink" to the averager */
+  sink_pad = gst_pad_new ("sink", GST_PAD_SINK);
+  ck_assert_msg (GST_IS_PAD (sink_pad));
+  gst_pad_set_chain_function (sink_pad, gst_check_chain_func);
+  gst_pad_set_active (sink_pad, TRUE);
+  pad_peer = gst_element_get_static_pad (filter, "src");
+  ck_assert_msg (gst_pad_link (pad_peer, sink_pad) == GST_PAD_LINK_OK,
+      "Could not link sink and %s source pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  /* two blocks, so the squares are known to start over */
+  for (f = 0; f < 6; f++) {
+    buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY,
+        (gpointer) frames[f % 3], sizeof(junk_data), 0, sizeof(junk_data),
+        NULL, NULL);
+    ck_assert_msg (gst_pad_push (src_pad, buffer) == GST_FLOW_OK,
+      "Failed to push buffer");
+  }
+  ck_assert_int_eq  (g_list_length (buffers), 2);
+
+  for (f = 0; f < 2; f++) {
+    outp_buffer = GST_BUFFER (g_list_nth_data (buffers, f));
+    gst_check_buffer_data(outp_buffer, junk_data3, sizeof(junk_data3));
+    meta = gst_buffer_get_gst_avg_frames_meta (outp_buffer);
+    ck_assert_msg (meta != NULL, "No variance on the output");
+    ck_assert_int_eq (meta->data_size, sizeof(junk_data));
+    ck_assert_int_eq (meta->frames, 3);
+    for (i = 0; i < sizeof(junk_data); i++) {
+      gdouble mean = (junk_data[i] + junk_data2[i] + junk_data3[i]) / 3.0;
+      gdouble var = (junk_data[i] * junk_data[i] +
+          junk_data2[i] * junk_data2[i] +
+          junk_data3[i] * junk_data3[i]) / 3.0 - mean * mean;
+      ck_assert_msg (ABS (meta->variance[i] - var) < 1e-2,
+          "variance %f of sample %d is not %f", meta->variance[i], i, var);
+    }
+  }
+
+  /* cleanup */
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_NULL) == GST_STATE_CHANGE_SUCCESS, "could not set to null");
+
+  gst_check_drop_buffers();
+  g_object_unref (src_pad);
+  g_object_unref (sink_pad);
+  gst_caps_unref(caps);
+
+  gst_check_teardown_element(filter);
+
+}
+GST_END_TEST;
+
+/* a sink that only takes 16 bit frames */
+static GstStaticPadTemplate wide_sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS ("video/x-raw, format = (string) GRAY16_LE")
+    );
+
+GST_START_TEST (test_avgframes_wide)
+{
+  GstElement *filter;
+  GstCaps *caps;
+  GstBuffer *buffer, *outp_buffer;
+  GstPad *pad_peer;
+  GstPad *sink_pad = NULL;
+  GstPad *src_pad;
+  gchar element_name[] = "avgframes";
+  GstMapInfo map;
+  const guint8 *frames[] = { junk_data, junk_data2, junk_data3 };
+  gint f, i;
+
+  gst_check_drop_buffers();
+  filter = gst_check_setup_element (element_name);
+
+  g_object_set(filter, "frameno", 3, NULL);
+
+  /*caps init */
+  caps = gst_caps_new_simple ("video/x-raw",
+        "width", G_TYPE_INT, sizeof(junk_data),
+        "height", G_TYPE_INT, 1,
+        "framerate", GST_TYPE_FRACTION, 1, 1,
+        "format", G_TYPE_STRING, "GRAY8",
+      NULL);
+  ck_assert_msg (GST_IS_CAPS (caps));
+
+  /* link our "source" to the averager */
+  src_pad = gst_pad_new ("src", GST_PAD_SRC);
+  ck_assert_msg (GST_IS_PAD (src_pad));
+  gst_pad_set_active (src_pad, TRUE);
+  gst_check_setup_events (src_pad, filter, caps, GST_FORMAT_BYTES);
+  pad_peer = gst_element_get_static_pad (filter, "sink");
+  ck_assert_msg (GST_IS_PAD (pad_peer));
+  ck_assert_msg (gst_pad_link (src_pad, pad_peer) == GST_PAD_LINK_OK,
+    "Could not link source and %s sink pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  /* link our "sink" to the averager */
+  sink_pad = gst_pad_new_from_static_template (&wide_sink_template, "sink");
+  ck_assert_msg (GST_IS_PAD (sink_pad));
+  gst_pad_set_chain_function (sink_pad, gst_check_chain_func);
+  gst_pad_set_active (sink_pad, TRUE);
+  pad_peer = gst_element_get_static_pad (filter, "src");
+  ck_assert_msg (gst_pad_link (pad_peer, sink_pad) == GST_PAD_LINK_OK,
+      "Could not link sink and %s source pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  for (f = 0; f < 3; f++) {
+    buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY,
+        (gpointer) frames[f], sizeof(junk_data), 0, sizeof(junk_data),
+        NULL, NULL);
+    ck_assert_msg (gst_pad_push (src_pad, buffer) == GST_FLOW_OK,
+      "Failed to push buffer");
+  }
+  ck_assert_int_eq  (g_list_length (buffers), 1);
+
+  /* the average keeps 8 fractional bits */
+  outp_buffer = GST_BUFFER (buffers->data);
+  ck_assert_msg (gst_buffer_map (outp_buffer, &map, GST_MAP_READ));
+  ck_assert_int_eq (map.size, sizeof(junk_data) * sizeof (guint16));
+  for (i = 0; i < sizeof(junk_data); i++) {
+    guint sum = junk_data[i] + junk_data2[i] + junk_data3[i];
+    ck_assert_int_eq (GUINT16_FROM_LE (((guint16 *) map.data)[i]),
+        sum * 256 / 3);
+  }
+  gst_buffer_unmap (outp_buffer, &map);
+
+  /* cleanup */
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_NULL) == GST_STATE_CHANGE_SUCCESS, "could not set to null");
+
+  gst_check_drop_buffers();
+  g_object_unref (src_pad);
+  g_object_unref (sink_pad);
+  gst_caps_unref(caps);
+
+  gst_check_teardown_element(filter);
+
+}
+GST_END_TEST;
+
+/* ema and sigma-clip keep their fractional bits too */
+GST_START_TEST (test_avgframes_wide_modes)
+{
+  GstElement *filter;
+  GstCaps *caps;
+  GstBuffer *buffer, *outp_buffer;
+  GstPad *pad_peer;
+  GstPad *sink_pad = NULL;
+  GstPad *src_pad;
+  gchar element_name[] = "avgframes";
+  GstMapInfo map;
+  const guint8 *frames[] = { junk_data, junk_data2, junk_data3 };
+  gint modes[] = { 2, 4 };
+  gint m, f, i;
+
+  for (m = 0; m < G_N_ELEMENTS (modes); m++) {
+    gst_check_drop_buffers();
+    filter = gst_check_setup_element (element_name);
+
+    /* a new frame gets half of the weight, kappa keeps all of 3 samples */
+    g_object_set(filter, "mode", modes[m], "frameno", 3, "alpha-shift", 1,
+        NULL);
+
+    /*caps init */
+    caps = gst_caps_new_simple ("video/x-raw",
+          "width", G_TYPE_INT, sizeof(junk_data),
+          "height", G_TYPE_INT, 1,
+          "framerate", GST_TYPE_FRACTION, 1, 1,
+          "format", G_TYPE_STRING, "GRAY8",
+        NULL);
+    ck_assert_msg (GST_IS_CAPS (caps));
+
+    /* link our "source" to the averager */
+    src_pad = gst_pad_new ("src", GST_PAD_SRC);
+    ck_assert_msg (GST_IS_PAD (src_pad));
+    gst_pad_set_active (src_pad, TRUE);
+    gst_check_setup_events (src_pad, filter, caps, GST_FORMAT_BYTES);
+    pad_peer = gst_element_get_static_pad (filter, "sink");
+    ck_assert_msg (GST_IS_PAD (pad_peer));
+    ck_assert_msg (gst_pad_link (src_pad, pad_peer) == GST_PAD_LINK_OK,
+      "Could not link source and %s sink pads", GST_ELEMENT_NAME (filter));
+    gst_object_unref (pad_peer);
+
+    /* link our "sink" to the averager */
+    sink_pad = gst_pad_new_from_static_template (&wide_sink_template, "sink");
+    ck_assert_msg (GST_IS_PAD (sink_pad));
+    gst_pad_set_chain_function (sink_pad, gst_check_chain_func);
+    gst_pad_set_active (sink_pad, TRUE);
+    pad_peer = gst_element_get_static_pad (filter, "src");
+    ck_assert_msg (gst_pad_link (pad_peer, sink_pad) == GST_PAD_LINK_OK,
+        "Could not link sink and %s source pads", GST_ELEMENT_NAME (filter));
+    gst_object_unref (pad_peer);
+
+    ck_assert_msg (gst_element_set_state (filter,
+            GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+        "could not set to playing");
+
+    for (f = 0; f < 3; f++) {
+      buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY,
+          (gpointer) frames[f], sizeof(junk_data), 0, sizeof(junk_data),
+          NULL, NULL);
+      ck_assert_msg (gst_pad_push (src_pad, buffer) == GST_FLOW_OK,
+        "Failed to push buffer");
+    }
+    ck_assert_int_eq  (g_list_length (buffers), modes[m] == 2 ? 3 : 1);
+
+    /* the ema of the 3 frames is (a + b + 2 c) / 4, exact in 8 fractional
+     * bits. All 3 samples are kept by the clip, so it is their average. */
+    outp_buffer = GST_BUFFER (g_list_last (buffers)->data);
+    ck_assert_msg (gst_buffer_map (outp_buffer, &map, GST_MAP_READ));
+    ck_assert_int_eq (map.size, sizeof(junk_data) * sizeof (guint16));
+    for (i = 0; i < sizeof(junk_data); i++) {
+      guint val = GUINT16_FROM_LE (((guint16 *) map.data)[i]);
+
+      if (modes[m] == 2)
+        ck_assert_int_eq (val,
+            (junk_data[i] + junk_data2[i] + 2 * junk_data3[i]) * 64);
+      else
+        ck_assert_int_eq (val,
+            (junk_data[i] + junk_data2[i] + junk_data3[i]) * 256 / 3);
+    }
+    gst_buffer_unmap (outp_buffer, &map);
+
+    /* cleanup */
+    ck_assert_msg (gst_element_set_state (filter,
+            GST_STATE_NULL) == GST_STATE_CHANGE_SUCCESS,
+        "could not set to null");
+
+    gst_check_drop_buffers();
+    g_object_unref (src_pad);
+    g_object_unref (sink_pad);
+    gst_caps_unref(caps);
+
+    gst_check_teardown_element(filter);
+  }
+}
+GST_END_TEST;
+
+static void
+push_frame (GstPad *pad, const guint8 *data, gint f)
+{
+  GstBuffer *buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY,
+      (gpointer) data, sizeof(junk_data), 0, sizeof(junk_data), NULL, NULL);
+
+  GST_BUFFER_PTS (buffer) = f * GST_SECOND;
+  GST_BUFFER_DURATION (buffer) = GST_SECOND;
+  ck_assert_msg (gst_pad_push (pad, buffer) == GST_FLOW_OK,
+    "Failed to push buffer");
+}
+
+/* frames that are late by a QoS event give no output, but ema mode still
+ * filters them and block mode starts its window over */
+GST_START_TEST (test_avgframes_qos)
+{
+  GstElement *filter;
+  GstCaps *caps;
+  GstBuffer *outp_buffer;
+  GstPad *pad_peer;
+  GstPad *sink_pad = NULL;
+  GstPad *src_pad;
+  gchar element_name[] = "avgframes";
+  GstMapInfo map;
+  gint modes[] = { 0, 2 };
+  gint m, i;
+
+  for (m = 0; m < G_N_ELEMENTS (modes); m++) {
+    gst_check_drop_buffers();
+    filter = gst_check_setup_element (element_name);
+
+    g_object_set(filter, "mode", modes[m], "frameno", 3, "alpha-shift", 1,
+        NULL);
+
+    /*caps init */
+    caps = gst_caps_new_simple ("video/x-raw",
+          "width", G_TYPE_INT, sizeof(junk_data),
+          "height", G_TYPE_INT, 1,
+          "framerate", GST_TYPE_FRACTION, 1, 1,
+          "format", G_TYPE_STRING, "GRAY8",
+        NULL);
+    ck_assert_msg (GST_IS_CAPS (caps));
+
+    /* link our "source" to the averager */
+    src_pad = gst_pad_new ("src", GST_PAD_SRC);
+    ck_assert_msg (GST_IS_PAD (src_pad));
+    gst_pad_set_active (src_pad, TRUE);
+    gst_check_setup_events (src_pad, filter, caps, GST_FORMAT_TIME);
+    pad_peer = gst_element_get_static_pad (filter, "sink");
+    ck_assert_msg (GST_IS_PAD (pad_peer));
+    ck_assert_msg (gst_pad_link (src_pad, pad_peer) == GST_PAD_LINK_OK,
+      "Could not link source and %s sink pads", GST_ELEMENT_NAME (filter));
+    gst_object_unref (pad_peer);
+
+    /* link our "sink" to the averager */
+    sink_pad = gst_pad_new ("sink", GST_PAD_SINK);
+    ck_assert_msg (GST_IS_PAD (sink_pad));
+    gst_pad_set_chain_function (sink_pad, gst_check_chain_func);
+    gst_pad_set_active (sink_pad, TRUE);
+    pad_peer = gst_element_get_static_pad (filter, "src");
+    ck_assert_msg (gst_pad_link (pad_peer, sink_pad) == GST_PAD_LINK_OK,
+        "Could not link sink and %s source pads", GST_ELEMENT_NAME (filter));
+    gst_object_unref (pad_peer);
+
+    ck_assert_msg (gst_element_set_state (filter,
+            GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+        "could not set to playing");
+
+    /* everything before 10s is late */
+    gst_pad_push_event (sink_pad, gst_event_new_qos (GST_QOS_TYPE_UNDERFLOW,
+            1.0, 10 * GST_SECOND, 0));
+    if (modes[m] == 2) {
+      push_frame (src_pad, junk_data, 0);
+    } else {
+      push_frame (src_pad, junk_data2, 0);
+      push_frame (src_pad, junk_data, 1);
+      push_frame (src_pad, junk_data2, 2);
+    }
+    ck_assert_int_eq  (g_list_length (buffers), 0);
+
+    /* nothing is late any more */
+    gst_pad_push_event (sink_pad, gst_event_new_qos (GST_QOS_TYPE_UNDERFLOW,
+            1.0, 0, 0));
+    if (modes[m] == 2) {
+      push_frame (src_pad, junk_data3, 1);
+    } else {
+      push_frame (src_pad, junk_data, 3);
+      push_frame (src_pad, junk_data2, 4);
+      push_frame (src_pad, junk_data3, 5);
+    }
+    ck_assert_int_eq  (g_list_length (buffers), 1);
+
+    /* the ema has the late frame in it, the block average of the 3 frames
+     * after the dropped window is the third one */
+    outp_buffer = GST_BUFFER (buffers->data);
+    ck_assert_msg (gst_buffer_map (outp_buffer, &map, GST_MAP_READ));
+    for (i = 0; i < sizeof(junk_data); i++) {
+      if (modes[m] == 2)
+        ck_assert_int_eq (map.data[i], (junk_data[i] + junk_data3[i] + 1) / 2);
+      else
+        ck_assert_int_eq (map.data[i], junk_data3[i]);
+    }
+    gst_buffer_unmap (outp_buffer, &map);
+
+    /* cleanup */
+    ck_assert_msg (gst_element_set_state (filter,
+            GST_STATE_NULL) == GST_STATE_CHANGE_SUCCESS,
+        "could not set to null");
+
+    gst_check_drop_buffers();
+    g_object_unref (src_pad);
+    g_object_unref (sink_pad);
+    gst_caps_unref(caps);
+
+    gst_check_teardown_element(filter);
+  }
+}
+GST_END_TEST;
+
+/* a live source with 10ms of latency */
+static gboolean
+live_src_query (GstPad * pad, GstObject * parent, GstQuery * query)
+{
+  if (GST_QUERY_TYPE (query) != GST_QUERY_LATENCY)
+    return gst_pad_query_default (pad, parent, query);
+
+  gst_query_set_latency (query, TRUE, 10 * GST_MSECOND, GST_CLOCK_TIME_NONE);
+  return TRUE;
+}
+
+GST_START_TEST (test_avgframes_timing)
+{
+  GstElement *filter;
+  GstCaps *caps;
+  GstBuffer *buffer, *outp_buffer;
+  GstPad *pad_peer;
+  GstPad *sink_pad = NULL;
+  GstPad *src_pad;
+  gchar element_name[] = "avgframes";
+  GstQuery *query;
+  GstClockTime min, max;
+  gboolean live;
+  gint f;
+
+  gst_check_drop_buffers();
+  filter = gst_check_setup_element (element_name);
+
+  g_object_set(filter, "frameno", 4, NULL);
+
+  /*caps init */
+  caps = gst_caps_new_simple ("video/x-raw",
+        "width", G_TYPE_INT, sizeof(junk_data),
+        "height", G_TYPE_INT, 1,
+        "framerate", GST_TYPE_FRACTION, 10, 1,
+        "format", G_TYPE_STRING, "GRAY8",
+      NULL);
+  ck_assert_msg (GST_IS_CAPS (caps));
+
+  /* link our "source" to the averager */
+  src_pad = gst_pad_new ("src", GST_PAD_SRC);
+  ck_assert_msg (GST_IS_PAD (src_pad));
+  gst_pad_set_query_function (src_pad, live_src_query);
+  gst_pad_set_active (src_pad, TRUE);
+  gst_check_setup_events (src_pad, filter, caps, GST_FORMAT_TIME);
+  pad_peer = gst_element_get_static_pad (filter, "sink");
+  ck_assert_msg (GST_IS_PAD (pad_peer));
+  ck_assert_msg (gst_pad_link (src_pad, pad_peer) == GST_PAD_LINK_OK,
+    "Could not link source and %s sink pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  /* link our "sink" to the averager */
+  sink_pad = gst_pad_new ("sink", GST_PAD_SINK);
+  ck_assert_msg (GST_IS_PAD (sink_pad));
+  gst_pad_set_chain_function (sink_pad, gst_check_chain_func);
+  gst_pad_set_active (sink_pad, TRUE);
+  pad_peer = gst_element_get_static_pad (filter, "src");
+  ck_assert_msg (gst_pad_link (pad_peer, sink_pad) == GST_PAD_LINK_OK,
+      "Could not link sink and %s source pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  for (f = 0; f < 4; f++) {
+    buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, junk_data,
+        sizeof(junk_data), 0, sizeof(junk_data), NULL, NULL);
+    GST_BUFFER_PTS (buffer) = f * 100 * GST_MSECOND;
+    GST_BUFFER_DURATION (buffer) = 100 * GST_MSECOND;
+    ck_assert_msg (gst_pad_push (src_pad, buffer) == GST_FLOW_OK,
+      "Failed to push buffer");
+  }
+  ck_assert_int_eq  (g_list_length (buffers), 1);
+
+  /* the average covers all four frames */
+  outp_buffer = GST_BUFFER (buffers->data);
+  ck_assert_uint_eq (GST_BUFFER_PTS (outp_buffer), 0);
+  ck_assert_uint_eq (GST_BUFFER_DURATION (outp_buffer), 400 * GST_MSECOND);
+
+  /* and it is three frames later than the first one */
+  query = gst_query_new_latency ();
+  ck_assert_msg (gst_pad_peer_query (sink_pad, query),
+      "Latency query failed");
+  gst_query_parse_latency (query, &live, &min, &max);
+  ck_assert_msg (live);
+  ck_assert_uint_eq (min, 310 * GST_MSECOND);
+  ck_assert_uint_eq (max, GST_CLOCK_TIME_NONE);
+  gst_query_unref (query);
+
+  /* every frame goes out at its own time when sliding */
+  g_object_set(filter, "mode", 1, NULL);
+  query = gst_query_new_latency ();
+  ck_assert_msg (gst_pad_peer_query (sink_pad, query),
+      "Latency query failed");
+  gst_query_parse_latency (query, &live, &min, &max);
+  ck_assert_uint_eq (min, 10 * GST_MSECOND);
+  gst_query_unref (query);
+
+  /* cleanup */
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_NULL) == GST_STATE_CHANGE_SUCCESS, "could not set to null");
+
+  gst_check_drop_buffers();
+  g_object_unref (src_pad);
+  g_object_unref (sink_pad);
+  gst_caps_unref(caps);
+
+  gst_check_teardown_element(filter);
+
+}
+GST_END_TEST;
+
+GST_START_TEST (test_avgframes_kernels)
+{
+  const AvgFramesKernels *ref, *k;
+  gint cpu, i, f, frames;
+  /* odd size so the scalar tails of the vector kernels get used too */
+  gsize size = 1003;
+  guint8 *src8 = g_malloc (size);
+  guint16 *src16 = g_malloc (size * sizeof (guint16));
+  guint32 *sum_ref = g_malloc (size * sizeof (guint32));
+  guint32 *sum = g_malloc (size * sizeof (guint32));
+  guint8 *out8_ref = g_malloc (size);
+  guint8 *out8 = g_malloc (size);
+  guint16 *out16_ref = g_malloc (size * sizeof (guint16));
+  guint16 *out16 = g_malloc (size * sizeof (guint16));
+  guint8 *win8[MAX_FRAMES];
+  guint16 *win16[MAX_FRAMES];
+  AvgFramesNetwork *net;
+
+  for (f = 0; f < MAX_FRAMES; f++) {
+    win8[f] = g_malloc (size);
+    win16[f] = g_malloc (size * sizeof (guint16));
+  }
+
+  ref = avg_frames_kernels_get (AVG_KERNELS_CPU_SCALAR);
+  ck_assert_msg (ref != NULL, "Scalar kernels are always available");
+
+  srand(time(NULL));
+
+  for (cpu = AVG_KERNELS_CPU_SCALAR + 1; cpu < AVG_KERNELS_CPU_LAST; cpu++) {
+    k = avg_frames_kernels_get (cpu);
+    if (!k)
+      continue;
+
+    GST_DEBUG ("checking %s kernels against the scalar ones", k->name);
+
+    /* sliding a frame in and out has to match the scalar bookkeeping */
+    for (i = 0; i < size; i++) {
+      sum_ref[i] = sum[i] = rand () & 0xffffff;
+      out8_ref[i] = out8[i] = rand ();
+      src8[i] = rand ();
+    }
+    ref->slide_u8 (sum_ref, out8_ref, src8, size);
+    k->slide_u8 (sum, out8, src8, size);
+    ck_assert_msg (memcmp (sum_ref, sum, size * sizeof (guint32)) == 0,
+        "%s slide_u8 differs from scalar", k->name);
+    ck_assert_msg (memcmp (out8, src8, size) == 0,
+        "%s slide_u8 did not store the new frame", k->name);
+
+    for (i = 0; i < size; i++) {
+      out16_ref[i] = out16[i] = rand ();
+      src16[i] = rand ();
+    }
+    ref->slide_u16 (sum_ref, out16_ref, src16, size);
+    k->slide_u16 (sum, out16, src16, size);
+    ck_assert_msg (memcmp (sum_ref, sum, size * sizeof (guint32)) == 0,
+        "%s slide_u16 differs from scalar", k->name);
+    for (i = 0; i < size; i++)
+      src16[i] = rand ();
+    ref->slide_u16_swap (sum_ref, out16_ref, src16, size);
+    k->slide_u16_swap (sum, out16, src16, size);
+    ck_assert_msg (memcmp (sum_ref, sum, size * sizeof (guint32)) == 0,
+        "%s slide_u16_swap differs from scalar", k->name);
+    ck_assert_msg (memcmp (out16, src16, size * sizeof (guint16)) == 0,
+        "%s slide_u16_swap did not store the new frame", k->name);
+
+    /* run both filters over the same frames, starting with k = 0 */
+    for (f = 0; f < 20; f++) {
+      for (i = 0; i < size; i++)
+        src8[i] = rand ();
+      ref->ema_u8 (sum_ref, out8_ref, src8, size, f ? f % 16 : 0);
+      k->ema_u8 (sum, out8, src8, size, f ? f % 16 : 0);
+      ck_assert_msg (memcmp (sum_ref, sum, size * sizeof (guint32)) == 0,
+          "%s ema_u8 state differs from scalar", k->name);
+      ck_assert_msg (memcmp (out8_ref, out8, size) == 0,
+          "%s ema_u8 differs from scalar", k->name);
+    }
+    for (f = 0; f < 40; f++) {
+      for (i = 0; i < size; i++)
+        src16[i] = rand ();
+      if (f < 20) {
+        ref->ema_u16 (sum_ref, out16_ref, src16, size, f ? f % 16 : 0);
+        k->ema_u16 (sum, out16, src16, size, f ? f % 16 : 0);
+      } else {
+        ref->ema_u16_swap (sum_ref, out16_ref, src16, size, f % 16);
+        k->ema_u16_swap (sum, out16, src16, size, f % 16);
+      }
+      ck_assert_msg (memcmp (sum_ref, sum, size * sizeof (guint32)) == 0,
+          "%s ema_u16 state differs from scalar", k->name);
+      ck_assert_msg (memcmp (out16_ref, out16, size * sizeof (guint16)) == 0,
+          "%s ema_u16 differs from scalar", k->name);
+    }
+
+    for (frames = 1; frames <= MAX_FRAMES; frames += 6) {
+      net = avg_frames_network_new_median (frames);
+      for (f = 0; f < frames; f++) {
+        for (i = 0; i < size; i++) {
+          win8[f][i] = rand ();
+          win16[f][i] = rand ();
+        }
+      }
+      ref->median_u8 (out8_ref, (const guint8 * const *) win8, size, net);
+      k->median_u8 (out8, (const guint8 * const *) win8, size, net);
+      ck_assert_msg (memcmp (out8_ref, out8, size) == 0,
+          "%s median_u8 differs from scalar", k->name);
+      ref->median_u16 (out16_ref, (const guint16 * const *) win16, size, net);
+      k->median_u16 (out16, (const guint16 * const *) win16, size, net);
+      ck_assert_msg (memcmp (out16_ref, out16, size * sizeof (guint16)) == 0,
+          "%s median_u16 differs from scalar", k->name);
+      avg_frames_network_free (net);
+    }
+
+    /* narrow samples with a few outliers, so that some get clipped */
+    for (frames = 1; frames <= MAX_FRAMES; frames += 3) {
+      gdouble kappa = 0.5 * (1 + frames % 6);
+
+      for (f = 0; f < frames; f++) {
+        for (i = 0; i < size; i++) {
+          gboolean outlier = (rand () & 0x0f) == 0;
+
+          win8[f][i] = outlier ? rand () : 100 + (rand () & 0x07);
+          win16[f][i] = outlier ? rand () : 30000 + (rand () & 0x3ff);
+        }
+      }
+      ref->clip_u8 (out8_ref, (const guint8 * const *) win8, frames, size,
+          kappa);
+      k->clip_u8 (out8, (const guint8 * const *) win8, frames, size, kappa);
+      ck_assert_msg (memcmp (out8_ref, out8, size) == 0,
+          "%s clip_u8 differs from scalar", k->name);
+      ref->clip_u8_wide (out16_ref, (const guint8 * const *) win8, frames,
+          size, kappa);
+      k->clip_u8_wide (out16, (const guint8 * const *) win8, frames, size,
+          kappa);
+      ck_assert_msg (memcmp (out16_ref, out16, size * sizeof (guint16)) == 0,
+          "%s clip_u8_wide differs from scalar", k->name);
+      ref->clip_u16 (out16_ref, (const guint16 * const *) win16, frames,
+          size, kappa);
+      k->clip_u16 (out16, (const guint16 * const *) win16, frames, size,
+          kappa);
+      ck_assert_msg (memcmp (out16_ref, out16, size * sizeof (guint16)) == 0,
+          "%s clip_u16 differs from scalar", k->name);
+    }
+  }
+
+  /* the scalar median has as many samples below it as above it, give or
+   * take the one of an even window */
+  for (frames = 1; frames <= MAX_FRAMES; frames += 6) {
+    net = avg_frames_network_new_median (frames);
+    for (f = 0; f < frames; f++) {
+      for (i = 0; i < size; i++)
+        win8[f][i] = rand () & 0x0f;
+    }
+    ref->median_u8 (out8_ref, (const guint8 * const *) win8, size, net);
+    for (i = 0; i < size; i++) {
+      gint below = 0, above = 0;
+      for (f = 0; f < frames; f++) {
+        below += win8[f][i] < out8_ref[i];
+        above += win8[f][i] > out8_ref[i];
+      }
+      ck_assert_int_le (below, (frames - 1) / 2);
+      ck_assert_int_le (above, frames / 2);
+    }
+    avg_frames_network_free (net);
+  }
+
+  /* the wide clip is the 8 bit one with 8 more fractional bits */
+  for (frames = 1; frames <= MAX_FRAMES; frames += 6) {
+    for (f = 0; f < frames; f++) {
+      for (i = 0; i < size; i++)
+        win8[f][i] = rand ();
+    }
+    ref->clip_u8 (out8_ref, (const guint8 * const *) win8, frames, size, 2.0);
+    ref->clip_u8_wide (out16, (const guint8 * const *) win8, frames, size,
+        2.0);
+    for (i = 0; i < size; i++)
+      ck_assert_int_eq (out16[i] >> 8, out8_ref[i]);
+  }
+
+  g_free (src8);
+  g_free (src16);
+  g_free (sum_ref);
+  g_free (sum);
+  g_free (out8_ref);
+  g_free (out8);
+  g_free (out16_ref);
+  g_free (out16);
+  for (f = 0; f < MAX_FRAMES; f++) {
+    g_free (win8[f]);
+    g_free (win16[f]);
+  }
+}
+GST_END_TEST;
+
 static Suite *
 avgframes_suite (void)
 {
@@ -420,6 +1608,17 @@ avgframes_suite (void)
   tcase_add_test (tc_chain, test_avgframes_frameavgno);
   tcase_add_test (tc_chain, test_avgframes_flush);
   tcase_add_test (tc_chain, test_avgframes_averaging);
+  tcase_add_test (tc_chain, test_avgframes_sliding);
+  tcase_add_test (tc_chain, test_avgframes_ema);
+  tcase_add_test (tc_chain, test_avgframes_threads);
+  tcase_add_test (tc_chain, test_avgframes_planar);
+  tcase_add_test (tc_chain, test_avgframes_median);
+  tcase_add_test (tc_chain, test_avgframes_variance);
+  tcase_add_test (tc_chain, test_avgframes_wide);
+  tcase_add_test (tc_chain, test_avgframes_wide_modes);
+  tcase_add_test (tc_chain, test_avgframes_timing);
+  tcase_add_test (tc_chain, test_avgframes_qos);
+  tcase_add_test (tc_chain, test_avgframes_kernels);
 
   return s;
 }
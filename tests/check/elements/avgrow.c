@@ -8,6 +8,10 @@
 #include <gst/check/gstcheck.h>
 #include <time.h>
 #include <stdlib.h>
+#include <string.h>
+#include <gst/video/gstvideometa.h>
+#include <gst/avgrow/gstavgrowmeta.h>
+#include "avgrowkernels.h"
 
 /* NOTE ABOUT avgrow:
  * Do not forget that frames that are getting averaged are being dropped
@@ -317,6 +321,1023 @@ GST_START_TEST (test_avgrow_averaging)
 }
 GST_END_TEST;
 
+GST_START_TEST (test_avgrow_threads)
+{
+  GstElement *filter;
+  GstCaps *caps;
+  GstBuffer *buffer, *outp_buffer;
+  GstMapInfo map;
+  GstPad *pad_peer;
+  GstPad *sink_pad = NULL;
+  GstPad *src_pad;
+  gchar element_name[] = "avgrow";
+  /* large enough to be split over all the threads */
+  gint width = 256, height = 1024;
+  guint16 *data = g_malloc (width * height * sizeof (guint16));
+  guint16 *expected = g_malloc (width * sizeof (guint16));
+  guint64 sum;
+  gint i, z;
+
+  srand(time(NULL));
+
+  for (i = 0; i < width * height; i++)
+    data[i] = rand ();
+  for (i = 0; i < width; i++) {
+    sum = 0;
+    for (z = 0; z < height; z++)
+      sum += GUINT16_FROM_BE (data[i + z * width]);
+    expected[i] = GUINT16_TO_BE (sum / height);
+  }
+
+  gst_check_drop_buffers();
+  filter = gst_check_setup_element (element_name);
+
+  g_object_set(filter, "total-avg", 1, "n-threads", 4, NULL);
+
+  /*caps init */
+  caps = gst_caps_new_simple ("video/x-raw",
+        "width", G_TYPE_INT, width,
+        "height", G_TYPE_INT, height,
+        "framerate", GST_TYPE_FRACTION, 1, 1,
+        "format", G_TYPE_STRING, "GRAY16_BE",
+      NULL);
+  ck_assert_msg (GST_IS_CAPS (caps));
+
+  buffer = gst_buffer_new_wrapped (data, width * height * sizeof (guint16));
+  ck_assert_msg(GST_IS_BUFFER(buffer), "Unable to allocate buffer");
+
+  /* link our "source" to the averager */
+  src_pad = gst_pad_new ("src", GST_PAD_SRC);
+  ck_assert_msg (GST_IS_PAD (src_pad));
+  gst_pad_set_active (src_pad, TRUE);
+  gst_check_setup_events (src_pad, filter, caps, GST_FORMAT_BYTES);
+  pad_peer = gst_element_get_static_pad (filter, "sink");
+  ck_assert_msg (GST_IS_PAD (pad_peer));
+  ck_assert_msg (gst_pad_link (src_pad, pad_peer) == GST_PAD_LINK_OK,
+    "Could not link source and %s sink pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  /* link our "sink" to the averager */
+  sink_pad = gst_pad_new ("sink", GST_PAD_SINK);
+  ck_assert_msg (GST_IS_PAD (sink_pad));
+  gst_pad_set_chain_function (sink_pad, gst_check_chain_func);
+  gst_pad_set_active (sink_pad, TRUE);
+  pad_peer = gst_element_get_static_pad (filter, "src");
+  ck_assert_msg (gst_pad_link (pad_peer, sink_pad) == GST_PAD_LINK_OK,
+      "Could not link sink and %s source pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  ck_assert_msg (gst_pad_push (src_pad, buffer) == GST_FLOW_OK,
+      "Failed to push buffer");
+
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_NULL) == GST_STATE_CHANGE_SUCCESS, "could not set to null");
+
+  /* the threaded sums have to give the plain column averages */
+  ck_assert_int_eq (g_list_length (buffers), 1);
+  outp_buffer = GST_BUFFER (buffers->data);
+  gst_buffer_map (outp_buffer, &map, GST_MAP_READ);
+  ck_assert_int_eq (map.size, width * sizeof (guint16));
+  ck_assert_msg (memcmp (map.data, expected, map.size) == 0,
+      "Threaded total average differs from the reference");
+  gst_buffer_unmap (outp_buffer, &map);
+
+  /* cleanup */
+  gst_check_drop_buffers();
+
+  g_free (expected);
+  g_object_unref (src_pad);
+  g_object_unref (sink_pad);
+  gst_caps_unref(caps);
+
+  gst_check_teardown_element(filter);
+}
+GST_END_TEST;
+
+GST_START_TEST (test_avgrow_roi)
+{
+  GstElement *filter;
+  GstCaps *caps;
+  GstBuffer *buffer, *outp_buffer;
+  GstPad *pad_peer;
+  GstPad *sink_pad = NULL;
+  GstPad *src_pad;
+  gchar element_name[] = "avgrow";
+  guint8 frame[6 * 8];
+  /* rows 2 to 4 and columns 1 to 4 of the frame */
+  guint8 roi_avg[] = { 31, 32, 33, 34 };
+  /* rows 3 and 4, the region meta reaches past the region of interest */
+  guint8 meta_avg[] = { 36, 37, 38, 39 };
+  gint i, z;
+
+  for (z = 0; z < 6; z++)
+    for (i = 0; i < 8; i++)
+      frame[z * 8 + i] = z * 10 + i;
+
+  gst_check_drop_buffers();
+  filter = gst_check_setup_element (element_name);
+
+  g_object_set(filter, "total-avg", 1, "roi-top", 2, "roi-height", 3,
+      "roi-left", 1, "roi-width", 4, "roi-meta", 1, NULL);
+
+  /*caps init */
+  caps = gst_caps_new_simple ("video/x-raw",
+        "width", G_TYPE_INT, 8,
+        "height", G_TYPE_INT, 6,
+        "framerate", GST_TYPE_FRACTION, 1, 1,
+        "format", G_TYPE_STRING, "GRAY8",
+      NULL);
+  ck_assert_msg (GST_IS_CAPS (caps));
+
+  /* link our "source" to the averager */
+  src_pad = gst_pad_new ("src", GST_PAD_SRC);
+  ck_assert_msg (GST_IS_PAD (src_pad));
+  gst_pad_set_active (src_pad, TRUE);
+  gst_check_setup_events (src_pad, filter, caps, GST_FORMAT_BYTES);
+  pad_peer = gst_element_get_static_pad (filter, "sink");
+  ck_assert_msg (GST_IS_PAD (pad_peer));
+  ck_assert_msg (gst_pad_link (src_pad, pad_peer) == GST_PAD_LINK_OK,
+    "Could not link source and %s sink pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  /* link our "sink" to the averager */
+  sink_pad = gst_pad_new ("sink", GST_PAD_SINK);
+  ck_assert_msg (GST_IS_PAD (sink_pad));
+  gst_pad_set_chain_function (sink_pad, gst_check_chain_func);
+  gst_pad_set_event_function(sink_pad, sink_event_func);
+  gst_pad_set_active (sink_pad, TRUE);
+  pad_peer = gst_element_get_static_pad (filter, "src");
+  ck_assert_msg (gst_pad_link (pad_peer, sink_pad) == GST_PAD_LINK_OK,
+      "Could not link sink and %s source pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  /* only the region of interest is averaged */
+  buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, frame,
+      sizeof(frame), 0, sizeof(frame), NULL, NULL);
+  ck_assert_msg (gst_pad_push (src_pad, buffer) == GST_FLOW_OK,
+      "Failed to push buffer");
+
+  ck_assert_int_eq (negotiated_height, 1);
+  ck_assert_int_eq (g_list_length (buffers), 1);
+  outp_buffer = GST_BUFFER (buffers->data);
+  gst_check_buffer_data(outp_buffer, roi_avg, sizeof(roi_avg));
+
+  /* and of that only the rows of the region meta */
+  buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, frame,
+      sizeof(frame), 0, sizeof(frame), NULL, NULL);
+  gst_buffer_add_video_region_of_interest_meta (buffer, "rows", 0, 3, 8, 5);
+  ck_assert_msg (gst_pad_push (src_pad, buffer) == GST_FLOW_OK,
+      "Failed to push buffer");
+
+  ck_assert_int_eq (g_list_length (buffers), 2);
+  outp_buffer = GST_BUFFER (g_list_nth_data (buffers, 1));
+  gst_check_buffer_data(outp_buffer, meta_avg, sizeof(meta_avg));
+
+  /* cleanup */
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_NULL) == GST_STATE_CHANGE_SUCCESS, "could not set to null");
+
+  gst_check_drop_buffers();
+
+  g_object_unref (src_pad);
+  g_object_unref (sink_pad);
+  gst_caps_unref(caps);
+
+  gst_check_teardown_element(filter);
+}
+GST_END_TEST;
+
+GST_START_TEST (test_avgrow_binning)
+{
+  GstElement *filter;
+  GstCaps *caps;
+  GstBuffer *buffer, *outp_buffer;
+  GstPad *pad_peer;
+  GstPad *sink_pad = NULL;
+  GstPad *src_pad;
+  gchar element_name[] = "avgrow";
+  guint8 frame[6 * 8];
+  guint8 binned[3 * 4];
+  gint i, z;
+
+  /* every 2x2 block averages to 20 * row + 2 * col + 5.5 */
+  for (z = 0; z < 6; z++)
+    for (i = 0; i < 8; i++)
+      frame[z * 8 + i] = z * 10 + i;
+  for (z = 0; z < 3; z++)
+    for (i = 0; i < 4; i++)
+      binned[z * 4 + i] = 20 * z + 2 * i + 5;
+
+  gst_check_drop_buffers();
+  filter = gst_check_setup_element (element_name);
+
+  g_object_set(filter, "norows", 2, "nocols", 2, NULL);
+
+  /*caps init */
+  caps = gst_caps_new_simple ("video/x-raw",
+        "width", G_TYPE_INT, 8,
+        "height", G_TYPE_INT, 6,
+        "framerate", GST_TYPE_FRACTION, 1, 1,
+        "format", G_TYPE_STRING, "GRAY8",
+      NULL);
+  ck_assert_msg (GST_IS_CAPS (caps));
+
+  buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, frame,
+      sizeof(frame), 0, sizeof(frame), NULL, NULL);
+
+  /* link our "source" to the averager */
+  src_pad = gst_pad_new ("src", GST_PAD_SRC);
+  ck_assert_msg (GST_IS_PAD (src_pad));
+  gst_pad_set_active (src_pad, TRUE);
+  gst_check_setup_events (src_pad, filter, caps, GST_FORMAT_BYTES);
+  pad_peer = gst_element_get_static_pad (filter, "sink");
+  ck_assert_msg (GST_IS_PAD (pad_peer));
+  ck_assert_msg (gst_pad_link (src_pad, pad_peer) == GST_PAD_LINK_OK,
+    "Could not link source and %s sink pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  /* link our "sink" to the averager */
+  sink_pad = gst_pad_new ("sink", GST_PAD_SINK);
+  ck_assert_msg (GST_IS_PAD (sink_pad));
+  gst_pad_set_chain_function (sink_pad, gst_check_chain_func);
+  gst_pad_set_event_function(sink_pad, sink_event_func);
+  gst_pad_set_active (sink_pad, TRUE);
+  pad_peer = gst_element_get_static_pad (filter, "src");
+  ck_assert_msg (gst_pad_link (pad_peer, sink_pad) == GST_PAD_LINK_OK,
+      "Could not link sink and %s source pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  ck_assert_msg (gst_pad_push (src_pad, buffer) == GST_FLOW_OK,
+      "Failed to push buffer");
+
+  ck_assert_int_eq (negotiated_height, 3);
+  ck_assert_int_eq (g_list_length (buffers), 1);
+  outp_buffer = GST_BUFFER (buffers->data);
+  gst_check_buffer_data(outp_buffer, binned, sizeof(binned));
+
+  /* cleanup */
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_NULL) == GST_STATE_CHANGE_SUCCESS, "could not set to null");
+
+  gst_check_drop_buffers();
+
+  g_object_unref (src_pad);
+  g_object_unref (sink_pad);
+  gst_caps_unref(caps);
+
+  gst_check_teardown_element(filter);
+}
+GST_END_TEST;
+
+GST_START_TEST (test_avgrow_median)
+{
+  GstElement *filter;
+  GstCaps *caps;
+  GstBuffer *buffer, *outp_buffer;
+  GstPad *pad_peer;
+  GstPad *sink_pad = NULL;
+  GstPad *src_pad;
+  gchar element_name[] = "avgrow";
+  /* columns with hot pixels and values spread over several buckets */
+  guint16 values[5][4] = {
+    {  100,  7,  1000, 258 },
+    {  200,  7,     5, 257 },
+    {  300,  7,   999, 256 },
+    {  400,  7,  1001, 300 },
+    { 65535, 7, 60000,   1 }
+  };
+  guint16 medians[4] = { 300, 7, 1000, 257 };
+  guint16 frame[5 * 4];
+  gint i, z;
+
+  for (z = 0; z < 5; z++)
+    for (i = 0; i < 4; i++)
+      frame[z * 4 + i] = GUINT16_TO_BE (values[z][i]);
+  for (i = 0; i < 4; i++)
+    medians[i] = GUINT16_TO_BE (medians[i]);
+
+  gst_check_drop_buffers();
+  filter = gst_check_setup_element (element_name);
+
+  g_object_set(filter, "total-avg", 1, NULL);
+  gst_util_set_object_arg (G_OBJECT (filter), "statistic", "median");
+
+  /*caps init */
+  caps = gst_caps_new_simple ("video/x-raw",
+        "width", G_TYPE_INT, 4,
+        "height", G_TYPE_INT, 5,
+        "framerate", GST_TYPE_FRACTION, 1, 1,
+        "format", G_TYPE_STRING, "GRAY16_BE",
+      NULL);
+  ck_assert_msg (GST_IS_CAPS (caps));
+
+  buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, frame,
+      sizeof(frame), 0, sizeof(frame), NULL, NULL);
+
+  /* link our "source" to the averager */
+  src_pad = gst_pad_new ("src", GST_PAD_SRC);
+  ck_assert_msg (GST_IS_PAD (src_pad));
+  gst_pad_set_active (src_pad, TRUE);
+  gst_check_setup_events (src_pad, filter, caps, GST_FORMAT_BYTES);
+  pad_peer = gst_element_get_static_pad (filter, "sink");
+  ck_assert_msg (GST_IS_PAD (pad_peer));
+  ck_assert_msg (gst_pad_link (src_pad, pad_peer) == GST_PAD_LINK_OK,
+    "Could not link source and %s sink pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  /* link our "sink" to the averager */
+  sink_pad = gst_pad_new ("sink", GST_PAD_SINK);
+  ck_assert_msg (GST_IS_PAD (sink_pad));
+  gst_pad_set_chain_function (sink_pad, gst_check_chain_func);
+  gst_pad_set_active (sink_pad, TRUE);
+  pad_peer = gst_element_get_static_pad (filter, "src");
+  ck_assert_msg (gst_pad_link (pad_peer, sink_pad) == GST_PAD_LINK_OK,
+      "Could not link sink and %s source pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  ck_assert_msg (gst_pad_push (src_pad, buffer) == GST_FLOW_OK,
+      "Failed to push buffer");
+
+  ck_assert_int_eq (g_list_length (buffers), 1);
+  outp_buffer = GST_BUFFER (buffers->data);
+  gst_check_buffer_data(outp_buffer, medians, sizeof(medians));
+
+  /* cleanup */
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_NULL) == GST_STATE_CHANGE_SUCCESS, "could not set to null");
+
+  gst_check_drop_buffers();
+
+  g_object_unref (src_pad);
+  g_object_unref (sink_pad);
+  gst_caps_unref(caps);
+
+  gst_check_teardown_element(filter);
+}
+GST_END_TEST;
+
+GST_START_TEST (test_avgrow_line_scan)
+{
+  GstElement *filter;
+  GstCaps *caps;
+  GstBuffer *buffer, *outp_buffer;
+  GstStructure *s;
+  GstPad *pad_peer;
+  GstPad *sink_pad = NULL;
+  GstPad *src_pad;
+  gchar element_name[] = "avgrow";
+  guint8 frame[4 * 3];
+  guint8 row[4];
+  gint i, line;
+
+  gst_check_drop_buffers();
+  filter = gst_check_setup_element (element_name);
+
+  /* rows of 4 lines out of buffers of 3 lines */
+  g_object_set(filter, "norows", 4, "line-scan", TRUE, NULL);
+
+  /*caps init */
+  caps = gst_caps_new_simple ("video/x-raw",
+        "width", G_TYPE_INT, 4,
+        "height", G_TYPE_INT, 3,
+        "framerate", GST_TYPE_FRACTION, 1, 3,
+        "format", G_TYPE_STRING, "GRAY8",
+      NULL);
+  ck_assert_msg (GST_IS_CAPS (caps));
+
+  /* link our "source" to the averager */
+  src_pad = gst_pad_new ("src", GST_PAD_SRC);
+  ck_assert_msg (GST_IS_PAD (src_pad));
+  gst_pad_set_active (src_pad, TRUE);
+  gst_check_setup_events (src_pad, filter, caps, GST_FORMAT_TIME);
+  pad_peer = gst_element_get_static_pad (filter, "sink");
+  ck_assert_msg (GST_IS_PAD (pad_peer));
+  ck_assert_msg (gst_pad_link (src_pad, pad_peer) == GST_PAD_LINK_OK,
+    "Could not link source and %s sink pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  /* link our "sink" to the averager */
+  sink_pad = gst_pad_new ("sink", GST_PAD_SINK);
+  ck_assert_msg (GST_IS_PAD (sink_pad));
+  gst_pad_set_chain_function (sink_pad, gst_check_chain_func);
+  gst_pad_set_event_function(sink_pad, sink_event_func);
+  gst_pad_set_active (sink_pad, TRUE);
+  pad_peer = gst_element_get_static_pad (filter, "src");
+  ck_assert_msg (gst_pad_link (pad_peer, sink_pad) == GST_PAD_LINK_OK,
+      "Could not link sink and %s source pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  /* every line is 10 times its number and lasts a second, so three buffers
+   * give the rows of lines 0-3 and 4-7 and leave line 8 behind */
+  for (line = 0; line < 15; line++) {
+    memset (frame + (line % 3) * 4, line * 10, 4);
+    if (line % 3 != 2)
+      continue;
+
+    if (line == 11) {
+      /* the flush drops line 8, the next row starts with line 9 */
+      s = gst_structure_new ("qtec-flush-struct",
+        "name", G_TYPE_STRING, "qtec-flush", NULL);
+      gst_pad_push_event (src_pad,
+          gst_event_new_custom (GST_EVENT_CUSTOM_DOWNSTREAM_OOB, s));
+    }
+
+    buffer = gst_buffer_new_allocate (NULL, sizeof(frame), NULL);
+    gst_buffer_fill (buffer, 0, frame, sizeof(frame));
+    GST_BUFFER_PTS (buffer) = (line - 2) * GST_SECOND;
+    GST_BUFFER_DURATION (buffer) = 3 * GST_SECOND;
+    ck_assert_msg (gst_pad_push (src_pad, buffer) == GST_FLOW_OK,
+        "Failed to push buffer");
+
+    if (line == 8)
+      ck_assert_int_eq (g_list_length (buffers), 2);
+  }
+
+  ck_assert_int_eq (negotiated_height, 1);
+  /* lines 13 and 14 are waiting for the next row */
+  ck_assert_int_eq (g_list_length (buffers), 3);
+
+  for (i = 0; i < 3; i++) {
+    outp_buffer = GST_BUFFER (g_list_nth_data (buffers, i));
+    memset (row, i < 2 ? 40 * i + 15 : 105, sizeof(row));
+    gst_check_buffer_data(outp_buffer, row, sizeof(row));
+    ck_assert_uint_eq (GST_BUFFER_PTS (outp_buffer),
+        (i < 2 ? 4 * i : 9) * GST_SECOND);
+    ck_assert_uint_eq (GST_BUFFER_DURATION (outp_buffer), 4 * GST_SECOND);
+  }
+
+  /* cleanup */
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_NULL) == GST_STATE_CHANGE_SUCCESS, "could not set to null");
+
+  gst_check_drop_buffers();
+
+  g_object_unref (src_pad);
+  g_object_unref (sink_pad);
+  gst_caps_unref(caps);
+
+  gst_check_teardown_element(filter);
+}
+GST_END_TEST;
+
+/* a sink that only takes the exact means */
+static GstStaticPadTemplate float_sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS ("video/x-raw-gray-float")
+    );
+
+GST_START_TEST (test_avgrow_float)
+{
+  GstElement *filter;
+  GstCaps *caps;
+  GstBuffer *buffer, *outp_buffer;
+  GstPad *pad_peer;
+  GstPad *sink_pad = NULL;
+  GstPad *src_pad;
+  gchar element_name[] = "avgrow";
+  GstMapInfo map;
+  guint16 frame[6 * 4];
+  gint i, z;
+
+  /* every group of 3 rows of a column adds up to 3 * value + 2, which does
+   * not divide evenly */
+  for (z = 0; z < 6; z++)
+    for (i = 0; i < 4; i++)
+      frame[z * 4 + i] = GUINT16_TO_LE (1000 * (z / 3) + 10 * i +
+          (z % 3 ? 1 : 0));
+
+  gst_check_drop_buffers();
+  filter = gst_check_setup_element (element_name);
+
+  g_object_set(filter, "norows", 3, NULL);
+
+  /*caps init */
+  caps = gst_caps_new_simple ("video/x-raw",
+        "width", G_TYPE_INT, 4,
+        "height", G_TYPE_INT, 6,
+        "framerate", GST_TYPE_FRACTION, 1, 1,
+        "format", G_TYPE_STRING, "GRAY16_LE",
+      NULL);
+  ck_assert_msg (GST_IS_CAPS (caps));
+
+  /* link our "source" to the averager */
+  src_pad = gst_pad_new ("src", GST_PAD_SRC);
+  ck_assert_msg (GST_IS_PAD (src_pad));
+  gst_pad_set_active (src_pad, TRUE);
+  gst_check_setup_events (src_pad, filter, caps, GST_FORMAT_BYTES);
+  pad_peer = gst_element_get_static_pad (filter, "sink");
+  ck_assert_msg (GST_IS_PAD (pad_peer));
+  ck_assert_msg (gst_pad_link (src_pad, pad_peer) == GST_PAD_LINK_OK,
+    "Could not link source and %s sink pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  /* link our "sink" to the averager */
+  sink_pad = gst_pad_new_from_static_template (&float_sink_template, "sink");
+  ck_assert_msg (GST_IS_PAD (sink_pad));
+  gst_pad_set_chain_function (sink_pad, gst_check_chain_func);
+  gst_pad_set_event_function(sink_pad, sink_event_func);
+  gst_pad_set_active (sink_pad, TRUE);
+  pad_peer = gst_element_get_static_pad (filter, "src");
+  ck_assert_msg (gst_pad_link (pad_peer, sink_pad) == GST_PAD_LINK_OK,
+      "Could not link sink and %s source pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, frame,
+      sizeof(frame), 0, sizeof(frame), NULL, NULL);
+  ck_assert_msg (gst_pad_push (src_pad, buffer) == GST_FLOW_OK,
+      "Failed to push buffer");
+
+  ck_assert_int_eq (negotiated_height, 2);
+  ck_assert_int_eq (g_list_length (buffers), 1);
+
+  /* the means keep their fraction */
+  outp_buffer = GST_BUFFER (buffers->data);
+  ck_assert_msg (gst_buffer_map (outp_buffer, &map, GST_MAP_READ));
+  ck_assert_int_eq (map.size, 2 * 4 * sizeof (gfloat));
+  for (z = 0; z < 2; z++)
+    for (i = 0; i < 4; i++)
+      ck_assert_msg (ABS (((gfloat *) map.data)[z * 4 + i] -
+              (1000 * z + 10 * i + 2.0 / 3)) < 1e-3,
+          "Wrong mean %f at %d,%d", ((gfloat *) map.data)[z * 4 + i], i, z);
+  gst_buffer_unmap (outp_buffer, &map);
+
+  /* cleanup */
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_NULL) == GST_STATE_CHANGE_SUCCESS, "could not set to null");
+
+  gst_check_drop_buffers();
+
+  g_object_unref (src_pad);
+  g_object_unref (sink_pad);
+  gst_caps_unref(caps);
+
+  gst_check_teardown_element(filter);
+}
+GST_END_TEST;
+
+GST_START_TEST (test_avgrow_passthrough_meta)
+{
+  GstElement *filter;
+  GstCaps *caps;
+  GstBuffer *buffer, *outp_buffer;
+  GstAvgrowMeta *meta;
+  GstPad *pad_peer;
+  GstPad *sink_pad = NULL;
+  GstPad *src_pad;
+  gchar element_name[] = "avgrow";
+  guint8 frame[4 * 4];
+  gint i, z;
+
+  /* every pair of columns holds 10 * row + 2 * pair and that plus one */
+  for (z = 0; z < 4; z++)
+    for (i = 0; i < 4; i++)
+      frame[z * 4 + i] = z * 10 + i;
+
+  gst_check_drop_buffers();
+  filter = gst_check_setup_element (element_name);
+
+  g_object_set(filter, "passthrough-meta", TRUE, "meta-extrema", TRUE,
+      "meta-stddev", TRUE, "nocols", 2, NULL);
+
+  /*caps init */
+  caps = gst_caps_new_simple ("video/x-raw",
+        "width", G_TYPE_INT, 4,
+        "height", G_TYPE_INT, 4,
+        "framerate", GST_TYPE_FRACTION, 1, 1,
+        "format", G_TYPE_STRING, "GRAY8",
+      NULL);
+  ck_assert_msg (GST_IS_CAPS (caps));
+
+  buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, frame,
+      sizeof(frame), 0, sizeof(frame), NULL, NULL);
+
+  /* link our "source" to the averager */
+  src_pad = gst_pad_new ("src", GST_PAD_SRC);
+  ck_assert_msg (GST_IS_PAD (src_pad));
+  gst_pad_set_active (src_pad, TRUE);
+  gst_check_setup_events (src_pad, filter, caps, GST_FORMAT_BYTES);
+  pad_peer = gst_element_get_static_pad (filter, "sink");
+  ck_assert_msg (GST_IS_PAD (pad_peer));
+  ck_assert_msg (gst_pad_link (src_pad, pad_peer) == GST_PAD_LINK_OK,
+    "Could not link source and %s sink pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  /* link our "sink" to the averager */
+  sink_pad = gst_pad_new ("sink", GST_PAD_SINK);
+  ck_assert_msg (GST_IS_PAD (sink_pad));
+  gst_pad_set_chain_function (sink_pad, gst_check_chain_func);
+  gst_pad_set_event_function(sink_pad, sink_event_func);
+  gst_pad_set_active (sink_pad, TRUE);
+  pad_peer = gst_element_get_static_pad (filter, "src");
+  ck_assert_msg (gst_pad_link (pad_peer, sink_pad) == GST_PAD_LINK_OK,
+      "Could not link sink and %s source pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  ck_assert_msg (gst_pad_push (src_pad, buffer) == GST_FLOW_OK,
+      "Failed to push buffer");
+
+  /* the frame goes through as it is */
+  ck_assert_int_eq (negotiated_height, 4);
+  ck_assert_int_eq (g_list_length (buffers), 1);
+  outp_buffer = GST_BUFFER (buffers->data);
+  gst_check_buffer_data(outp_buffer, frame, sizeof(frame));
+
+  meta = gst_buffer_get_gst_avgrow_meta (outp_buffer);
+  ck_assert_msg (meta != NULL);
+  ck_assert_int_eq (meta->data_size, 2);
+  ck_assert_int_eq (meta->rows, 4);
+  for (i = 0; i < 2; i++) {
+    ck_assert_msg (ABS (meta->mean[i] - (15.5 + 2 * i)) < 1e-4,
+        "Wrong mean %f of column %d", meta->mean[i], i);
+    ck_assert_int_eq (meta->min[i], 2 * i);
+    ck_assert_int_eq (meta->max[i], 31 + 2 * i);
+    /* the variance of the rows plus that of the pair */
+    ck_assert_msg (ABS (meta->stddev[i] * meta->stddev[i] - 125.25) < 1e-2,
+        "Wrong standard deviation %f of column %d", meta->stddev[i], i);
+  }
+
+  /* cleanup */
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_NULL) == GST_STATE_CHANGE_SUCCESS, "could not set to null");
+
+  gst_check_drop_buffers();
+
+  g_object_unref (src_pad);
+  g_object_unref (sink_pad);
+  gst_caps_unref(caps);
+
+  gst_check_teardown_element(filter);
+}
+GST_END_TEST;
+
+GST_START_TEST (test_avgrow_frameno)
+{
+  GstElement *filter;
+  GstCaps *caps;
+  GstBuffer *buffer, *outp_buffer;
+  GstStructure *s;
+  GstPad *pad_peer;
+  GstPad *sink_pad = NULL;
+  GstPad *src_pad;
+  gchar element_name[] = "avgrow";
+  guint8 frame[4 * 2];
+  guint8 row[4];
+  gint f, i, z;
+
+  gst_check_drop_buffers();
+  filter = gst_check_setup_element (element_name);
+
+  g_object_set(filter, "total-avg", TRUE, "frameno", 3, NULL);
+
+  /*caps init */
+  caps = gst_caps_new_simple ("video/x-raw",
+        "width", G_TYPE_INT, 4,
+        "height", G_TYPE_INT, 2,
+        "framerate", GST_TYPE_FRACTION, 1, 1,
+        "format", G_TYPE_STRING, "GRAY8",
+      NULL);
+  ck_assert_msg (GST_IS_CAPS (caps));
+
+  /* link our "source" to the averager */
+  src_pad = gst_pad_new ("src", GST_PAD_SRC);
+  ck_assert_msg (GST_IS_PAD (src_pad));
+  gst_pad_set_active (src_pad, TRUE);
+  gst_check_setup_events (src_pad, filter, caps, GST_FORMAT_TIME);
+  pad_peer = gst_element_get_static_pad (filter, "sink");
+  ck_assert_msg (GST_IS_PAD (pad_peer));
+  ck_assert_msg (gst_pad_link (src_pad, pad_peer) == GST_PAD_LINK_OK,
+    "Could not link source and %s sink pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  /* link our "sink" to the averager */
+  sink_pad = gst_pad_new ("sink", GST_PAD_SINK);
+  ck_assert_msg (GST_IS_PAD (sink_pad));
+  gst_pad_set_chain_function (sink_pad, gst_check_chain_func);
+  gst_pad_set_event_function(sink_pad, sink_event_func);
+  gst_pad_set_active (sink_pad, TRUE);
+  pad_peer = gst_element_get_static_pad (filter, "src");
+  ck_assert_msg (gst_pad_link (pad_peer, sink_pad) == GST_PAD_LINK_OK,
+      "Could not link sink and %s source pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  /* frame f holds 10 * f + 2 * row + column and lasts a second, frames 3
+   * and 4 are flushed before their window is complete */
+  for (f = 0; f < 8; f++) {
+    if (f == 5) {
+      s = gst_structure_new ("qtec-flush-struct",
+        "name", G_TYPE_STRING, "qtec-flush", NULL);
+      gst_pad_push_event (src_pad,
+          gst_event_new_custom (GST_EVENT_CUSTOM_DOWNSTREAM_OOB, s));
+    }
+
+    for (z = 0; z < 2; z++)
+      for (i = 0; i < 4; i++)
+        frame[z * 4 + i] = 10 * f + 2 * z + i;
+    buffer = gst_buffer_new_allocate (NULL, sizeof(frame), NULL);
+    gst_buffer_fill (buffer, 0, frame, sizeof(frame));
+    GST_BUFFER_PTS (buffer) = f * GST_SECOND;
+    GST_BUFFER_DURATION (buffer) = GST_SECOND;
+    ck_assert_msg (gst_pad_push (src_pad, buffer) == GST_FLOW_OK,
+        "Failed to push buffer");
+  }
+
+  ck_assert_int_eq (negotiated_height, 1);
+  ck_assert_int_eq (g_list_length (buffers), 2);
+
+  /* the windows of frames 0-2 and 5-7 */
+  for (f = 0; f < 2; f++) {
+    outp_buffer = GST_BUFFER (g_list_nth_data (buffers, f));
+    for (i = 0; i < 4; i++)
+      row[i] = 50 * f + 11 + i;
+    gst_check_buffer_data(outp_buffer, row, sizeof(row));
+    ck_assert_uint_eq (GST_BUFFER_PTS (outp_buffer), 5 * f * GST_SECOND);
+    ck_assert_uint_eq (GST_BUFFER_DURATION (outp_buffer), 3 * GST_SECOND);
+  }
+
+  /* cleanup */
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_NULL) == GST_STATE_CHANGE_SUCCESS, "could not set to null");
+
+  gst_check_drop_buffers();
+
+  g_object_unref (src_pad);
+  g_object_unref (sink_pad);
+  gst_caps_unref(caps);
+
+  gst_check_teardown_element(filter);
+}
+GST_END_TEST;
+
+GST_START_TEST (test_avgrow_frameno_change)
+{
+  GstElement *filter;
+  GstCaps *caps;
+  GstBuffer *buffer, *outp_buffer;
+  GstPad *pad_peer;
+  GstPad *sink_pad = NULL;
+  GstPad *src_pad;
+  gchar element_name[] = "avgrow";
+  guint8 frame[4 * 2];
+  guint8 row[4];
+  gint f, i, z;
+
+  gst_check_drop_buffers();
+  filter = gst_check_setup_element (element_name);
+
+  g_object_set(filter, "total-avg", TRUE, "frameno", 4, NULL);
+
+  /*caps init */
+  caps = gst_caps_new_simple ("video/x-raw",
+        "width", G_TYPE_INT, 4,
+        "height", G_TYPE_INT, 2,
+        "framerate", GST_TYPE_FRACTION, 1, 1,
+        "format", G_TYPE_STRING, "GRAY8",
+      NULL);
+  ck_assert_msg (GST_IS_CAPS (caps));
+
+  /* link our "source" to the averager */
+  src_pad = gst_pad_new ("src", GST_PAD_SRC);
+  ck_assert_msg (GST_IS_PAD (src_pad));
+  gst_pad_set_active (src_pad, TRUE);
+  gst_check_setup_events (src_pad, filter, caps, GST_FORMAT_TIME);
+  pad_peer = gst_element_get_static_pad (filter, "sink");
+  ck_assert_msg (GST_IS_PAD (pad_peer));
+  ck_assert_msg (gst_pad_link (src_pad, pad_peer) == GST_PAD_LINK_OK,
+    "Could not link source and %s sink pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  /* link our "sink" to the averager */
+  sink_pad = gst_pad_new ("sink", GST_PAD_SINK);
+  ck_assert_msg (GST_IS_PAD (sink_pad));
+  gst_pad_set_chain_function (sink_pad, gst_check_chain_func);
+  gst_pad_set_event_function(sink_pad, sink_event_func);
+  gst_pad_set_active (sink_pad, TRUE);
+  pad_peer = gst_element_get_static_pad (filter, "src");
+  ck_assert_msg (gst_pad_link (pad_peer, sink_pad) == GST_PAD_LINK_OK,
+      "Could not link sink and %s source pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  /* frame f holds 10 * f + 2 * row + column and lasts a second. The window
+   * of frames 0-3 keeps its frameno when it is lowered after frame 2, the
+   * next one is made of frames 4 and 5 */
+  for (f = 0; f < 6; f++) {
+    if (f == 3)
+      g_object_set(filter, "frameno", 2, NULL);
+
+    for (z = 0; z < 2; z++)
+      for (i = 0; i < 4; i++)
+        frame[z * 4 + i] = 10 * f + 2 * z + i;
+    buffer = gst_buffer_new_allocate (NULL, sizeof(frame), NULL);
+    gst_buffer_fill (buffer, 0, frame, sizeof(frame));
+    GST_BUFFER_PTS (buffer) = f * GST_SECOND;
+    GST_BUFFER_DURATION (buffer) = GST_SECOND;
+    ck_assert_msg (gst_pad_push (src_pad, buffer) == GST_FLOW_OK,
+        "Failed to push buffer");
+  }
+
+  ck_assert_int_eq (negotiated_height, 1);
+  ck_assert_int_eq (g_list_length (buffers), 2);
+
+  outp_buffer = GST_BUFFER (g_list_nth_data (buffers, 0));
+  for (i = 0; i < 4; i++)
+    row[i] = 16 + i;
+  gst_check_buffer_data(outp_buffer, row, sizeof(row));
+  ck_assert_uint_eq (GST_BUFFER_PTS (outp_buffer), 0);
+  ck_assert_uint_eq (GST_BUFFER_DURATION (outp_buffer), 4 * GST_SECOND);
+
+  outp_buffer = GST_BUFFER (g_list_nth_data (buffers, 1));
+  for (i = 0; i < 4; i++)
+    row[i] = 46 + i;
+  gst_check_buffer_data(outp_buffer, row, sizeof(row));
+  ck_assert_uint_eq (GST_BUFFER_PTS (outp_buffer), 4 * GST_SECOND);
+  ck_assert_uint_eq (GST_BUFFER_DURATION (outp_buffer), 2 * GST_SECOND);
+
+  /* cleanup */
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_NULL) == GST_STATE_CHANGE_SUCCESS, "could not set to null");
+
+  gst_check_drop_buffers();
+
+  g_object_unref (src_pad);
+  g_object_unref (sink_pad);
+  gst_caps_unref(caps);
+
+  gst_check_teardown_element(filter);
+}
+GST_END_TEST;
+
+/* the column profile is made from every frame on its own, whatever the
+ * window of the total average is */
+GST_START_TEST (test_avgrow_frameno_passthrough_meta)
+{
+  GstElement *filter;
+  GstCaps *caps;
+  GstBuffer *buffer, *outp_buffer;
+  GstAvgrowMeta *meta;
+  GstPad *pad_peer;
+  GstPad *sink_pad = NULL;
+  GstPad *src_pad;
+  gchar element_name[] = "avgrow";
+  guint8 frame[4 * 2];
+  gint f, i, z;
+
+  gst_check_drop_buffers();
+  filter = gst_check_setup_element (element_name);
+
+  g_object_set(filter, "total-avg", TRUE, "frameno", 3,
+      "passthrough-meta", TRUE, "meta-stddev", TRUE, NULL);
+
+  /*caps init */
+  caps = gst_caps_new_simple ("video/x-raw",
+        "width", G_TYPE_INT, 4,
+        "height", G_TYPE_INT, 2,
+        "framerate", GST_TYPE_FRACTION, 1, 1,
+        "format", G_TYPE_STRING, "GRAY8",
+      NULL);
+  ck_assert_msg (GST_IS_CAPS (caps));
+
+  /* link our "source" to the averager */
+  src_pad = gst_pad_new ("src", GST_PAD_SRC);
+  ck_assert_msg (GST_IS_PAD (src_pad));
+  gst_pad_set_active (src_pad, TRUE);
+  gst_check_setup_events (src_pad, filter, caps, GST_FORMAT_TIME);
+  pad_peer = gst_element_get_static_pad (filter, "sink");
+  ck_assert_msg (GST_IS_PAD (pad_peer));
+  ck_assert_msg (gst_pad_link (src_pad, pad_peer) == GST_PAD_LINK_OK,
+    "Could not link source and %s sink pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  /* link our "sink" to the averager */
+  sink_pad = gst_pad_new ("sink", GST_PAD_SINK);
+  ck_assert_msg (GST_IS_PAD (sink_pad));
+  gst_pad_set_chain_function (sink_pad, gst_check_chain_func);
+  gst_pad_set_event_function(sink_pad, sink_event_func);
+  gst_pad_set_active (sink_pad, TRUE);
+  pad_peer = gst_element_get_static_pad (filter, "src");
+  ck_assert_msg (gst_pad_link (pad_peer, sink_pad) == GST_PAD_LINK_OK,
+      "Could not link sink and %s source pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  /* frame f holds 10 * f + 2 * row + column */
+  for (f = 0; f < 2; f++) {
+    for (z = 0; z < 2; z++)
+      for (i = 0; i < 4; i++)
+        frame[z * 4 + i] = 10 * f + 2 * z + i;
+    buffer = gst_buffer_new_allocate (NULL, sizeof(frame), NULL);
+    gst_buffer_fill (buffer, 0, frame, sizeof(frame));
+    GST_BUFFER_PTS (buffer) = f * GST_SECOND;
+    GST_BUFFER_DURATION (buffer) = GST_SECOND;
+    ck_assert_msg (gst_pad_push (src_pad, buffer) == GST_FLOW_OK,
+        "Failed to push buffer");
+  }
+
+  /* every frame goes through with the profile of its own two rows */
+  ck_assert_int_eq (g_list_length (buffers), 2);
+  for (f = 0; f < 2; f++) {
+    outp_buffer = GST_BUFFER (g_list_nth_data (buffers, f));
+    meta = gst_buffer_get_gst_avgrow_meta (outp_buffer);
+    ck_assert_msg (meta != NULL);
+    ck_assert_int_eq (meta->data_size, 4);
+    ck_assert_int_eq (meta->rows, 2);
+    for (i = 0; i < 4; i++) {
+      ck_assert_msg (ABS (meta->mean[i] - (10 * f + 1 + i)) < 1e-4,
+          "Wrong mean %f of column %d in frame %d", meta->mean[i], i, f);
+      ck_assert_msg (ABS (meta->stddev[i] - 1.0) < 1e-4,
+          "Wrong standard deviation %f of column %d in frame %d",
+          meta->stddev[i], i, f);
+    }
+  }
+
+  /* cleanup */
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_NULL) == GST_STATE_CHANGE_SUCCESS, "could not set to null");
+
+  gst_check_drop_buffers();
+
+  g_object_unref (src_pad);
+  g_object_unref (sink_pad);
+  gst_caps_unref(caps);
+
+  gst_check_teardown_element(filter);
+}
+GST_END_TEST;
+
+GST_START_TEST (test_avgrow_kernels)
+{
+  const AvgRowKernels *ref, *k;
+  gint cpu, i;
+  /* odd size so the scalar tails of the vector kernels get used too */
+  gsize size = 1003;
+  guint32 *sum_ref = g_malloc (size * sizeof (guint32));
+  guint32 *sum = g_malloc (size * sizeof (guint32));
+
+  ref = avg_row_kernels_get (AVG_KERNELS_CPU_SCALAR);
+  ck_assert_msg (ref != NULL, "Scalar kernels are always available");
+
+  srand(time(NULL));
+
+  for (cpu = AVG_KERNELS_CPU_SCALAR + 1; cpu < AVG_KERNELS_CPU_LAST; cpu++) {
+    k = avg_row_kernels_get (cpu);
+    if (!k)
+      continue;
+
+    GST_DEBUG ("checking %s kernels against the scalar ones", k->name);
+
+    /* folding neighbouring columns in place, as binning does */
+    for (i = 0; i < size; i++)
+      sum_ref[i] = sum[i] = rand () & 0xffffff;
+    ref->pair_add (sum_ref, sum_ref, size / 2);
+    k->pair_add (sum, sum, size / 2);
+    ck_assert_msg (memcmp (sum_ref, sum, size / 2 * sizeof (guint32)) == 0,
+        "%s pair_add differs from scalar", k->name);
+  }
+
+  g_free (sum_ref);
+  g_free (sum);
+}
+GST_END_TEST;
+
 static Suite *
 avgrow_suite (void)
 {
@@ -326,6 +1347,17 @@ avgrow_suite (void)
   suite_add_tcase (s, tc_chain);
   tcase_add_test (tc_chain, test_avgrow_negotiation);
   tcase_add_test (tc_chain, test_avgrow_averaging);
+  tcase_add_test (tc_chain, test_avgrow_threads);
+  tcase_add_test (tc_chain, test_avgrow_roi);
+  tcase_add_test (tc_chain, test_avgrow_binning);
+  tcase_add_test (tc_chain, test_avgrow_median);
+  tcase_add_test (tc_chain, test_avgrow_line_scan);
+  tcase_add_test (tc_chain, test_avgrow_float);
+  tcase_add_test (tc_chain, test_avgrow_passthrough_meta);
+  tcase_add_test (tc_chain, test_avgrow_frameno);
+  tcase_add_test (tc_chain, test_avgrow_frameno_change);
+  tcase_add_test (tc_chain, test_avgrow_frameno_passthrough_meta);
+  tcase_add_test (tc_chain, test_avgrow_kernels);
   //tcase_add_test (tc_chain, test_avgrow_flush);
 
   return s;
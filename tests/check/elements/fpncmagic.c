@@ -8,6 +8,7 @@
 #include <gst/check/gstcheck.h>
 #include <time.h>
 #include <stdlib.h>
+#include <string.h>
 #include <gst/fpncmagic/gstfpncmagicmeta.h>
 
 /* NOTE ABOUT fpncmagic:
@@ -110,22 +111,112 @@ GST_START_TEST (test_fpncmagic_meta)
   ck_assert_msg(fpncmeta->data_size == EXPECTED_DSIZE,
     "Data size was not correct, was expecting %d and got %d", EXPECTED_DSIZE, fpncmeta->data_size);
 
-  if (memcmp (fpncmeta->rolling_median, rolling_median, sizeof(rolling_median)) != 0) {
-    g_print ("\nConverted data:\n");
-    gst_util_dump_mem (((const guchar *)fpncmeta->rolling_median), fpncmeta->data_size * sizeof(gint));
-    g_print ("\nExpected data:\n");
-    gst_util_dump_mem (((const guchar *)rolling_median), sizeof(rolling_median));
+  /* GRAY8 values are stored as small as they fit */
+  ck_assert_int_eq (fpncmeta->median_type, GST_FPNC_MAGIC_UINT8);
+  ck_assert_int_eq (fpncmeta->error_type, GST_FPNC_MAGIC_INT16);
+
+  int i;
+  for (i=0; i<fpncmeta->data_size; i++ ) {
+    ck_assert_int_eq (gst_fpnc_magic_meta_get_median (fpncmeta, i),
+        rolling_median[i]);
+    ck_assert_int_eq (gst_fpnc_magic_meta_get_error (fpncmeta, i), error[i]);
   }
 
-  if (memcmp (fpncmeta->error, error, sizeof(error)) != 0) {
-    g_print ("\nConverted data:\n");
-    int i;
-    for (i=0; i<fpncmeta->data_size; i++ )
-      GST_WARNING("VAL: %d", fpncmeta->error[i]);
-    //gst_util_dump_mem (fpncmeta->error, fpncmeta->data_size * sizeof(gint));
-    g_print ("\nExpected data:\n");
-    gst_util_dump_mem (((const guchar *)error), sizeof(error));
+  /* cleanup */
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_NULL) == GST_STATE_CHANGE_SUCCESS, "could not set to null");
+
+  gst_check_drop_buffers();
+
+  g_object_unref (src_pad);
+  g_object_unref (sink_pad);
+  gst_caps_unref(caps);
+  gst_check_teardown_element(filter);
+
+}
+GST_END_TEST;
+
+GST_START_TEST (test_fpncmagic_meta_pool)
+{
+  GstElement *filter;
+  GstCaps *caps;
+  GstBuffer *buffer, *outp_buffer, *copy;
+  GstPad *pad_peer;
+  GstPad *sink_pad = NULL;
+  GstPad *src_pad;
+  gchar element_name[] = "fpncmagic";
+  GstFpncMagicMeta *fpncmeta, *copymeta;
+  gpointer block;
+  gint i;
+
+  gst_check_drop_buffers();
+  filter = gst_check_setup_element (element_name);
+
+  caps = gst_caps_new_simple ("video/x-raw",
+        "width", G_TYPE_INT, sizeof(junk_data),
+        "height", G_TYPE_INT, 1,
+        "framerate", GST_TYPE_FRACTION, 1, 1,
+        "format", G_TYPE_STRING, "GRAY8",
+      NULL);
+
+  src_pad = gst_pad_new ("src", GST_PAD_SRC);
+  gst_pad_set_active (src_pad, TRUE);
+  gst_check_setup_events (src_pad, filter, caps, GST_FORMAT_BYTES);
+  pad_peer = gst_element_get_static_pad (filter, "sink");
+  ck_assert_msg (gst_pad_link (src_pad, pad_peer) == GST_PAD_LINK_OK,
+    "Could not link source and %s sink pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  sink_pad = gst_pad_new ("sink", GST_PAD_SINK);
+  gst_pad_set_chain_function (sink_pad, gst_check_chain_func);
+  gst_pad_set_active (sink_pad, TRUE);
+  pad_peer = gst_element_get_static_pad (filter, "src");
+  ck_assert_msg (gst_pad_link (pad_peer, sink_pad) == GST_PAD_LINK_OK,
+      "Could not link sink and %s source pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  buffer = gst_buffer_new_wrapped (g_memdup (junk_data, sizeof(junk_data)),
+      sizeof(junk_data));
+  ck_assert_msg (gst_pad_push (src_pad, buffer) == GST_FLOW_OK,
+      "Failed to push buffer");
+  ck_assert_int_eq (g_list_length (buffers), 1);
+  outp_buffer = GST_BUFFER (buffers->data);
+  fpncmeta = gst_buffer_get_gst_fpnc_magic_meta (outp_buffer);
+  ck_assert_msg(fpncmeta != NULL, "Could not retrive fpncmagic metadata");
+  block = fpncmeta->rolling_median.ptr;
+
+  /* a copy of the buffer shares the values instead of copying them */
+  copy = gst_buffer_copy (outp_buffer);
+  copymeta = gst_buffer_get_gst_fpnc_magic_meta (copy);
+  ck_assert_msg(copymeta != NULL, "Copy lost the fpncmagic metadata");
+  ck_assert_msg(copymeta->rolling_median.ptr == fpncmeta->rolling_median.ptr);
+  ck_assert_msg(copymeta->error.ptr == fpncmeta->error.ptr);
+  ck_assert_int_eq (copymeta->data_size, EXPECTED_DSIZE);
+  ck_assert_int_eq (copymeta->avg, EXPECTED_AVG);
+
+  /* the block stays in use while the copy is around */
+  gst_check_drop_buffers();
+  for (i=0; i<copymeta->data_size; i++ ) {
+    ck_assert_int_eq (gst_fpnc_magic_meta_get_median (copymeta, i),
+        rolling_median[i]);
+    ck_assert_int_eq (gst_fpnc_magic_meta_get_error (copymeta, i), error[i]);
   }
+  gst_buffer_unref (copy);
+
+  /* and is reused for the next buffer once all of them are gone */
+  buffer = gst_buffer_new_wrapped (g_memdup (junk_data, sizeof(junk_data)),
+      sizeof(junk_data));
+  ck_assert_msg (gst_pad_push (src_pad, buffer) == GST_FLOW_OK,
+      "Failed to push buffer");
+  ck_assert_int_eq (g_list_length (buffers), 1);
+  fpncmeta = gst_buffer_get_gst_fpnc_magic_meta (GST_BUFFER (buffers->data));
+  ck_assert_msg(fpncmeta != NULL, "Could not retrive fpncmagic metadata");
+  ck_assert_msg(fpncmeta->rolling_median.ptr == block,
+      "The meta block was not taken from the pool");
 
   /* cleanup */
   ck_assert_msg (gst_element_set_state (filter,
@@ -137,7 +228,240 @@ GST_START_TEST (test_fpncmagic_meta)
   g_object_unref (sink_pad);
   gst_caps_unref(caps);
   gst_check_teardown_element(filter);
+}
+GST_END_TEST;
+
+/* reference median of the window the element uses for column i */
+static gint
+compare_guint16 (gconstpointer a, gconstpointer b)
+{
+  return *(const guint16 *) a - *(const guint16 *) b;
+}
+
+static gint
+reference_median (const guint16 * row, gint width, gint i, gint window)
+{
+  guint16 sorted[128];
+  gint min, max;
+
+  min = MAX (i - window / 2, 0);
+  max = MIN (i - window / 2 + window, width - 1);
+  if (max <= min)
+    return row[i];
+  memcpy (sorted, row + min, (max - min) * sizeof (guint16));
+  qsort (sorted, max - min, sizeof (guint16), compare_guint16);
+
+  return sorted[(max - min - 1) / 2];
+}
+
+static GstBuffer *
+push_row (const gchar * format, gconstpointer data, gsize size, gint width,
+    guint window, guint n_threads)
+{
+  GstElement *filter;
+  GstCaps *caps;
+  GstBuffer *buffer, *outp_buffer;
+  GstPad *pad_peer;
+  GstPad *sink_pad = NULL;
+  GstPad *src_pad;
+  gchar element_name[] = "fpncmagic";
+
+  gst_check_drop_buffers();
+  filter = gst_check_setup_element (element_name);
+  g_object_set (filter, "window", window, "n-threads", n_threads, NULL);
+
+  caps = gst_caps_new_simple ("video/x-raw",
+        "width", G_TYPE_INT, width,
+        "height", G_TYPE_INT, 1,
+        "framerate", GST_TYPE_FRACTION, 1, 1,
+        "format", G_TYPE_STRING, format,
+      NULL);
+
+  buffer = gst_buffer_new_wrapped (g_memdup (data, size), size);
+
+  src_pad = gst_pad_new ("src", GST_PAD_SRC);
+  gst_pad_set_active (src_pad, TRUE);
+  gst_check_setup_events (src_pad, filter, caps, GST_FORMAT_BYTES);
+  pad_peer = gst_element_get_static_pad (filter, "sink");
+  ck_assert_msg (gst_pad_link (src_pad, pad_peer) == GST_PAD_LINK_OK,
+    "Could not link source and %s sink pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  sink_pad = gst_pad_new ("sink", GST_PAD_SINK);
+  gst_pad_set_chain_function (sink_pad, gst_check_chain_func);
+  gst_pad_set_active (sink_pad, TRUE);
+  pad_peer = gst_element_get_static_pad (filter, "src");
+  ck_assert_msg (gst_pad_link (pad_peer, sink_pad) == GST_PAD_LINK_OK,
+      "Could not link sink and %s source pads", GST_ELEMENT_NAME (filter));
+  gst_object_unref (pad_peer);
+
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS,
+      "could not set to playing");
+
+  ck_assert_msg (gst_pad_push (src_pad, buffer) == GST_FLOW_OK,
+      "Failed to push buffer");
+
+  ck_assert_msg (gst_element_set_state (filter,
+          GST_STATE_NULL) == GST_STATE_CHANGE_SUCCESS, "could not set to null");
+
+  ck_assert_int_eq (g_list_length (buffers), 1);
+  outp_buffer = gst_buffer_ref (GST_BUFFER (buffers->data));
+
+  /* cleanup */
+  gst_check_drop_buffers();
+
+  g_object_unref (src_pad);
+  g_object_unref (sink_pad);
+  gst_caps_unref(caps);
+  gst_check_teardown_element(filter);
+
+  return outp_buffer;
+}
+
+GST_START_TEST (test_fpncmagic_sliding_median)
+{
+  const gint width = 300;
+  guint16 row[300], le[300], be[300];
+  GstBuffer *outp_buffer;
+  GstFpncMagicMeta *fpncmeta;
+  gint i, pass, sum = 0;
+
+  g_random_set_seed (7);
+  for (i = 0; i < width; i++) {
+    /* a narrow value range gives plenty of duplicates in every window */
+    row[i] = (i % 3) ? g_random_int_range (1000, 1008) :
+        g_random_int_range (0, 65536);
+    le[i] = GUINT16_TO_LE (row[i]);
+    be[i] = GUINT16_TO_BE (row[i]);
+    sum += row[i];
+  }
+
+  for (pass = 0; pass < 2; pass++) {
+    if (pass == 0)
+      outp_buffer = push_row ("GRAY16_LE", le, sizeof (le), width, 50, 1);
+    else
+      outp_buffer = push_row ("GRAY16_BE", be, sizeof (be), width, 50, 1);
+
+    fpncmeta = gst_buffer_get_gst_fpnc_magic_meta (outp_buffer);
+    ck_assert_msg (fpncmeta != NULL, "Could not retrive fpncmagic metadata");
+    ck_assert_int_eq (fpncmeta->data_size, width);
+    ck_assert_int_eq (fpncmeta->avg, sum / width);
+
+    ck_assert_int_eq (fpncmeta->median_type, GST_FPNC_MAGIC_UINT16);
+    ck_assert_int_eq (fpncmeta->error_type, GST_FPNC_MAGIC_INT32);
+
+    for (i = 0; i < width; i++) {
+      ck_assert_int_eq (fpncmeta->rolling_median.ui16[i],
+          reference_median (row, width, i, 50));
+      ck_assert_int_eq (fpncmeta->error.i32[i],
+          row[i] - fpncmeta->rolling_median.ui16[i]);
+    }
+
+    gst_buffer_unref (outp_buffer);
+  }
+}
+GST_END_TEST;
+
+GST_START_TEST (test_fpncmagic_window)
+{
+  /* sorting network, histogram and heap sized windows */
+  const guint windows[] = { 1, 3, 8, 9, 64, 101 };
+  const gint width = 200;
+  guint16 row[200], row16[200];
+  guint8 row8[200];
+  GstBuffer *outp_buffer;
+  GstFpncMagicMeta *fpncmeta;
+  gint i, w, bits;
+
+  g_random_set_seed (11);
+  for (i = 0; i < width; i++) {
+    row8[i] = g_random_int_range (0, 256);
+    row16[i] = GUINT16_TO_LE (g_random_int_range (0, 4096));
+  }
+
+  for (w = 0; w < G_N_ELEMENTS (windows); w++) {
+    for (bits = 8; bits <= 16; bits += 8) {
+      for (i = 0; i < width; i++)
+        row[i] = (bits == 8) ? row8[i] : GUINT16_FROM_LE (row16[i]);
+
+      if (bits == 8)
+        outp_buffer = push_row ("GRAY8", row8, sizeof (row8), width,
+            windows[w], 1);
+      else
+        outp_buffer = push_row ("GRAY16_LE", row16, sizeof (row16), width,
+            windows[w], 1);
+
+      fpncmeta = gst_buffer_get_gst_fpnc_magic_meta (outp_buffer);
+      ck_assert_msg (fpncmeta != NULL, "Could not retrive fpncmagic metadata");
+
+      for (i = 0; i < width; i++)
+        ck_assert_msg (gst_fpnc_magic_meta_get_median (fpncmeta, i) ==
+            reference_median (row, width, i, windows[w]),
+            "%d bit window %u column %d: got %d expected %d", bits,
+            windows[w], i, gst_fpnc_magic_meta_get_median (fpncmeta, i),
+            reference_median (row, width, i, windows[w]));
+
+      gst_buffer_unref (outp_buffer);
+    }
+  }
+}
+GST_END_TEST;
+
+GST_START_TEST (test_fpncmagic_chunks)
+{
+  /* wide enough to be split between the threads, and bright enough for
+   * the sum of the 16 bit row not to fit in an int */
+  const gint width = 50000;
+  guint16 *row16;
+  guint8 *row8;
+  GstBuffer *serial, *chunked;
+  GstFpncMagicMeta *smeta, *cmeta;
+  gint64 sum8 = 0, sum16 = 0;
+  gint i, bits;
+
+  row16 = g_new (guint16, width);
+  row8 = g_new (guint8, width);
+  g_random_set_seed (13);
+  for (i = 0; i < width; i++) {
+    row16[i] = GUINT16_TO_LE (g_random_int_range (32768, 65536));
+    row8[i] = g_random_int_range (0, 256);
+    sum16 += GUINT16_FROM_LE (row16[i]);
+    sum8 += row8[i];
+  }
+
+  for (bits = 8; bits <= 16; bits += 8) {
+    if (bits == 8) {
+      serial = push_row ("GRAY8", row8, width, width, 50, 1);
+      chunked = push_row ("GRAY8", row8, width, width, 50, 4);
+    } else {
+      serial = push_row ("GRAY16_LE", row16, width * 2, width, 101, 1);
+      chunked = push_row ("GRAY16_LE", row16, width * 2, width, 101, 4);
+    }
+
+    smeta = gst_buffer_get_gst_fpnc_magic_meta (serial);
+    cmeta = gst_buffer_get_gst_fpnc_magic_meta (chunked);
+    ck_assert_msg (smeta != NULL && cmeta != NULL,
+        "Could not retrive fpncmagic metadata");
+    ck_assert_int_eq (cmeta->data_size, smeta->data_size);
+    ck_assert_int_eq (smeta->avg, (bits == 8 ? sum8 : sum16) / width);
+    ck_assert_int_eq (cmeta->avg, smeta->avg);
+    ck_assert_int_eq (cmeta->median_type, smeta->median_type);
+    ck_assert_int_eq (cmeta->error_type, smeta->error_type);
+
+    for (i = 0; i < width; i++) {
+      ck_assert_int_eq (gst_fpnc_magic_meta_get_median (cmeta, i),
+          gst_fpnc_magic_meta_get_median (smeta, i));
+      ck_assert_int_eq (gst_fpnc_magic_meta_get_error (cmeta, i),
+          gst_fpnc_magic_meta_get_error (smeta, i));
+    }
+
+    gst_buffer_unref (serial);
+    gst_buffer_unref (chunked);
+  }
 
+  g_free (row16);
+  g_free (row8);
 }
 GST_END_TEST;
 
@@ -149,6 +473,10 @@ fpncmagic_suite (void)
 
   suite_add_tcase (s, tc_chain);
   tcase_add_test (tc_chain, test_fpncmagic_meta);
+  tcase_add_test (tc_chain, test_fpncmagic_meta_pool);
+  tcase_add_test (tc_chain, test_fpncmagic_sliding_median);
+  tcase_add_test (tc_chain, test_fpncmagic_window);
+  tcase_add_test (tc_chain, test_fpncmagic_chunks);
 
   return s;
 }
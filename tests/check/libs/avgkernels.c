@@ -0,0 +1,124 @@
+#include <gst/check/gstcheck.h>
+#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gst/avgkernels/avgkernels.h>
+
+GST_START_TEST (test_avg_kernels)
+{
+  const AvgKernels *ref, *k;
+  gint cpu, i, r, t;
+  /* odd size so the scalar tails of the vector kernels get used too */
+  gsize size = 1003;
+  /* sample counts up to a full frame of avgrow total-avg */
+  gint rows[] = { 1, 2, 3, 7, 64, 255, 3072 };
+  guint8 *src8 = g_malloc (size);
+  guint16 *src16 = g_malloc (size * sizeof (guint16));
+  guint32 *sum_ref = g_malloc (size * sizeof (guint32));
+  guint32 *sum = g_malloc (size * sizeof (guint32));
+  guint8 *out8_ref = g_malloc (size);
+  guint8 *out8 = g_malloc (size);
+  guint16 *out16_ref = g_malloc (size * sizeof (guint16));
+  guint16 *out16 = g_malloc (size * sizeof (guint16));
+  guint32 mul;
+  guint shift;
+
+  ref = avg_kernels_get (AVG_KERNELS_CPU_SCALAR);
+  ck_assert_msg (ref != NULL, "Scalar kernels are always available");
+
+  srand(time(NULL));
+
+  for (cpu = AVG_KERNELS_CPU_SCALAR + 1; cpu < AVG_KERNELS_CPU_LAST; cpu++) {
+    k = avg_kernels_get (cpu);
+    if (!k)
+      continue;
+
+    GST_DEBUG ("checking %s kernels against the scalar ones", k->name);
+
+    for (t = 0; t < G_N_ELEMENTS (rows); t++) {
+      avg_kernels_reciprocal (rows[t], 8, &mul, &shift);
+      memset (sum_ref, 0, size * sizeof (guint32));
+      memset (sum, 0, size * sizeof (guint32));
+      for (r = 0; r < rows[t]; r++) {
+        for (i = 0; i < size; i++)
+          src8[i] = rand ();
+        ref->accum_u8 (sum_ref, src8, size);
+        k->accum_u8 (sum, src8, size);
+      }
+      ck_assert_msg (memcmp (sum_ref, sum, size * sizeof (guint32)) == 0,
+          "%s accum_u8 differs from scalar", k->name);
+      ref->norm_u8 (out8_ref, sum_ref, size, mul, shift, FALSE);
+      k->norm_u8 (out8, sum, size, mul, shift, TRUE);
+      ck_assert_msg (memcmp (out8_ref, out8, size) == 0,
+          "%s norm_u8 differs from scalar", k->name);
+      for (i = 0; i < size; i++) {
+        ck_assert_int_eq (out8_ref[i], sum_ref[i] / rows[t]);
+        ck_assert_int_eq (sum[i], 0);
+      }
+
+      avg_kernels_reciprocal (rows[t], 16, &mul, &shift);
+      memset (sum_ref, 0, size * sizeof (guint32));
+      memset (sum, 0, size * sizeof (guint32));
+      for (r = 0; r < rows[t]; r++) {
+        for (i = 0; i < size; i++)
+          src16[i] = rand ();
+        ref->accum_u16 (sum_ref, src16, size);
+        k->accum_u16 (sum, src16, size);
+      }
+      ck_assert_msg (memcmp (sum_ref, sum, size * sizeof (guint32)) == 0,
+          "%s accum_u16 differs from scalar", k->name);
+      ref->norm_u16 (out16_ref, sum_ref, size, mul, shift, FALSE);
+      k->norm_u16 (out16, sum, size, mul, shift, FALSE);
+      ck_assert_msg (memcmp (out16_ref, out16, size * sizeof (guint16)) == 0,
+          "%s norm_u16 differs from scalar", k->name);
+      for (i = 0; i < size; i++)
+        ck_assert_int_eq (out16_ref[i], sum_ref[i] / rows[t]);
+
+      /* the same rows again, read as big endian */
+      memset (sum_ref, 0, size * sizeof (guint32));
+      memset (sum, 0, size * sizeof (guint32));
+      for (r = 0; r < rows[t]; r++) {
+        for (i = 0; i < size; i++)
+          src16[i] = rand ();
+        ref->accum_u16_swap (sum_ref, src16, size);
+        k->accum_u16_swap (sum, src16, size);
+      }
+      ck_assert_msg (memcmp (sum_ref, sum, size * sizeof (guint32)) == 0,
+          "%s accum_u16_swap differs from scalar", k->name);
+      ref->norm_u16_swap (out16_ref, sum_ref, size, mul, shift, FALSE);
+      k->norm_u16_swap (out16, sum, size, mul, shift, TRUE);
+      ck_assert_msg (memcmp (out16_ref, out16, size * sizeof (guint16)) == 0,
+          "%s norm_u16_swap differs from scalar", k->name);
+      for (i = 0; i < size; i++) {
+        ck_assert_int_eq (GUINT16_SWAP_LE_BE (out16_ref[i]),
+            sum_ref[i] / rows[t]);
+        ck_assert_int_eq (sum[i], 0);
+      }
+    }
+
+  }
+
+  g_free (src8);
+  g_free (src16);
+  g_free (sum_ref);
+  g_free (sum);
+  g_free (out8_ref);
+  g_free (out8);
+  g_free (out16_ref);
+  g_free (out16);
+}
+GST_END_TEST;
+
+static Suite *
+avgkernels_suite (void)
+{
+  Suite *s = suite_create ("avgkernels");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_avg_kernels);
+
+  return s;
+}
+
+GST_CHECK_MAIN (avgkernels);